@@ -69,15 +69,16 @@ int main(int argc, char **argv) {
     alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, hnsw_path);
 
     alg_hnsw->setEf(get_arg(arg));
-    alg_hnsw->metric_hops = 0;
-    alg_hnsw->metric_distance_computations = 0;
+    hnswlib::SearchParams params;
+    params.k = K;
+    hnswlib::PerThreadSearchStats stats;
 
     int success = 0;
     std::cout << "query num: " << m_xq << " total_level: " << alg_hnsw->maxlevel_ << " ef: " << get_arg(arg) << std::endl;
     
     for(int i = 0; i < 1; i++) {
     // for(int i = 0; i < 1; i++) {
-        std::priority_queue<std::pair<float, hnswlib::labeltype>> result = alg_hnsw->searchKnn(data_query.data() + (i * d_xq), K);
+        std::priority_queue<std::pair<float, hnswlib::labeltype>> result = alg_hnsw->searchKnn(data_query.data() + (i * d_xq), params, stats);
         for(int j = 0; j < K; j++) {
             for(int k = 0; k < K; k++) if(result.top().second == data_gt[k + i * d_xt]) success++;
             std::cout << result.top().second << "/" << result.top().first << std::endl;
@@ -87,18 +88,14 @@ int main(int argc, char **argv) {
     }
     
     // std::cout << "QPS: " << m_xq / search_time << std::endl;
-    std::cout << "dist_op_ns_: " << alg_hnsw->dist_op_ns_ << std::endl;
-    std::cout << "data_bytes: " << alg_hnsw->dist_ops_/2*4 << std::endl;
-    std::cout << "dist_OPS: " << alg_hnsw->dist_ops_ << std::endl;
-    std::cout << "result_cmp_cnt_: " << alg_hnsw->result_cmp_cnt_ << std::endl;
-    std::cout << "topk_cmp_cnt_: " << alg_hnsw->topk_cmp_cnt_ << std::endl;
-    std::cout << "candidate_cmp_cnt_: " << alg_hnsw->candidate_cmp_cnt_ << std::endl;
-    uint64_t total_ops = alg_hnsw->dist_ops_ + 
-                         alg_hnsw->result_cmp_cnt_ +
-                         alg_hnsw->topk_cmp_cnt_ + 
-                         alg_hnsw->candidate_cmp_cnt_;
+    hnswlib::SearchStats &total = hnswlib::PerThreadSearchStats::total();
+    std::cout << "search_ns: " << total.time_ns << std::endl;
+    std::cout << "data_bytes: " << total.distance_computations * dim * 4 << std::endl;
+    std::cout << "dist_OPS: " << total.distance_computations * dim * 2 << std::endl;
+    std::cout << "cmp_cnt: " << total.compares << std::endl;
+    uint64_t total_ops = total.distance_computations * dim * 2 + total.compares;
     std::cout << "total_ops: " << total_ops << std::endl;
     std::cout << "recall10@"<<K<<": " << 1.0*success / (m_xq * K)*100 << std::endl;
-    std::cout << "dis_compute per query: " << alg_hnsw->metric_distance_computations / (m_xq * 1.0) << std::endl;
-    std::cout << "hops per query: " << alg_hnsw->metric_hops / (m_xq * 1.0) << std::endl;
+    std::cout << "dis_compute per query: " << total.distance_computations / (m_xq * 1.0) << std::endl;
+    std::cout << "hops per query: " << total.hops / (m_xq * 1.0) << std::endl;
 }
\ No newline at end of file
@@ -2,64 +2,6 @@
 #include <thread>
 
 
-// Multithreaded executor
-// The helper function copied from python_bindings/bindings.cpp (and that itself is copied from nmslib)
-// An alternative is using #pragme omp parallel for or any other C++ threading
-template<class Function>
-inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-    }
-
-    if (numThreads == 1) {
-        for (size_t id = start; id < end; id++) {
-            fn(id, 0);
-        }
-    } else {
-        std::vector<std::thread> threads;
-        std::atomic<size_t> current(start);
-
-        // keep track of exceptions in threads
-        // https://stackoverflow.com/a/32428427/1713196
-        std::exception_ptr lastException = nullptr;
-        std::mutex lastExceptMutex;
-
-        for (size_t threadId = 0; threadId < numThreads; ++threadId) {
-            threads.push_back(std::thread([&, threadId] {
-                while (true) {
-                    size_t id = current.fetch_add(1);
-
-                    if (id >= end) {
-                        break;
-                    }
-
-                    try {
-                        fn(id, threadId);
-                    } catch (...) {
-                        std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
-                        lastException = std::current_exception();
-                        /*
-                         * This will work even when current is the largest value that
-                         * size_t can fit, because fetch_add returns the previous value
-                         * before the increment (what will result in overflow
-                         * and produce 0 instead of current + 1).
-                         */
-                        current = end;
-                        break;
-                    }
-                }
-            }));
-        }
-        for (auto &thread : threads) {
-            thread.join();
-        }
-        if (lastException) {
-            std::rethrow_exception(lastException);
-        }
-    }
-}
-
-
 // Filter that allows labels divisible by divisor
 class PickDivisibleIds: public hnswlib::BaseFilterFunctor {
 unsigned int divisor = 1;
@@ -80,6 +22,7 @@ int main() {
                                 // strongly affects the memory consumption
     int ef_construction = 200;  // Controls index search speed/build speed tradeoff
     int num_threads = 20;       // Number of threads for operations with index
+    hnswlib::ThreadPool pool(num_threads);
 
     // Initing index
     hnswlib::L2Space space(dim);
@@ -95,7 +38,7 @@ int main() {
     }
 
     // Add data to index
-    ParallelFor(0, max_elements, num_threads, [&](size_t row, size_t threadId) {
+    pool.parallelFor(0, max_elements, [&](size_t row, size_t threadId) {
         alg_hnsw->addPoint((void*)(data + dim * row), row);
     });
 
@@ -105,7 +48,7 @@ int main() {
     // Query the elements for themselves with filter and check returned labels
     int k = 10;
     std::vector<hnswlib::labeltype> neighbors(max_elements * k);
-    ParallelFor(0, max_elements, num_threads, [&](size_t row, size_t threadId) {
+    pool.parallelFor(0, max_elements, [&](size_t row, size_t threadId) {
         std::priority_queue<std::pair<float, hnswlib::labeltype>> result = alg_hnsw->searchKnn(data + dim * row, k, &pickIdsDivisibleByTwo);
         for (int i = 0; i < k; i++) {
             hnswlib::labeltype label = result.top().second;
@@ -2,64 +2,6 @@
 #include <thread>
 
 
-// Multithreaded executor
-// The helper function copied from python_bindings/bindings.cpp (and that itself is copied from nmslib)
-// An alternative is using #pragme omp parallel for or any other C++ threading
-template<class Function>
-inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-    }
-
-    if (numThreads == 1) {
-        for (size_t id = start; id < end; id++) {
-            fn(id, 0);
-        }
-    } else {
-        std::vector<std::thread> threads;
-        std::atomic<size_t> current(start);
-
-        // keep track of exceptions in threads
-        // https://stackoverflow.com/a/32428427/1713196
-        std::exception_ptr lastException = nullptr;
-        std::mutex lastExceptMutex;
-
-        for (size_t threadId = 0; threadId < numThreads; ++threadId) {
-            threads.push_back(std::thread([&, threadId] {
-                while (true) {
-                    size_t id = current.fetch_add(1);
-
-                    if (id >= end) {
-                        break;
-                    }
-
-                    try {
-                        fn(id, threadId);
-                    } catch (...) {
-                        std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
-                        lastException = std::current_exception();
-                        /*
-                         * This will work even when current is the largest value that
-                         * size_t can fit, because fetch_add returns the previous value
-                         * before the increment (what will result in overflow
-                         * and produce 0 instead of current + 1).
-                         */
-                        current = end;
-                        break;
-                    }
-                }
-            }));
-        }
-        for (auto &thread : threads) {
-            thread.join();
-        }
-        if (lastException) {
-            std::rethrow_exception(lastException);
-        }
-    }
-}
-
-
 int main() {
     int dim = 16;               // Dimension of the elements
     int max_elements = 10000;   // Maximum number of elements, should be known beforehand
@@ -67,6 +9,7 @@ int main() {
                                 // strongly affects the memory consumption
     int ef_construction = 200;  // Controls index search speed/build speed tradeoff
     int num_threads = 20;       // Number of threads for operations with index
+    hnswlib::ThreadPool pool(num_threads);
 
     // Initing index with allow_replace_deleted=true
     int seed = 100; 
@@ -83,13 +26,13 @@ int main() {
     }
 
     // Add data to index
-    ParallelFor(0, max_elements, num_threads, [&](size_t row, size_t threadId) {
+    pool.parallelFor(0, max_elements, [&](size_t row, size_t threadId) {
         alg_hnsw->addPoint((void*)(data + dim * row), row);
     });
 
     // Mark first half of elements as deleted
     int num_deleted = max_elements / 2;
-    ParallelFor(0, num_deleted, num_threads, [&](size_t row, size_t threadId) {
+    pool.parallelFor(0, num_deleted, [&](size_t row, size_t threadId) {
         alg_hnsw->markDelete(row);
     });
 
@@ -102,7 +45,7 @@ int main() {
     // Replace deleted data with new elements
     // Maximum number of elements is reached therefore we cannot add new items,
     // but we can replace the deleted ones by using replace_deleted=true
-    ParallelFor(0, num_deleted, num_threads, [&](size_t row, size_t threadId) {
+    pool.parallelFor(0, num_deleted, [&](size_t row, size_t threadId) {
         hnswlib::labeltype label = max_elements + row;
         alg_hnsw->addPoint((void*)(add_data + dim * row), label, true);
     });
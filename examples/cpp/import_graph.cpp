@@ -0,0 +1,79 @@
+#include "../../hnswlib/graph_import.h"
+
+#include <chrono>
+
+
+void usage() {
+    std::cerr << "usage: import_graph <cagra|nsg|vamana> <graph file> <vectors.fvecs|.bvecs> <output index>\n"
+                 "                    [--space l2|ip] [--M m] [--ef_construction ef] [--no_upper_levels]\n"
+                 "                    [--truncate] [--threads n]" << std::endl;
+    exit(1);
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 5)
+        usage();
+    std::string format_name = argv[1];
+    hnswlib::GraphFormat format;
+    if (format_name == "cagra")
+        format = hnswlib::GRAPH_CAGRA;
+    else if (format_name == "nsg")
+        format = hnswlib::GRAPH_NSG;
+    else if (format_name == "vamana")
+        format = hnswlib::GRAPH_VAMANA;
+    else
+        usage();
+    std::string graph_path = argv[2];
+    std::string vectors_path = argv[3];
+    std::string output_path = argv[4];
+
+    std::string space_name = "l2";
+    hnswlib::GraphImportOptions options;
+    for (int i = 5; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--space" && has_value)
+            space_name = argv[++i];
+        else if (arg == "--M" && has_value)
+            options.M = std::stoul(argv[++i]);
+        else if (arg == "--ef_construction" && has_value)
+            options.ef_construction = std::stoul(argv[++i]);
+        else if (arg == "--threads" && has_value)
+            options.num_threads = std::stoul(argv[++i]);
+        else if (arg == "--no_upper_levels")
+            options.build_upper_levels = false;
+        else if (arg == "--truncate")
+            options.truncate = true;
+        else
+            usage();
+    }
+
+    hnswlib::FileIndexInput vectors_input(vectors_path);
+    hnswlib::VectorFileInfo vectors = hnswlib::readVectorFileInfo(
+        vectors_input, hnswlib::vectorFileFormatFromPath(vectors_path));
+    hnswlib::SpaceInterface<float> *space;
+    if (space_name == "l2")
+        space = new hnswlib::L2Space(vectors.dim);
+    else if (space_name == "ip")
+        space = new hnswlib::InnerProductSpace(vectors.dim);
+    else
+        usage();
+
+    auto start = std::chrono::steady_clock::now();
+    hnswlib::HierarchicalNSW<float> *index = hnswlib::importGraph(space, graph_path, format, vectors_path, options);
+    auto imported = std::chrono::steady_clock::now();
+    index->saveIndex(output_path);
+    auto saved = std::chrono::steady_clock::now();
+
+    std::cout << "elements: " << index->getCurrentElementCount() << " M: " << index->M_
+              << " max level: " << index->maxlevel_ << std::endl;
+    std::cout << "import: " << std::chrono::duration<double>(imported - start).count() << " s, save: "
+              << std::chrono::duration<double>(saved - imported).count() << " s" << std::endl;
+    if (!options.build_upper_levels)
+        std::cout << "level 0 only: set base_layer_only after loading the index" << std::endl;
+
+    delete index;
+    delete space;
+    return 0;
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "index_format.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <vector>
+
+#if defined(__linux__) && !defined(HNSWLIB_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_SINGLE_MMAP)
+#define HNSWLIB_IO_URING
+#endif
+#endif
+#endif
+
+namespace hnswlib {
+
+// INDEX_FILE_ALIGNMENT-aligned allocations, as needed for O_DIRECT reads.
+static inline void *allocateAlignedBlocks(size_t size) {
+    void *buffer = nullptr;
+#ifdef _WIN32
+    buffer = _aligned_malloc(size, INDEX_FILE_ALIGNMENT);
+#else
+    if (posix_memalign(&buffer, INDEX_FILE_ALIGNMENT, size) != 0)
+        buffer = nullptr;
+#endif
+    if (buffer == nullptr)
+        throw std::runtime_error("Not enough memory: failed to allocate aligned buffer");
+    return buffer;
+}
+
+
+static inline void freeAlignedBlocks(void *buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+
+struct BlockRead {
+    void *buffer;
+    size_t size;
+    uint64_t offset;
+};
+
+
+/*
+ * Reads batches of blocks from a file. With io_uring (Linux) a batch is submitted at once and the
+ * reads run concurrently on the device; without it, or if the kernel refuses io_uring, the blocks
+ * are read one after another with pread. The ring is set up through the raw system calls, so no
+ * liburing is needed; define HNSWLIB_NO_IO_URING to leave it out.
+ * A reader is not thread-safe: use one per thread.
+ */
+class BlockReader {
+    FileIndexInput &input_;
+
+#ifdef HNSWLIB_IO_URING
+    int ring_fd_{-1};
+    unsigned ring_entries_{0};
+    void *sq_ring_{nullptr};
+    size_t sq_ring_size_{0};
+    void *cq_ring_{nullptr};
+    size_t cq_ring_size_{0};
+    io_uring_sqe *sqes_{nullptr};
+    size_t sqes_size_{0};
+    unsigned *sq_tail_{nullptr};
+    unsigned *sq_mask_{nullptr};
+    unsigned *sq_array_{nullptr};
+    unsigned *cq_head_{nullptr};
+    unsigned *cq_tail_{nullptr};
+    unsigned *cq_mask_{nullptr};
+    io_uring_cqe *cqes_{nullptr};
+
+    bool setupRing(unsigned queue_depth) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = (int) syscall(__NR_io_uring_setup, queue_depth, &params);
+        if (fd < 0)
+            return false;
+        ring_fd_ = fd;
+        ring_entries_ = params.sq_entries;
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+        void *sq_ring = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED)
+            return false;
+        sq_ring_ = sq_ring;
+        if (single_mmap) {
+            cq_ring_ = sq_ring_;
+        } else {
+            void *cq_ring = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 fd, IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED)
+                return false;
+            cq_ring_ = cq_ring;
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        sqes_ = (io_uring_sqe *) sqes;
+
+        char *sq = (char *) sq_ring_;
+        char *cq = (char *) cq_ring_;
+        sq_tail_ = (unsigned *) (sq + params.sq_off.tail);
+        sq_mask_ = (unsigned *) (sq + params.sq_off.ring_mask);
+        sq_array_ = (unsigned *) (sq + params.sq_off.array);
+        cq_head_ = (unsigned *) (cq + params.cq_off.head);
+        cq_tail_ = (unsigned *) (cq + params.cq_off.tail);
+        cq_mask_ = (unsigned *) (cq + params.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe *) (cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void teardownRing() {
+        if (sqes_)
+            munmap(sqes_, sqes_size_);
+        if (cq_ring_ && cq_ring_ != sq_ring_)
+            munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_)
+            munmap(sq_ring_, sq_ring_size_);
+        if (ring_fd_ >= 0)
+            close(ring_fd_);
+        ring_fd_ = -1;
+        sqes_ = nullptr;
+        cq_ring_ = sq_ring_ = nullptr;
+    }
+
+    // Submits up to ring_entries_ reads and waits for all of them.
+    void readBatch(BlockRead *reads, unsigned count) {
+        unsigned tail = *sq_tail_;
+        for (unsigned i = 0; i < count; i++) {
+            unsigned index = (tail + i) & *sq_mask_;
+            io_uring_sqe *sqe = &sqes_[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = input_.fd();
+            sqe->addr = (uint64_t) (uintptr_t) reads[i].buffer;
+            sqe->len = reads[i].size;
+            sqe->off = reads[i].offset;
+            sqe->user_data = i;
+            sq_array_[index] = index;
+        }
+        __atomic_store_n(sq_tail_, tail + count, __ATOMIC_RELEASE);
+
+        unsigned to_submit = count;
+        unsigned completed = 0;
+        while (completed < count) {
+            if (to_submit || __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) == *cq_head_) {
+                int ret = (int) syscall(__NR_io_uring_enter, ring_fd_, to_submit, 1, IORING_ENTER_GETEVENTS,
+                                        nullptr, 0);
+                if (ret < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw std::runtime_error("io_uring_enter failed");
+                }
+                to_submit -= std::min<unsigned>(to_submit, ret);
+            }
+
+            unsigned head = *cq_head_;
+            unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != cq_tail; head++, completed++) {
+                const io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+                BlockRead &read = reads[cqe.user_data];
+                // failed (e.g. IORING_OP_READ unsupported) or short reads are finished with pread
+                size_t done = cqe.res > 0 ? cqe.res : 0;
+                if (done < read.size)
+                    input_.readAt((char *) read.buffer + done, read.size - done, read.offset + done);
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+    }
+#endif
+
+ public:
+    BlockReader(FileIndexInput &input, unsigned queue_depth, bool use_io_uring = true) : input_(input) {
+#ifdef HNSWLIB_IO_URING
+        if (use_io_uring && !setupRing(std::max(1u, queue_depth)))
+            teardownRing();
+#endif
+    }
+
+    ~BlockReader() {
+#ifdef HNSWLIB_IO_URING
+        teardownRing();
+#endif
+    }
+
+    bool usesIoUring() const {
+#ifdef HNSWLIB_IO_URING
+        return ring_fd_ >= 0;
+#else
+        return false;
+#endif
+    }
+
+    // Fills every reads[i].buffer with reads[i].size bytes at reads[i].offset.
+    void read(BlockRead *reads, size_t count) {
+#ifdef HNSWLIB_IO_URING
+        if (ring_fd_ >= 0) {
+            for (size_t i = 0; i < count; i += ring_entries_) {
+                readBatch(reads + i, (unsigned) std::min<size_t>(ring_entries_, count - i));
+            }
+            return;
+        }
+#endif
+        for (size_t i = 0; i < count; i++) {
+            input_.readAt(reads[i].buffer, reads[i].size, reads[i].offset);
+        }
+    }
+};
+
+}  // namespace hnswlib
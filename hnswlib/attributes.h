@@ -0,0 +1,354 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include "bitmap.h"
+
+namespace hnswlib {
+
+enum AttributeType : uint32_t {
+    ATTRIBUTE_INT = 1,  // int64 per element: integers, enums, timestamps
+    ATTRIBUTE_TAGS = 2,  // set of uint32 tags per element
+};
+
+enum PredicateOp {
+    PREDICATE_EQUAL,  // ATTRIBUTE_INT value == low
+    PREDICATE_RANGE,  // ATTRIBUTE_INT value in [low, high]
+    PREDICATE_TAG_IN,  // ATTRIBUTE_TAGS set containing any of tags
+};
+
+// One condition on an attribute; a query filter is the conjunction of its predicates.
+struct AttributePredicate {
+    std::string attribute;
+    PredicateOp op{PREDICATE_EQUAL};
+    int64_t low{0};
+    int64_t high{0};
+    std::vector<uint32_t> tags;
+
+    static AttributePredicate equal(const std::string &attribute, int64_t value) {
+        AttributePredicate predicate;
+        predicate.attribute = attribute;
+        predicate.op = PREDICATE_EQUAL;
+        predicate.low = predicate.high = value;
+        return predicate;
+    }
+
+    static AttributePredicate range(const std::string &attribute, int64_t low, int64_t high) {
+        AttributePredicate predicate;
+        predicate.attribute = attribute;
+        predicate.op = PREDICATE_RANGE;
+        predicate.low = low;
+        predicate.high = high;
+        return predicate;
+    }
+
+    static AttributePredicate tagIn(const std::string &attribute, const std::vector<uint32_t> &tags) {
+        AttributePredicate predicate;
+        predicate.attribute = attribute;
+        predicate.op = PREDICATE_TAG_IN;
+        predicate.tags = tags;
+        return predicate;
+    }
+};
+
+/*
+ * Typed attribute columns indexed by internal id. Elements without a value read as 0 (ATTRIBUTE_INT) or
+ * as an empty tag set. Columns with at most MAX_INDEXED_VALUES distinct values (or tags) get a bitmap
+ * index, built on the first query that can use it and kept up to date by later writes; other columns
+ * are scanned. Not thread safe: HierarchicalNSW serializes access.
+ *
+ * Serialized layout (SECTION_ATTRIBUTES), for element_count elements:
+ *   uint32 num_columns, then per column: uint32 type, uint32 name size, the name bytes, and
+ *   ATTRIBUTE_INT:  int64 value per element
+ *   ATTRIBUTE_TAGS: uint32 tag count per element, then all the tags in element order
+ */
+class AttributeStore {
+ public:
+    static const size_t MAX_INDEXED_VALUES = 256;
+
+    struct Column {
+        std::string name;
+        AttributeType type;
+        std::vector<int64_t> values;  // ATTRIBUTE_INT
+        std::vector<std::vector<uint32_t>> tags;  // ATTRIBUTE_TAGS
+        // bitmap index: elements per value (or tag); valid only while indexed
+        std::unordered_map<int64_t, Bitmap> index;
+        bool indexed{false};
+        bool indexable{true};  // false once the column had too many distinct values to index
+    };
+
+    std::vector<Column> columns;
+
+    bool empty() const {
+        return columns.empty();
+    }
+
+    void clear() {
+        columns.clear();
+    }
+
+    // Index of the column, or -1
+    int findColumn(const std::string &name) const {
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i].name == name)
+                return (int) i;
+        }
+        return -1;
+    }
+
+    Column &column(const std::string &name, AttributeType type) {
+        int i = findColumn(name);
+        if (i < 0)
+            throw std::runtime_error("Unknown attribute " + name);
+        if (columns[i].type != type)
+            throw std::runtime_error("Wrong type for attribute " + name);
+        return columns[i];
+    }
+
+    void addColumn(const std::string &name, AttributeType type) {
+        if (type != ATTRIBUTE_INT && type != ATTRIBUTE_TAGS)
+            throw std::runtime_error("Unknown attribute type");
+        if (findColumn(name) >= 0)
+            throw std::runtime_error("Attribute " + name + " already exists");
+        Column column;
+        column.name = name;
+        column.type = type;
+        columns.push_back(column);
+    }
+
+    void setValue(size_t id, const std::string &name, int64_t value) {
+        Column &col = column(name, ATTRIBUTE_INT);
+        for (size_t skipped = col.values.size(); skipped <= id; skipped++) {
+            col.values.push_back(0);
+            if (col.indexed)
+                indexValue(col, skipped, 0);
+        }
+        int64_t old_value = col.values[id];
+        col.values[id] = value;
+        if (col.indexed) {
+            unindex(col, id, old_value);
+            indexValue(col, id, value);
+        }
+    }
+
+    int64_t getValue(size_t id, const std::string &name) const {
+        const Column &col = const_cast<AttributeStore *>(this)->column(name, ATTRIBUTE_INT);
+        return id < col.values.size() ? col.values[id] : 0;
+    }
+
+    void setTags(size_t id, const std::string &name, const std::vector<uint32_t> &tags) {
+        Column &col = column(name, ATTRIBUTE_TAGS);
+        if (col.tags.size() <= id)
+            col.tags.resize(id + 1);
+        if (col.indexed) {
+            for (uint32_t tag : col.tags[id]) unindex(col, id, tag);
+            for (uint32_t tag : tags) indexValue(col, id, tag);
+        }
+        col.tags[id] = tags;
+    }
+
+    const std::vector<uint32_t> &getTags(size_t id, const std::string &name) const {
+        static const std::vector<uint32_t> no_tags;
+        const Column &col = const_cast<AttributeStore *>(this)->column(name, ATTRIBUTE_TAGS);
+        return id < col.tags.size() ? col.tags[id] : no_tags;
+    }
+
+    // Back to the defaults, for an element slot reused by another element
+    void resetElement(size_t id) {
+        for (Column &col : columns) {
+            if (col.type == ATTRIBUTE_INT && id < col.values.size())
+                setValue(id, col.name, 0);
+            else if (col.type == ATTRIBUTE_TAGS && id < col.tags.size())
+                setTags(id, col.name, std::vector<uint32_t>());
+        }
+    }
+
+    // Elements 0..count-1 matching all the predicates, as a bitmap over internal ids.
+    Bitmap evaluate(const std::vector<AttributePredicate> &predicates, size_t count) {
+        Bitmap result(count);
+        result.setAll();
+        for (const AttributePredicate &predicate : predicates) {
+            result.andWith(evaluate(predicate, count));
+        }
+        return result;
+    }
+
+    Bitmap evaluate(const AttributePredicate &predicate, size_t count) {
+        Bitmap result(count);
+        Column &col = column(predicate.attribute, predicate.op == PREDICATE_TAG_IN ? ATTRIBUTE_TAGS : ATTRIBUTE_INT);
+        bool use_index = buildIndex(col);
+        if (predicate.op == PREDICATE_TAG_IN) {
+            if (use_index) {
+                for (uint32_t tag : predicate.tags) orIndexed(col, tag, result);
+                return result;
+            }
+            size_t n = std::min(count, col.tags.size());
+            for (size_t id = 0; id < n; id++) {
+                for (uint32_t tag : col.tags[id]) {
+                    if (std::find(predicate.tags.begin(), predicate.tags.end(), tag) != predicate.tags.end()) {
+                        result.set(id);
+                        break;
+                    }
+                }
+            }
+            return result;
+        }
+
+        int64_t low = predicate.low;
+        int64_t high = predicate.op == PREDICATE_EQUAL ? predicate.low : predicate.high;
+        if (use_index) {
+            for (const auto &entry : col.index) {
+                if (entry.first >= low && entry.first <= high)
+                    result.orWith(entry.second);
+            }
+        } else {
+            size_t n = std::min(count, col.values.size());
+            for (size_t id = 0; id < n; id++) {
+                if (col.values[id] >= low && col.values[id] <= high)
+                    result.set(id);
+            }
+        }
+        // elements never set read as 0
+        if (low <= 0 && high >= 0) {
+            for (size_t id = col.values.size(); id < count; id++) result.set(id);
+        }
+        return result;
+    }
+
+    uint64_t serializedSize(size_t element_count) const {
+        uint64_t size = sizeof(uint32_t);
+        for (const Column &col : columns) {
+            size += 2 * sizeof(uint32_t) + col.name.size();
+            if (col.type == ATTRIBUTE_INT) {
+                size += element_count * sizeof(int64_t);
+            } else {
+                size += element_count * sizeof(uint32_t);
+                for (size_t id = 0; id < std::min(element_count, col.tags.size()); id++)
+                    size += col.tags[id].size() * sizeof(uint32_t);
+            }
+        }
+        return size;
+    }
+
+    // Calls fn(data, size) on consecutive pieces of the serialized columns of elements 0..element_count-1.
+    template<typename Function>
+    void forEachChunk(size_t element_count, Function fn) const {
+        const size_t chunk = 1024;
+        uint32_t num_columns = (uint32_t) columns.size();
+        fn(&num_columns, sizeof(num_columns));
+        for (const Column &col : columns) {
+            uint32_t header[2] = {(uint32_t) col.type, (uint32_t) col.name.size()};
+            fn(header, sizeof(header));
+            fn(col.name.data(), col.name.size());
+            if (col.type == ATTRIBUTE_INT) {
+                int64_t values[chunk];
+                for (size_t i = 0; i < element_count; i += chunk) {
+                    size_t n = std::min(chunk, element_count - i);
+                    for (size_t j = 0; j < n; j++)
+                        values[j] = i + j < col.values.size() ? col.values[i + j] : 0;
+                    fn(values, n * sizeof(int64_t));
+                }
+            } else {
+                uint32_t counts[chunk];
+                for (size_t i = 0; i < element_count; i += chunk) {
+                    size_t n = std::min(chunk, element_count - i);
+                    for (size_t j = 0; j < n; j++)
+                        counts[j] = i + j < col.tags.size() ? (uint32_t) col.tags[i + j].size() : 0;
+                    fn(counts, n * sizeof(uint32_t));
+                }
+                for (size_t id = 0; id < std::min(element_count, col.tags.size()); id++) {
+                    if (!col.tags[id].empty())
+                        fn(col.tags[id].data(), col.tags[id].size() * sizeof(uint32_t));
+                }
+            }
+        }
+    }
+
+    // Replaces the columns with the ones serialized in data[0..size).
+    void deserialize(const char *data, size_t size, size_t element_count) {
+        const char *end = data + size;
+        auto read = [&data, end](void *out, size_t n) {
+            if ((size_t) (end - data) < n)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            memcpy(out, data, n);
+            data += n;
+        };
+        std::vector<Column> loaded;
+        uint32_t num_columns;
+        read(&num_columns, sizeof(num_columns));
+        for (uint32_t c = 0; c < num_columns; c++) {
+            uint32_t header[2];
+            read(header, sizeof(header));
+            Column col;
+            col.type = (AttributeType) header[0];
+            col.name.resize(header[1]);
+            read(&col.name[0], header[1]);
+            if (col.type == ATTRIBUTE_INT) {
+                col.values.resize(element_count);
+                read(col.values.data(), element_count * sizeof(int64_t));
+            } else if (col.type == ATTRIBUTE_TAGS) {
+                std::vector<uint32_t> counts(element_count);
+                read(counts.data(), element_count * sizeof(uint32_t));
+                col.tags.resize(element_count);
+                for (size_t id = 0; id < element_count; id++) {
+                    col.tags[id].resize(counts[id]);
+                    read(col.tags[id].data(), counts[id] * sizeof(uint32_t));
+                }
+            } else {
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            }
+            loaded.push_back(std::move(col));
+        }
+        if (data != end)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        columns.swap(loaded);
+    }
+
+ private:
+    void indexValue(Column &col, size_t id, int64_t value) {
+        Bitmap &bitmap = col.index[value];
+        if (bitmap.size() <= id)
+            bitmap.resize(std::max(id + 1, 2 * bitmap.size()));
+        bitmap.set(id);
+        if (col.index.size() > MAX_INDEXED_VALUES) {
+            col.index.clear();
+            col.indexed = false;
+            col.indexable = false;
+        }
+    }
+
+    void unindex(Column &col, size_t id, int64_t value) {
+        auto found = col.index.find(value);
+        if (found != col.index.end() && found->second.test(id))
+            found->second.reset(id);
+    }
+
+    void orIndexed(const Column &col, int64_t value, Bitmap &result) const {
+        auto found = col.index.find(value);
+        if (found != col.index.end())
+            result.orWith(found->second);
+    }
+
+    // Builds the bitmap index of col if it has none yet; returns whether queries can use it.
+    bool buildIndex(Column &col) {
+        if (col.indexed || !col.indexable)
+            return col.indexed;
+        col.indexed = true;
+        if (col.type == ATTRIBUTE_INT) {
+            for (size_t id = 0; id < col.values.size() && col.indexed; id++)
+                indexValue(col, id, col.values[id]);
+        } else {
+            for (size_t id = 0; id < col.tags.size() && col.indexed; id++) {
+                for (uint32_t tag : col.tags[id]) indexValue(col, id, tag);
+            }
+        }
+        return col.indexed;
+    }
+};
+
+}  // namespace hnswlib
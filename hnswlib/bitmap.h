@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace hnswlib {
+
+static inline size_t popcount64(uint64_t word) {
+#ifdef _MSC_VER
+    return (size_t) __popcnt64(word);
+#else
+    return (size_t) __builtin_popcountll(word);
+#endif
+}
+
+// Index of the lowest set bit of a non-zero word
+static inline size_t countTrailingZeros64(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    return (size_t) __builtin_ctzll(word);
+#endif
+}
+
+/*
+ * Dense bitmap over ids 0..size()-1, 64 ids per word. Ids beyond size() read as clear, so a bitmap
+ * sized for the ids known so far still answers for later ones. The number of set ids is kept up to
+ * date, so count() is free.
+ */
+class Bitmap {
+    std::vector<uint64_t> words_;
+    size_t size_{0};
+    size_t count_{0};
+
+    void recount() {
+        count_ = 0;
+        for (uint64_t word : words_) count_ += popcount64(word);
+    }
+
+ public:
+    Bitmap() {}
+
+    explicit Bitmap(size_t size) {
+        resize(size);
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Grows or shrinks to size ids; new ids are clear.
+    void resize(size_t size) {
+        words_.resize((size + 63) / 64, 0);
+        if (size < size_ && size % 64)
+            words_.back() &= (uint64_t(1) << (size % 64)) - 1;
+        if (size < size_)
+            recount();
+        size_ = size;
+    }
+
+    void set(size_t id) {
+        uint64_t bit = uint64_t(1) << (id % 64);
+        count_ += !(words_[id / 64] & bit);
+        words_[id / 64] |= bit;
+    }
+
+    void reset(size_t id) {
+        uint64_t bit = uint64_t(1) << (id % 64);
+        count_ -= !!(words_[id / 64] & bit);
+        words_[id / 64] &= ~bit;
+    }
+
+    bool test(size_t id) const {
+        return id < size_ && (words_[id / 64] >> (id % 64)) & 1;
+    }
+
+    void setAll() {
+        for (uint64_t &word : words_) word = ~uint64_t(0);
+        if (size_ % 64)
+            words_.back() = (uint64_t(1) << (size_ % 64)) - 1;
+        count_ = size_;
+    }
+
+    void clear() {
+        for (uint64_t &word : words_) word = 0;
+        count_ = 0;
+    }
+
+    // Keeps the ids also set in other; ids beyond other.size() are cleared.
+    void andWith(const Bitmap &other) {
+        size_t common = std::min(words_.size(), other.words_.size());
+        for (size_t i = 0; i < common; i++) words_[i] &= other.words_[i];
+        for (size_t i = common; i < words_.size(); i++) words_[i] = 0;
+        recount();
+    }
+
+    // Adds the ids set in other, up to size().
+    void orWith(const Bitmap &other) {
+        size_t common = std::min(words_.size(), other.words_.size());
+        for (size_t i = 0; i < common; i++) words_[i] |= other.words_[i];
+        if (common == words_.size() && size_ % 64 && common)
+            words_.back() &= (uint64_t(1) << (size_ % 64)) - 1;
+        recount();
+    }
+
+    // Number of set ids
+    size_t count() const {
+        return count_;
+    }
+
+    const uint64_t *words() const {
+        return words_.data();
+    }
+
+    size_t numWords() const {
+        return words_.size();
+    }
+};
+
+}  // namespace hnswlib
@@ -103,15 +103,18 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
     }
 
 
+    using AlgorithmInterface<dist_t>::searchKnn;
+
     std::priority_queue<std::pair<dist_t, labeltype >>
     searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
         assert(k <= cur_element_count);
         std::priority_queue<std::pair<dist_t, labeltype >> topResults;
         if (cur_element_count == 0) return topResults;
+        FilterCheck isAllowed(isIdAllowed);
         for (int i = 0; i < k; i++) {
             dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
             labeltype label = *((labeltype*) (data_ + size_per_element_ * i + data_size_));
-            if ((!isIdAllowed) || (*isIdAllowed)(label)) {
+            if (isAllowed(label)) {
                 topResults.emplace(dist, label);
             }
         }
@@ -120,7 +123,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
             dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
             if (dist <= lastdist) {
                 labeltype label = *((labeltype *) (data_ + size_per_element_ * i + data_size_));
-                if ((!isIdAllowed) || (*isIdAllowed)(label)) {
+                if (isAllowed(label)) {
                     topResults.emplace(dist, label);
                 }
                 if (topResults.size() > k)
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include "hnswlib.h"
+
+namespace hnswlib {
+
+// Length of the leading run of set bits in mask
+static inline size_t countTrailingOnes(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, ~mask);
+    return index;
+#else
+    return __builtin_ctz(~mask);
+#endif
+}
+
+/*
+ * Number of leading entries of the ascending array dists[0..n) that are not greater than value,
+ * i.e. where value goes to stay after its equals. compares gets the number of entries looked at.
+ */
+template<typename dist_t>
+static size_t countNotGreater(const dist_t *dists, size_t n, dist_t value, size_t &compares) {
+    size_t i = 0;
+    while (i < n && dists[i] <= value) {
+        i++;
+    }
+    compares += std::min(i + 1, n);
+    return i;
+}
+
+static size_t countNotGreater(const float *dists, size_t n, float value, size_t &compares) {
+    size_t i = 0;
+    // the array is sorted, so the lanes that pass form a prefix and the first partial block ends the scan
+#if defined(USE_AVX512)
+    __m512 query = _mm512_set1_ps(value);
+    for (; i + 16 <= n; i += 16) {
+        unsigned int mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(dists + i), query, _CMP_LE_OQ);
+        if (mask != 0xffff) {
+            compares += i + 16;
+            return i + countTrailingOnes(mask);
+        }
+    }
+#elif defined(USE_AVX)
+    __m256 query = _mm256_set1_ps(value);
+    for (; i + 8 <= n; i += 8) {
+        unsigned int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(dists + i), query, _CMP_LE_OQ));
+        if (mask != 0xff) {
+            compares += i + 8;
+            return i + countTrailingOnes(mask);
+        }
+    }
+#elif defined(USE_SSE)
+    __m128 query = _mm_set1_ps(value);
+    for (; i + 4 <= n; i += 4) {
+        unsigned int mask = _mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(dists + i), query));
+        if (mask != 0xf) {
+            compares += i + 4;
+            return i + countTrailingOnes(mask);
+        }
+    }
+#endif
+    compares += i;
+    return i + countNotGreater<float>(dists + i, n - i, value, compares);
+}
+
+/*
+ * Fixed-capacity candidate list kept sorted by distance, closest first, with distances and ids in
+ * separate arrays. push finds the slot with a SIMD scan and shifts the tail; popMin and popMax are
+ * O(1). For up to a few hundred elements this beats a binary heap of pairs. Equal distances keep
+ * insertion order.
+ */
+template<typename dist_t, typename id_t>
+class SortedCandidateBuffer {
+    std::vector<dist_t> dists_;
+    std::vector<id_t> ids_;
+    size_t begin_{0};  // live elements are [begin_, end_) of the arrays
+    size_t end_{0};
+
+    void compact() {
+        size_t count = end_ - begin_;
+        memmove(dists_.data(), dists_.data() + begin_, count * sizeof(dist_t));
+        memmove(ids_.data(), ids_.data() + begin_, count * sizeof(id_t));
+        begin_ = 0;
+        end_ = count;
+    }
+
+ public:
+    size_t compares{0};  // distance comparisons since clear()
+
+    // Room for capacity live elements; popMin leaves a gap in front, so the arrays are twice as long.
+    void reserve(size_t capacity) {
+        if (dists_.size() < 2 * capacity) {
+            dists_.resize(2 * capacity);
+            ids_.resize(2 * capacity);
+        }
+    }
+
+    size_t capacity() const {
+        return dists_.size() / 2;
+    }
+
+    void clear() {
+        begin_ = end_ = 0;
+        compares = 0;
+    }
+
+    size_t size() const {
+        return end_ - begin_;
+    }
+
+    bool empty() const {
+        return end_ == begin_;
+    }
+
+    dist_t minDist() const {
+        return dists_[begin_];
+    }
+
+    id_t minId() const {
+        return ids_[begin_];
+    }
+
+    void popMin() {
+        begin_++;
+    }
+
+    dist_t maxDist() const {
+        return dists_[end_ - 1];
+    }
+
+    void popMax() {
+        end_--;
+    }
+
+    // At most capacity() elements may be live after the push.
+    void push(dist_t dist, id_t id) {
+        if (end_ == dists_.size())
+            compact();
+        size_t pos = begin_ + countNotGreater(dists_.data() + begin_, end_ - begin_, dist, compares);
+        memmove(dists_.data() + pos + 1, dists_.data() + pos, (end_ - pos) * sizeof(dist_t));
+        memmove(ids_.data() + pos + 1, ids_.data() + pos, (end_ - pos) * sizeof(id_t));
+        dists_[pos] = dist;
+        ids_[pos] = id;
+        end_++;
+    }
+
+    // push, keeping at most max_size elements: the farthest one, possibly the new one, is dropped.
+    void pushBounded(dist_t dist, id_t id, size_t max_size) {
+        if (size() == max_size) {
+            compares++;
+            if (!(dist < maxDist()))
+                return;
+            popMax();
+        }
+        push(dist, id);
+    }
+
+    // i-th closest
+    dist_t dist(size_t i) const {
+        return dists_[begin_ + i];
+    }
+
+    id_t id(size_t i) const {
+        return ids_[begin_ + i];
+    }
+};
+
+/*
+ * Min-max heap of candidates with distances and ids in separate arrays: O(log n) push, popMin and
+ * popMax, for candidate lists too long for SortedCandidateBuffer. Even levels are ordered as a
+ * min-heap, odd levels as a max-heap.
+ */
+template<typename dist_t, typename id_t>
+class MinMaxCandidateHeap {
+    std::vector<dist_t> dists_;
+    std::vector<id_t> ids_;
+    size_t size_{0};
+
+    static bool isMinLevel(size_t i) {
+#ifdef _MSC_VER
+        unsigned long level;
+        _BitScanReverse(&level, (unsigned long) (i + 1));
+#else
+        unsigned int level = 31 - __builtin_clz((unsigned int) (i + 1));
+#endif
+        return (level & 1) == 0;
+    }
+
+    void moveElement(size_t from, size_t to) {
+        dists_[to] = dists_[from];
+        ids_[to] = ids_[from];
+    }
+
+    // Places (dist, id), whose slot is i, among the grandparents of i; less is true on min levels.
+    template<bool less>
+    void bubbleUpGrandparents(size_t i, dist_t dist, id_t id) {
+        while (i > 2) {
+            size_t grandparent = ((i - 1) / 2 - 1) / 2;
+            compares++;
+            if (less ? !(dist < dists_[grandparent]) : !(dists_[grandparent] < dist))
+                break;
+            moveElement(grandparent, i);
+            i = grandparent;
+        }
+        dists_[i] = dist;
+        ids_[i] = id;
+    }
+
+    void bubbleUp(size_t i) {
+        dist_t dist = dists_[i];
+        id_t id = ids_[i];
+        if (i == 0)
+            return;
+        size_t parent = (i - 1) / 2;
+        compares++;
+        if (isMinLevel(i)) {
+            if (dists_[parent] < dist) {
+                moveElement(parent, i);
+                bubbleUpGrandparents<false>(parent, dist, id);
+            } else {
+                bubbleUpGrandparents<true>(i, dist, id);
+            }
+        } else {
+            if (dist < dists_[parent]) {
+                moveElement(parent, i);
+                bubbleUpGrandparents<true>(parent, dist, id);
+            } else {
+                bubbleUpGrandparents<false>(i, dist, id);
+            }
+        }
+    }
+
+    // Restores the order below slot i, which holds the element to place; less is true on min levels.
+    template<bool less>
+    void trickleDown(size_t i) {
+        dist_t dist = dists_[i];
+        id_t id = ids_[i];
+        while (2 * i + 1 < size_) {
+            // best of the children and grandchildren
+            size_t child = 2 * i + 1;
+            size_t best = child;
+            if (child + 1 < size_) {
+                compares++;
+                if (less ? dists_[child + 1] < dists_[best] : dists_[best] < dists_[child + 1])
+                    best = child + 1;
+            }
+            size_t end = std::min(4 * i + 7, size_);
+            for (size_t grandchild = 4 * i + 3; grandchild < end; grandchild++) {
+                compares++;
+                if (less ? dists_[grandchild] < dists_[best] : dists_[best] < dists_[grandchild])
+                    best = grandchild;
+            }
+            compares++;
+            if (!(less ? dists_[best] < dist : dist < dists_[best]))
+                break;
+            moveElement(best, i);
+            i = best;
+            if (best <= child + 1)
+                break;
+            // a grandchild moved up; the element continues from its slot, past the parent if needed
+            size_t parent = (best - 1) / 2;
+            compares++;
+            if (less ? dists_[parent] < dist : dist < dists_[parent]) {
+                std::swap(dist, dists_[parent]);
+                std::swap(id, ids_[parent]);
+            }
+        }
+        dists_[i] = dist;
+        ids_[i] = id;
+    }
+
+    void removeAt(size_t i) {
+        size_--;
+        if (i == size_)
+            return;
+        dists_[i] = dists_[size_];
+        ids_[i] = ids_[size_];
+        if (isMinLevel(i))
+            trickleDown<true>(i);
+        else
+            trickleDown<false>(i);
+    }
+
+    size_t maxIndex() const {
+        if (size_ < 3)
+            return size_ - 1;
+        return dists_[1] < dists_[2] ? 2 : 1;
+    }
+
+ public:
+    size_t compares{0};  // distance comparisons since clear()
+
+    void reserve(size_t capacity) {
+        if (dists_.size() < capacity) {
+            dists_.resize(capacity);
+            ids_.resize(capacity);
+        }
+    }
+
+    size_t capacity() const {
+        return dists_.size();
+    }
+
+    void clear() {
+        size_ = 0;
+        compares = 0;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    dist_t minDist() const {
+        return dists_[0];
+    }
+
+    id_t minId() const {
+        return ids_[0];
+    }
+
+    void popMin() {
+        removeAt(0);
+    }
+
+    dist_t maxDist() const {
+        return dists_[maxIndex()];
+    }
+
+    void popMax() {
+        removeAt(maxIndex());
+    }
+
+    // At most capacity() elements may be live after the push.
+    void push(dist_t dist, id_t id) {
+        dists_[size_] = dist;
+        ids_[size_] = id;
+        size_++;
+        bubbleUp(size_ - 1);
+    }
+
+    // push, keeping at most max_size elements: the farthest one, possibly the new one, is dropped.
+    // A full heap replaces its maximum in one pass instead of popMax and push.
+    void pushBounded(dist_t dist, id_t id, size_t max_size) {
+        if (size_ < max_size) {
+            push(dist, id);
+            return;
+        }
+        size_t i = maxIndex();
+        compares++;
+        if (!(dist < dists_[i]))
+            return;
+        dists_[i] = dist;
+        ids_[i] = id;
+        if (i == 0)
+            return;
+        compares++;
+        if (dist < dists_[0]) {
+            std::swap(dists_[0], dists_[i]);
+            std::swap(ids_[0], ids_[i]);
+        }
+        trickleDown<false>(i);
+    }
+
+    // Elements in heap order
+    dist_t dist(size_t i) const {
+        return dists_[i];
+    }
+
+    id_t id(size_t i) const {
+        return ids_[i];
+    }
+};
+
+}  // namespace hnswlib
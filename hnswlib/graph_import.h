@@ -0,0 +1,379 @@
+#pragma once
+
+#include "hnswlib.h"
+
+#include <memory>
+
+namespace hnswlib {
+
+/*
+ * Conversion of proximity graphs built by other libraries into a HierarchicalNSW whose level 0 is the
+ * imported graph. Supported graph files:
+ *
+ *   GRAPH_CAGRA   fixed-degree adjacency matrix as dumped from CAGRA: uint32 num_nodes, uint32 degree,
+ *                 then num_nodes * degree uint32 ids. Ids of 0xffffffff are padding. The file has no
+ *                 entry point; the element closest to the centroid is used.
+ *   GRAPH_NSG     efanna/NSG: uint32 width, uint32 entry point, then per node uint32 degree and the ids.
+ *   GRAPH_VAMANA  DiskANN in-memory index: uint64 file size, uint32 max degree, uint32 entry point,
+ *                 uint64 frozen points, then per node uint32 degree and the ids.
+ *
+ * Vectors come from .fvecs or .bvecs files (bvecs are converted to float). Node i of the graph is
+ * vector i and gets label i.
+ */
+enum GraphFormat {
+    GRAPH_CAGRA = 1,
+    GRAPH_NSG = 2,
+    GRAPH_VAMANA = 3
+};
+
+enum VectorFileFormat {
+    VECTORS_FVECS = 1,
+    VECTORS_BVECS = 2
+};
+
+static const tableint GRAPH_INVALID_ID = 0xffffffff;
+
+struct GraphImportOptions {
+    size_t M = 0;                    // 0: the smallest M with 2 * M >= the largest degree in the graph
+    size_t ef_construction = 200;    // used to build the upper levels
+    bool build_upper_levels = true;  // otherwise the index searches level 0 only, from num_seeds pivots
+    bool truncate = false;           // cut lists longer than maxM0_ instead of failing
+    size_t num_threads = 0;          // 0: hardware concurrency
+    size_t random_seed = 100;
+};
+
+
+/*
+ * Reads a file front to back through a large buffer.
+ */
+class SequentialFileReader {
+    IndexInput &input_;
+    uint64_t offset_;  // file offset of buffer_[0]
+    uint64_t size_;
+    std::vector<char> buffer_;
+    size_t pos_{0};
+    size_t len_{0};
+
+ public:
+    SequentialFileReader(IndexInput &input, uint64_t offset, size_t buffer_size = 1 << 22)
+        : input_(input), offset_(offset), size_(input.size()), buffer_(buffer_size) {}
+
+    uint64_t offset() const {
+        return offset_ + pos_;
+    }
+
+    bool atEnd() const {
+        return offset() >= size_;
+    }
+
+    void read(void *data, size_t size) {
+        char *out = (char *) data;
+        while (size) {
+            if (pos_ == len_) {
+                offset_ += len_;
+                pos_ = 0;
+                len_ = (size_t) std::min<uint64_t>(buffer_.size(), size_ - offset_);
+                if (len_ == 0)
+                    throw std::runtime_error("Graph file seems to be truncated");
+                input_.readAt(buffer_.data(), len_, offset_);
+            }
+            size_t n = std::min(size, len_ - pos_);
+            memcpy(out, buffer_.data() + pos_, n);
+            pos_ += n;
+            out += n;
+            size -= n;
+        }
+    }
+
+    void skip(uint64_t size) {
+        if (size <= len_ - pos_) {
+            pos_ += size;
+            return;
+        }
+        offset_ = offset() + size;
+        pos_ = len_ = 0;
+        if (offset_ > size_)
+            throw std::runtime_error("Graph file seems to be truncated");
+    }
+};
+
+
+struct GraphFileInfo {
+    GraphFormat format;
+    size_t num_nodes{0};
+    size_t max_degree{0};
+    tableint entry_point{GRAPH_INVALID_ID};
+    uint64_t nodes_offset{0};
+    std::vector<uint64_t> chunk_offsets;  // file offset of every GRAPH_CHUNK_SIZE-th node
+};
+
+static const size_t GRAPH_CHUNK_SIZE = 1 << 16;
+
+
+static inline GraphFileInfo readGraphFileInfo(IndexInput &input, GraphFormat format) {
+    GraphFileInfo info;
+    info.format = format;
+    SequentialFileReader reader(input, 0);
+    if (format == GRAPH_CAGRA) {
+        uint32_t num_nodes, degree;
+        reader.read(&num_nodes, sizeof(num_nodes));
+        reader.read(&degree, sizeof(degree));
+        info.num_nodes = num_nodes;
+        info.max_degree = degree;
+        info.nodes_offset = reader.offset();
+        if (input.size() != info.nodes_offset + (uint64_t) num_nodes * degree * sizeof(tableint))
+            throw std::runtime_error("Graph file seems to be corrupted");
+        for (size_t i = 0; i < info.num_nodes; i += GRAPH_CHUNK_SIZE) {
+            info.chunk_offsets.push_back(info.nodes_offset + (uint64_t) i * degree * sizeof(tableint));
+        }
+        return info;
+    }
+
+    uint32_t entry_point;
+    if (format == GRAPH_NSG) {
+        uint32_t width;
+        reader.read(&width, sizeof(width));
+        reader.read(&entry_point, sizeof(entry_point));
+    } else if (format == GRAPH_VAMANA) {
+        uint64_t file_size, num_frozen;
+        uint32_t max_degree;
+        reader.read(&file_size, sizeof(file_size));
+        reader.read(&max_degree, sizeof(max_degree));
+        reader.read(&entry_point, sizeof(entry_point));
+        reader.read(&num_frozen, sizeof(num_frozen));
+        if (file_size != input.size())
+            throw std::runtime_error("Graph file seems to be corrupted");
+        if (num_frozen)
+            throw std::runtime_error("Vamana graphs with frozen points are not supported");
+    } else {
+        throw std::runtime_error("Unknown graph format");
+    }
+    info.entry_point = entry_point;
+    info.nodes_offset = reader.offset();
+
+    // variable-length lists: one pass to count the nodes and to find where the chunks start
+    while (!reader.atEnd()) {
+        if (info.num_nodes % GRAPH_CHUNK_SIZE == 0)
+            info.chunk_offsets.push_back(reader.offset());
+        uint32_t degree;
+        reader.read(&degree, sizeof(degree));
+        reader.skip((uint64_t) degree * sizeof(tableint));
+        info.max_degree = std::max<size_t>(info.max_degree, degree);
+        info.num_nodes++;
+    }
+    if (info.entry_point >= info.num_nodes)
+        throw std::runtime_error("Graph entry point is out of range");
+    return info;
+}
+
+
+/*
+ * Calls fn(id, neighbors, degree) for the nodes of chunk chunk_id (GRAPH_CHUNK_SIZE nodes, fewer for
+ * the last one). Chunks can be read concurrently.
+ */
+template<typename Function>
+static void forEachGraphNode(IndexInput &input, const GraphFileInfo &info, size_t chunk_id, Function fn) {
+    size_t begin = chunk_id * GRAPH_CHUNK_SIZE;
+    size_t end = std::min(info.num_nodes, begin + GRAPH_CHUNK_SIZE);
+    SequentialFileReader reader(input, info.chunk_offsets[chunk_id], 1 << 20);
+    std::vector<tableint> neighbors(info.max_degree);
+    for (size_t id = begin; id < end; id++) {
+        uint32_t degree = info.max_degree;
+        if (info.format != GRAPH_CAGRA)
+            reader.read(&degree, sizeof(degree));
+        reader.read(neighbors.data(), degree * sizeof(tableint));
+        fn((tableint) id, neighbors.data(), (size_t) degree);
+    }
+}
+
+
+struct VectorFileInfo {
+    VectorFileFormat format;
+    size_t num_vectors{0};
+    size_t dim{0};
+    size_t record_size{0};
+};
+
+
+static inline VectorFileFormat vectorFileFormatFromPath(const std::string &location) {
+    if (location.size() >= 6 && location.compare(location.size() - 6, 6, ".bvecs") == 0)
+        return VECTORS_BVECS;
+    if (location.size() >= 6 && location.compare(location.size() - 6, 6, ".fvecs") == 0)
+        return VECTORS_FVECS;
+    throw std::runtime_error("Unknown vector file format, expected .fvecs or .bvecs");
+}
+
+
+static inline VectorFileInfo readVectorFileInfo(IndexInput &input, VectorFileFormat format) {
+    VectorFileInfo info;
+    info.format = format;
+    int32_t dim = 0;
+    if (input.size() >= sizeof(dim))
+        input.readAt(&dim, sizeof(dim), 0);
+    if (dim <= 0)
+        throw std::runtime_error("Vector file seems to be corrupted");
+    info.dim = dim;
+    info.record_size = sizeof(dim) + info.dim * (format == VECTORS_BVECS ? 1 : sizeof(float));
+    if (input.size() % info.record_size)
+        throw std::runtime_error("Vector file seems to be corrupted");
+    info.num_vectors = input.size() / info.record_size;
+    return info;
+}
+
+
+// Reads vectors [begin, end) as floats into out(i), a pointer to dim floats.
+template<typename Output>
+static void readVectors(IndexInput &input, const VectorFileInfo &info, size_t begin, size_t end, Output out) {
+    SequentialFileReader reader(input, begin * info.record_size, 1 << 20);
+    std::vector<uint8_t> bytes(info.dim);
+    for (size_t i = begin; i < end; i++) {
+        int32_t dim;
+        reader.read(&dim, sizeof(dim));
+        if ((size_t) dim != info.dim)
+            throw std::runtime_error("Vector file seems to be corrupted");
+        float *vector = out(i);
+        if (info.format == VECTORS_FVECS) {
+            reader.read(vector, info.dim * sizeof(float));
+        } else {
+            reader.read(bytes.data(), info.dim);
+            for (size_t d = 0; d < info.dim; d++) {
+                vector[d] = bytes[d];
+            }
+        }
+    }
+}
+
+
+// Element closest to the mean of the indexed vectors.
+template<typename dist_t>
+static tableint findCentralElement(const HierarchicalNSW<dist_t> &index, size_t dim, size_t num_threads) {
+    size_t element_count = index.cur_element_count;
+    size_t num_ranges = HierarchicalNSW<dist_t>::parallelRangeCount(element_count, num_threads);
+    std::vector<std::vector<double>> sums(num_ranges, std::vector<double>(dim, 0.0));
+    HierarchicalNSW<dist_t>::parallelRanges(element_count, num_threads, [&](size_t range_id, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const float *vector = (const float *) index.getDataByInternalId(i);
+            for (size_t d = 0; d < dim; d++) {
+                sums[range_id][d] += vector[d];
+            }
+        }
+    });
+    std::vector<float> centroid(dim, 0.0f);
+    for (size_t d = 0; d < dim; d++) {
+        double sum = 0;
+        for (size_t r = 0; r < num_ranges; r++) {
+            sum += sums[r][d];
+        }
+        centroid[d] = (float) (sum / std::max<size_t>(1, element_count));
+    }
+
+    std::vector<std::pair<dist_t, tableint>> closest(num_ranges);
+    HierarchicalNSW<dist_t>::parallelRanges(element_count, num_threads, [&](size_t range_id, size_t begin, size_t end) {
+        closest[range_id] = std::make_pair(std::numeric_limits<dist_t>::max(), (tableint) begin);
+        for (size_t i = begin; i < end; i++) {
+            dist_t dist = index.fstdistfunc_(centroid.data(), index.getDataByInternalId(i), index.dist_func_param_);
+            if (dist < closest[range_id].first)
+                closest[range_id] = std::make_pair(dist, (tableint) i);
+        }
+    });
+    return std::min_element(closest.begin(), closest.end())->second;
+}
+
+
+/*
+ * Builds an index from a graph file and the vector file it was built from. The vectors must be
+ * floats in s (e.g. L2Space or InnerProductSpace with the dimension of the file).
+ * Lists longer than maxM0_ throw unless options.truncate is set; ids out of range always throw.
+ */
+template<typename dist_t>
+static HierarchicalNSW<dist_t> *importGraph(
+    SpaceInterface<dist_t> *s,
+    const std::string &graph_location,
+    GraphFormat format,
+    const std::string &vectors_location,
+    const GraphImportOptions &options = GraphImportOptions()) {
+    size_t num_threads = options.num_threads ? options.num_threads : std::thread::hardware_concurrency();
+
+    FileIndexInput graph_input(graph_location);
+    GraphFileInfo graph = readGraphFileInfo(graph_input, format);
+    FileIndexInput vectors_input(vectors_location);
+    VectorFileInfo vectors = readVectorFileInfo(vectors_input, vectorFileFormatFromPath(vectors_location));
+    if (vectors.num_vectors != graph.num_nodes)
+        throw std::runtime_error("The graph and the vector file have different numbers of elements");
+    if (vectors.dim * sizeof(float) != s->get_data_size())
+        throw std::runtime_error("Vector dimension does not match the space");
+
+    size_t M = options.M ? options.M : std::max<size_t>(2, (graph.max_degree + 1) / 2);
+    if (2 * M > 0xffff)
+        throw std::runtime_error("Graph degree is too large");
+    std::unique_ptr<HierarchicalNSW<dist_t>> index(
+        new HierarchicalNSW<dist_t>(s, std::max<size_t>(1, graph.num_nodes), M, options.ef_construction,
+                                    options.random_seed));
+    size_t max_degree = index->maxM0_;
+    size_t element_count = graph.num_nodes;
+
+    // level 0: vectors, labels and the imported lists, one chunk of nodes at a time per thread
+    size_t num_chunks = graph.chunk_offsets.size();
+    HierarchicalNSW<dist_t>::parallelRanges(num_chunks, num_threads, [&](size_t, size_t begin, size_t end) {
+        for (size_t chunk_id = begin; chunk_id < end; chunk_id++) {
+            size_t first = chunk_id * GRAPH_CHUNK_SIZE;
+            size_t last = std::min(element_count, first + GRAPH_CHUNK_SIZE);
+            memset(index->data_level0_memory_ + first * index->size_data_per_element_, 0,
+                   (last - first) * index->size_data_per_element_);
+            readVectors(vectors_input, vectors, first, last, [&](size_t i) {
+                labeltype label = i;
+                memcpy(index->getExternalLabeLp(i), &label, sizeof(labeltype));
+                return (float *) index->getDataByInternalId(i);
+            });
+            forEachGraphNode(graph_input, graph, chunk_id, [&](tableint id, const tableint *neighbors, size_t degree) {
+                linklistsizeint *ll = index->get_linklist0(id);
+                tableint *data = (tableint *) (ll + 1);
+                size_t size = 0;
+                for (size_t j = 0; j < degree; j++) {
+                    tableint neighbor = neighbors[j];
+                    if (neighbor == GRAPH_INVALID_ID || neighbor == id)
+                        continue;
+                    if (neighbor >= element_count)
+                        throw std::runtime_error("Graph contains a neighbor id out of range");
+                    if (size == max_degree) {
+                        if (!options.truncate)
+                            throw std::runtime_error("Graph degree exceeds maxM0_");
+                        break;
+                    }
+                    data[size++] = neighbor;
+                }
+                index->setListCount(ll, size);
+            });
+        }
+    });
+    index->cur_element_count = element_count;
+    if (element_count == 0)
+        return index.release();
+
+    std::thread label_thread([&]() {
+        index->label_lookup_.reserve(element_count);
+        for (size_t i = 0; i < element_count; i++) {
+            index->label_lookup_[i] = i;
+        }
+    });
+
+    try {
+        if (graph.entry_point == GRAPH_INVALID_ID)
+            graph.entry_point = findCentralElement(*index, vectors.dim, num_threads);
+        index->enterpoint_node_ = graph.entry_point;
+        index->maxlevel_ = 0;
+        if (options.build_upper_levels) {
+            index->buildUpperLevels(num_threads);
+        } else {
+            index->base_layer_only = true;
+            index->buildPivots(0, options.random_seed);
+        }
+    } catch (...) {
+        label_thread.join();
+        throw;
+    }
+    label_thread.join();
+    return index.release();
+}
+
+}  // namespace hnswlib
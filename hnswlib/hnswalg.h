@@ -1,7 +1,14 @@
 #pragma once
 
 #include "visited_list_pool.h"
+#include "candidate_buffers.h"
+#include "index_format.h"
+#include "mutation_gate.h"
+#include "wal.h"
+#include "thread_pool.h"
+#include "attributes.h"
 #include "hnswlib.h"
+#include <algorithm>
 #include <atomic>
 #include <random>
 #include <stdlib.h>
@@ -9,23 +16,104 @@
 #include <unordered_set>
 #include <list>
 #include <chrono>
+#include <thread>
+#include <future>
+#include <functional>
+#include <memory>
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
 
 namespace hnswlib {
 typedef unsigned int tableint;
 typedef unsigned int linklistsizeint;
 
+/*
+ * Buffers for HierarchicalNSW::searchKnn(ctx, ...): a visited list and the candidate lists. They keep
+ * their capacity between queries, so once a context has seen the index size and ef, searching with it
+ * allocates nothing. A context serves one search at a time; keep one per thread.
+ */
 template<typename dist_t>
-class HierarchicalNSW : public AlgorithmInterface<dist_t> {
+class SearchContext {
  public:
-    // My perf
-    mutable std::atomic<uint64_t> dist_ops_{0};
-    mutable std::atomic<uint64_t> cmp_ops_{0};
-    mutable std::atomic<uint64_t> dist_op_ns_{0};
+    // searches with ef up to this use SortedCandidateBuffer, larger ones MinMaxCandidateHeap
+    static const size_t SORTED_BUFFER_MAX_EF = 512;
+
+    VisitedList *visited{nullptr};
+    std::vector<std::pair<dist_t, tableint>> top_candidates;  // max-heap on distance, at most ef + 1
+    std::vector<std::pair<dist_t, tableint>> candidate_set;  // max-heap on negated distance
+    std::vector<std::pair<dist_t, labeltype>> results;
+    // bounded candidate lists of the search without filter or deletions
+    SortedCandidateBuffer<dist_t, tableint> sorted_top, sorted_candidates;
+    MinMaxCandidateHeap<dist_t, tableint> heap_top, heap_candidates;
+
+    SearchContext() {}
+
+    SearchContext(size_t max_elements, size_t ef) {
+        reserve(max_elements, ef);
+    }
+
+    ~SearchContext() {
+        delete visited;
+    }
+
+    SearchContext(const SearchContext &) = delete;
+    SearchContext &operator=(const SearchContext &) = delete;
+
+    // Grows the buffers for an index of max_elements elements searched with ef; no-op if large enough.
+    void reserve(size_t max_elements, size_t ef) {
+        if (!visited || visited->numelements < max_elements) {
+            delete visited;
+            visited = nullptr;
+            visited = new VisitedList(max_elements);
+        }
+        reserveCandidates(ef);
+    }
+
+    // Grows the candidate lists only, for searches with their own visited list.
+    void reserveCandidates(size_t ef) {
+        if (top_candidates.capacity() < ef + 1) {
+            top_candidates.reserve(ef + 1);
+            candidate_set.reserve(4 * ef);
+            results.reserve(ef);
+        }
+        size_t sorted_ef = SORTED_BUFFER_MAX_EF;
+        if (ef <= sorted_ef) {
+            sorted_top.reserve(ef + 1);
+            sorted_candidates.reserve(ef + 1);
+        } else {
+            heap_top.reserve(ef + 1);
+            heap_candidates.reserve(ef + 1);
+        }
+    }
+};
+
+/*
+ * How HierarchicalNSW picks the links of an element among its candidates, see setNeighborSelection.
+ * The default is the HNSW heuristic: a candidate is dropped if it is closer to an already kept neighbor
+ * than to the element.
+ */
+struct NeighborSelection {
+    float alpha{1.0f};  // Vamana's relaxed rule: drop only if alpha * d(kept, candidate) < d(element, candidate)
+    bool keep_pruned{false};  // fill the links left over with the closest dropped candidates
+    bool extend_candidates{false};  // add the candidates' neighbors before selecting a new element's links
+};
 
+template<typename dist_t>
+class HierarchicalNSW : public AlgorithmInterface<dist_t> {
+ public:
     bool base_layer_only = false;
     int num_seeds = 32;
-    bool base_layer_init = true;
+    // planFilteredSearch cost model: a two-hop search costs this many unfiltered searches of the same ef,
+    // and loses recall when fewer elements than filter_two_hop_min_selectivity are allowed
+    float filter_two_hop_cost = 8.0f;
+    float filter_two_hop_min_selectivity = 0.02f;
     static const tableint MAX_LABEL_OPERATION_LOCKS = 65536;
+    static const size_t ADD_POINTS_SERIAL_SEED = 1000;  // see addPoints
+    static const size_t ADD_POINTS_BATCH_FRACTION = 50;  // see addPointsBatched
+    static const size_t ADD_POINTS_MAX_BATCH = 1 << 16;
+    static const size_t REFINE_GRAPH_CHUNK = 1024;  // elements refineGraph refines per progress report
+    static const size_t BATCH_SEARCH_GROUP = 8;  // queries searchKnnBatch advances together
     static const unsigned char DELETE_MARK = 0x01;
 
     size_t max_elements_{0};
@@ -62,6 +150,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     size_t data_size_{0};
 
     DISTFUNC<dist_t> fstdistfunc_;
+    DISTFUNC_BATCH<dist_t> fstdistfunc_batch_{nullptr};  // nullptr if the space has no batched kernel
     void *dist_func_param_{nullptr};
 
     mutable std::mutex label_lookup_lock;  // lock for label_lookup_
@@ -70,14 +159,40 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     std::default_random_engine level_generator_;
     std::default_random_engine update_probability_generator_;
 
-    mutable std::atomic<long> metric_distance_computations{0};
-    mutable std::atomic<long> metric_hops{0};
-
     bool allow_replace_deleted_ = false;  // flag to replace deleted elements (marked as deleted) during insertions
 
+    bool flat_graph_ = false;  // every element on level 0 only, no linkLists_, see setFlatGraph
+    NeighborSelection neighbor_selection_;  // see setNeighborSelection
+
     std::mutex deleted_elements_lock;  // lock for deleted_elements
     std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
 
+    MutationGate mutation_gate_;  // lets saveIndexAsync pause addPoint/markDelete/unmarkDelete/resizeIndex
+
+    WriteAheadLog *wal_{nullptr};  // optional log of addPoint/markDelete/unmarkDelete, see openWal
+    std::string wal_location_;
+    uint64_t wal_lsn_{0};  // LSN of the last logged mutation contained in the index
+
+    // Pivots the base_layer_only searches start from (see buildPivots): internal ids, and their vectors
+    // copied into one block, stride bytes apart, for a batched scan
+    struct PivotTable {
+        std::vector<tableint> ids;
+        std::vector<char> vectors;
+        size_t stride{0};
+    };
+    mutable std::mutex pivots_lock_;  // lock for pivots_
+    // replaced whole, never changed in place, so a table taken by pivots() stays valid and consistent
+    std::shared_ptr<const PivotTable> pivots_{std::make_shared<PivotTable>()};
+
+    mutable std::mutex attributes_lock_;  // lock for attributes_
+    // attribute columns by internal id, see addAttribute; mutable as compileFilter builds their bitmap indexes
+    mutable AttributeStore attributes_;
+
+    // Caller-owned buffer given to adoptIndexBuffer: level 0 and the link lists of the loaded elements
+    // point into it and are not freed by the index
+    char *adopted_buffer_{nullptr};
+    size_t adopted_buffer_size_{0};
+
 
     HierarchicalNSW(SpaceInterface<dist_t> *s) {
     }
@@ -109,6 +224,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         num_deleted_ = 0;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstdistfunc_batch_ = s->get_dist_func_batch();
         dist_func_param_ = s->get_dist_func_param();
         M_ = M;
         maxM_ = M_;
@@ -147,13 +263,15 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     ~HierarchicalNSW() {
-        free(data_level0_memory_);
+        if (!isInAdoptedBuffer(data_level0_memory_))
+            free(data_level0_memory_);
         for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
+            if (element_levels_[i] > 0 && !isInAdoptedBuffer(linkLists_[i]))
                 free(linkLists_[i]);
         }
-        free(linkLists_);
+        free(linkLists_);  // nullptr in a flat graph
         delete visited_list_pool_;
+        delete wal_;
     }
 
 
@@ -164,20 +282,77 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         }
     };
 
-    mutable size_t result_cmp_cnt_ = 0;
-    mutable size_t topk_cmp_cnt_ = 0;
-    mutable size_t candidate_cmp_cnt_ = 0;
-    struct CompareByFirstDebug {
-        size_t &cmp_cnt;  // 引用外部计数器
-        // 构造时传入引用
-        CompareByFirstDebug(size_t &counter) : cmp_cnt(counter) {}
-        constexpr bool operator()(std::pair<dist_t, tableint> const& a,
-            std::pair<dist_t, tableint> const& b) const noexcept {
-            cmp_cnt++;
+    // CompareByFirst that reports every comparison to a stats policy
+    template<typename StatsPolicy>
+    struct StatsCompareByFirst {
+        StatsPolicy *stats;
+
+        explicit StatsCompareByFirst(StatsPolicy &stats) : stats(&stats) {}
+
+        bool operator()(std::pair<dist_t, tableint> const& a, std::pair<dist_t, tableint> const& b) const {
+            stats->addCompare();
             return a.first < b.first;
         }
     };
 
+    // searchBaseLayerWithRules rules of a plain search for the ef closest
+    struct EfStopRules {
+        size_t ef;
+        bool stop_at_bound;  // stop once the closest candidate is beyond lowerBound, even with fewer than ef found
+
+        EfStopRules(size_t ef, bool stop_at_bound) : ef(ef), stop_at_bound(stop_at_bound) {}
+
+        bool shouldStop(dist_t candidate_dist, dist_t lowerBound, size_t found) const {
+            return candidate_dist > lowerBound && (found == ef || stop_at_bound);
+        }
+
+        bool shouldConsider(dist_t dist, dist_t lowerBound, size_t found) const {
+            return found < ef || lowerBound > dist;
+        }
+
+        bool shouldRemoveExtra(size_t found) const {
+            return found > ef;
+        }
+
+        void added(tableint id, dist_t dist) {}
+
+        void removed(tableint id, dist_t dist) {}
+    };
+
+    // searchBaseLayerWithRules rules taken from a BaseSearchStopCondition
+    struct StopConditionRules {
+        const HierarchicalNSW *index;
+        BaseSearchStopCondition<dist_t> *condition;
+
+        StopConditionRules(const HierarchicalNSW *index, BaseSearchStopCondition<dist_t> *condition)
+            : index(index), condition(condition) {}
+
+        bool shouldStop(dist_t candidate_dist, dist_t lowerBound, size_t found) {
+            return condition->should_stop_search(candidate_dist, lowerBound);
+        }
+
+        bool shouldConsider(dist_t dist, dist_t lowerBound, size_t found) {
+            return condition->should_consider_candidate(dist, lowerBound);
+        }
+
+        bool shouldRemoveExtra(size_t found) {
+            return condition->should_remove_extra();
+        }
+
+        void added(tableint id, dist_t dist) {
+            condition->add_point_to_result(index->getExternalLabel(id), index->getDataByInternalId(id), dist);
+        }
+
+        void removed(tableint id, dist_t dist) {
+            condition->remove_point_from_result(index->getExternalLabel(id), index->getDataByInternalId(id), dist);
+        }
+    };
+
+
+    bool isInAdoptedBuffer(const char *ptr) const {
+        return ptr && ptr >= adopted_buffer_ && ptr < adopted_buffer_ + adopted_buffer_size_;
+    }
+
 
     void setEf(size_t ef) {
         ef_ = ef;
@@ -203,6 +378,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    // Whether isIdAllowed allows the element internal_id, by its bitmap when bound to this index
+    inline bool filterAllows(const FilterCheck &isIdAllowed, tableint internal_id) const {
+        return isIdAllowed.allows(internal_id, [&]() { return getExternalLabel(internal_id); });
+    }
+
+
     inline labeltype *getExternalLabeLp(tableint internal_id) const {
         return (labeltype *) (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_);
     }
@@ -232,7 +413,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
-    searchBaseLayer(tableint ep_id, const void *data_point, int layer) {
+    searchBaseLayer(tableint ep_id, const void *data_point, int layer, size_t ef = 0) {
+        if (ef == 0)
+            ef = ef_construction_;
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
         vl_type *visited_array = vl->mass;
         vl_type visited_array_tag = vl->curV;
@@ -254,7 +437,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         while (!candidateSet.empty()) {
             std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
-            if ((-curr_el_pair.first) > lowerBound && top_candidates.size() == ef_construction_) {
+            if ((-curr_el_pair.first) > lowerBound && top_candidates.size() == ef) {
                 break;
             }
             candidateSet.pop();
@@ -291,7 +474,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 char *currObj1 = (getDataByInternalId(candidate_id));
 
                 dist_t dist1 = fstdistfunc_(data_point, currObj1, dist_func_param_);
-                if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
+                if (top_candidates.size() < ef || lowerBound > dist1) {
                     candidateSet.emplace(-dist1, candidate_id);
 #ifdef USE_SSE
                     _mm_prefetch(getDataByInternalId(candidateSet.top().second), _MM_HINT_T0);
@@ -300,7 +483,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     if (!isMarkedDeleted(candidate_id))
                         top_candidates.emplace(dist1, candidate_id);
 
-                    if (top_candidates.size() > ef_construction_)
+                    if (top_candidates.size() > ef)
                         top_candidates.pop();
 
                     if (!top_candidates.empty())
@@ -314,143 +497,153 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    template <bool has_deletions, bool collect_metrics = false>
-    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirstDebug>
-    searchBaseLayerST(tableint ep_id, const void *data_point, size_t ef, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        size_t dim = *((size_t*)dist_func_param_);
-        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
-
-        // std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        std::priority_queue<std::pair<dist_t, tableint>, 
-                            std::vector<std::pair<dist_t, tableint>>, 
-                            CompareByFirstDebug> top_candidates { CompareByFirstDebug(this->topk_cmp_cnt_) };
-        std::priority_queue<std::pair<dist_t, tableint>, 
-                            std::vector<std::pair<dist_t, tableint>>, 
-                            CompareByFirstDebug> candidate_set { CompareByFirstDebug(this->candidate_cmp_cnt_) };
-
-        dist_t lowerBound;
-        if ((!has_deletions || !isMarkedDeleted(ep_id)) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id)))) {
-            dist_t dist = fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
-            dist_ops_+=dim*2;
-
-            lowerBound = dist;
-            top_candidates.emplace(dist, ep_id);
-            candidate_set.emplace(-dist, ep_id);
-        } else {
-            lowerBound = std::numeric_limits<dist_t>::max();
-            candidate_set.emplace(-lowerBound, ep_id);
+    /*
+    * Distances between an element being connected (slot 0) and the neighbors selected for it, filled
+    * while its links are selected and read back when those neighbors' own lists are pruned, so that
+    * no pair is computed twice within one mutuallyConnectNewElement.
+    */
+    struct NeighborDistanceCache {
+        std::vector<tableint> ids;
+        std::vector<dist_t> dists;  // capacity x capacity, row-major
+        std::vector<char> known;
+        size_t capacity{0};
+
+        void reset(tableint element, size_t max_neighbors) {
+            capacity = max_neighbors + 1;
+            ids.assign(1, element);
+            dists.resize(capacity * capacity);
+            known.assign(capacity * capacity, 0);
         }
 
-        visited_array[ep_id] = visited_array_tag;
-
-        while (!candidate_set.empty()) {
-            std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
-
-            if ((-current_node_pair.first) > lowerBound &&
-                (top_candidates.size() == ef || (!isIdAllowed && !has_deletions))) {
-                break;
-            }
-            candidate_set.pop();
-
-            tableint current_node_id = current_node_pair.second;
-            int *data = (int *) get_linklist0(current_node_id);
-            size_t size = getListCount((linklistsizeint*)data);
-//                bool cur_node_deleted = isMarkedDeleted(current_node_id);
-            if (collect_metrics) {
-                metric_hops++;
-                metric_distance_computations+=size;
+        int slot(tableint id) const {
+            for (size_t i = 0; i < ids.size(); i++) {
+                if (ids[i] == id)
+                    return (int) i;
             }
+            return -1;
+        }
 
-#ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
-            _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
-#endif
+        void put(int a, int b, dist_t dist) {
+            dists[a * capacity + b] = dists[b * capacity + a] = dist;
+            known[a * capacity + b] = known[b * capacity + a] = 1;
+        }
 
-            for (size_t j = 1; j <= size; j++) {
-                int candidate_id = *(data + j);
-//                    if (candidate_id == 0) continue;
-#ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
-                                _MM_HINT_T0);  ////////////
-#endif
-                if (!(visited_array[candidate_id] == visited_array_tag)) {
-                    visited_array[candidate_id] = visited_array_tag;
+        // Adds a selected neighbor, with its distance to the element and to the first row.size() neighbors
+        void add(tableint id, dist_t dist, const std::vector<dist_t> &row) {
+            if (ids.size() == capacity)
+                return;
+            int added = (int) ids.size();
+            ids.push_back(id);
+            put(0, added, dist);
+            for (size_t i = 0; i < row.size(); i++) {
+                put((int) i + 1, added, row[i]);
+            }
+        }
+    };
 
-                    char *currObj1 = (getDataByInternalId(candidate_id));
-                    dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
-                    dist_ops_+=dim*2;
 
-                    if (top_candidates.size() < ef || lowerBound > dist) {
-                        candidate_set.emplace(-dist, candidate_id);
-#ifdef USE_SSE
-                        _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
-                                        offsetLevel0_,  ///////////
-                                        _MM_HINT_T0);  ////////////////////////
-#endif
+    dist_t pairDistance(tableint a, tableint b, NeighborDistanceCache *cache) const {
+        int slot_a = cache ? cache->slot(a) : -1;
+        int slot_b = slot_a >= 0 ? cache->slot(b) : -1;
+        if (slot_b >= 0 && cache->known[slot_a * cache->capacity + slot_b])
+            return cache->dists[slot_a * cache->capacity + slot_b];
+        dist_t dist = fstdistfunc_(getDataByInternalId(a), getDataByInternalId(b), dist_func_param_);
+        if (slot_b >= 0)
+            cache->put(slot_a, slot_b, dist);
+        return dist;
+    }
 
-                        if ((!has_deletions || !isMarkedDeleted(candidate_id)) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))
-                            top_candidates.emplace(dist, candidate_id);
 
-                        if (top_candidates.size() > ef)
-                            top_candidates.pop();
+    /*
+    * Keeps at most M of candidates (sorted by distance to the element, closest first) by
+    * neighbor_selection_, closest first. With record, the kept candidates are added to cache, whose
+    * element must be the one the candidates were found for.
+    */
+    void selectNeighbors(std::vector<std::pair<dist_t, tableint>> &candidates, size_t M,
+                         NeighborDistanceCache *cache = nullptr, bool record = false) const {
+        if (candidates.size() < M) {
+            // all kept; their pairwise distances are computed only if needed later
+            for (size_t i = 0; record && i < candidates.size(); i++) {
+                cache->add(candidates[i].second, candidates[i].first, std::vector<dist_t>());
+            }
+            return;
+        }
 
-                        if (!top_candidates.empty())
-                            lowerBound = top_candidates.top().first;
-                    }
+        float alpha = neighbor_selection_.alpha;
+        std::vector<std::pair<dist_t, tableint>> selected;
+        std::vector<std::pair<dist_t, tableint>> pruned;
+        std::vector<dist_t> row;
+        selected.reserve(M);
+        for (const std::pair<dist_t, tableint> &candidate : candidates) {
+            if (selected.size() >= M)
+                break;
+            bool good = true;
+            row.clear();
+            for (const std::pair<dist_t, tableint> &kept : selected) {
+                dist_t curdist = pairDistance(kept.second, candidate.second, cache);
+                row.push_back(curdist);
+                if (alpha == 1.0f ? curdist < candidate.first : alpha * curdist < candidate.first) {
+                    good = false;
+                    break;
                 }
             }
+            if (good) {
+                selected.push_back(candidate);
+                if (record)
+                    cache->add(candidate.second, candidate.first, row);
+            } else if (neighbor_selection_.keep_pruned) {
+                pruned.push_back(candidate);
+            }
         }
-
-        visited_list_pool_->releaseVisitedList(vl);
-        return top_candidates;
+        for (size_t i = 0; i < pruned.size() && selected.size() < M; i++) {
+            selected.push_back(pruned[i]);
+        }
+        candidates.swap(selected);
     }
 
 
     void getNeighborsByHeuristic2(
             std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> &top_candidates,
     const size_t M) {
-        if (top_candidates.size() < M) {
-            return;
-        }
-
-        std::priority_queue<std::pair<dist_t, tableint>> queue_closest;
-        std::vector<std::pair<dist_t, tableint>> return_list;
+        std::vector<std::pair<dist_t, tableint>> candidates;
+        candidates.reserve(top_candidates.size());
         while (top_candidates.size() > 0) {
-            queue_closest.emplace(-top_candidates.top().first, top_candidates.top().second);
+            candidates.push_back(top_candidates.top());
             top_candidates.pop();
         }
+        std::reverse(candidates.begin(), candidates.end());
+        selectNeighbors(candidates, M);
+        for (const std::pair<dist_t, tableint> &candidate : candidates) {
+            top_candidates.push(candidate);
+        }
+    }
 
-        while (queue_closest.size()) {
-            if (return_list.size() >= M)
-                break;
-            std::pair<dist_t, tableint> curent_pair = queue_closest.top();
-            dist_t dist_to_query = -curent_pair.first;
-            queue_closest.pop();
-            bool good = true;
 
-            for (std::pair<dist_t, tableint> second_pair : return_list) {
-                dist_t curdist =
-                        fstdistfunc_(getDataByInternalId(second_pair.second),
-                                        getDataByInternalId(curent_pair.second),
-                                        dist_func_param_);
-                if (curdist < dist_to_query) {
-                    good = false;
-                    break;
-                }
+    // Adds the neighbors on level of every candidate, by distance to data_point, keeping them sorted.
+    void extendCandidates(const void *data_point, tableint cur_c, int level,
+                          std::vector<std::pair<dist_t, tableint>> &candidates) {
+        std::unordered_set<tableint> seen;
+        seen.insert(cur_c);
+        for (const std::pair<dist_t, tableint> &candidate : candidates) {
+            seen.insert(candidate.second);
+        }
+        size_t num_candidates = candidates.size();
+        std::vector<tableint> neighbors;
+        for (size_t i = 0; i < num_candidates; i++) {
+            tableint id = candidates[i].second;
+            {
+                std::unique_lock <std::mutex> lock(link_list_locks_[id]);
+                linklistsizeint *data = get_linklist_at_level(id, level);
+                tableint *datal = (tableint *) (data + 1);
+                neighbors.assign(datal, datal + getListCount(data));
             }
-            if (good) {
-                return_list.push_back(curent_pair);
+            for (tableint neighbor : neighbors) {
+                if (seen.insert(neighbor).second)
+                    candidates.emplace_back(fstdistfunc_(data_point, getDataByInternalId(neighbor), dist_func_param_),
+                                            neighbor);
             }
         }
-
-        for (std::pair<dist_t, tableint> curent_pair : return_list) {
-            top_candidates.emplace(-curent_pair.first, curent_pair.second);
-        }
+        std::sort(candidates.begin(), candidates.end(), CompareByFirst());
     }
 
 
@@ -480,19 +673,22 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> &top_candidates,
         int level,
         bool isUpdate) {
-        size_t Mcurmax = level ? maxM_ : maxM0_;
-        getNeighborsByHeuristic2(top_candidates, M_);
-        if (top_candidates.size() > M_)
-            throw std::runtime_error("Should be not be more than M_ candidates returned by the heuristic");
-
-        std::vector<tableint> selectedNeighbors;
-        selectedNeighbors.reserve(M_);
+        std::vector<std::pair<dist_t, tableint>> selectedNeighbors;
+        selectedNeighbors.reserve(top_candidates.size());
         while (top_candidates.size() > 0) {
-            selectedNeighbors.push_back(top_candidates.top().second);
+            selectedNeighbors.push_back(top_candidates.top());
             top_candidates.pop();
         }
+        std::reverse(selectedNeighbors.begin(), selectedNeighbors.end());
+        if (neighbor_selection_.extend_candidates)
+            extendCandidates(data_point, cur_c, level, selectedNeighbors);
+        NeighborDistanceCache cache;
+        cache.reset(cur_c, M_);
+        selectNeighbors(selectedNeighbors, M_, &cache, true);
+        if (selectedNeighbors.size() > M_)
+            throw std::runtime_error("Should be not be more than M_ candidates returned by the heuristic");
 
-        tableint next_closest_entry_point = selectedNeighbors.back();
+        tableint next_closest_entry_point = selectedNeighbors.front().second;
 
         {
             // lock only during the update
@@ -515,93 +711,79 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
                 if (data[idx] && !isUpdate)
                     throw std::runtime_error("Possible memory corruption");
-                if (level > element_levels_[selectedNeighbors[idx]])
+                if (level > element_levels_[selectedNeighbors[idx].second])
                     throw std::runtime_error("Trying to make a link on a non-existent level");
 
-                data[idx] = selectedNeighbors[idx];
+                data[idx] = selectedNeighbors[idx].second;
             }
         }
 
         for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
-            std::unique_lock <std::mutex> lock(link_list_locks_[selectedNeighbors[idx]]);
-
-            linklistsizeint *ll_other;
-            if (level == 0)
-                ll_other = get_linklist0(selectedNeighbors[idx]);
-            else
-                ll_other = get_linklist(selectedNeighbors[idx], level);
-
-            size_t sz_link_list_other = getListCount(ll_other);
+            connectBack(selectedNeighbors[idx].second, cur_c, selectedNeighbors[idx].first, level, isUpdate, &cache);
+        }
 
-            if (sz_link_list_other > Mcurmax)
-                throw std::runtime_error("Bad value of sz_link_list_other");
-            if (selectedNeighbors[idx] == cur_c)
-                throw std::runtime_error("Trying to connect an element to itself");
-            if (level > element_levels_[selectedNeighbors[idx]])
-                throw std::runtime_error("Trying to make a link on a non-existent level");
+        return next_closest_entry_point;
+    }
 
-            tableint *data = (tableint *) (ll_other + 1);
 
-            bool is_cur_c_present = false;
-            if (isUpdate) {
-                for (size_t j = 0; j < sz_link_list_other; j++) {
-                    if (data[j] == cur_c) {
-                        is_cur_c_present = true;
-                        break;
-                    }
-                }
+    /*
+    * Adds the link neighbor -> cur_c (at distance dist) on level, repruning the list of neighbor by the
+    * heuristic if it is full. With check_present nothing changes if the link already exists.
+    */
+    void connectBack(tableint neighbor, tableint cur_c, dist_t dist, int level, bool check_present,
+                     NeighborDistanceCache *cache = nullptr) {
+        size_t Mcurmax = level ? maxM_ : maxM0_;
+        std::unique_lock <std::mutex> lock(link_list_locks_[neighbor]);
+
+        linklistsizeint *ll_other;
+        if (level == 0)
+            ll_other = get_linklist0(neighbor);
+        else
+            ll_other = get_linklist(neighbor, level);
+
+        size_t sz_link_list_other = getListCount(ll_other);
+
+        if (sz_link_list_other > Mcurmax)
+            throw std::runtime_error("Bad value of sz_link_list_other");
+        if (neighbor == cur_c)
+            throw std::runtime_error("Trying to connect an element to itself");
+        if (level > element_levels_[neighbor])
+            throw std::runtime_error("Trying to make a link on a non-existent level");
+
+        tableint *data = (tableint *) (ll_other + 1);
+
+        // If cur_c is already present in the neighboring connections of `neighbor` then no need to modify any connections or run the heuristics.
+        if (check_present) {
+            for (size_t j = 0; j < sz_link_list_other; j++) {
+                if (data[j] == cur_c)
+                    return;
             }
+        }
 
-            // If cur_c is already present in the neighboring connections of `selectedNeighbors[idx]` then no need to modify any connections or run the heuristics.
-            if (!is_cur_c_present) {
-                if (sz_link_list_other < Mcurmax) {
-                    data[sz_link_list_other] = cur_c;
-                    setListCount(ll_other, sz_link_list_other + 1);
-                } else {
-                    // finding the "weakest" element to replace it with the new one
-                    dist_t d_max = fstdistfunc_(getDataByInternalId(cur_c), getDataByInternalId(selectedNeighbors[idx]),
-                                                dist_func_param_);
-                    // Heuristic:
-                    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
-                    candidates.emplace(d_max, cur_c);
-
-                    for (size_t j = 0; j < sz_link_list_other; j++) {
-                        candidates.emplace(
-                                fstdistfunc_(getDataByInternalId(data[j]), getDataByInternalId(selectedNeighbors[idx]),
-                                                dist_func_param_), data[j]);
-                    }
-
-                    getNeighborsByHeuristic2(candidates, Mcurmax);
-
-                    int indx = 0;
-                    while (candidates.size() > 0) {
-                        data[indx] = candidates.top().second;
-                        candidates.pop();
-                        indx++;
-                    }
-
-                    setListCount(ll_other, indx);
-                    // Nearest K:
-                    /*int indx = -1;
-                    for (int j = 0; j < sz_link_list_other; j++) {
-                        dist_t d = fstdistfunc_(getDataByInternalId(data[j]), getDataByInternalId(rez[idx]), dist_func_param_);
-                        if (d > d_max) {
-                            indx = j;
-                            d_max = d;
-                        }
-                    }
-                    if (indx >= 0) {
-                        data[indx] = cur_c;
-                    } */
-                }
-            }
+        if (sz_link_list_other < Mcurmax) {
+            data[sz_link_list_other] = cur_c;
+            setListCount(ll_other, sz_link_list_other + 1);
+            return;
+        }
+        // finding the "weakest" element to replace it with the new one, by the heuristic
+        std::vector<std::pair<dist_t, tableint>> candidates;
+        candidates.reserve(sz_link_list_other + 1);
+        candidates.emplace_back(dist, cur_c);
+        for (size_t j = 0; j < sz_link_list_other; j++) {
+            candidates.emplace_back(pairDistance(data[j], neighbor, cache), data[j]);
         }
+        std::sort(candidates.begin(), candidates.end(), CompareByFirst());
+        selectNeighbors(candidates, Mcurmax, cache);
 
-        return next_closest_entry_point;
+        for (size_t j = 0; j < candidates.size(); j++) {
+            data[j] = candidates[j].second;
+        }
+        setListCount(ll_other, candidates.size());
     }
 
 
     void resizeIndex(size_t new_max_elements) {
+        MutationGuard mutation_guard(mutation_gate_);
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
 
@@ -612,376 +794,1837 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
 
-        // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
+        // Reallocate base layer, moving it out of an adopted buffer
+        char * data_level0_memory_new;
+        if (isInAdoptedBuffer(data_level0_memory_)) {
+            data_level0_memory_new = (char *) malloc(new_max_elements * size_data_per_element_);
+            if (data_level0_memory_new)
+                memcpy(data_level0_memory_new, data_level0_memory_, cur_element_count * size_data_per_element_);
+        } else {
+            data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
+        }
         if (data_level0_memory_new == nullptr)
             throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
         data_level0_memory_ = data_level0_memory_new;
 
         // Reallocate all other layers
-        char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
-        if (linkLists_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
-        linkLists_ = linkLists_new;
+        if (!flat_graph_) {
+            char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
+            if (linkLists_new == nullptr)
+                throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
+            linkLists_ = linkLists_new;
+        }
 
         max_elements_ = new_max_elements;
     }
 
 
-    void saveIndex(const std::string &location) {
-        std::ofstream output(location, std::ios::binary);
-        std::streampos position;
-
-        writeBinaryPOD(output, offsetLevel0_);
-        writeBinaryPOD(output, max_elements_);
-        writeBinaryPOD(output, cur_element_count);
-        writeBinaryPOD(output, size_data_per_element_);
-        writeBinaryPOD(output, label_offset_);
-        writeBinaryPOD(output, offsetData_);
-        writeBinaryPOD(output, maxlevel_);
-        writeBinaryPOD(output, enterpoint_node_);
-        writeBinaryPOD(output, maxM_);
-
-        writeBinaryPOD(output, maxM0_);
-        writeBinaryPOD(output, M_);
-        writeBinaryPOD(output, mult_);
-        writeBinaryPOD(output, ef_construction_);
+    IndexMetadata getIndexMetadata() const {
+        IndexMetadata meta;
+        memset(&meta, 0, sizeof(meta));
+        meta.offset_level0 = offsetLevel0_;
+        meta.max_elements = max_elements_;
+        meta.cur_element_count = cur_element_count;
+        meta.size_data_per_element = size_data_per_element_;
+        meta.label_offset = label_offset_;
+        meta.offset_data = offsetData_;
+        meta.max_level = maxlevel_;
+        meta.enterpoint_node = enterpoint_node_;
+        meta.max_M = maxM_;
+        meta.max_M0 = maxM0_;
+        meta.M = M_;
+        meta.mult = mult_;
+        meta.ef_construction = ef_construction_;
+        meta.data_size = data_size_;
+        meta.size_links_per_element = size_links_per_element_;
+        meta.num_deleted = num_deleted_;
+        meta.label_size = sizeof(labeltype);
+        meta.tableint_size = sizeof(tableint);
+        meta.wal_lsn = wal_lsn_;
+        meta.flags = (flat_graph_ ? INDEX_FLAG_FLAT_GRAPH : 0) |
+                     (neighbor_selection_.keep_pruned ? INDEX_FLAG_KEEP_PRUNED : 0) |
+                     (neighbor_selection_.extend_candidates ? INDEX_FLAG_EXTEND_CANDIDATES : 0);
+        meta.prune_alpha = neighbor_selection_.alpha;
+        return meta;
+    }
 
-        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
 
-        for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-            writeBinaryPOD(output, linkListSize);
-            if (linkListSize)
-                output.write(linkLists_[i], linkListSize);
-        }
-        output.close();
+    size_t getLinkListSize(tableint internal_id) const {
+        return element_levels_[internal_id] > 0 ? size_links_per_element_ * element_levels_[internal_id] : 0;
     }
 
 
-    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
-        std::ifstream input(location, std::ios::binary);
+    /*
+    * The parts of a saved index guarded by locks other than the mutation gate, captured by
+    * captureSaveState under those locks. Sections given one read it instead of taking the locks, which
+    * the forked child of saveIndexAsync must not touch.
+    */
+    struct IndexSaveState {
+        std::vector<char> attributes;  // SECTION_ATTRIBUTES payload, empty without attributes
+        std::shared_ptr<const PivotTable> pivots;
+    };
 
-        if (!input.is_open())
-            throw std::runtime_error("Cannot open file");
 
-        // get file size:
-        input.seekg(0, input.end);
-        std::streampos total_filesize = input.tellg();
-        input.seekg(0, input.beg);
+    // Run with mutations paused, so that the state matches the element memory saved with it.
+    IndexSaveState captureSaveState() const {
+        IndexSaveState state;
+        size_t element_count = cur_element_count;
+        state.pivots = pivots();
+        std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+        if (!attributes_.empty()) {
+            state.attributes.reserve(attributes_.serializedSize(element_count));
+            attributes_.forEachChunk(element_count, [&state](const void *data, size_t size) {
+                state.attributes.insert(state.attributes.end(), (const char *) data, (const char *) data + size);
+            });
+        }
+        return state;
+    }
 
-        readBinaryPOD(input, offsetLevel0_);
-        readBinaryPOD(input, max_elements_);
-        readBinaryPOD(input, cur_element_count);
 
-        size_t max_elements = max_elements_i;
-        if (max_elements < cur_element_count)
-            max_elements = max_elements_;
-        max_elements_ = max_elements;
-        readBinaryPOD(input, size_data_per_element_);
-        readBinaryPOD(input, label_offset_);
-        readBinaryPOD(input, offsetData_);
-        readBinaryPOD(input, maxlevel_);
-        readBinaryPOD(input, enterpoint_node_);
-
-        readBinaryPOD(input, maxM_);
-        readBinaryPOD(input, maxM0_);
-        readBinaryPOD(input, M_);
-        readBinaryPOD(input, mult_);
-        readBinaryPOD(input, ef_construction_);
+    IndexFileLayout getIndexFileLayout(bool checksums, const IndexSaveState *state = nullptr) const {
+        size_t element_count = cur_element_count;
+        size_t upper_levels_size = element_count * sizeof(int32_t);
+        for (size_t i = 0; i < element_count; i++) {
+            upper_levels_size += getLinkListSize(i);
+        }
 
-        data_size_ = s->get_data_size();
-        fstdistfunc_ = s->get_dist_func();
-        dist_func_param_ = s->get_dist_func_param();
+        IndexFileLayout layout;
+        layout.addSection(SECTION_METADATA, sizeof(IndexMetadata), checksums);
+        layout.addSection(SECTION_LEVEL0, element_count * size_data_per_element_, checksums);
+        layout.addSection(SECTION_UPPER_LEVELS, upper_levels_size, checksums);
+        layout.addSection(SECTION_LABELS, element_count * sizeof(labeltype), checksums);
+        layout.addSection(SECTION_DELETED, (element_count + 63) / 64 * sizeof(uint64_t), checksums);
+        std::shared_ptr<const PivotTable> pivots = state ? state->pivots : this->pivots();
+        if (base_layer_only && !pivots->ids.empty())
+            layout.addSection(SECTION_PIVOTS, pivots->ids.size() * sizeof(tableint), checksums);
+        if (state) {
+            if (!state->attributes.empty())
+                layout.addSection(SECTION_ATTRIBUTES, state->attributes.size(), checksums);
+        } else {
+            std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+            if (!attributes_.empty())
+                layout.addSection(SECTION_ATTRIBUTES, attributes_.serializedSize(element_count), checksums);
+        }
+        layout.finalize();
+        return layout;
+    }
 
-        auto pos = input.tellg();
 
-        /// Optional - check if index is ok:
-        input.seekg(cur_element_count * size_data_per_element_, input.cur);
-        for (size_t i = 0; i < cur_element_count; i++) {
-            if (input.tellg() < 0 || input.tellg() >= total_filesize) {
-                throw std::runtime_error("Index seems to be corrupted or unsupported");
+    /*
+    * Calls fn(data, size) on consecutive pieces of the payload of a section, in file order; the parts in
+    * state when given one.
+    */
+    template<typename Function>
+    void forEachSectionChunk(uint32_t kind, Function fn, const IndexSaveState *state = nullptr) const {
+        const size_t chunk = 1024;
+        size_t element_count = cur_element_count;
+        switch (kind) {
+        case SECTION_METADATA: {
+            IndexMetadata meta = getIndexMetadata();
+            fn(&meta, sizeof(meta));
+            break;
+        }
+        case SECTION_LEVEL0:
+            fn(data_level0_memory_, element_count * size_data_per_element_);
+            break;
+        case SECTION_UPPER_LEVELS: {
+            int32_t levels[chunk];
+            for (size_t i = 0; i < element_count; i += chunk) {
+                size_t n = std::min(chunk, element_count - i);
+                for (size_t j = 0; j < n; j++)
+                    levels[j] = element_levels_[i + j];
+                fn(levels, n * sizeof(int32_t));
             }
-
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize != 0) {
-                input.seekg(linkListSize, input.cur);
+            for (size_t i = 0; i < element_count; i++) {
+                size_t link_list_size = getLinkListSize(i);
+                if (link_list_size)
+                    fn(linkLists_[i], link_list_size);
+            }
+            break;
+        }
+        case SECTION_LABELS: {
+            labeltype labels[chunk];
+            for (size_t i = 0; i < element_count; i += chunk) {
+                size_t n = std::min(chunk, element_count - i);
+                for (size_t j = 0; j < n; j++)
+                    labels[j] = getExternalLabel(i + j);
+                fn(labels, n * sizeof(labeltype));
+            }
+            break;
+        }
+        case SECTION_DELETED: {
+            uint64_t words[chunk / 64];
+            for (size_t i = 0; i < element_count; i += chunk) {
+                size_t n = std::min(chunk, element_count - i);
+                memset(words, 0, sizeof(words));
+                for (size_t j = 0; j < n; j++) {
+                    if (isMarkedDeleted(i + j))
+                        words[j / 64] |= (uint64_t) 1 << (j % 64);
+                }
+                fn(words, (n + 63) / 64 * sizeof(uint64_t));
             }
+            break;
         }
+        case SECTION_PIVOTS: {
+            std::shared_ptr<const PivotTable> pivots = state ? state->pivots : this->pivots();
+            fn(pivots->ids.data(), pivots->ids.size() * sizeof(tableint));
+            break;
+        }
+        case SECTION_ATTRIBUTES: {
+            if (state) {
+                fn(state->attributes.data(), state->attributes.size());
+                break;
+            }
+            std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+            attributes_.forEachChunk(element_count, fn);
+            break;
+        }
+        default:
+            throw std::runtime_error("Unknown index section");
+        }
+    }
 
-        // throw exception if it either corrupted or old index
-        if (input.tellg() != total_filesize)
-            throw std::runtime_error("Index seems to be corrupted or unsupported");
 
-        input.clear();
-        /// Optional check end
+    size_t indexFileSize() const {
+        return getIndexFileLayout(false).fileSize();
+    }
 
-        input.seekg(pos, input.beg);
 
-        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
-        input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
+    void saveIndex(const std::string &location) {
+        saveIndex(location, true);
+    }
 
-        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
 
-        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
-        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+    void saveIndex(const std::string &location, bool checksums) {
+        if (wal_)
+            wal_lsn_ = wal_->lastLsn();
+        std::ofstream output(location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+        StreamIndexOutput stream_output(output);
+        saveIndex(stream_output, checksums);
+        output.close();
+    }
 
-        visited_list_pool_ = new VisitedListPool(1, max_elements);
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
-        element_levels_ = std::vector<int>(max_elements);
-        revSize_ = 1.0 / mult_;
-        ef_ = 10;
-        for (size_t i = 0; i < cur_element_count; i++) {
-            label_lookup_[getExternalLabel(i)] = i;
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize == 0) {
-                element_levels_[i] = 0;
-                linkLists_[i] = nullptr;
-            } else {
-                element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char *) malloc(linkListSize);
-                if (linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                input.read(linkLists_[i], linkListSize);
+    /*
+    * Writes the index in the sectioned format (see index_format.h).
+    * With checksums every section gets a CRC32C, which costs an extra pass over the index memory.
+    * The parts behind locks come from state (see captureSaveState), captured here if not given; with
+    * one no lock is taken.
+    */
+    void saveIndex(IndexOutput &output, bool checksums = true, const IndexSaveState *state = nullptr) const {
+        IndexSaveState own_state;
+        if (!state) {
+            own_state = captureSaveState();
+            state = &own_state;
+        }
+        IndexFileLayout layout = getIndexFileLayout(checksums, state);
+        if (checksums) {
+            for (size_t i = 0; i < layout.sections.size(); i++) {
+                uint32_t crc = 0;
+                forEachSectionChunk(layout.sections[i].kind, [&crc](const void *data, size_t size) {
+                    crc = crc32cExtend(crc, data, size);
+                }, state);
+                layout.sections[i].crc = crc;
             }
         }
 
-        for (size_t i = 0; i < cur_element_count; i++) {
-            if (isMarkedDeleted(i)) {
-                num_deleted_ += 1;
-                if (allow_replace_deleted_) deleted_elements.insert(i);
-            }
+        layout.writeHeader(output);
+        for (size_t i = 0; i < layout.sections.size(); i++) {
+            const IndexSectionEntry &section = layout.sections[i];
+            forEachSectionChunk(section.kind, [&output](const void *data, size_t size) {
+                output.write(data, size);
+            }, state);
+            uint64_t next = i + 1 < layout.sections.size() ? layout.sections[i + 1].offset : layout.fileSize();
+            output.writeZeros(next - section.offset - section.size);
         }
+    }
 
-        input.close();
 
-        return;
+    /*
+    * Saves a consistent snapshot of the index in the background while it keeps serving and ingesting.
+    * Mutations are paused only until the in-flight ones finish and the process forks; the child then
+    * writes its copy-on-write image of the index to location + ".tmp" with large (O_DIRECT where the
+    * file system supports it) writes and renames it over location. The future becomes ready once the
+    * file is on disk and throws if the snapshot could not be written.
+    * Without fork (Windows) the index is saved synchronously with mutations paused.
+    */
+    std::future<void> saveIndexAsync(const std::string &location, bool checksums = true) {
+        return saveIndexAsync(location, checksums, []() {});
     }
 
 
-    template<typename data_t>
-    std::vector<data_t> getDataByLabel(labeltype label) const {
-        // lock all operations with element by label
-        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
-        
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end() || isMarkedDeleted(search->second)) {
-            throw std::runtime_error("Label not found");
+    // Same, calling before_snapshot() while mutations are paused, right before the snapshot is taken.
+    template<typename Function>
+    std::future<void> saveIndexAsync(const std::string &location, bool checksums, Function before_snapshot) {
+#ifdef _WIN32
+        std::promise<void> done;
+        try {
+            MutationPause mutation_pause(mutation_gate_);
+            before_snapshot();
+            saveIndex(location, checksums);
+            done.set_value();
+        } catch (...) {
+            done.set_exception(std::current_exception());
         }
-        tableint internalId = search->second;
-        lock_table.unlock();
+        return done.get_future();
+#else
+        // everything the child needs is allocated before forking
+        const size_t buffer_size = 4 << 20;
+        std::string tmp_location = location + ".tmp";
+        void *buffer = nullptr;
+        if (posix_memalign(&buffer, INDEX_FILE_ALIGNMENT, buffer_size) != 0)
+            throw std::runtime_error("Not enough memory: saveIndexAsync failed to allocate write buffer");
+
+        pid_t pid;
+        {
+            MutationPause mutation_pause(mutation_gate_);
+            before_snapshot();
+            if (wal_)
+                wal_lsn_ = wal_->lastLsn();
+            IndexSaveState state = captureSaveState();
+            pid = fork();
+            // the child must not touch a lock or condition variable other threads share, so it never
+            // leaves the pause scope (whose end resumes the gate), saves from state and exits from here
+            if (pid == 0)
+                _exit(writeSnapshot(location.c_str(), tmp_location.c_str(), (char *) buffer, buffer_size, checksums,
+                                    state));
+        }
+        free(buffer);
+        if (pid < 0)
+            throw std::runtime_error("saveIndexAsync: fork failed");
+
+        return std::async(std::launch::async, [pid]() {
+            int status;
+            while (waitpid(pid, &status, 0) < 0) {
+                if (errno != EINTR)
+                    throw std::runtime_error("saveIndexAsync: lost the snapshot process");
+            }
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                throw std::runtime_error("saveIndexAsync: failed to write the snapshot");
+        });
+#endif
+    }
 
-        char* data_ptrv = getDataByInternalId(internalId);
-        size_t dim = *((size_t *) dist_func_param_);
-        std::vector<data_t> data;
-        data_t* data_ptr = (data_t*) data_ptrv;
-        for (int i = 0; i < dim; i++) {
-            data.push_back(*data_ptr);
-            data_ptr += 1;
+
+#ifndef _WIN32
+    // Runs in the forked child of saveIndexAsync, returns its exit status. Takes no lock.
+    int writeSnapshot(const char *location, const char *tmp_location, char *buffer, size_t buffer_size, bool checksums,
+                      const IndexSaveState &state) const {
+        int fd = -1;
+#ifdef O_DIRECT
+        fd = open(tmp_location, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#endif
+        if (fd < 0)
+            fd = open(tmp_location, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return 1;
+
+        bool ok = true;
+        try {
+            FileIndexOutput output(fd, buffer, buffer_size);
+            saveIndex(output, checksums, &state);
+            output.flush();
+        } catch (...) {
+            ok = false;
         }
-        return data;
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(tmp_location, location) != 0) {
+            unlink(tmp_location);
+            return 1;
+        }
+        return 0;
     }
+#endif
 
 
     /*
-    * Marks an element with the given label deleted, does NOT really change the current graph.
+    * Starts logging addPoint, markDelete and unmarkDelete to a write-ahead log at location, after
+    * replaying the records the index does not contain yet (those with an LSN above the one stored in
+    * the loaded snapshot) with num_threads threads (0 means one per core). Crash recovery is thus:
+    * load the last snapshot written by checkpoint, then openWal with the same location.
+    * With sync, a mutation returns only once its record is on disk; concurrent mutations share
+    * writes and syncs (group commit).
     */
-    void markDelete(labeltype label) {
-        // lock all operations with element by label
-        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+    void openWal(const std::string &location, bool sync = true, size_t num_threads = 0) {
+        if (wal_)
+            throw std::runtime_error("Write-ahead log is already open");
+        replayWal(location, num_threads);
+        wal_ = new WriteAheadLog(location, data_size_, sync, wal_lsn_);
+        wal_location_ = location;
+    }
 
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end()) {
-            throw std::runtime_error("Label not found");
-        }
-        tableint internalId = search->second;
-        lock_table.unlock();
 
-        markDeletedInternal(internalId);
+    void closeWal() {
+        if (wal_)
+            wal_lsn_ = wal_->lastLsn();
+        delete wal_;
+        wal_ = nullptr;
     }
 
 
     /*
-    * Uses the last 16 bits of the memory for the linked list size to store the mark,
-    * whereas maxM0_ has to be limited to the lower 16 bits, however, still large enough in almost all cases.
+    * Writes a snapshot of the index to location like saveIndexAsync (mutations keep going) and
+    * compacts the write-ahead log: records logged before the snapshot are moved to a separate
+    * file, deleted once the snapshot is on disk. Returns when the snapshot is written.
     */
-    void markDeletedInternal(tableint internalId) {
-        assert(internalId < cur_element_count);
-        if (!isMarkedDeleted(internalId)) {
-            unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
-            *ll_cur |= DELETE_MARK;
-            num_deleted_ += 1;
-            if (allow_replace_deleted_) {
-                std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
-                deleted_elements.insert(internalId);
+    void checkpoint(const std::string &location, bool checksums = true) {
+        if (!wal_)
+            throw std::runtime_error("No write-ahead log is open");
+        std::string old_location = wal_location_ + ".old";
+        // a file left by an unfinished checkpoint holds older records only, the new snapshot covers them
+        bool rotate = !std::ifstream(old_location).good();
+        saveIndexAsync(location, checksums, [&]() {
+            if (rotate)
+                wal_->rotate(old_location);
+        }).get();
+        remove(old_location.c_str());
+    }
+
+
+    uint64_t logMutation(uint8_t type, uint8_t flags, labeltype label, const void *data_point) {
+        return wal_ ? wal_->append(type, flags, label, data_point) : 0;
+    }
+
+
+    void waitWalDurable(uint64_t lsn) {
+        if (wal_ && lsn)
+            wal_->waitDurable(lsn);
+    }
+
+
+    /*
+    * Applies the records of the log at location (and of the one left by an unfinished checkpoint)
+    * that come after wal_lsn_. Records are split by label between threads, so the mutations of
+    * every label are applied in log order. Adds that replace a deleted element take the slot of
+    * whichever element is deleted at that point of the log, so each of them is applied alone, after
+    * all the records before it and before all the records after it.
+    */
+    void replayWal(const std::string &location, size_t num_threads) {
+        std::vector<WalRecordHeader> records;
+        std::vector<char> record_data;
+        uint64_t last_lsn = 0;
+        auto collect = [&](const WalRecordHeader &header, const char *data) {
+            if (header.lsn <= wal_lsn_)
+                return;
+            records.push_back(header);
+            record_data.insert(record_data.end(), data, data + header.data_size);
+        };
+        readWal(location + ".old", data_size_, &last_lsn, collect);
+        readWal(location, data_size_, &last_lsn, collect);
+        if (records.empty())
+            return;
+
+        std::vector<size_t> data_offsets(records.size());
+        size_t num_added = 0;
+        for (size_t i = 0, offset = 0; i < records.size(); i++) {
+            data_offsets[i] = offset;
+            offset += records[i].data_size;
+            if (records[i].type == WAL_ADD_POINT)
+                num_added++;
+        }
+        if (cur_element_count + num_added > max_elements_)
+            resizeIndex(cur_element_count + num_added);
+
+        auto apply = [&](size_t i) {
+            const WalRecordHeader &header = records[i];
+            std::unique_lock <std::mutex> lock_label(getLabelOpMutex(header.label));
+            switch (header.type) {
+            case WAL_ADD_POINT:
+                addPointWithLabelLock(record_data.data() + data_offsets[i], header.label,
+                                      header.flags & WAL_FLAG_REPLACE_DELETED);
+                break;
+            case WAL_MARK_DELETE:
+                markDeletedInternal(getInternalIdByLabel(header.label));
+                break;
+            case WAL_UNMARK_DELETE:
+                unmarkDeletedInternal(getInternalIdByLabel(header.label));
+                break;
+            default:
+                throw std::runtime_error("Write-ahead log seems to be corrupted or unsupported");
             }
-        } else {
-            throw std::runtime_error("The requested to delete element is already deleted");
+        };
+        auto replaces_deleted = [&](size_t i) {
+            return records[i].type == WAL_ADD_POINT && (records[i].flags & WAL_FLAG_REPLACE_DELETED);
+        };
+
+        if (num_threads == 0)
+            num_threads = std::thread::hardware_concurrency();
+        for (size_t begin = 0; begin < records.size();) {
+            // an add that replaces a deleted element depends on every record before it
+            if (replaces_deleted(begin)) {
+                apply(begin++);
+                continue;
+            }
+            size_t end = begin;
+            while (end < records.size() && !replaces_deleted(end)) {
+                end++;
+            }
+            size_t phase_threads = parallelRangeCount(end - begin, num_threads);
+            parallelRanges(phase_threads, phase_threads, [&](size_t thread_id, size_t, size_t) {
+                for (size_t i = begin; i < end; i++) {
+                    if ((records[i].label * 0x9E3779B97F4A7C15ULL >> 32) % phase_threads == thread_id)
+                        apply(i);
+                }
+            });
+            begin = end;
         }
+        wal_lsn_ = records.back().lsn;
     }
 
 
     /*
-    * Removes the deleted mark of the node, does NOT really change the current graph.
-    * 
-    * Note: the method is not safe to use when replacement of deleted elements is enabled,
-    *  because elements marked as deleted can be completely removed by addPoint
+    * Writes the index in the format used before the sectioned one, for readers that do not support it yet.
     */
-    void unmarkDelete(labeltype label) {
-        // lock all operations with element by label
-        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+    void saveIndexLegacy(const std::string &location) {
+        std::ofstream output(location, std::ios::binary);
+        std::streampos position;
 
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end()) {
-            throw std::runtime_error("Label not found");
-        }
-        tableint internalId = search->second;
-        lock_table.unlock();
+        writeBinaryPOD(output, offsetLevel0_);
+        writeBinaryPOD(output, max_elements_);
+        writeBinaryPOD(output, cur_element_count);
+        writeBinaryPOD(output, size_data_per_element_);
+        writeBinaryPOD(output, label_offset_);
+        writeBinaryPOD(output, offsetData_);
+        writeBinaryPOD(output, maxlevel_);
+        writeBinaryPOD(output, enterpoint_node_);
+        writeBinaryPOD(output, maxM_);
 
-        unmarkDeletedInternal(internalId);
-    }
+        writeBinaryPOD(output, maxM0_);
+        writeBinaryPOD(output, M_);
+        writeBinaryPOD(output, mult_);
+        writeBinaryPOD(output, ef_construction_);
+
+        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
 
+        for (size_t i = 0; i < cur_element_count; i++) {
+            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
+            writeBinaryPOD(output, linkListSize);
+            if (linkListSize)
+                output.write(linkLists_[i], linkListSize);
+        }
+        output.close();
+    }
 
 
     /*
-    * Remove the deleted mark of the node.
+    * Loads an index written by saveIndex, in either the sectioned or the legacy format.
+    * The file is read with positional reads from num_threads threads (0 means one per core).
     */
-    void unmarkDeletedInternal(tableint internalId) {
-        assert(internalId < cur_element_count);
-        if (isMarkedDeleted(internalId)) {
-            unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
-            *ll_cur &= ~DELETE_MARK;
-            num_deleted_ -= 1;
-            if (allow_replace_deleted_) {
-                std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
-                deleted_elements.erase(internalId);
-            }
+    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0, size_t num_threads = 0) {
+        FileIndexInput input(location);
+        loadIndex(input, s, max_elements_i, num_threads);
+    }
+
+
+    void loadIndex(std::istream &input, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
+        StreamIndexInput stream_input(input);
+        loadIndex(stream_input, s, max_elements_i, 1);
+    }
+
+
+    void loadIndex(IndexInput &input, SpaceInterface<dist_t> *s, size_t max_elements_i = 0, size_t num_threads = 0) {
+        if (num_threads == 0)
+            num_threads = std::thread::hardware_concurrency();
+        if (num_threads == 0 || !input.concurrentReads())
+            num_threads = 1;
+
+        IndexFileHeader header;
+        std::vector<IndexSectionEntry> sections;
+        if (readIndexFileHeader(input, header, sections)) {
+            loadIndexSections(input, sections, s, max_elements_i, num_threads);
         } else {
-            throw std::runtime_error("The requested to undelete element is not deleted");
+            loadIndexLegacy(input, s, max_elements_i, num_threads);
         }
     }
 
 
     /*
-    * Checks the first 16 bits of the memory to see if the element is marked deleted.
+    * Writes the index in the sectioned format into buffer, which must hold at least indexFileSize()
+    * bytes. Returns the number of bytes written.
     */
-    bool isMarkedDeleted(tableint internalId) const {
-        unsigned char *ll_cur = ((unsigned char*)get_linklist0(internalId)) + 2;
-        return *ll_cur & DELETE_MARK;
+    size_t saveIndexToBuffer(void *buffer, size_t size, bool checksums = true) const {
+        BufferIndexOutput output(buffer, size);
+        saveIndex(output, checksums);
+        return output.size();
     }
 
 
-    unsigned short int getListCount(linklistsizeint * ptr) const {
-        return *((unsigned short int *)ptr);
+    void saveIndexToBuffer(std::streambuf &buffer, bool checksums = true) const {
+        std::ostream output(&buffer);
+        StreamIndexOutput stream_output(output);
+        saveIndex(stream_output, checksums);
     }
 
 
-    void setListCount(linklistsizeint * ptr, unsigned short int size) const {
-        *((unsigned short int*)(ptr))=*((unsigned short int *)&size);
+    // Loads an index (either format) from a copy of buffer, which the caller may release afterwards.
+    void loadIndexFromBuffer(const void *buffer, size_t size, SpaceInterface<dist_t> *s, size_t max_elements_i = 0, size_t num_threads = 0) {
+        MemoryIndexInput input(buffer, size);
+        loadIndex(input, s, max_elements_i, num_threads);
+    }
+
+
+    // The stream buffer must be seekable.
+    void loadIndexFromBuffer(std::streambuf &buffer, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
+        std::istream input(&buffer);
+        loadIndex(input, s, max_elements_i);
     }
 
 
     /*
-    * Adds point. Updates the point if it is already in the index.
-    * If replacement of deleted elements is enabled: replaces previously deleted point if any, updating it with new point
+    * Zero-copy load of an index in the sectioned format: level 0 and the link lists stay in buffer,
+    * which must stay valid and writable for the lifetime of the index and is not freed by it.
+    * Only the levels, labels and deleted marks are copied. The index is loaded full (max elements is
+    * the element count); resizeIndex moves level 0 to memory owned by the index.
+    * Without verify_checksums the vectors and links are not read at all, so a memory-mapped file is
+    * only paged in as it is searched.
     */
-    void addPoint(const void *data_point, labeltype label, bool replace_deleted = false) {
-        if ((allow_replace_deleted_ == false) && (replace_deleted == true)) {
-            throw std::runtime_error("Replacement of deleted elements is disabled in constructor");
-        }
+    void adoptIndexBuffer(void *buffer, size_t size, SpaceInterface<dist_t> *s, bool verify_checksums = true, size_t num_threads = 0) {
+        if (num_threads == 0)
+            num_threads = std::thread::hardware_concurrency();
+        if (num_threads == 0)
+            num_threads = 1;
+
+        MemoryIndexInput input(buffer, size);
+        IndexFileHeader header;
+        std::vector<IndexSectionEntry> sections;
+        if (!readIndexFileHeader(input, header, sections))
+            throw std::runtime_error("Only indexes in the sectioned format can be adopted");
+        adopted_buffer_ = (char *) buffer;
+        adopted_buffer_size_ = size;
+        loadIndexSections(input, sections, s, 0, num_threads, verify_checksums);
+    }
 
-        // lock all operations with element by label
-        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
-        if (!replace_deleted) {
-            addPoint(data_point, label, -1);
-            return;
+
+    static size_t parallelRangeCount(size_t count, size_t num_threads) {
+        return std::max<size_t>(1, std::min(num_threads, count));
+    }
+
+
+    /*
+    * Splits [0, count) into parallelRangeCount(count, num_threads) contiguous ranges and runs
+    * fn(range_id, begin, end) for each of them on its own thread. Rethrows the first exception.
+    */
+    template<typename Function>
+    static void parallelRanges(size_t count, size_t num_threads, Function fn) {
+        size_t num_ranges = parallelRangeCount(count, num_threads);
+        std::exception_ptr last_exception = nullptr;
+        std::mutex last_exception_lock;
+        auto run = [&](size_t range_id) {
+            try {
+                fn(range_id, count * range_id / num_ranges, count * (range_id + 1) / num_ranges);
+            } catch (...) {
+                std::unique_lock <std::mutex> lock(last_exception_lock);
+                last_exception = std::current_exception();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t range_id = 1; range_id < num_ranges; range_id++) {
+            threads.push_back(std::thread(run, range_id));
         }
-        // check if there is vacant place
-        tableint internal_id_replaced;
-        std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
-        bool is_vacant_place = !deleted_elements.empty();
-        if (is_vacant_place) {
-            internal_id_replaced = *deleted_elements.begin();
-            deleted_elements.erase(internal_id_replaced);
+        run(0);
+        for (auto &thread : threads) {
+            thread.join();
         }
-        lock_deleted_elements.unlock();
+        if (last_exception)
+            std::rethrow_exception(last_exception);
+    }
 
-        // if there is no vacant place then add or update point
-        // else add point to vacant place
-        if (!is_vacant_place) {
-            addPoint(data_point, label, -1);
-        } else {
-            // we assume that there are no concurrent operations on deleted element
-            labeltype label_replaced = getExternalLabel(internal_id_replaced);
-            setExternalLabel(internal_id_replaced, label);
 
-            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-            label_lookup_.erase(label_replaced);
-            label_lookup_[label] = internal_id_replaced;
-            lock_table.unlock();
+    // Reads size bytes at offset in roughly equal pieces, one per thread. Returns their CRC32C if checksum is set.
+    static uint32_t readIndexRange(IndexInput &input, char *data, uint64_t size, uint64_t offset,
+                                   size_t num_threads, bool checksum) {
+        const uint64_t min_piece_size = 1 << 20;
+        size_t num_pieces = parallelRangeCount(size / min_piece_size, num_threads);
+        std::vector<uint32_t> crcs(num_pieces, 0);
+        parallelRanges(num_pieces, num_threads, [&](size_t, size_t begin, size_t end) {
+            for (size_t piece = begin; piece < end; piece++) {
+                uint64_t piece_begin = size * piece / num_pieces;
+                uint64_t piece_end = size * (piece + 1) / num_pieces;
+                input.readAt(data + piece_begin, piece_end - piece_begin, offset + piece_begin);
+                if (checksum)
+                    crcs[piece] = crc32c(data + piece_begin, piece_end - piece_begin);
+            }
+        });
 
-            unmarkDeletedInternal(internal_id_replaced);
-            updatePoint(data_point, internal_id_replaced, 1.0);
+        uint32_t crc = crcs[0];
+        for (size_t piece = 1; piece < num_pieces; piece++) {
+            crc = crc32cCombine(crc, crcs[piece], size * (piece + 1) / num_pieces - size * piece / num_pieces);
         }
+        return crc;
     }
 
 
-    void updatePoint(const void *dataPoint, tableint internalId, float updateNeighborProbability) {
-        // update the feature vector associated with existing point with new vector
-        memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
+    static void readIndexSection(IndexInput &input, const IndexSectionEntry &section, void *data, size_t num_threads = 1) {
+        bool checksum = section.flags & SECTION_FLAG_CRC32C;
+        uint32_t crc = readIndexRange(input, (char *) data, section.size, section.offset, num_threads, checksum);
+        checkIndexSectionCrc(section, crc);
+    }
 
-        int maxLevelCopy = maxlevel_;
-        tableint entryPointCopy = enterpoint_node_;
-        // If point to be updated is entry point and graph just contains single element then just return.
-        if (entryPointCopy == internalId && cur_element_count == 1)
-            return;
 
-        int elemLevel = element_levels_[internalId];
-        std::uniform_real_distribution<float> distribution(0.0, 1.0);
-        for (int layer = 0; layer <= elemLevel; layer++) {
-            std::unordered_set<tableint> sCand;
-            std::unordered_set<tableint> sNeigh;
-            std::vector<tableint> listOneHop = getConnectionsWithLock(internalId, layer);
-            if (listOneHop.size() == 0)
-                continue;
+    // Reads SECTION_METADATA, zero-filling fields missing from older files, and checks it against s.
+    static IndexMetadata readIndexMetadata(IndexInput &input, const std::vector<IndexSectionEntry> &sections,
+                                           SpaceInterface<dist_t> *s) {
+        const IndexSectionEntry &meta_section = requireIndexSection(sections, SECTION_METADATA);
+        std::vector<char> meta_buffer(meta_section.size);
+        readIndexSection(input, meta_section, meta_buffer.data());
+        IndexMetadata meta;
+        memset(&meta, 0, sizeof(meta));
+        memcpy(&meta, meta_buffer.data(), std::min(meta_buffer.size(), sizeof(meta)));
+
+        if (meta.label_size != sizeof(labeltype) || meta.tableint_size != sizeof(tableint))
+            throw std::runtime_error("Index was saved with different label or id types");
+        if (meta.data_size != s->get_data_size())
+            throw std::runtime_error("Index data size does not match the space");
+        return meta;
+    }
 
-            sCand.insert(internalId);
 
-            for (auto&& elOneHop : listOneHop) {
-                sCand.insert(elOneHop);
+    static const IndexSectionEntry &requireIndexSection(const std::vector<IndexSectionEntry> &sections, uint32_t kind) {
+        const IndexSectionEntry *section = findIndexSection(sections, kind);
+        if (section == nullptr)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        return *section;
+    }
 
-                if (distribution(update_probability_generator_) > updateNeighborProbability)
-                    continue;
 
-                sNeigh.insert(elOneHop);
+    /*
+    * Reads SECTION_UPPER_LEVELS as stored into upper_levels and sets offsets[i] to the position of
+    * element i's link lists in it. For read-only index types that keep the section as one array.
+    */
+    static void readUpperLevelsSection(IndexInput &input, const std::vector<IndexSectionEntry> &sections,
+                                       size_t element_count, size_t size_links_per_element,
+                                       std::vector<char> &upper_levels, std::vector<size_t> &offsets,
+                                       size_t num_threads = 1) {
+        const IndexSectionEntry &section = requireIndexSection(sections, SECTION_UPPER_LEVELS);
+        upper_levels.resize(section.size);
+        readIndexSection(input, section, upper_levels.data(), num_threads);
+        upperLevelListOffsets(upper_levels, element_count, size_links_per_element, offsets);
+    }
 
-                std::vector<tableint> listTwoHop = getConnectionsWithLock(elOneHop, layer);
-                for (auto&& elTwoHop : listTwoHop) {
-                    sCand.insert(elTwoHop);
-                }
-            }
 
-            for (auto&& neigh : sNeigh) {
-                // if (neigh == internalId)
-                //     continue;
+    // Positions of the link lists of every element in a SECTION_UPPER_LEVELS payload.
+    static void upperLevelListOffsets(const std::vector<char> &upper_levels, size_t element_count,
+                                      size_t size_links_per_element, std::vector<size_t> &offsets) {
+        if (upper_levels.size() < element_count * sizeof(int32_t))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        offsets.resize(element_count);
+        size_t offset = element_count * sizeof(int32_t);
+        for (size_t i = 0; i < element_count; i++) {
+            int32_t level;
+            memcpy(&level, upper_levels.data() + i * sizeof(int32_t), sizeof(level));
+            offsets[i] = offset;
+            offset += level > 0 ? level * size_links_per_element : 0;
+        }
+        if (offset != upper_levels.size())
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+    }
 
-                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
-                size_t size = sCand.find(neigh) == sCand.end() ? sCand.size() : sCand.size() - 1;  // sCand guaranteed to have size >= 1
-                size_t elementsToKeep = std::min(ef_construction_, size);
-                for (auto&& cand : sCand) {
-                    if (cand == neigh)
-                        continue;
+
+    // Reads SECTION_PIVOTS, if the file has one, into pivots.
+    static void readPivotsSection(IndexInput &input, const std::vector<IndexSectionEntry> &sections,
+                                  size_t element_count, std::vector<tableint> &pivots) {
+        pivots.clear();
+        const IndexSectionEntry *section = findIndexSection(sections, SECTION_PIVOTS);
+        if (!section)
+            return;
+        if (section->size % sizeof(tableint))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        pivots.resize(section->size / sizeof(tableint));
+        readIndexSection(input, *section, pivots.data());
+        for (tableint id : pivots) {
+            if (id >= element_count)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+    }
+
+
+    // Allocates everything that is not stored in the file, once the header fields are known.
+    void initLoadedIndex(SpaceInterface<dist_t> *s, size_t max_elements, bool allocate_level0 = true) {
+        data_size_ = s->get_data_size();
+        fstdistfunc_ = s->get_dist_func();
+        fstdistfunc_batch_ = s->get_dist_func_batch();
+        dist_func_param_ = s->get_dist_func_param();
+
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+
+        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
+        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+
+        visited_list_pool_ = new VisitedListPool(1, max_elements);
+
+        if (!flat_graph_) {
+            linkLists_ = (char **) calloc(max_elements, sizeof(void *));
+            if (linkLists_ == nullptr)
+                throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+        }
+        element_levels_ = std::vector<int>(max_elements);
+        revSize_ = 1.0 / mult_;
+        ef_ = 10;
+
+        if (!allocate_level0)
+            return;
+        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
+        if (data_level0_memory_ == nullptr)
+            throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
+    }
+
+
+    /*
+    * Reads the link lists of the upper levels, given the file offset of each element's list
+    * (element_levels_ must be set), or points them into the adopted buffer. Every thread reads the lists of a contiguous range of elements
+    * with a few large reads. Returns the CRC32C of everything read, which is the checksum of the
+    * lists when they are stored back to back.
+    */
+    uint32_t readLinkLists(IndexInput &input, const std::vector<uint64_t> &list_offsets, size_t num_threads, bool checksum) {
+        const uint64_t max_block_size = 8 << 20;
+        size_t element_count = cur_element_count;
+        size_t num_ranges = parallelRangeCount(element_count, num_threads);
+        std::vector<uint32_t> crcs(num_ranges, 0);
+        std::vector<uint64_t> lengths(num_ranges, 0);
+
+        parallelRanges(element_count, num_threads, [&](size_t range_id, size_t begin, size_t end) {
+            if (adopted_buffer_) {
+                for (size_t k = begin; k < end; k++) {
+                    if (getLinkListSize(k))
+                        linkLists_[k] = adopted_buffer_ + list_offsets[k];
+                }
+                if (end > begin) {
+                    lengths[range_id] = list_offsets[end - 1] + getLinkListSize(end - 1) - list_offsets[begin];
+                    if (checksum)
+                        crcs[range_id] = crc32c(adopted_buffer_ + list_offsets[begin], lengths[range_id]);
+                }
+                return;
+            }
+
+            std::vector<char> block;
+            size_t i = begin;
+            while (i < end) {
+                uint64_t block_begin = list_offsets[i];
+                size_t j = i + 1;
+                while (j < end && list_offsets[j] + getLinkListSize(j) - block_begin <= max_block_size)
+                    j++;
+                block.resize(list_offsets[j - 1] + getLinkListSize(j - 1) - block_begin);
+                input.readAt(block.data(), block.size(), block_begin);
+                if (checksum)
+                    crcs[range_id] = crc32cExtend(crcs[range_id], block.data(), block.size());
+                lengths[range_id] += block.size();
+
+                for (size_t k = i; k < j; k++) {
+                    size_t linkListSize = getLinkListSize(k);
+                    if (linkListSize == 0)
+                        continue;
+                    linkLists_[k] = (char *) malloc(linkListSize);
+                    if (linkLists_[k] == nullptr)
+                        throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
+                    memcpy(linkLists_[k], block.data() + (list_offsets[k] - block_begin), linkListSize);
+                }
+                i = j;
+            }
+        });
+
+        uint32_t crc = crcs[0];
+        for (size_t range_id = 1; range_id < num_ranges; range_id++) {
+            crc = crc32cCombine(crc, crcs[range_id], lengths[range_id]);
+        }
+        return crc;
+    }
+
+
+    /*
+    * Fills label_lookup_ from labels (or from level 0 if labels is null). Runs on its own thread so
+    * that it overlaps with reading the link lists.
+    */
+    void rebuildLabelLookup(const labeltype *labels) {
+        size_t element_count = cur_element_count;
+        label_lookup_.reserve(element_count);
+        for (size_t i = 0; i < element_count; i++) {
+            label_lookup_[labels ? labels[i] : getExternalLabel(i)] = i;
+        }
+    }
+
+
+    // Counts deleted elements from the bitmap words (or the level 0 marks if words is null).
+    void rebuildDeletedElements(const uint64_t *deleted_words, size_t num_threads) {
+        size_t element_count = cur_element_count;
+        size_t num_ranges = parallelRangeCount(element_count, num_threads);
+        std::vector<size_t> counts(num_ranges, 0);
+        std::vector<std::vector<tableint>> deleted_ids(num_ranges);
+        parallelRanges(element_count, num_threads, [&](size_t range_id, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                bool deleted = deleted_words ? (deleted_words[i / 64] >> (i % 64)) & 1 : isMarkedDeleted(i);
+                if (!deleted)
+                    continue;
+                counts[range_id]++;
+                if (allow_replace_deleted_)
+                    deleted_ids[range_id].push_back(i);
+            }
+        });
+
+        num_deleted_ = 0;
+        for (size_t range_id = 0; range_id < num_ranges; range_id++) {
+            num_deleted_ += counts[range_id];
+            deleted_elements.insert(deleted_ids[range_id].begin(), deleted_ids[range_id].end());
+        }
+    }
+
+
+    // Reads the upper levels while label_lookup_ is rebuilt on another thread, then counts deleted elements.
+    uint32_t loadLinkListsAndLabels(
+        IndexInput &input,
+        const std::vector<uint64_t> &list_offsets,
+        const labeltype *labels,
+        const uint64_t *deleted_words,
+        size_t num_threads,
+        bool checksum) {
+        uint32_t crc;
+        if (num_threads == 1) {
+            rebuildLabelLookup(labels);
+            crc = readLinkLists(input, list_offsets, num_threads, checksum);
+        } else {
+            std::exception_ptr label_exception = nullptr;
+            std::thread label_thread([&] {
+                try {
+                    rebuildLabelLookup(labels);
+                } catch (...) {
+                    label_exception = std::current_exception();
+                }
+            });
+            try {
+                crc = readLinkLists(input, list_offsets, num_threads, checksum);
+            } catch (...) {
+                label_thread.join();
+                throw;
+            }
+            label_thread.join();
+            if (label_exception)
+                std::rethrow_exception(label_exception);
+        }
+        rebuildDeletedElements(deleted_words, num_threads);
+        return crc;
+    }
+
+
+    void loadIndexSections(
+        IndexInput &input,
+        const std::vector<IndexSectionEntry> &sections,
+        SpaceInterface<dist_t> *s,
+        size_t max_elements_i,
+        size_t num_threads,
+        bool verify_checksums = true) {
+        IndexMetadata meta = readIndexMetadata(input, sections, s);
+
+        offsetLevel0_ = meta.offset_level0;
+        max_elements_ = meta.max_elements;
+        size_t element_count = meta.cur_element_count;
+        size_data_per_element_ = meta.size_data_per_element;
+        label_offset_ = meta.label_offset;
+        offsetData_ = meta.offset_data;
+        maxlevel_ = meta.max_level;
+        enterpoint_node_ = meta.enterpoint_node;
+        maxM_ = meta.max_M;
+        maxM0_ = meta.max_M0;
+        M_ = meta.M;
+        mult_ = meta.mult;
+        ef_construction_ = meta.ef_construction;
+        wal_lsn_ = meta.wal_lsn;
+        flat_graph_ = (meta.flags & INDEX_FLAG_FLAT_GRAPH) != 0;
+        neighbor_selection_.alpha = meta.prune_alpha > 0 ? meta.prune_alpha : 1.0f;
+        neighbor_selection_.keep_pruned = (meta.flags & INDEX_FLAG_KEEP_PRUNED) != 0;
+        neighbor_selection_.extend_candidates = (meta.flags & INDEX_FLAG_EXTEND_CANDIDATES) != 0;
+        if (flat_graph_ && maxlevel_ != 0)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        size_t max_elements = max_elements_i;
+        if (max_elements < element_count)
+            max_elements = max_elements_;
+        if (adopted_buffer_)
+            max_elements = element_count;
+        max_elements_ = max_elements;
+
+        initLoadedIndex(s, max_elements, adopted_buffer_ == nullptr);
+        if (meta.size_links_per_element != size_links_per_element_ || element_count > max_elements)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        cur_element_count = element_count;
+
+        const IndexSectionEntry &level0_section = requireIndexSection(sections, SECTION_LEVEL0);
+        if (level0_section.size != element_count * size_data_per_element_)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        if (adopted_buffer_) {
+            data_level0_memory_ = adopted_buffer_ + level0_section.offset;
+            if (verify_checksums && (level0_section.flags & SECTION_FLAG_CRC32C))
+                checkIndexSectionCrc(level0_section, crc32c(data_level0_memory_, level0_section.size));
+        } else {
+            readIndexSection(input, level0_section, data_level0_memory_, num_threads);
+        }
+
+        static_assert(sizeof(int) == sizeof(int32_t), "element_levels_ is stored as int32");
+        const IndexSectionEntry &upper_section = requireIndexSection(sections, SECTION_UPPER_LEVELS);
+        bool upper_checksum = verify_checksums && (upper_section.flags & SECTION_FLAG_CRC32C);
+        uint64_t levels_size = element_count * sizeof(int32_t);
+        if (upper_section.size < levels_size)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        uint32_t levels_crc = readIndexRange(input, (char *) element_levels_.data(), levels_size,
+                                             upper_section.offset, num_threads, upper_checksum);
+
+        // One pass over the levels to get the offset of every link list
+        size_t num_ranges = parallelRangeCount(element_count, num_threads);
+        std::vector<uint64_t> range_offsets(num_ranges + 1, 0);
+        parallelRanges(element_count, num_threads, [&](size_t range_id, size_t begin, size_t end) {
+            uint64_t size = 0;
+            for (size_t i = begin; i < end; i++) {
+                if (element_levels_[i] < 0 || element_levels_[i] > maxlevel_)
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+                size += getLinkListSize(i);
+            }
+            range_offsets[range_id + 1] = size;
+        });
+        range_offsets[0] = upper_section.offset + levels_size;
+        for (size_t range_id = 0; range_id < num_ranges; range_id++) {
+            range_offsets[range_id + 1] += range_offsets[range_id];
+        }
+        uint64_t lists_size = range_offsets[num_ranges] - range_offsets[0];
+        if (levels_size + lists_size != upper_section.size)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        std::vector<uint64_t> list_offsets(element_count);
+        parallelRanges(element_count, num_threads, [&](size_t range_id, size_t begin, size_t end) {
+            uint64_t offset = range_offsets[range_id];
+            for (size_t i = begin; i < end; i++) {
+                list_offsets[i] = offset;
+                offset += getLinkListSize(i);
+            }
+        });
+
+        std::vector<labeltype> labels;
+        const IndexSectionEntry *labels_section = findIndexSection(sections, SECTION_LABELS);
+        if (labels_section) {
+            if (labels_section->size != element_count * sizeof(labeltype))
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            labels.resize(element_count);
+            readIndexSection(input, *labels_section, labels.data(), num_threads);
+        }
+
+        std::vector<uint64_t> deleted_words;
+        const IndexSectionEntry *deleted_section = findIndexSection(sections, SECTION_DELETED);
+        if (deleted_section) {
+            if (deleted_section->size != (element_count + 63) / 64 * sizeof(uint64_t))
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            deleted_words.resize(deleted_section->size / sizeof(uint64_t));
+            readIndexSection(input, *deleted_section, deleted_words.data());
+        }
+
+        std::vector<tableint> pivots;
+        readPivotsSection(input, sections, element_count, pivots);
+        setPivots(pivots);
+        if (!pivots.empty())
+            base_layer_only = true;  // only base_layer_only indexes save their pivots
+
+        const IndexSectionEntry *attributes_section = findIndexSection(sections, SECTION_ATTRIBUTES);
+        if (attributes_section) {
+            std::vector<char> attributes_data(attributes_section->size);
+            readIndexSection(input, *attributes_section, attributes_data.data());
+            attributes_.deserialize(attributes_data.data(), attributes_data.size(), element_count);
+        } else {
+            attributes_.clear();
+        }
+
+        uint32_t lists_crc = loadLinkListsAndLabels(
+            input, list_offsets,
+            labels_section ? labels.data() : nullptr,
+            deleted_section ? deleted_words.data() : nullptr,
+            num_threads, upper_checksum);
+        if (upper_checksum)
+            checkIndexSectionCrc(upper_section, crc32cCombine(levels_crc, lists_crc, lists_size));
+    }
+
+
+    void loadIndexLegacy(IndexInput &input, SpaceInterface<dist_t> *s, size_t max_elements_i, size_t num_threads) {
+        uint64_t total_filesize = input.size();
+
+        const size_t header_size = 10 * sizeof(size_t) + sizeof(int) + sizeof(tableint) + sizeof(double);
+        char header[header_size];
+        if (total_filesize < header_size)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        input.readAt(header, header_size, 0);
+        const char *field = header;
+        auto readField = [&field](void *podRef, size_t size) {
+            memcpy(podRef, field, size);
+            field += size;
+        };
+
+        size_t element_count;
+        flat_graph_ = false;
+        neighbor_selection_ = NeighborSelection();
+        readField(&offsetLevel0_, sizeof(offsetLevel0_));
+        readField(&max_elements_, sizeof(max_elements_));
+        readField(&element_count, sizeof(element_count));
+
+        size_t max_elements = max_elements_i;
+        if (max_elements < element_count)
+            max_elements = max_elements_;
+        max_elements_ = max_elements;
+        readField(&size_data_per_element_, sizeof(size_data_per_element_));
+        readField(&label_offset_, sizeof(label_offset_));
+        readField(&offsetData_, sizeof(offsetData_));
+        readField(&maxlevel_, sizeof(maxlevel_));
+        readField(&enterpoint_node_, sizeof(enterpoint_node_));
+
+        readField(&maxM_, sizeof(maxM_));
+        readField(&maxM0_, sizeof(maxM0_));
+        readField(&M_, sizeof(M_));
+        readField(&mult_, sizeof(mult_));
+        readField(&ef_construction_, sizeof(ef_construction_));
+
+        uint64_t level0_size = element_count * size_data_per_element_;
+        if (header_size + level0_size > total_filesize)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        initLoadedIndex(s, max_elements);
+        if (element_count > max_elements)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        cur_element_count = element_count;
+
+        // One pass over the link list sizes to get the offset of every link list; it also checks that
+        // the file ends right after the last one (otherwise it is either corrupted or an old index)
+        std::vector<uint64_t> list_offsets(element_count);
+        std::vector<char> buffer(1 << 20);
+        uint64_t buffer_begin = 0, buffer_end = 0;
+        uint64_t position = header_size + level0_size;
+        for (size_t i = 0; i < element_count; i++) {
+            unsigned int linkListSize;
+            if (position + sizeof(linkListSize) > total_filesize)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            if (position < buffer_begin || position + sizeof(linkListSize) > buffer_end) {
+                buffer_begin = position;
+                buffer_end = std::min<uint64_t>(position + buffer.size(), total_filesize);
+                input.readAt(buffer.data(), buffer_end - buffer_begin, buffer_begin);
+            }
+            memcpy(&linkListSize, buffer.data() + (position - buffer_begin), sizeof(linkListSize));
+            if (linkListSize % size_links_per_element_ != 0)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            element_levels_[i] = linkListSize / size_links_per_element_;
+            list_offsets[i] = position + sizeof(linkListSize);
+            position = list_offsets[i] + linkListSize;
+        }
+        if (position != total_filesize)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        readIndexRange(input, data_level0_memory_, level0_size, header_size, num_threads, false);
+        loadLinkListsAndLabels(input, list_offsets, nullptr, nullptr, num_threads, false);
+    }
+
+
+    template<typename data_t>
+    std::vector<data_t> getDataByLabel(labeltype label) const {
+        // lock all operations with element by label
+        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+        
+        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+        auto search = label_lookup_.find(label);
+        if (search == label_lookup_.end() || isMarkedDeleted(search->second)) {
+            throw std::runtime_error("Label not found");
+        }
+        tableint internalId = search->second;
+        lock_table.unlock();
+
+        char* data_ptrv = getDataByInternalId(internalId);
+        size_t dim = *((size_t *) dist_func_param_);
+        std::vector<data_t> data;
+        data_t* data_ptr = (data_t*) data_ptrv;
+        for (int i = 0; i < dim; i++) {
+            data.push_back(*data_ptr);
+            data_ptr += 1;
+        }
+        return data;
+    }
+
+
+    /*
+    * Adds an attribute column stored with the index (and saved with it) for filtering searches natively:
+    * ATTRIBUTE_INT holds an int64 per element (integers, enums, timestamps), ATTRIBUTE_TAGS a set of
+    * uint32 tags. Elements read as 0 or no tags until set. Attribute writes are not logged to the WAL.
+    */
+    void addAttribute(const std::string &name, AttributeType type) {
+        MutationGuard mutation_guard(mutation_gate_);
+        std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+        attributes_.addColumn(name, type);
+    }
+
+
+    void setAttribute(labeltype label, const std::string &name, int64_t value) {
+        MutationGuard mutation_guard(mutation_gate_);
+        tableint internal_id = getInternalIdByLabel(label);
+        std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+        attributes_.setValue(internal_id, name, value);
+    }
+
+
+    void setAttributeTags(labeltype label, const std::string &name, const std::vector<uint32_t> &tags) {
+        MutationGuard mutation_guard(mutation_gate_);
+        tableint internal_id = getInternalIdByLabel(label);
+        std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+        attributes_.setTags(internal_id, name, tags);
+    }
+
+
+    int64_t getAttribute(labeltype label, const std::string &name) const {
+        tableint internal_id = getInternalIdByLabel(label);
+        std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+        return attributes_.getValue(internal_id, name);
+    }
+
+
+    std::vector<uint32_t> getAttributeTags(labeltype label, const std::string &name) const {
+        tableint internal_id = getInternalIdByLabel(label);
+        std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+        return attributes_.getTags(internal_id, name);
+    }
+
+
+    /*
+    * Filter allowing the labels of the elements that match all the predicates, for SearchParams::filter.
+    * Low-cardinality columns are answered from bitmap indexes, the others by a column scan; the result
+    * comes bound to this index, so its searches test a bitmap over internal ids instead of calling back
+    * per candidate, and the planner knows the selectivity. The filter is a snapshot: compile it again
+    * after attribute or element changes.
+    */
+    BitmapFilter compileFilter(const std::vector<AttributePredicate> &predicates) const {
+        size_t element_count = cur_element_count;
+        Bitmap matching;
+        {
+            std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+            matching = attributes_.evaluate(predicates, element_count);
+        }
+        std::vector<labeltype> labels;
+        const uint64_t *words = matching.words();
+        for (size_t w = 0; w < matching.numWords(); w++) {
+            uint64_t word = words[w];
+            while (word) {
+                size_t internal_id = w * 64 + countTrailingZeros64(word);
+                word &= word - 1;
+                labels.push_back(getExternalLabel(internal_id));
+            }
+        }
+        BitmapFilter filter(std::move(labels));
+        filter.allowed = std::move(matching);
+        filter.index = this;
+        return filter;
+    }
+
+
+    /*
+    * Binds filter to this index: its labels are translated to internal ids once, into filter.allowed,
+    * which the searches of this index then test inline. A snapshot of the elements present now: bind it
+    * again after adding, replacing or removing elements.
+    */
+    void bindFilter(BitmapFilter &filter) const {
+        size_t element_count = cur_element_count;
+        Bitmap allowed(element_count);
+        {
+            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+            for (labeltype label : filter.labels) {
+                auto search = label_lookup_.find(label);
+                if (search != label_lookup_.end() && search->second < element_count)
+                    allowed.set(search->second);
+            }
+        }
+        filter.allowed = std::move(allowed);
+        filter.index = this;
+    }
+
+
+    /*
+    * Marks an element with the given label deleted, does NOT really change the current graph.
+    */
+    void markDelete(labeltype label) {
+        uint64_t lsn;
+        {
+            MutationGuard mutation_guard(mutation_gate_);
+            // lock all operations with element by label
+            std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+            markDeletedInternal(getInternalIdByLabel(label));
+            lsn = logMutation(WAL_MARK_DELETE, 0, label, nullptr);
+        }
+        waitWalDurable(lsn);
+    }
+
+
+    tableint getInternalIdByLabel(labeltype label) const {
+        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+        auto search = label_lookup_.find(label);
+        if (search == label_lookup_.end()) {
+            throw std::runtime_error("Label not found");
+        }
+        return search->second;
+    }
+
+
+    /*
+    * Uses the last 16 bits of the memory for the linked list size to store the mark,
+    * whereas maxM0_ has to be limited to the lower 16 bits, however, still large enough in almost all cases.
+    */
+    void markDeletedInternal(tableint internalId) {
+        assert(internalId < cur_element_count);
+        if (!isMarkedDeleted(internalId)) {
+            unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
+            *ll_cur |= DELETE_MARK;
+            num_deleted_ += 1;
+            if (allow_replace_deleted_) {
+                std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
+                deleted_elements.insert(internalId);
+            }
+        } else {
+            throw std::runtime_error("The requested to delete element is already deleted");
+        }
+    }
+
+
+    /*
+    * Removes the deleted mark of the node, does NOT really change the current graph.
+    * 
+    * Note: the method is not safe to use when replacement of deleted elements is enabled,
+    *  because elements marked as deleted can be completely removed by addPoint
+    */
+    void unmarkDelete(labeltype label) {
+        uint64_t lsn;
+        {
+            MutationGuard mutation_guard(mutation_gate_);
+            // lock all operations with element by label
+            std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+            unmarkDeletedInternal(getInternalIdByLabel(label));
+            lsn = logMutation(WAL_UNMARK_DELETE, 0, label, nullptr);
+        }
+        waitWalDurable(lsn);
+    }
+
+
+
+    /*
+    * Remove the deleted mark of the node.
+    */
+    void unmarkDeletedInternal(tableint internalId) {
+        assert(internalId < cur_element_count);
+        if (isMarkedDeleted(internalId)) {
+            unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
+            *ll_cur &= ~DELETE_MARK;
+            num_deleted_ -= 1;
+            if (allow_replace_deleted_) {
+                std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
+                deleted_elements.erase(internalId);
+            }
+        } else {
+            throw std::runtime_error("The requested to undelete element is not deleted");
+        }
+    }
+
+
+    /*
+    * Checks the first 16 bits of the memory to see if the element is marked deleted.
+    */
+    bool isMarkedDeleted(tableint internalId) const {
+        unsigned char *ll_cur = ((unsigned char*)get_linklist0(internalId)) + 2;
+        return *ll_cur & DELETE_MARK;
+    }
+
+
+    unsigned short int getListCount(linklistsizeint * ptr) const {
+        return *((unsigned short int *)ptr);
+    }
+
+
+    void setListCount(linklistsizeint * ptr, unsigned short int size) const {
+        *((unsigned short int*)(ptr))=*((unsigned short int *)&size);
+    }
+
+
+    /*
+    * Adds point. Updates the point if it is already in the index.
+    * If replacement of deleted elements is enabled: replaces previously deleted point if any, updating it with new point
+    */
+    void addPoint(const void *data_point, labeltype label, bool replace_deleted = false) {
+        if ((allow_replace_deleted_ == false) && (replace_deleted == true)) {
+            throw std::runtime_error("Replacement of deleted elements is disabled in constructor");
+        }
+
+        uint64_t lsn;
+        {
+            MutationGuard mutation_guard(mutation_gate_);
+            // lock all operations with element by label
+            std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+            addPointWithLabelLock(data_point, label, replace_deleted);
+            lsn = logMutation(WAL_ADD_POINT, replace_deleted ? WAL_FLAG_REPLACE_DELETED : 0, label, data_point);
+        }
+        waitWalDurable(lsn);
+    }
+
+
+    /*
+    * Inserts n points: data holds n vectors of data_size_ bytes back to back, labels their n labels.
+    * While the index holds fewer than ADD_POINTS_SERIAL_SEED elements, a random subset of the batch
+    * (chosen with the level generator, so reproducible for a given random_seed) is inserted serially
+    * first to give the parallel insertions a well-formed graph to start from. The rest is inserted on
+    * num_threads threads (0: one per hardware thread).
+    * progress(done, n) is called every n / 1000 insertions and at the end, one call at a time.
+    * The first exception thrown by an insertion stops the batch and is rethrown; points inserted
+    * before it stay in the index.
+    */
+    void addPoints(const void *data, const labeltype *labels, size_t n, size_t num_threads = 0,
+                   bool replace_deleted = false, const std::function<void(size_t, size_t)> &progress = nullptr) {
+        ThreadPool pool(num_threads);
+        addPoints(data, labels, n, pool, replace_deleted, progress);
+    }
+
+
+    void addPoints(const void *data, const labeltype *labels, size_t n, ThreadPool &pool,
+                   bool replace_deleted = false, const std::function<void(size_t, size_t)> &progress = nullptr) {
+        const char *points = (const char *) data;
+        size_t num_serial;
+        std::vector<size_t> order = addPointsOrder(n, num_serial);
+
+        std::atomic<size_t> done(0);
+        std::mutex progress_lock;
+        size_t report_every = std::max<size_t>(1, n / 1000);
+        auto insert = [&](size_t i) {
+            addPoint(points + order[i] * data_size_, labels[order[i]], replace_deleted);
+            size_t now_done = ++done;
+            if (progress && (now_done % report_every == 0 || now_done == n)) {
+                std::unique_lock <std::mutex> lock(progress_lock);
+                progress(done.load(), n);
+            }
+        };
+        for (size_t i = 0; i < num_serial; i++) {
+            insert(i);
+        }
+        // flat graphs insert from the pivots: sample them from the serial seed, and again at the end
+        if (flat_graph_ && num_serial < n)
+            buildPivots();
+        pool.parallelFor(num_serial, n, [&](size_t i, size_t) {
+            insert(i);
+        });
+        if (flat_graph_)
+            buildPivots();
+    }
+
+
+    /*
+    * Order in which addPoints inserts n points: a random subset of num_serial of them (set to what
+    * the serial seed needs, see addPoints) first, then the others in their order.
+    */
+    std::vector<size_t> addPointsOrder(size_t n, size_t &num_serial) {
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        size_t current_count = cur_element_count;
+        size_t serial_seed = ADD_POINTS_SERIAL_SEED;
+        num_serial = std::min(n, serial_seed - std::min(serial_seed, current_count));
+        if (num_serial) {
+            // partial Fisher-Yates shuffle: the serial subset goes first, the rest keeps its order
+            std::default_random_engine rng(level_generator_());
+            for (size_t i = 0; i < num_serial; i++) {
+                std::uniform_int_distribution<size_t> distribution(i, n - 1);
+                std::swap(order[i], order[distribution(rng)]);
+            }
+            std::sort(order.begin() + num_serial, order.end());
+        }
+        return order;
+    }
+
+
+    /*
+    * Inserts n points like addPoints, but in mini-batches that take no lock on the existing elements
+    * one insert at a time. After the serial seed of addPoints, each batch runs in two parallel phases:
+    * first every point of the batch searches the graph as it was before the batch and selects its
+    * links, then every element that gains links from the batch takes them all at once, reselecting
+    * its list by the heuristic once if it overflows. Points of a batch do not link to each other, so
+    * a batch holds at most 1 / ADD_POINTS_BATCH_FRACTION of the elements already indexed (and at
+    * most ADD_POINTS_MAX_BATCH points); batches grow with the index.
+    * Points whose label is already indexed, or repeated in the batch, are updated as addPoint does it
+    * once their batch is in. Replacing deleted elements is not supported here; use addPoints.
+    * A batch that does not fit in max_elements_ throws before any of it is inserted; the batches before
+    * it stay in the index. The mutation gate is taken per point searched or linked (and for the short
+    * serial step that writes and publishes the batch), so saveIndexAsync never waits for a whole batch.
+    */
+    void addPointsBatched(const void *data, const labeltype *labels, size_t n, size_t num_threads = 0,
+                          const std::function<void(size_t, size_t)> &progress = nullptr) {
+        ThreadPool pool(num_threads);
+        addPointsBatched(data, labels, n, pool, progress);
+    }
+
+
+    void addPointsBatched(const void *data, const labeltype *labels, size_t n, ThreadPool &pool,
+                          const std::function<void(size_t, size_t)> &progress = nullptr) {
+        const char *points = (const char *) data;
+        size_t num_serial;
+        std::vector<size_t> order = addPointsOrder(n, num_serial);
+        size_t report_every = std::max<size_t>(1, n / 1000);
+        size_t reported = 0;
+        auto report = [&](size_t done) {
+            if (progress && (done / report_every > reported / report_every || done == n))
+                progress(done, n);
+            reported = done;
+        };
+
+        for (size_t i = 0; i < num_serial; i++) {
+            addPoint(points + order[i] * data_size_, labels[order[i]]);
+            report(i + 1);
+        }
+        if (flat_graph_ && num_serial < n)
+            buildPivots();
+
+        const size_t batch_fraction = ADD_POINTS_BATCH_FRACTION;
+        const size_t max_batch = ADD_POINTS_MAX_BATCH;
+        std::vector<BatchedPoint> batch;
+        std::vector<size_t> updates;
+        for (size_t begin = num_serial; begin < n;) {
+            size_t batch_size = std::min(max_batch, std::max<size_t>(1, cur_element_count / batch_fraction));
+            size_t end = std::min(n, begin + batch_size);
+            uint64_t lsn = 0;
+            batch.clear();
+            updates.clear();
+            {
+                MutationGuard mutation_guard(mutation_gate_);
+                std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+                std::unordered_set<labeltype> batch_labels;
+                for (size_t i = begin; i < end; i++) {
+                    labeltype label = labels[order[i]];
+                    if (label_lookup_.count(label) || !batch_labels.insert(label).second) {
+                        updates.push_back(order[i]);
+                        continue;
+                    }
+                    BatchedPoint point;
+                    point.id = cur_element_count + batch.size();
+                    point.level = flat_graph_ ? 0 : getRandomLevel(mult_);
+                    point.label = label;
+                    point.data_point = points + order[i] * data_size_;
+                    batch.push_back(point);
+                }
+                // the batch must fit before anything is changed
+                if (cur_element_count + batch.size() > max_elements_)
+                    throw std::runtime_error("The number of elements exceeds the specified limit");
+                // the elements are written before their labels and ids are published, so that no
+                // label operation or scan by internal id sees an unwritten element
+                writeBatchedElements(batch);
+                for (const BatchedPoint &point : batch) {
+                    label_lookup_[point.label] = point.id;
+                }
+                cur_element_count += batch.size();
+                // logged before another thread can find the labels, so that their later updates follow
+                for (const BatchedPoint &point : batch) {
+                    lsn = logMutation(WAL_ADD_POINT, 0, point.label, point.data_point);
+                }
+            }
+            int maxlevelcopy = maxlevel_;
+            tableint enterpoint_copy = enterpoint_node_;
+            pool.parallelFor(0, batch.size(), [&](size_t i, size_t) {
+                MutationGuard mutation_guard(mutation_gate_);
+                searchBatchedPoint(batch[i], maxlevelcopy, enterpoint_copy);
+            });
+            connectBatch(batch, pool);
+            // repeated labels are written in the order of the input
+            for (size_t i : updates) {
+                addPoint(points + i * data_size_, labels[i]);
+            }
+            waitWalDurable(lsn);
+            begin = end;
+            report(end);
+        }
+        if (flat_graph_)
+            buildPivots();
+    }
+
+
+    // A point of an addPointsBatched batch, with the links it selected on each of its levels.
+    struct BatchedPoint {
+        tableint id;
+        int level;
+        labeltype label;
+        const char *data_point;
+        std::vector<std::vector<std::pair<dist_t, tableint>>> links;
+    };
+
+
+    /*
+    * Writes the elements of a batch (level, zeroed links, label and vector) into their reserved
+    * slots, with label_lookup_lock held. Throws before any upper level list is left allocated.
+    */
+    void writeBatchedElements(const std::vector<BatchedPoint> &batch) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            const BatchedPoint &point = batch[i];
+            tableint cur_c = point.id;
+            if (point.level) {
+                linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * point.level + 1);
+                if (linkLists_[cur_c] == nullptr) {
+                    for (size_t j = 0; j < i; j++) {
+                        if (batch[j].level)
+                            free(linkLists_[batch[j].id]);
+                    }
+                    throw std::runtime_error("Not enough memory: addPointsBatched failed to allocate linklist");
+                }
+                memset(linkLists_[cur_c], 0, size_links_per_element_ * point.level + 1);
+            }
+            element_levels_[cur_c] = point.level;
+            memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+            memcpy(getExternalLabeLp(cur_c), &point.label, sizeof(labeltype));
+            memcpy(getDataByInternalId(cur_c), point.data_point, data_size_);
+        }
+    }
+
+
+    /*
+    * First phase of a batch: selects the links of point (already written) as addPoint does, from the
+    * entry point and max level the index had before the batch. Writes no link.
+    */
+    void searchBatchedPoint(BatchedPoint &point, int maxlevelcopy, tableint enterpoint_copy) {
+        tableint cur_c = point.id;
+        point.links.assign(std::min(point.level, maxlevelcopy) + 1, std::vector<std::pair<dist_t, tableint>>());
+        if ((signed) enterpoint_copy == -1)
+            return;
+
+        const void *data_point = point.data_point;
+        tableint currObj = enterpoint_copy;
+        if (flat_graph_ && !pivots()->ids.empty()) {
+            dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
+            NoSearchStats stats;
+            searchSeeds(data_point, currObj, curdist, stats);
+        }
+        if (point.level < maxlevelcopy) {
+            dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
+            for (int level = maxlevelcopy; level > point.level; level--) {
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
+                    linklistsizeint *data = get_linklist(currObj, level);
+                    int size = getListCount(data);
+                    tableint *datal = (tableint *) (data + 1);
+                    for (int i = 0; i < size; i++) {
+                        tableint cand = datal[i];
+                        dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
+                        if (d < curdist) {
+                            curdist = d;
+                            currObj = cand;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        bool epDeleted = isMarkedDeleted(enterpoint_copy);
+        for (int level = std::min(point.level, maxlevelcopy); level >= 0; level--) {
+            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates =
+                searchBaseLayer(currObj, data_point, level);
+            if (epDeleted) {
+                top_candidates.emplace(fstdistfunc_(data_point, getDataByInternalId(enterpoint_copy), dist_func_param_), enterpoint_copy);
+                if (top_candidates.size() > ef_construction_)
+                    top_candidates.pop();
+            }
+            std::vector<std::pair<dist_t, tableint>> &links = point.links[level];
+            links.reserve(top_candidates.size());
+            while (!top_candidates.empty()) {
+                if (top_candidates.top().second != cur_c)
+                    links.push_back(top_candidates.top());
+                top_candidates.pop();
+            }
+            std::reverse(links.begin(), links.end());
+            if (neighbor_selection_.extend_candidates)
+                extendCandidates(data_point, cur_c, level, links);
+            selectNeighbors(links, M_);
+            if (!links.empty())
+                currObj = links.front().second;
+        }
+    }
+
+
+    /*
+    * Second phase of a batch: every point writes its own links, then the links back to the points are
+    * grouped by the element and level they go to and each group is added under one lock.
+    */
+    void connectBatch(std::vector<BatchedPoint> &batch, ThreadPool &pool) {
+        struct BackLink {
+            int level;
+            tableint target;
+            tableint source;
+            dist_t dist;
+        };
+        std::vector<BackLink> back_links;
+        for (const BatchedPoint &point : batch) {
+            for (size_t level = 0; level < point.links.size(); level++) {
+                for (const std::pair<dist_t, tableint> &link : point.links[level]) {
+                    back_links.push_back({(int) level, link.second, point.id, link.first});
+                }
+            }
+        }
+        std::sort(back_links.begin(), back_links.end(), [](const BackLink &a, const BackLink &b) {
+            return a.level != b.level ? a.level < b.level : a.target < b.target;
+        });
+        std::vector<size_t> groups;
+        for (size_t i = 0; i < back_links.size(); i++) {
+            if (i == 0 || back_links[i].level != back_links[i - 1].level || back_links[i].target != back_links[i - 1].target)
+                groups.push_back(i);
+        }
+        groups.push_back(back_links.size());
+
+        pool.parallelFor(0, batch.size(), [&](size_t i, size_t) {
+            MutationGuard mutation_guard(mutation_gate_);
+            const BatchedPoint &point = batch[i];
+            std::unique_lock <std::mutex> lock(link_list_locks_[point.id]);
+            for (size_t level = 0; level < point.links.size(); level++) {
+                linklistsizeint *ll_cur = get_linklist_at_level(point.id, level);
+                tableint *data = (tableint *) (ll_cur + 1);
+                for (size_t j = 0; j < point.links[level].size(); j++) {
+                    data[j] = point.links[level][j].second;
+                }
+                setListCount(ll_cur, point.links[level].size());
+            }
+        });
+        pool.parallelFor(0, groups.size() - 1, [&](size_t group, size_t) {
+            MutationGuard mutation_guard(mutation_gate_);
+            const BackLink &first = back_links[groups[group]];
+            size_t Mcurmax = first.level ? maxM_ : maxM0_;
+            std::unique_lock <std::mutex> lock(link_list_locks_[first.target]);
+            linklistsizeint *ll_other = get_linklist_at_level(first.target, first.level);
+            tableint *data = (tableint *) (ll_other + 1);
+            size_t size = getListCount(ll_other);
+            size_t num_new = groups[group + 1] - groups[group];
+            if (size + num_new <= Mcurmax) {
+                for (size_t j = 0; j < num_new; j++) {
+                    data[size + j] = back_links[groups[group] + j].source;
+                }
+                setListCount(ll_other, size + num_new);
+                return;
+            }
+            std::vector<std::pair<dist_t, tableint>> candidates;
+            candidates.reserve(size + num_new);
+            for (size_t j = 0; j < num_new; j++) {
+                candidates.emplace_back(back_links[groups[group] + j].dist, back_links[groups[group] + j].source);
+            }
+            for (size_t j = 0; j < size; j++) {
+                candidates.emplace_back(pairDistance(data[j], first.target, nullptr), data[j]);
+            }
+            std::sort(candidates.begin(), candidates.end(), CompareByFirst());
+            selectNeighbors(candidates, Mcurmax);
+            for (size_t j = 0; j < candidates.size(); j++) {
+                data[j] = candidates[j].second;
+            }
+            setListCount(ll_other, candidates.size());
+        });
+
+        // the highest point of the batch becomes the entry point if it is above the current one
+        MutationGuard mutation_guard(mutation_gate_);
+        std::unique_lock <std::mutex> templock(global);
+        for (const BatchedPoint &point : batch) {
+            if (point.level > maxlevel_ || (signed) enterpoint_node_ == -1) {
+                enterpoint_node_ = point.id;
+                maxlevel_ = point.level;
+            }
+        }
+    }
+
+
+    // Body of addPoint, called with the label lock held.
+    void addPointWithLabelLock(const void *data_point, labeltype label, bool replace_deleted) {
+        if (!replace_deleted) {
+            addPoint(data_point, label, -1);
+            return;
+        }
+        // check if there is vacant place
+        tableint internal_id_replaced;
+        std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
+        bool is_vacant_place = !deleted_elements.empty();
+        if (is_vacant_place) {
+            internal_id_replaced = *deleted_elements.begin();
+            deleted_elements.erase(internal_id_replaced);
+        }
+        lock_deleted_elements.unlock();
+
+        // if there is no vacant place then add or update point
+        // else add point to vacant place
+        if (!is_vacant_place) {
+            addPoint(data_point, label, -1);
+        } else {
+            // we assume that there are no concurrent operations on deleted element
+            labeltype label_replaced = getExternalLabel(internal_id_replaced);
+            setExternalLabel(internal_id_replaced, label);
+
+            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+            label_lookup_.erase(label_replaced);
+            label_lookup_[label] = internal_id_replaced;
+            lock_table.unlock();
+            {
+                std::unique_lock <std::mutex> lock_attributes(attributes_lock_);
+                attributes_.resetElement(internal_id_replaced);
+            }
+
+            unmarkDeletedInternal(internal_id_replaced);
+            updatePoint(data_point, internal_id_replaced, 1.0);
+        }
+    }
+
+
+    void updatePoint(const void *dataPoint, tableint internalId, float updateNeighborProbability) {
+        // update the feature vector associated with existing point with new vector
+        memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
+        {
+            // a pivot gets a new table with its vector replaced; after the copy above, so that a table
+            // being published concurrently has the new vector either way
+            std::unique_lock <std::mutex> lock_pivots(pivots_lock_);
+            const std::vector<tableint> &pivot_ids = pivots_->ids;
+            auto pivot = std::find(pivot_ids.begin(), pivot_ids.end(), internalId);
+            if (pivot != pivot_ids.end()) {
+                std::shared_ptr<PivotTable> table = std::make_shared<PivotTable>(*pivots_);
+                memcpy(table->vectors.data() + (pivot - pivot_ids.begin()) * table->stride, dataPoint, data_size_);
+                pivots_ = table;
+            }
+        }
+
+        int maxLevelCopy = maxlevel_;
+        tableint entryPointCopy = enterpoint_node_;
+        // If point to be updated is entry point and graph just contains single element then just return.
+        if (entryPointCopy == internalId && cur_element_count == 1)
+            return;
+
+        int elemLevel = element_levels_[internalId];
+        std::uniform_real_distribution<float> distribution(0.0, 1.0);
+        for (int layer = 0; layer <= elemLevel; layer++) {
+            std::unordered_set<tableint> sCand;
+            std::unordered_set<tableint> sNeigh;
+            std::vector<tableint> listOneHop = getConnectionsWithLock(internalId, layer);
+            if (listOneHop.size() == 0)
+                continue;
+
+            sCand.insert(internalId);
+
+            for (auto&& elOneHop : listOneHop) {
+                sCand.insert(elOneHop);
+
+                if (distribution(update_probability_generator_) > updateNeighborProbability)
+                    continue;
+
+                sNeigh.insert(elOneHop);
+
+                std::vector<tableint> listTwoHop = getConnectionsWithLock(elOneHop, layer);
+                for (auto&& elTwoHop : listTwoHop) {
+                    sCand.insert(elTwoHop);
+                }
+            }
+
+            for (auto&& neigh : sNeigh) {
+                // if (neigh == internalId)
+                //     continue;
+
+                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+                size_t size = sCand.find(neigh) == sCand.end() ? sCand.size() : sCand.size() - 1;  // sCand guaranteed to have size >= 1
+                size_t elementsToKeep = std::min(ef_construction_, size);
+                for (auto&& cand : sCand) {
+                    if (cand == neigh)
+                        continue;
 
                     dist_t distance = fstdistfunc_(getDataByInternalId(neigh), getDataByInternalId(cand), dist_func_param_);
                     if (candidates.size() < elementsToKeep) {
@@ -994,316 +2637,1648 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     }
                 }
 
-                // Retrieve neighbours using heuristic and set connections.
-                getNeighborsByHeuristic2(candidates, layer == 0 ? maxM0_ : maxM_);
+                // Retrieve neighbours using heuristic and set connections.
+                getNeighborsByHeuristic2(candidates, layer == 0 ? maxM0_ : maxM_);
+
+                {
+                    std::unique_lock <std::mutex> lock(link_list_locks_[neigh]);
+                    linklistsizeint *ll_cur;
+                    ll_cur = get_linklist_at_level(neigh, layer);
+                    size_t candSize = candidates.size();
+                    setListCount(ll_cur, candSize);
+                    tableint *data = (tableint *) (ll_cur + 1);
+                    for (size_t idx = 0; idx < candSize; idx++) {
+                        data[idx] = candidates.top().second;
+                        candidates.pop();
+                    }
+                }
+            }
+        }
+
+        repairConnectionsForUpdate(dataPoint, entryPointCopy, internalId, elemLevel, maxLevelCopy);
+    }
+
+
+    void repairConnectionsForUpdate(
+        const void *dataPoint,
+        tableint entryPointInternalId,
+        tableint dataPointInternalId,
+        int dataPointLevel,
+        int maxLevel) {
+        tableint currObj = entryPointInternalId;
+        if (dataPointLevel < maxLevel) {
+            dist_t curdist = fstdistfunc_(dataPoint, getDataByInternalId(currObj), dist_func_param_);
+            for (int level = maxLevel; level > dataPointLevel; level--) {
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    unsigned int *data;
+                    std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
+                    data = get_linklist_at_level(currObj, level);
+                    int size = getListCount(data);
+                    tableint *datal = (tableint *) (data + 1);
+#ifdef USE_SSE
+                    _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
+#endif
+                    for (int i = 0; i < size; i++) {
+#ifdef USE_SSE
+                        _mm_prefetch(getDataByInternalId(*(datal + i + 1)), _MM_HINT_T0);
+#endif
+                        tableint cand = datal[i];
+                        dist_t d = fstdistfunc_(dataPoint, getDataByInternalId(cand), dist_func_param_);
+                        if (d < curdist) {
+                            curdist = d;
+                            currObj = cand;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (dataPointLevel > maxLevel)
+            throw std::runtime_error("Level of item to be updated cannot be bigger than max level");
+
+        for (int level = dataPointLevel; level >= 0; level--) {
+            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> topCandidates = searchBaseLayer(
+                    currObj, dataPoint, level);
+
+            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> filteredTopCandidates;
+            while (topCandidates.size() > 0) {
+                if (topCandidates.top().second != dataPointInternalId)
+                    filteredTopCandidates.push(topCandidates.top());
+
+                topCandidates.pop();
+            }
+
+            // Since element_levels_ is being used to get `dataPointLevel`, there could be cases where `topCandidates` could just contains entry point itself.
+            // To prevent self loops, the `topCandidates` is filtered and thus can be empty.
+            if (filteredTopCandidates.size() > 0) {
+                bool epDeleted = isMarkedDeleted(entryPointInternalId);
+                if (epDeleted) {
+                    filteredTopCandidates.emplace(fstdistfunc_(dataPoint, getDataByInternalId(entryPointInternalId), dist_func_param_), entryPointInternalId);
+                    if (filteredTopCandidates.size() > ef_construction_)
+                        filteredTopCandidates.pop();
+                }
+
+                currObj = mutuallyConnectNewElement(dataPoint, dataPointInternalId, filteredTopCandidates, level, true);
+            }
+        }
+    }
+
+
+    std::vector<tableint> getConnectionsWithLock(tableint internalId, int level) {
+        std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
+        unsigned int *data = get_linklist_at_level(internalId, level);
+        int size = getListCount(data);
+        std::vector<tableint> result(size);
+        tableint *ll = (tableint *) (data + 1);
+        memcpy(result.data(), ll, size * sizeof(tableint));
+        return result;
+    }
+
+
+    tableint addPoint(const void *data_point, labeltype label, int level) {
+        tableint cur_c = 0;
+        {
+            // Checking if the element with the same label already exists
+            // if so, updating it *instead* of creating a new element.
+            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+            auto search = label_lookup_.find(label);
+            if (search != label_lookup_.end()) {
+                tableint existingInternalId = search->second;
+                if (allow_replace_deleted_) {
+                    if (isMarkedDeleted(existingInternalId)) {
+                        throw std::runtime_error("Can't use addPoint to update deleted elements if replacement of deleted elements is enabled.");
+                    }
+                }
+                lock_table.unlock();
+
+                if (isMarkedDeleted(existingInternalId)) {
+                    unmarkDeletedInternal(existingInternalId);
+                }
+                updatePoint(data_point, existingInternalId, 1.0);
+
+                return existingInternalId;
+            }
+
+            if (cur_element_count >= max_elements_) {
+                throw std::runtime_error("The number of elements exceeds the specified limit");
+            }
+
+            cur_c = cur_element_count;
+            cur_element_count++;
+            label_lookup_[label] = cur_c;
+        }
+
+        std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
+        int curlevel = getRandomLevel(mult_);
+        if (level > -1)
+            curlevel = level;
+        if (flat_graph_)
+            curlevel = 0;
+
+        element_levels_[cur_c] = curlevel;
+
+        std::unique_lock <std::mutex> templock(global);
+        int maxlevelcopy = maxlevel_;
+        if (curlevel <= maxlevelcopy)
+            templock.unlock();
+        tableint currObj = enterpoint_node_;
+        tableint enterpoint_copy = enterpoint_node_;
+
+        memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+
+        // Initialisation of the data and label
+        memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
+        memcpy(getDataByInternalId(cur_c), data_point, data_size_);
+
+        if (curlevel) {
+            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
+            if (linkLists_[cur_c] == nullptr)
+                throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
+            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
+        }
+
+        if ((signed)currObj != -1) {
+            if (flat_graph_ && !pivots()->ids.empty()) {
+                dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
+                NoSearchStats stats;
+                searchSeeds(data_point, currObj, curdist, stats);
+            }
+            if (curlevel < maxlevelcopy) {
+                dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
+                for (int level = maxlevelcopy; level > curlevel; level--) {
+                    bool changed = true;
+                    while (changed) {
+                        changed = false;
+                        unsigned int *data;
+                        std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
+                        data = get_linklist(currObj, level);
+                        int size = getListCount(data);
+
+                        tableint *datal = (tableint *) (data + 1);
+                        for (int i = 0; i < size; i++) {
+                            tableint cand = datal[i];
+                            if (static_cast<int>(cand) < 0 || cand > max_elements_)
+                                throw std::runtime_error("cand error");
+                            dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
+                            if (d < curdist) {
+                                curdist = d;
+                                currObj = cand;
+                                changed = true;
+                            }
+                        }
+                    }
+                }
+            }
+
+            bool epDeleted = isMarkedDeleted(enterpoint_copy);
+            for (int level = std::min(curlevel, maxlevelcopy); level >= 0; level--) {
+                if (level > maxlevelcopy || level < 0)  // possible?
+                    throw std::runtime_error("Level error");
+
+                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates = searchBaseLayer(
+                        currObj, data_point, level);
+                if (epDeleted) {
+                    top_candidates.emplace(fstdistfunc_(data_point, getDataByInternalId(enterpoint_copy), dist_func_param_), enterpoint_copy);
+                    if (top_candidates.size() > ef_construction_)
+                        top_candidates.pop();
+                }
+                currObj = mutuallyConnectNewElement(data_point, cur_c, top_candidates, level, false);
+            }
+        } else {
+            // Do nothing for the first element
+            enterpoint_node_ = 0;
+            maxlevel_ = curlevel;
+        }
+
+        // Releasing lock for the maximum level
+        if (curlevel > maxlevelcopy) {
+            enterpoint_node_ = cur_c;
+            maxlevel_ = curlevel;
+        }
+        return cur_c;
+    }
+
+
+    /*
+    * Builds the upper levels over elements whose level 0 is already in place (e.g. an imported graph)
+    * and that have no upper levels yet; throws otherwise. Every element gets a random level; those
+    * above level 0 are connected on their upper levels the way addPoint does it, on num_threads
+    * threads, each element under the mutation gate. Level 0 is left untouched.
+    */
+    void buildUpperLevels(size_t num_threads = 0) {
+        if (flat_graph_)
+            throw std::runtime_error("A flat graph has no upper levels");
+        if (num_threads == 0)
+            num_threads = std::thread::hardware_concurrency();
+        std::vector<tableint> upper_elements;
+        {
+            MutationGuard mutation_guard(mutation_gate_);
+            size_t element_count = cur_element_count;
+            if (maxlevel_ > 0)
+                throw std::runtime_error("buildUpperLevels needs an index without upper levels");
+            for (size_t i = 0; i < element_count; i++) {
+                if (element_levels_[i] != 0)
+                    throw std::runtime_error("buildUpperLevels needs an index without upper levels");
+            }
+            std::vector<int> levels(element_count);
+            for (size_t i = 0; i < element_count; i++) {
+                levels[i] = getRandomLevel(mult_);
+                if (levels[i] > 0)
+                    upper_elements.push_back(i);
+            }
+            if (upper_elements.empty())
+                return;
+
+            for (size_t i = 0; i < upper_elements.size(); i++) {
+                tableint id = upper_elements[i];
+                linkLists_[id] = (char *) malloc(size_links_per_element_ * levels[id] + 1);
+                if (linkLists_[id] == nullptr) {
+                    for (size_t j = 0; j < i; j++) {
+                        free(linkLists_[upper_elements[j]]);
+                    }
+                    throw std::runtime_error("Not enough memory: buildUpperLevels failed to allocate linklist");
+                }
+                memset(linkLists_[id], 0, size_links_per_element_ * levels[id] + 1);
+            }
+            for (tableint id : upper_elements) {
+                element_levels_[id] = levels[id];
+            }
+
+            // the highest element goes first and becomes the entry point
+            std::iter_swap(upper_elements.begin(), std::max_element(upper_elements.begin(), upper_elements.end(),
+                [this](tableint a, tableint b) { return element_levels_[a] < element_levels_[b]; }));
+            enterpoint_node_ = upper_elements[0];
+            maxlevel_ = element_levels_[upper_elements[0]];
+        }
+        parallelRanges(upper_elements.size() - 1, num_threads, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                MutationGuard mutation_guard(mutation_gate_);
+                connectUpperLevels(upper_elements[i + 1]);
+            }
+        });
+    }
+
+
+    /*
+    * Improves the finished graph, for a better recall at the same ef (or the same recall at a lower one):
+    * every live element searches its own neighborhood again with ef (default ef_construction_), merges
+    * what it finds with its current links, reselects up to maxM0_ of them by the heuristic, and the links
+    * it gains are added back from the other side. Level 0 only, where the elements inserted early have
+    * the poorest neighborhoods. Each element is refined under the mutation gate, so that searches and
+    * inserts go on meanwhile and saveIndexAsync only waits for the elements being refined. Elements
+    * are handed to the pool in chunks of REFINE_GRAPH_CHUNK; progress(done, total) is called after
+    * every chunk.
+    */
+    void refineGraph(size_t ef = 0, size_t iterations = 1, size_t num_threads = 0,
+                     const std::function<void(size_t, size_t)> &progress = nullptr) {
+        ThreadPool pool(num_threads);
+        refineGraph(ef, iterations, pool, progress);
+    }
+
+
+    void refineGraph(size_t ef, size_t iterations, ThreadPool &pool,
+                     const std::function<void(size_t, size_t)> &progress = nullptr) {
+        const size_t chunk = REFINE_GRAPH_CHUNK;
+        size_t element_count = cur_element_count;
+        for (size_t iteration = 0; iteration < iterations; iteration++) {
+            for (size_t begin = 0; begin < element_count; begin += chunk) {
+                size_t end = std::min(element_count, begin + chunk);
+                pool.parallelFor(begin, end, [&](size_t i, size_t) {
+                    MutationGuard mutation_guard(mutation_gate_);
+                    refineElement(i, ef);
+                });
+                if (progress)
+                    progress(iteration * element_count + end, iterations * element_count);
+            }
+        }
+    }
+
+
+    /*
+    * Reselects the level 0 links of internal_id, see refineGraph. The search runs unlocked; the merge
+    * with the current links and the selection run under the lock of internal_id, so that links other
+    * threads add meanwhile (connectBack from inserts) take part instead of being overwritten.
+    */
+    void refineElement(tableint internal_id, size_t ef = 0) {
+        if (isMarkedDeleted(internal_id))
+            return;
+        const void *data_point = getDataByInternalId(internal_id);
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates =
+            searchBaseLayer(internal_id, data_point, 0, ef);
+
+        std::unordered_set<tableint> seen;
+        seen.insert(internal_id);
+        std::vector<std::pair<dist_t, tableint>> candidates;
+        candidates.reserve(top_candidates.size() + maxM0_);
+        while (!top_candidates.empty()) {
+            if (seen.insert(top_candidates.top().second).second)
+                candidates.push_back(top_candidates.top());
+            top_candidates.pop();
+        }
+
+        std::vector<tableint> old_links;
+        {
+            std::unique_lock <std::mutex> lock(link_list_locks_[internal_id]);
+            linklistsizeint *ll_cur = get_linklist0(internal_id);
+            tableint *data = (tableint *) (ll_cur + 1);
+            old_links.assign(data, data + getListCount(ll_cur));
+            for (tableint link : old_links) {
+                if (seen.insert(link).second)
+                    candidates.emplace_back(fstdistfunc_(data_point, getDataByInternalId(link), dist_func_param_), link);
+            }
+            std::sort(candidates.begin(), candidates.end(), CompareByFirst());
+            selectNeighbors(candidates, maxM0_);
+            for (size_t i = 0; i < candidates.size(); i++) {
+                data[i] = candidates[i].second;
+            }
+            setListCount(ll_cur, candidates.size());
+        }
+        for (const std::pair<dist_t, tableint> &candidate : candidates) {
+            if (std::find(old_links.begin(), old_links.end(), candidate.second) == old_links.end())
+                connectBack(candidate.second, internal_id, candidate.first, 0, true);
+        }
+    }
+
+
+    /*
+    * Sets how the links of the elements inserted from now on are selected (see NeighborSelection).
+    * The selection is saved with the index, and a loaded index keeps inserting with it.
+    */
+    void setNeighborSelection(const NeighborSelection &selection) {
+        if (selection.alpha < 1.0f)
+            throw std::runtime_error("Pruning alpha must be at least 1");
+        neighbor_selection_ = selection;
+    }
+
+
+    /*
+    * Builds a flat graph instead of a hierarchy, for high-dimensional data where the upper levels add
+    * little: every element is inserted on level 0 only, no upper level lists (nor their pointer table)
+    * are allocated, and searches start from the pivots (see buildPivots), which addPoints keeps sampled.
+    * alpha > 1 selects neighbors the Vamana way, keeping a candidate unless a selected neighbor is more
+    * than alpha times closer to it than to the new element, which keeps more long links. Distances are
+    * compared as the space returns them (squared for L2Space). Must be called on an empty index.
+    */
+    void setFlatGraph(float alpha = 1.0f) {
+        if (cur_element_count)
+            throw std::runtime_error("setFlatGraph needs an empty index");
+        if (alpha < 1.0f)
+            throw std::runtime_error("Pruning alpha must be at least 1");
+        flat_graph_ = true;
+        neighbor_selection_.alpha = alpha;
+        base_layer_only = true;
+        free(linkLists_);
+        linkLists_ = nullptr;
+    }
+
+
+    // Bytes held by the graph: level 0, the upper level lists and their pointer table, the element
+    // levels, the per-element locks and the pivots. Label map and visited lists are not counted.
+    size_t memoryUsage() const {
+        std::shared_ptr<const PivotTable> pivots = this->pivots();
+        size_t size = sizeof(*this) + max_elements_ * size_data_per_element_ +
+                      element_levels_.capacity() * sizeof(int) + link_list_locks_.capacity() * sizeof(std::mutex) +
+                      pivots->ids.capacity() * sizeof(tableint) + pivots->vectors.capacity();
+        if (linkLists_)
+            size += max_elements_ * sizeof(char *);
+        for (size_t i = 0; i < cur_element_count; i++) {
+            size += getLinkListSize(i) ? getLinkListSize(i) + 1 : 0;
+        }
+        return size;
+    }
+
+
+    /*
+    * Samples num_pivots (default num_seeds) live elements as the pivots a base_layer_only search starts
+    * from: the closest pivot to the query, found by one batched scan over their vectors, is the entry
+    * point of the base layer search. Without pivots the seeds are spread over the internal ids.
+    * The pivots are saved with base_layer_only indexes. Safe to call while the index is searched and
+    * added to: searches keep the pivots they started with.
+    */
+    void buildPivots(size_t num_pivots = 0, size_t random_seed = 100) {
+        MutationGuard mutation_guard(mutation_gate_);
+        if (num_pivots == 0)
+            num_pivots = num_seeds;
+        std::vector<tableint> live;
+        for (size_t i = 0; i < cur_element_count; i++) {
+            if (!isMarkedDeleted(i))
+                live.push_back(i);
+        }
+        num_pivots = std::min(num_pivots, live.size());
+        std::mt19937 rng(random_seed);
+        for (size_t i = 0; i < num_pivots; i++) {
+            std::uniform_int_distribution<size_t> pick(i, live.size() - 1);
+            std::swap(live[i], live[pick(rng)]);
+        }
+        live.resize(num_pivots);
+        std::sort(live.begin(), live.end());
+        publishPivots(live);
+    }
+
+
+    // Uses the given elements as pivots; an empty list goes back to the spread seeds.
+    void setPivots(const std::vector<tableint> &ids) {
+        MutationGuard mutation_guard(mutation_gate_);
+        for (tableint id : ids) {
+            if (id >= cur_element_count)
+                throw std::runtime_error("Pivot is not an element of the index");
+        }
+        publishPivots(ids);
+    }
+
+
+    // The current pivots, unchanged for as long as they are held.
+    std::shared_ptr<const PivotTable> pivots() const {
+        std::unique_lock <std::mutex> lock_pivots(pivots_lock_);
+        return pivots_;
+    }
+
+
+    // Replaces the pivot table. The vectors are copied under pivots_lock_, see updatePoint.
+    void publishPivots(const std::vector<tableint> &ids) {
+        std::shared_ptr<PivotTable> table = std::make_shared<PivotTable>();
+        table->ids = ids;
+        table->stride = (data_size_ + 63) / 64 * 64;
+        table->vectors.assign(ids.size() * table->stride, 0);
+        std::unique_lock <std::mutex> lock_pivots(pivots_lock_);
+        for (size_t i = 0; i < ids.size(); i++) {
+            memcpy(table->vectors.data() + i * table->stride, getDataByInternalId(ids[i]), data_size_);
+        }
+        pivots_ = table;
+    }
+
+
+    // The count pivots closest to query, closest first, e.g. to start several base layer searches.
+    std::vector<std::pair<dist_t, tableint>> nearestPivots(const void *query_data, size_t count) const {
+        std::shared_ptr<const PivotTable> table = this->pivots();
+        std::vector<std::pair<dist_t, tableint>> pivots(table->ids.size());
+        std::vector<dist_t> dists(table->ids.size());
+        pivotDistances(*table, query_data, dists.data());
+        for (size_t i = 0; i < table->ids.size(); i++) {
+            pivots[i] = std::make_pair(dists[i], table->ids[i]);
+        }
+        count = std::min(count, pivots.size());
+        std::partial_sort(pivots.begin(), pivots.begin() + count, pivots.end());
+        pivots.resize(count);
+        return pivots;
+    }
+
+
+    // Inserts cur_c on its levels above 0, as addPoint does it.
+    void connectUpperLevels(tableint cur_c) {
+        std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
+        int curlevel = element_levels_[cur_c];
+        std::unique_lock <std::mutex> templock(global);
+        int maxlevelcopy = maxlevel_;
+        if (curlevel <= maxlevelcopy)
+            templock.unlock();
+        tableint currObj = enterpoint_node_;
+        const void *data_point = getDataByInternalId(cur_c);
+
+        if (curlevel < maxlevelcopy) {
+            dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
+            for (int level = maxlevelcopy; level > curlevel; level--) {
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
+                    linklistsizeint *data = get_linklist(currObj, level);
+                    int size = getListCount(data);
+                    tableint *datal = (tableint *) (data + 1);
+                    for (int i = 0; i < size; i++) {
+                        tableint cand = datal[i];
+                        dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
+                        if (d < curdist) {
+                            curdist = d;
+                            currObj = cand;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        for (int level = std::min(curlevel, maxlevelcopy); level > 0; level--) {
+            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates = searchBaseLayer(
+                    currObj, data_point, level);
+            currObj = mutuallyConnectNewElement(data_point, cur_c, top_candidates, level, false);
+        }
 
-                {
-                    std::unique_lock <std::mutex> lock(link_list_locks_[neigh]);
-                    linklistsizeint *ll_cur;
-                    ll_cur = get_linklist_at_level(neigh, layer);
-                    size_t candSize = candidates.size();
-                    setListCount(ll_cur, candSize);
-                    tableint *data = (tableint *) (ll_cur + 1);
-                    for (size_t idx = 0; idx < candSize; idx++) {
-                        data[idx] = candidates.top().second;
-                        candidates.pop();
+        if (curlevel > maxlevelcopy) {
+            enterpoint_node_ = cur_c;
+            maxlevel_ = curlevel;
+        }
+    }
+
+
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        SearchParams params;
+        params.k = k;
+        params.filter = isIdAllowed;
+        return searchKnn(query_data, params);
+    }
+
+
+    /*
+    * searchKnn without allocations: the search runs in the buffers of ctx and the k nearest, closer
+    * first, are written to labels[0..) and distances[0..). Returns how many were found (at most k).
+    * Results are the same as searchKnnCloserFirst's.
+    */
+    size_t searchKnn(SearchContext<dist_t> &ctx, const void *query_data, size_t k, labeltype *labels,
+                     dist_t *distances, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        SearchParams params;
+        params.k = k;
+        params.filter = isIdAllowed;
+        return searchKnn(ctx, query_data, params, labels, distances);
+    }
+
+
+    // As above, with per-call settings; params.k results at most.
+    size_t searchKnn(SearchContext<dist_t> &ctx, const void *query_data, const SearchParams &params,
+                     labeltype *labels, dist_t *distances) const {
+        if (params.stats) {
+            PerQuerySearchStats stats;
+            size_t found = searchKnn(ctx, query_data, params, labels, distances, stats);
+            *params.stats = stats.stats;
+            return found;
+        }
+        NoSearchStats stats;
+        return searchKnn(ctx, query_data, params, labels, distances, stats);
+    }
+
+
+    /*
+    * As above, instrumented by the StatsPolicy object stats (NoSearchStats, PerQuerySearchStats,
+    * PerThreadSearchStats or any type with the same members); params.stats is not used.
+    */
+    template<typename StatsPolicy>
+    size_t searchKnn(SearchContext<dist_t> &ctx, const void *query_data, const SearchParams &params,
+                     labeltype *labels, dist_t *distances, StatsPolicy &stats) const {
+        stats.begin();
+        if (cur_element_count == 0 || params.k == 0) {
+            stats.end(false);
+            return 0;
+        }
+        size_t ef = std::max(params.ef ? params.ef : ef_, params.k);
+        ctx.reserve(max_elements_, ef);
+        bool stopped_early = searchLayers(ctx.visited, ctx, query_data, ef, params, stats);
+        stats.end(stopped_early);
+
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = ctx.top_candidates;
+        while (top_candidates.size() > params.k) {
+            std::pop_heap(top_candidates.begin(), top_candidates.end(), CompareByFirst());
+            top_candidates.pop_back();
+        }
+        ctx.results.clear();
+        for (const std::pair<dist_t, tableint> &candidate : top_candidates) {
+            ctx.results.emplace_back(candidate.first, getExternalLabel(candidate.second));
+        }
+        std::sort(ctx.results.begin(), ctx.results.end());
+        for (size_t i = 0; i < ctx.results.size(); i++) {
+            distances[i] = ctx.results[i].first;
+            labels[i] = ctx.results[i].second;
+        }
+        return ctx.results.size();
+    }
+
+
+    /*
+    * searchKnn with per-call settings: ef, filter, distance budget, deadline and stats come from params
+    * instead of the index, so concurrent searches can use different values.
+    */
+    std::priority_queue<std::pair<dist_t, labeltype>>
+    searchKnn(const void *query_data, const SearchParams &params) const override {
+        if (params.stats) {
+            PerQuerySearchStats stats;
+            std::priority_queue<std::pair<dist_t, labeltype>> result = searchKnn(query_data, params, stats);
+            *params.stats = stats.stats;
+            return result;
+        }
+        NoSearchStats stats;
+        return searchKnn(query_data, params, stats);
+    }
+
+
+    // As above, instrumented by the StatsPolicy object stats; params.stats is not used.
+    template<typename StatsPolicy>
+    std::priority_queue<std::pair<dist_t, labeltype>>
+    searchKnn(const void *query_data, const SearchParams &params, StatsPolicy &stats) const {
+        std::priority_queue<std::pair<dist_t, labeltype >> result;
+        stats.begin();
+        if (cur_element_count == 0 || params.k == 0) {
+            stats.end(false);
+            return result;
+        }
+        size_t ef = std::max(params.ef ? params.ef : ef_, params.k);
+
+        SearchContext<dist_t> buffers;
+        buffers.reserveCandidates(ef);
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = buffers.top_candidates;
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        bool stopped_early;
+        try {
+            stopped_early = searchLayers(vl, buffers, query_data, ef, params, stats);
+        } catch (...) {
+            visited_list_pool_->releaseVisitedList(vl);
+            throw;
+        }
+        visited_list_pool_->releaseVisitedList(vl);
+        stats.end(stopped_early);
+
+        while (top_candidates.size() > params.k) {
+            std::pop_heap(top_candidates.begin(), top_candidates.end(), CompareByFirst());
+            top_candidates.pop_back();
+        }
+        for (const std::pair<dist_t, tableint> &candidate : top_candidates) {
+            result.emplace(candidate.first, getExternalLabel(candidate.second));
+        }
+        return result;
+    }
+
+
+    /*
+    * Search whose result set and termination are decided by stop_condition instead of ef (range search
+    * with EpsilonSearchStopCondition, per-document results with MultiVectorSearchStopCondition). Returns
+    * what stop_condition.filter_results keeps, closer first.
+    */
+    std::vector<std::pair<dist_t, labeltype>>
+    searchStopConditionClosest(const void *query_data, BaseSearchStopCondition<dist_t> &stop_condition,
+                               BaseFilterFunctor* isIdAllowed = nullptr) const {
+        SearchContext<dist_t> buffers;
+        if (cur_element_count == 0)
+            return buffers.results;
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        try {
+            searchStopCondition(vl, buffers, query_data, stop_condition, isIdAllowed);
+        } catch (...) {
+            visited_list_pool_->releaseVisitedList(vl);
+            throw;
+        }
+        visited_list_pool_->releaseVisitedList(vl);
+        return std::move(buffers.results);
+    }
+
+
+    // As above in the buffers of ctx; the results are ctx.results, valid until its next search.
+    const std::vector<std::pair<dist_t, labeltype>> &
+    searchStopConditionClosest(SearchContext<dist_t> &ctx, const void *query_data,
+                               BaseSearchStopCondition<dist_t> &stop_condition,
+                               BaseFilterFunctor* isIdAllowed = nullptr) const {
+        ctx.results.clear();
+        if (cur_element_count == 0)
+            return ctx.results;
+        ctx.reserve(max_elements_, 0);
+        searchStopCondition(ctx.visited, ctx, query_data, stop_condition, isIdAllowed);
+        return ctx.results;
+    }
+
+
+    // searchStopConditionClosest with the visited list vl, into buffers.results
+    void searchStopCondition(VisitedList *vl, SearchContext<dist_t> &buffers, const void *query_data,
+                             BaseSearchStopCondition<dist_t> &stop_condition, BaseFilterFunctor* isIdAllowed) const {
+        NoSearchStats stats;
+        SearchParams params;
+        params.filter = isIdAllowed;
+        StopConditionRules rules(this, &stop_condition);
+        tableint currObj = searchUpperLevels(query_data, stats);
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = buffers.top_candidates;
+        if (num_deleted_)
+            searchBaseLayerWithRules<true>(vl, top_candidates, buffers.candidate_set, currObj, query_data, rules,
+                                           params, stats);
+        else
+            searchBaseLayerWithRules<false>(vl, top_candidates, buffers.candidate_set, currObj, query_data, rules,
+                                            params, stats);
+
+        std::sort_heap(top_candidates.begin(), top_candidates.end(), CompareByFirst());
+        for (const std::pair<dist_t, tableint> &candidate : top_candidates) {
+            buffers.results.emplace_back(candidate.first, getExternalLabel(candidate.second));
+        }
+        stop_condition.filter_results(buffers.results);
+    }
+
+
+    /*
+    * Upper levels then base layer, leaving the ef closest as a max-heap in buffers.top_candidates (which
+    * needs buffers.reserveCandidates(ef)); returns whether the budget or the deadline stopped the search.
+    */
+    template<typename StatsPolicy>
+    bool searchLayers(VisitedList *vl, SearchContext<dist_t> &buffers, const void *query_data, size_t ef,
+                      const SearchParams &params, StatsPolicy &stats) const {
+        FilterStrategy strategy = params.filter ? planFilteredSearch(params, ef) : FILTER_GRAPH;
+        if (strategy == FILTER_BRUTE_FORCE)
+            return searchAllowedBruteForce(buffers.top_candidates, query_data, ef, params, stats);
+        tableint currObj = searchUpperLevels(query_data, stats);
+        if (strategy == FILTER_TWO_HOP) {
+            if (num_deleted_)
+                return searchBaseLayerTwoHop<true>(vl, buffers.top_candidates, buffers.candidate_set, currObj,
+                                                   query_data, ef, params, stats);
+            return searchBaseLayerTwoHop<false>(vl, buffers.top_candidates, buffers.candidate_set, currObj,
+                                                query_data, ef, params, stats);
+        }
+        if (num_deleted_)
+            return searchBaseLayerST<true>(vl, buffers.top_candidates, buffers.candidate_set, currObj, query_data, ef,
+                                           params, stats);
+        if (params.filter)
+            return searchBaseLayerST<false>(vl, buffers.top_candidates, buffers.candidate_set, currObj, query_data,
+                                            ef, params, stats);
+
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = buffers.top_candidates;
+        top_candidates.clear();
+        bool stopped_early;
+        size_t sorted_ef = SearchContext<dist_t>::SORTED_BUFFER_MAX_EF;
+        if (ef <= sorted_ef) {
+            stopped_early = searchBaseLayerBounded(vl, buffers.sorted_top, buffers.sorted_candidates, currObj,
+                                                   query_data, ef, params, stats);
+            // closest last: a descending array is a valid max-heap
+            for (size_t i = buffers.sorted_top.size(); i > 0; i--) {
+                top_candidates.emplace_back(buffers.sorted_top.dist(i - 1), buffers.sorted_top.id(i - 1));
+            }
+        } else {
+            stopped_early = searchBaseLayerBounded(vl, buffers.heap_top, buffers.heap_candidates, currObj,
+                                                   query_data, ef, params, stats);
+            for (size_t i = 0; i < buffers.heap_top.size(); i++) {
+                top_candidates.emplace_back(buffers.heap_top.dist(i), buffers.heap_top.id(i));
+            }
+            std::make_heap(top_candidates.begin(), top_candidates.end(), CompareByFirst());
+        }
+        return stopped_early;
+    }
+
+
+    /*
+    * searchBaseLayerST without filter and deletions, on candidate lists (SortedCandidateBuffer or
+    * MinMaxCandidateHeap) bounded to ef elements. Every candidate then also enters top, so one that drops out
+    * of the ef closest candidates is beyond lowerBound and would never be expanded: the candidate list can
+    * drop its farthest element instead of growing. Expands the same nodes in the same order as
+    * searchBaseLayerST, except for the order among candidates at exactly equal distances.
+    */
+    template<typename CandidateList, typename StatsPolicy>
+    bool searchBaseLayerBounded(VisitedList *vl, CandidateList &top, CandidateList &candidates, tableint ep_id,
+                                const void *data_point, size_t ef, const SearchParams &params,
+                                StatsPolicy &stats) const {
+        size_t distance_computations = 0;
+        size_t expansions = 0;
+        vl->reset();
+        vl_type *visited_array = vl->mass;
+        vl_type visited_array_tag = vl->curV;
+
+        top.clear();
+        candidates.clear();
+        dist_t lowerBound = fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
+        distance_computations++;
+        top.push(lowerBound, ep_id);
+        candidates.push(lowerBound, ep_id);
+        visited_array[ep_id] = visited_array_tag;
+
+        bool stopped_early = false;
+        while (!candidates.empty()) {
+            if (candidates.minDist() > lowerBound)
+                break;
+            if (searchBudgetSpent(params, distance_computations, expansions)) {
+                stopped_early = true;
+                break;
+            }
+            tableint current_node_id = candidates.minId();
+            candidates.popMin();
+
+            int *data = (int *) get_linklist0(current_node_id);
+            size_t size = getListCount((linklistsizeint*)data);
+            stats.addHop();
+
+#ifdef USE_SSE
+            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
+            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
+            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
+            _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
+#endif
+
+            for (size_t j = 1; j <= size; j++) {
+                int candidate_id = *(data + j);
+#ifdef USE_SSE
+                _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
+                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
+                                _MM_HINT_T0);
+#endif
+                if (visited_array[candidate_id] == visited_array_tag)
+                    continue;
+                visited_array[candidate_id] = visited_array_tag;
+
+                dist_t dist = fstdistfunc_(data_point, getDataByInternalId(candidate_id), dist_func_param_);
+                distance_computations++;
+                if (top.size() < ef || lowerBound > dist) {
+                    candidates.pushBounded(dist, candidate_id, ef);
+#ifdef USE_SSE
+                    _mm_prefetch(data_level0_memory_ + candidates.minId() * size_data_per_element_ + offsetLevel0_,
+                                 _MM_HINT_T0);
+#endif
+                    top.pushBounded(dist, candidate_id, ef);
+                    lowerBound = top.maxDist();
+                }
+            }
+        }
+        stats.addDistances(distance_computations);
+        stats.addCompares(top.compares + candidates.compares);
+        return stopped_early;
+    }
+
+
+    /*
+    * Strategy for a search with params.filter: params.filter_strategy unless FILTER_AUTO. Otherwise the
+    * cheapest by distance computations, with s the allowed fraction: brute force s * count, the plain
+    * graph search about ef * maxM0_ / s (it expands 1 / s elements per allowed one), and two-hop
+    * filter_two_hop_cost * ef * maxM0_ from filter_two_hop_min_selectivity up. The selectivity of a filter
+    * bound to this index comes from the count its bitmap keeps, so planning costs no pass over it. Without
+    * one or a params.filter_selectivity it is unknown and the plain graph search is used.
+    */
+    FilterStrategy planFilteredSearch(const SearchParams &params, size_t ef) const {
+        if (params.filter_strategy != FILTER_AUTO)
+            return params.filter_strategy;
+        size_t count = cur_element_count;
+        float selectivity = params.filter_selectivity;
+        const Bitmap *bitmap = params.filter->bitmap(this);
+        if (bitmap)
+            selectivity = count ? std::min(1.0f, (float) bitmap->count() / count) : 0.0f;
+        if (selectivity < 0)
+            return FILTER_GRAPH;
+
+        double search_cost = (double) ef * maxM0_;
+        double brute_force_cost = (double) selectivity * count;
+        double graph_cost = search_cost / std::max(selectivity, 1e-6f);
+        double two_hop_cost = filter_two_hop_cost * search_cost;
+        bool two_hop = selectivity >= filter_two_hop_min_selectivity && two_hop_cost < graph_cost;
+        if (brute_force_cost <= graph_cost && (!two_hop || brute_force_cost <= two_hop_cost))
+            return FILTER_BRUTE_FORCE;
+        return two_hop ? FILTER_TWO_HOP : FILTER_GRAPH;
+    }
+
+
+    /*
+    * Exact search over the elements params.filter allows, leaving the ef closest as a max-heap in
+    * top_candidates. A filter bound to this index is walked by the set internal ids of its bitmap, with
+    * no label lookup; other filters are asked for every element. Distances are computed in blocks with
+    * the batched kernel when the space has one.
+    */
+    template<typename StatsPolicy>
+    bool searchAllowedBruteForce(std::vector<std::pair<dist_t, tableint>> &top_candidates, const void *query_data,
+                                 size_t ef, const SearchParams &params, StatsPolicy &stats) const {
+        const size_t block = 128;  // room for the allowed ids of two bitmap words
+        tableint ids[block];
+        const char *vectors[block];
+        dist_t dists[block];
+        size_t count = 0;
+        size_t distance_computations = 0;
+        size_t flushes = 0;
+        bool stopped_early = false;
+        StatsCompareByFirst<StatsPolicy> compare(stats);
+        top_candidates.clear();
+
+        // distances of the collected ids into top_candidates; true once the budget or the deadline is hit
+        auto flush = [&]() {
+            computeDistances(query_data, ids, count, vectors, dists);
+            distance_computations += count;
+            for (size_t i = 0; i < count; i++) {
+                if (top_candidates.size() < ef || dists[i] < top_candidates.front().first) {
+                    top_candidates.emplace_back(dists[i], ids[i]);
+                    std::push_heap(top_candidates.begin(), top_candidates.end(), compare);
+                    if (top_candidates.size() > ef) {
+                        std::pop_heap(top_candidates.begin(), top_candidates.end(), compare);
+                        top_candidates.pop_back();
                     }
                 }
             }
+            count = 0;
+            stopped_early = searchBudgetSpent(params, distance_computations, flushes);
+            return stopped_early;
+        };
+
+        const Bitmap *bitmap = params.filter->bitmap(this);
+        if (bitmap) {
+            size_t element_count = cur_element_count;
+            const uint64_t *words = bitmap->words();
+            size_t num_words = std::min(bitmap->numWords(), (element_count + 63) / 64);
+            for (size_t w = 0; w < num_words; w++) {
+                uint64_t word = words[w];
+                while (word) {
+                    tableint id = w * 64 + countTrailingZeros64(word);
+                    word &= word - 1;
+                    if (id < element_count && !isMarkedDeleted(id))
+                        ids[count++] = id;
+                }
+                if (count > block - 64 && flush())
+                    break;
+            }
+        } else {
+            FilterCheck isIdAllowed(params.filter);
+            size_t element_count = cur_element_count;
+            for (tableint id = 0; id < element_count; id++) {
+                if (!isMarkedDeleted(id) && isIdAllowed(getExternalLabel(id))) {
+                    ids[count++] = id;
+                    if (count == block && flush())
+                        break;
+                }
+            }
         }
+        if (count && !stopped_early)
+            flush();
+        stats.addDistances(distance_computations);
+        return stopped_early;
+    }
 
-        repairConnectionsForUpdate(dataPoint, entryPointCopy, internalId, elemLevel, maxLevelCopy);
+
+    /*
+    * Filtered base layer search in the style of ACORN: only allowed elements become candidates, and a
+    * disallowed neighbor is looked through, its own allowed neighbors being considered in its place, so
+    * the search stays connected when most of the graph is filtered out. Deleted elements count as
+    * disallowed. Same stopping rules and results layout as searchBaseLayerST.
+    */
+    template <bool has_deletions, typename StatsPolicy>
+    bool searchBaseLayerTwoHop(VisitedList *vl, std::vector<std::pair<dist_t, tableint>> &top_candidates,
+                               std::vector<std::pair<dist_t, tableint>> &candidate_set, tableint ep_id,
+                               const void *data_point, size_t ef, const SearchParams &params,
+                               StatsPolicy &stats) const {
+        FilterCheck isIdAllowed(params.filter, this);
+        size_t distance_computations = 0;
+        size_t expansions = 0;
+        vl->reset();
+        vl_type *visited_array = vl->mass;
+        vl_type visited_array_tag = vl->curV;
+
+        top_candidates.clear();
+        candidate_set.clear();
+        StatsCompareByFirst<StatsPolicy> compare(stats);
+        dist_t lowerBound = std::numeric_limits<dist_t>::max();
+
+        auto isAllowed = [&](tableint id) {
+            return (!has_deletions || !isMarkedDeleted(id)) && filterAllows(isIdAllowed, id);
+        };
+        auto consider = [&](tableint id) {
+            dist_t dist = fstdistfunc_(data_point, getDataByInternalId(id), dist_func_param_);
+            distance_computations++;
+            if (top_candidates.size() < ef || lowerBound > dist) {
+                candidate_set.emplace_back(-dist, id);
+                std::push_heap(candidate_set.begin(), candidate_set.end(), compare);
+                top_candidates.emplace_back(dist, id);
+                std::push_heap(top_candidates.begin(), top_candidates.end(), compare);
+                if (top_candidates.size() > ef) {
+                    std::pop_heap(top_candidates.begin(), top_candidates.end(), compare);
+                    top_candidates.pop_back();
+                }
+                lowerBound = top_candidates.front().first;
+            }
+        };
+
+        visited_array[ep_id] = visited_array_tag;
+        if (isAllowed(ep_id))
+            consider(ep_id);
+        else
+            candidate_set.emplace_back(-lowerBound, ep_id);
+
+        bool stopped_early = false;
+        while (!candidate_set.empty()) {
+            std::pair<dist_t, tableint> current_node_pair = candidate_set.front();
+            if ((-current_node_pair.first) > lowerBound && top_candidates.size() == ef)
+                break;
+            if (searchBudgetSpent(params, distance_computations, expansions)) {
+                stopped_early = true;
+                break;
+            }
+            std::pop_heap(candidate_set.begin(), candidate_set.end(), compare);
+            candidate_set.pop_back();
+
+            int *data = (int *) get_linklist0(current_node_pair.second);
+            size_t size = getListCount((linklistsizeint*)data);
+            stats.addHop();
+#ifdef USE_SSE
+            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
+            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
+#endif
+            // the allowed direct neighbors first, then those two hops away, up to maxM0_ in all
+            size_t gathered = 0;
+            for (size_t j = 1; j <= size; j++) {
+                tableint neighbor_id = *(data + j);
+#ifdef USE_SSE
+                if (j < size)
+                    _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
+                                 _MM_HINT_T0);
+#endif
+                if (visited_array[neighbor_id] == visited_array_tag || !isAllowed(neighbor_id))
+                    continue;
+                visited_array[neighbor_id] = visited_array_tag;
+                consider(neighbor_id);
+                gathered++;
+            }
+            for (size_t j = 1; j <= size && gathered < maxM0_; j++) {
+                tableint neighbor_id = *(data + j);
+                if (visited_array[neighbor_id] == visited_array_tag)
+                    continue;
+                int *hop_data = (int *) get_linklist0(neighbor_id);
+                size_t hop_size = getListCount((linklistsizeint*)hop_data);
+                size_t h = 1;
+                for (; h <= hop_size && gathered < maxM0_; h++) {
+                    tableint hop_id = *(hop_data + h);
+                    // disallowed ones stay unvisited, to be looked through when reached directly
+                    if (visited_array[hop_id] == visited_array_tag || !isAllowed(hop_id))
+                        continue;
+                    visited_array[hop_id] = visited_array_tag;
+                    consider(hop_id);
+                    gathered++;
+                }
+                // visited once all its hops were looked through; a scan cut short by the cap is done
+                // again when the neighbor is reached from another element
+                if (h > hop_size)
+                    visited_array[neighbor_id] = visited_array_tag;
+            }
+        }
+        stats.addDistances(distance_computations);
+        return stopped_early;
+    }
+
+
+    // Distances from query to every pivot, in pivots.ids order.
+    void pivotDistances(const PivotTable &pivots, const void *query_data, dist_t *dists) const {
+        const size_t block = 64;
+        const char *vectors[block];
+        for (size_t i = 0; i < pivots.ids.size(); i += block) {
+            size_t n = std::min(block, pivots.ids.size() - i);
+            for (size_t j = 0; j < n; j++) {
+                vectors[j] = pivots.vectors.data() + (i + j) * pivots.stride;
+            }
+            if (fstdistfunc_batch_) {
+                fstdistfunc_batch_(query_data, (const void *const *) vectors, n, dists + i, dist_func_param_);
+            } else {
+                for (size_t j = 0; j < n; j++) {
+                    dists[i + j] = fstdistfunc_(query_data, vectors[j], dist_func_param_);
+                }
+            }
+        }
+    }
+
+
+    // Moves node to the closest pivot (or spread seed without pivots) if it is closer to the query.
+    template<typename StatsPolicy>
+    void searchSeeds(const void *query_data, tableint &node, dist_t &node_dist, StatsPolicy &stats) const {
+        std::shared_ptr<const PivotTable> pivots = this->pivots();
+        size_t num_pivots = pivots->ids.size();
+        if (num_pivots) {
+            dist_t dists[256];
+            std::vector<dist_t> more_dists(num_pivots > 256 ? num_pivots : 0);
+            dist_t *pivot_dists = num_pivots > 256 ? more_dists.data() : dists;
+            pivotDistances(*pivots, query_data, pivot_dists);
+            for (size_t i = 0; i < num_pivots; i++) {
+                if (pivot_dists[i] < node_dist) {
+                    node_dist = pivot_dists[i];
+                    node = pivots->ids[i];
+                }
+            }
+            stats.addDistances(num_pivots);
+            return;
+        }
+        size_t element_count = cur_element_count;
+        size_t num = std::min<size_t>(num_seeds, element_count);
+        for (size_t i = 0; i < num; i++) {
+            tableint obj = i * (element_count / num);
+            dist_t dist = fstdistfunc_(query_data, getDataByInternalId(obj), dist_func_param_);
+            if (dist < node_dist) {
+                node_dist = dist;
+                node = obj;
+            }
+        }
+        stats.addDistances(num);
+    }
+
+
+    // Greedy descent through the upper levels (or the seeds with base_layer_only) to the base layer entry.
+    template<typename StatsPolicy>
+    tableint searchUpperLevels(const void *query_data, StatsPolicy &stats) const {
+        tableint currObj = enterpoint_node_;
+        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        stats.addDistances(1);
+        if (base_layer_only) {
+            searchSeeds(query_data, currObj, curdist, stats);
+            return currObj;
+        }
+        for (int level = maxlevel_; level > 0; level--) {
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                unsigned int *data = (unsigned int *) get_linklist(currObj, level);
+                int size = getListCount(data);
+                stats.addHop();
+                stats.addDistances(size);
+
+                tableint *datal = (tableint *) (data + 1);
+                for (int i = 0; i < size; i++) {
+                    tableint cand = datal[i];
+                    if (static_cast<int>(cand) < 0 || cand > max_elements_)
+                        throw std::runtime_error("cand error");
+                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+                    if (d < curdist) {
+                        curdist = d;
+                        currObj = cand;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        return currObj;
+    }
+
+
+    /*
+    * searchBaseLayerST on caller buffers (heaps kept with std::push_heap/pop_heap), leaving the ef closest
+    * in top_candidates. Stops expanding once params.max_distance_computations base layer distances
+    * are spent or params.deadline has passed (checked every 16 expansions), and returns whether it did.
+    */
+    template <bool has_deletions, typename StatsPolicy>
+    bool searchBaseLayerST(VisitedList *vl, std::vector<std::pair<dist_t, tableint>> &top_candidates,
+                           std::vector<std::pair<dist_t, tableint>> &candidate_set, tableint ep_id,
+                           const void *data_point, size_t ef, const SearchParams &params,
+                           StatsPolicy &stats) const {
+        EfStopRules rules(ef, !params.filter && !has_deletions);
+        return searchBaseLayerWithRules<has_deletions>(vl, top_candidates, candidate_set, ep_id, data_point, rules,
+                                                       params, stats);
     }
 
 
-    void repairConnectionsForUpdate(
-        const void *dataPoint,
-        tableint entryPointInternalId,
-        tableint dataPointInternalId,
-        int dataPointLevel,
-        int maxLevel) {
-        tableint currObj = entryPointInternalId;
-        if (dataPointLevel < maxLevel) {
-            dist_t curdist = fstdistfunc_(dataPoint, getDataByInternalId(currObj), dist_func_param_);
-            for (int level = maxLevel; level > dataPointLevel; level--) {
-                bool changed = true;
-                while (changed) {
-                    changed = false;
-                    unsigned int *data;
-                    std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
-                    data = get_linklist_at_level(currObj, level);
-                    int size = getListCount(data);
-                    tableint *datal = (tableint *) (data + 1);
+    /*
+    * The searchBaseLayerST loop with the stop, admission and eviction decisions taken by rules
+    * (EfStopRules, StopConditionRules): top_candidates keeps what the rules let in, as a max-heap.
+    */
+    template <bool has_deletions, typename StopRules, typename StatsPolicy>
+    bool searchBaseLayerWithRules(VisitedList *vl, std::vector<std::pair<dist_t, tableint>> &top_candidates,
+                                  std::vector<std::pair<dist_t, tableint>> &candidate_set, tableint ep_id,
+                                  const void *data_point, StopRules &rules, const SearchParams &params,
+                                  StatsPolicy &stats) const {
+        FilterCheck isIdAllowed(params.filter, this);
+        size_t distance_computations = 0;
+        size_t expansions = 0;
+        vl->reset();
+        vl_type *visited_array = vl->mass;
+        vl_type visited_array_tag = vl->curV;
+
+        top_candidates.clear();
+        candidate_set.clear();
+        StatsCompareByFirst<StatsPolicy> compare(stats);
+
+        dist_t lowerBound;
+        if ((!has_deletions || !isMarkedDeleted(ep_id)) && filterAllows(isIdAllowed, ep_id)) {
+            dist_t dist = fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
+            distance_computations++;
+            lowerBound = dist;
+            top_candidates.emplace_back(dist, ep_id);
+            rules.added(ep_id, dist);
+            candidate_set.emplace_back(-dist, ep_id);
+        } else {
+            lowerBound = std::numeric_limits<dist_t>::max();
+            candidate_set.emplace_back(-lowerBound, ep_id);
+        }
+
+        visited_array[ep_id] = visited_array_tag;
+
+        bool stopped_early = false;
+        while (!candidate_set.empty()) {
+            std::pair<dist_t, tableint> current_node_pair = candidate_set.front();
+
+            if (rules.shouldStop(-current_node_pair.first, lowerBound, top_candidates.size())) {
+                break;
+            }
+            if (searchBudgetSpent(params, distance_computations, expansions)) {
+                stopped_early = true;
+                break;
+            }
+            std::pop_heap(candidate_set.begin(), candidate_set.end(), compare);
+            candidate_set.pop_back();
+
+            tableint current_node_id = current_node_pair.second;
+            int *data = (int *) get_linklist0(current_node_id);
+            size_t size = getListCount((linklistsizeint*)data);
+            stats.addHop();
+
+#ifdef USE_SSE
+            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
+            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
+            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
+            _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
+#endif
+
+            for (size_t j = 1; j <= size; j++) {
+                int candidate_id = *(data + j);
 #ifdef USE_SSE
-                    _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
+                _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
+                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
+                                _MM_HINT_T0);
 #endif
-                    for (int i = 0; i < size; i++) {
+                if (!(visited_array[candidate_id] == visited_array_tag)) {
+                    visited_array[candidate_id] = visited_array_tag;
+
+                    char *currObj1 = (getDataByInternalId(candidate_id));
+                    dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+                    distance_computations++;
+
+                    if (rules.shouldConsider(dist, lowerBound, top_candidates.size())) {
+                        candidate_set.emplace_back(-dist, candidate_id);
+                        std::push_heap(candidate_set.begin(), candidate_set.end(), compare);
 #ifdef USE_SSE
-                        _mm_prefetch(getDataByInternalId(*(datal + i + 1)), _MM_HINT_T0);
+                        _mm_prefetch(data_level0_memory_ + candidate_set.front().second * size_data_per_element_ +
+                                        offsetLevel0_,
+                                        _MM_HINT_T0);
 #endif
-                        tableint cand = datal[i];
-                        dist_t d = fstdistfunc_(dataPoint, getDataByInternalId(cand), dist_func_param_);
-                        if (d < curdist) {
-                            curdist = d;
-                            currObj = cand;
-                            changed = true;
+
+                        if ((!has_deletions || !isMarkedDeleted(candidate_id)) && filterAllows(isIdAllowed, candidate_id)) {
+                            top_candidates.emplace_back(dist, candidate_id);
+                            std::push_heap(top_candidates.begin(), top_candidates.end(), compare);
+                            rules.added(candidate_id, dist);
+                        }
+
+                        while (rules.shouldRemoveExtra(top_candidates.size())) {
+                            std::pop_heap(top_candidates.begin(), top_candidates.end(), compare);
+                            rules.removed(top_candidates.back().second, top_candidates.back().first);
+                            top_candidates.pop_back();
                         }
+
+                        if (!top_candidates.empty())
+                            lowerBound = top_candidates.front().first;
                     }
                 }
             }
         }
+        stats.addDistances(distance_computations);
+        return stopped_early;
+    }
 
-        if (dataPointLevel > maxLevel)
-            throw std::runtime_error("Level of item to be updated cannot be bigger than max level");
-
-        for (int level = dataPointLevel; level >= 0; level--) {
-            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> topCandidates = searchBaseLayer(
-                    currObj, dataPoint, level);
-
-            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> filteredTopCandidates;
-            while (topCandidates.size() > 0) {
-                if (topCandidates.top().second != dataPointInternalId)
-                    filteredTopCandidates.push(topCandidates.top());
 
-                topCandidates.pop();
-            }
+    /*
+    * Searches n queries stored back to back (data_size_ bytes each) on the calling thread and writes the
+    * k nearest of query i, closer first, to labels[i * k ...] and distances[i * k ...], with the same
+    * results as searchKnn. BATCH_SEARCH_GROUP queries are advanced together, one node expansion at a time:
+    * a query prefetches the link list or the neighbor vectors it needs next and yields to the others, so
+    * its cache misses overlap with their distance computations.
+    * Queries that find fewer than k results are padded with label -1 and the largest distance; returns
+    * how many queries did.
+    */
+    size_t searchKnnBatch(const void *queries, size_t n, size_t k, labeltype *labels, dist_t *distances,
+                          BaseFilterFunctor* isIdAllowed = nullptr) const {
+        SearchParams params;
+        params.k = k;
+        params.filter = isIdAllowed;
+        return searchKnnGroup((const char *) queries, data_size_, n, labels, distances, params);
+    }
 
-            // Since element_levels_ is being used to get `dataPointLevel`, there could be cases where `topCandidates` could just contains entry point itself.
-            // To prevent self loops, the `topCandidates` is filtered and thus can be empty.
-            if (filteredTopCandidates.size() > 0) {
-                bool epDeleted = isMarkedDeleted(entryPointInternalId);
-                if (epDeleted) {
-                    filteredTopCandidates.emplace(fstdistfunc_(dataPoint, getDataByInternalId(entryPointInternalId), dist_func_param_), entryPointInternalId);
-                    if (filteredTopCandidates.size() > ef_construction_)
-                        filteredTopCandidates.pop();
-                }
 
-                currObj = mutuallyConnectNewElement(dataPoint, dataPointInternalId, filteredTopCandidates, level, true);
-            }
-        }
+    // As above with per-call settings; params.k results per query, params.stats (if set) gets n entries.
+    size_t searchKnnBatch(const void *queries, size_t n, labeltype *labels, dist_t *distances,
+                          const SearchParams &params) const {
+        return searchKnnGroup((const char *) queries, data_size_, n, labels, distances, params);
     }
 
 
-    std::vector<tableint> getConnectionsWithLock(tableint internalId, int level) {
-        std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
-        unsigned int *data = get_linklist_at_level(internalId, level);
-        int size = getListCount(data);
-        std::vector<tableint> result(size);
-        tableint *ll = (tableint *) (data + 1);
-        memcpy(result.data(), ll, size * sizeof(tableint));
-        return result;
+    using AlgorithmInterface<dist_t>::searchKnnParallel;
+
+    // Runs searchKnnBatch on groups of queries on the pool.
+    void searchKnnParallel(const void *queries, size_t n, size_t query_size, labeltype *labels,
+                           dist_t *distances, ThreadPool &pool, const SearchParams &params) const override {
+        size_t k = params.k;
+        size_t group_size = BATCH_SEARCH_GROUP;
+        size_t num_groups = (n + group_size - 1) / group_size;
+        pool.parallelFor(0, num_groups, [&](size_t group, size_t) {
+            size_t begin = group * group_size;
+            size_t count = std::min(group_size, n - begin);
+            SearchParams group_params = params;
+            if (params.stats)
+                group_params.stats = params.stats + begin;
+            if (searchKnnGroup((const char *) queries + begin * query_size, query_size, count,
+                               labels + begin * k, distances + begin * k, group_params))
+                throw std::runtime_error(
+                    "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
+        });
     }
 
 
-    tableint addPoint(const void *data_point, labeltype label, int level) {
-        tableint cur_c = 0;
-        {
-            // Checking if the element with the same label already exists
-            // if so, updating it *instead* of creating a new element.
-            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-            auto search = label_lookup_.find(label);
-            if (search != label_lookup_.end()) {
-                tableint existingInternalId = search->second;
-                if (allow_replace_deleted_) {
-                    if (isMarkedDeleted(existingInternalId)) {
-                        throw std::runtime_error("Can't use addPoint to update deleted elements if replacement of deleted elements is enabled.");
-                    }
-                }
-                lock_table.unlock();
+    // State of one query in searchKnnGroup
+    template<typename StatsPolicy>
+    struct BatchQuery {
+        enum Stage { LIST, NEIGHBORS, DISTANCES, DONE };
+
+        const void *query;
+        size_t row;
+        Stage stage;
+        int level;
+        tableint node;  // element whose neighbors are expanded next
+        dist_t node_dist;  // upper levels: distance to node
+        bool has_deletions;
+        VisitedList *visited{nullptr};
+        std::vector<std::pair<dist_t, tableint>> top_candidates;  // heaps, as in searchBaseLayerST
+        std::vector<std::pair<dist_t, tableint>> candidate_set;
+        dist_t lower_bound;
+        size_t ef;
+        std::vector<tableint> neighbors;
+        std::vector<const char *> vectors;
+        std::vector<dist_t> neighbor_dists;
+        StatsPolicy stats;
+        size_t distance_computations;  // base layer, for the budget
+        size_t expansions;  // base layer, for the deadline checks
+        bool stopped_early;
+    };
 
-                if (isMarkedDeleted(existingInternalId)) {
-                    unmarkDeletedInternal(existingInternalId);
-                }
-                updatePoint(data_point, existingInternalId, 1.0);
 
-                return existingInternalId;
-            }
+    /*
+    * Whether a search has to stop before its next step: params.max_distance_computations distances are
+    * spent, or params.deadline has passed. The clock is read on every 16th call only; steps counts
+    * the calls.
+    */
+    static bool searchBudgetSpent(const SearchParams &params, size_t distance_computations, size_t &steps) {
+        if (params.max_distance_computations && distance_computations >= params.max_distance_computations)
+            return true;
+        return params.deadline != std::chrono::steady_clock::time_point::max() && (steps++ & 15) == 0 &&
+               std::chrono::steady_clock::now() >= params.deadline;
+    }
 
-            if (cur_element_count >= max_elements_) {
-                throw std::runtime_error("The number of elements exceeds the specified limit");
-            }
 
-            cur_c = cur_element_count;
-            cur_element_count++;
-            label_lookup_[label] = cur_c;
+    // Distances from query to the vectors of ids[0..count), through the space's batched kernel if it has one.
+    void computeDistances(const void *query, const tableint *ids, size_t count, const char **vectors,
+                          dist_t *dists) const {
+        for (size_t i = 0; i < count; i++) {
+            vectors[i] = getDataByInternalId(ids[i]);
         }
+        if (fstdistfunc_batch_) {
+            fstdistfunc_batch_(query, (const void *const *) vectors, count, dists, dist_func_param_);
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                dists[i] = fstdistfunc_(query, vectors[i], dist_func_param_);
+            }
+        }
+    }
 
-        std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
-        int curlevel = getRandomLevel(mult_);
-        if (level > -1)
-            curlevel = level;
-
-        element_levels_[cur_c] = curlevel;
 
-        std::unique_lock <std::mutex> templock(global);
-        int maxlevelcopy = maxlevel_;
-        if (curlevel <= maxlevelcopy)
-            templock.unlock();
-        tableint currObj = enterpoint_node_;
-        tableint enterpoint_copy = enterpoint_node_;
+    // Picks the next base layer element to expand, as in searchBaseLayerST.
+    template<typename StatsPolicy>
+    void nextBaseNode(BatchQuery<StatsPolicy> &q, const SearchParams &params) const {
+        StatsCompareByFirst<StatsPolicy> compare(q.stats);
+        while (!q.candidate_set.empty()) {
+            std::pair<dist_t, tableint> current_node_pair = q.candidate_set.front();
+            if ((-current_node_pair.first) > q.lower_bound &&
+                (q.top_candidates.size() == q.ef || (!params.filter && !q.has_deletions))) {
+                break;
+            }
+            if (searchBudgetSpent(params, q.distance_computations, q.expansions)) {
+                q.stopped_early = true;
+                break;
+            }
+            std::pop_heap(q.candidate_set.begin(), q.candidate_set.end(), compare);
+            q.candidate_set.pop_back();
+            q.node = current_node_pair.second;
+            q.stage = BatchQuery<StatsPolicy>::LIST;
+            return;
+        }
+        q.stage = BatchQuery<StatsPolicy>::DONE;
+    }
 
-        memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
 
-        // Initialisation of the data and label
-        memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
-        memcpy(getDataByInternalId(cur_c), data_point, data_size_);
+    template<typename StatsPolicy>
+    void startBaseLayer(BatchQuery<StatsPolicy> &q, const SearchParams &params) const {
+        FilterCheck isIdAllowed(params.filter, this);
+        q.level = 0;
+        q.visited = visited_list_pool_->getFreeVisitedList();
+        q.top_candidates.clear();
+        q.candidate_set.clear();
+        tableint ep_id = q.node;
+        if ((!q.has_deletions || !isMarkedDeleted(ep_id)) && filterAllows(isIdAllowed, ep_id)) {
+            dist_t dist = fstdistfunc_(q.query, getDataByInternalId(ep_id), dist_func_param_);
+            q.distance_computations++;
+            q.lower_bound = dist;
+            q.top_candidates.emplace_back(dist, ep_id);
+            q.candidate_set.emplace_back(-dist, ep_id);
+        } else {
+            q.lower_bound = std::numeric_limits<dist_t>::max();
+            q.candidate_set.emplace_back(-q.lower_bound, ep_id);
+        }
+        q.visited->mass[ep_id] = q.visited->curV;
+        nextBaseNode(q, params);
+    }
 
-        if (!base_layer_init && curlevel == 0)
-            return cur_c;
 
-        if (curlevel) {
-            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
-            if (linkLists_[cur_c] == nullptr)
-                throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
+    template<typename StatsPolicy>
+    void startBatchQuery(BatchQuery<StatsPolicy> &q, const void *query, size_t row, const SearchParams &params) const {
+        q.stats.begin();
+        q.query = query;
+        q.row = row;
+        q.ef = std::max(params.ef ? params.ef : ef_, params.k);
+        q.has_deletions = num_deleted_ != 0;
+        q.distance_computations = 0;
+        q.expansions = 0;
+        q.stopped_early = false;
+        q.node = enterpoint_node_;
+        q.node_dist = fstdistfunc_(query, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        q.stats.addDistances(1);
+        q.level = maxlevel_;
+        if (base_layer_only) {
+            searchSeeds(query, q.node, q.node_dist, q.stats);
+            q.level = 0;
         }
+        q.stage = BatchQuery<StatsPolicy>::LIST;
+    }
 
-        if ((signed)currObj != -1) {
-            if (curlevel < maxlevelcopy) {
-                dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
-                for (int level = maxlevelcopy; level > curlevel; level--) {
-                    bool changed = true;
-                    while (changed) {
-                        changed = false;
-                        unsigned int *data;
-                        std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
-                        data = get_linklist(currObj, level);
-                        int size = getListCount(data);
 
-                        tableint *datal = (tableint *) (data + 1);
-                        for (int i = 0; i < size; i++) {
-                            tableint cand = datal[i];
-                            if (static_cast<int>(cand) < 0 || cand > max_elements_)
-                                throw std::runtime_error("cand error");
-                            dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
-                            if (d < curdist) {
-                                curdist = d;
-                                currObj = cand;
-                                changed = true;
-                            }
-                        }
-                    }
+    // Advances q by one stage; the base layer part mirrors searchBaseLayerST.
+    template<typename StatsPolicy>
+    void stepBatchQuery(BatchQuery<StatsPolicy> &q, const SearchParams &params) const {
+        typedef BatchQuery<StatsPolicy> Query;
+        if (q.stage == Query::LIST) {
+            if (q.level == 0 && !q.visited) {
+                startBaseLayer(q, params);
+                if (q.stage != Query::LIST)
+                    return;
+            }
+#ifdef USE_SSE
+            char *list = (char *) (q.level ? get_linklist(q.node, q.level) : get_linklist0(q.node));
+            _mm_prefetch(list, _MM_HINT_T0);
+            _mm_prefetch(list + 64, _MM_HINT_T0);
+#endif
+            q.stage = Query::NEIGHBORS;
+        } else if (q.stage == Query::NEIGHBORS) {
+            linklistsizeint *data = q.level ? get_linklist(q.node, q.level) : get_linklist0(q.node);
+            size_t size = getListCount(data);
+            tableint *datal = (tableint *) (data + 1);
+            q.stats.addHop();
+            q.neighbors.clear();
+            for (size_t j = 0; j < size; j++) {
+                tableint cand = datal[j];
+                if (q.level) {
+                    if (static_cast<int>(cand) < 0 || cand > max_elements_)
+                        throw std::runtime_error("cand error");
+                } else {
+                    // marked here rather than when the distance is computed; same outcome as
+                    // searchBaseLayerST since a link list holds no duplicates
+                    if (q.visited->mass[cand] == q.visited->curV)
+                        continue;
+                    q.visited->mass[cand] = q.visited->curV;
+                }
+                q.neighbors.push_back(cand);
+#ifdef USE_SSE
+                // the first lines only: long vectors would flush L1, the hardware prefetcher streams the rest
+                char *vector = getDataByInternalId(cand);
+                for (size_t offset = 0; offset < std::min<size_t>(data_size_, 512); offset += 64) {
+                    _mm_prefetch(vector + offset, _MM_HINT_T0);
                 }
+#endif
             }
-
-            bool epDeleted = isMarkedDeleted(enterpoint_copy);
-            for (int level = std::min(curlevel, maxlevelcopy); level >= 0; level--) {
-                if (level > maxlevelcopy || level < 0)  // possible?
-                    throw std::runtime_error("Level error");
-
-                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates = searchBaseLayer(
-                        currObj, data_point, level);
-                if (epDeleted) {
-                    top_candidates.emplace(fstdistfunc_(data_point, getDataByInternalId(enterpoint_copy), dist_func_param_), enterpoint_copy);
-                    if (top_candidates.size() > ef_construction_)
-                        top_candidates.pop();
+            q.stage = Query::DISTANCES;
+        } else if (q.level > 0) {
+            size_t size = q.neighbors.size();
+            computeDistances(q.query, q.neighbors.data(), size, q.vectors.data(), q.neighbor_dists.data());
+            q.stats.addDistances(size);
+            bool changed = false;
+            for (size_t j = 0; j < size; j++) {
+                if (q.neighbor_dists[j] < q.node_dist) {
+                    q.node_dist = q.neighbor_dists[j];
+                    q.node = q.neighbors[j];
+                    changed = true;
                 }
-                currObj = mutuallyConnectNewElement(data_point, cur_c, top_candidates, level, false);
             }
+            if (!changed)
+                q.level--;
+            q.stage = Query::LIST;
         } else {
-            // Do nothing for the first element
-            enterpoint_node_ = 0;
-            maxlevel_ = curlevel;
+            FilterCheck isIdAllowed(params.filter, this);
+            StatsCompareByFirst<StatsPolicy> compare(q.stats);
+            size_t size = q.neighbors.size();
+            computeDistances(q.query, q.neighbors.data(), size, q.vectors.data(), q.neighbor_dists.data());
+            q.distance_computations += size;
+            for (size_t j = 0; j < size; j++) {
+                tableint candidate_id = q.neighbors[j];
+                dist_t dist = q.neighbor_dists[j];
+                if (q.top_candidates.size() < q.ef || q.lower_bound > dist) {
+                    q.candidate_set.emplace_back(-dist, candidate_id);
+                    std::push_heap(q.candidate_set.begin(), q.candidate_set.end(), compare);
+                    if ((!q.has_deletions || !isMarkedDeleted(candidate_id)) &&
+                        filterAllows(isIdAllowed, candidate_id)) {
+                        q.top_candidates.emplace_back(dist, candidate_id);
+                        std::push_heap(q.top_candidates.begin(), q.top_candidates.end(), compare);
+                    }
+                    if (q.top_candidates.size() > q.ef) {
+                        std::pop_heap(q.top_candidates.begin(), q.top_candidates.end(), compare);
+                        q.top_candidates.pop_back();
+                    }
+                    if (!q.top_candidates.empty())
+                        q.lower_bound = q.top_candidates.front().first;
+                }
+            }
+            nextBaseNode(q, params);
         }
+    }
 
-        // Releasing lock for the maximum level
-        if (curlevel > maxlevelcopy) {
-            enterpoint_node_ = cur_c;
-            maxlevel_ = curlevel;
+
+    // Writes the k nearest of a finished query, closer first, padding missing results.
+    template<typename StatsPolicy>
+    bool finishBatchQuery(BatchQuery<StatsPolicy> &q, size_t k, labeltype *labels, dist_t *distances) const {
+        visited_list_pool_->releaseVisitedList(q.visited);
+        q.visited = nullptr;
+        q.stats.addDistances(q.distance_computations);
+        q.stats.end(q.stopped_early);
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = q.top_candidates;
+        while (top_candidates.size() > k) {
+            std::pop_heap(top_candidates.begin(), top_candidates.end(), CompareByFirst());
+            top_candidates.pop_back();
         }
-        return cur_c;
+        // ties in label order, like searchKnnCloserFirst
+        std::sort(top_candidates.begin(), top_candidates.end(),
+                  [this](const std::pair<dist_t, tableint> &a, const std::pair<dist_t, tableint> &b) {
+                      return a.first < b.first ||
+                             (a.first == b.first && getExternalLabel(a.second) < getExternalLabel(b.second));
+                  });
+        size_t found = top_candidates.size();
+        for (size_t i = 0; i < found; i++) {
+            labels[q.row * k + i] = getExternalLabel(top_candidates[i].second);
+            distances[q.row * k + i] = top_candidates[i].first;
+        }
+        for (size_t i = found; i < k; i++) {
+            labels[q.row * k + i] = (labeltype) -1;
+            distances[q.row * k + i] = std::numeric_limits<dist_t>::max();
+        }
+        return found == k;
     }
 
 
-    std::priority_queue<std::pair<dist_t, labeltype >>
-    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        using Clock = std::chrono::steady_clock;
-        std::priority_queue<
-            std::pair<dist_t, labeltype >,
-            std::vector<std::pair<dist_t,labeltype>>,
-            CompareByFirstDebug
-        >result_tmp{ CompareByFirstDebug(this->result_cmp_cnt_) };
-
-        std::priority_queue<std::pair<dist_t, labeltype >> result;
-        size_t dim = *((size_t*)dist_func_param_);
-        if (cur_element_count == 0) return result;
+    size_t searchKnnGroup(const char *queries, size_t query_size, size_t n, labeltype *labels,
+                          dist_t *distances, const SearchParams &params) const {
+        if (params.stats)
+            return searchKnnGroup<PerQuerySearchStats>(queries, query_size, n, labels, distances, params);
+        return searchKnnGroup<NoSearchStats>(queries, query_size, n, labels, distances, params);
+    }
 
-        tableint currObj = enterpoint_node_;
-        auto t0 = Clock::now();
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
-        auto t1 = Clock::now();
-        dist_op_ns_+=std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
-        dist_ops_+=dim*2;
 
-        if (base_layer_only) {
-            // You can increase the number of seeds when testing large-scale dataset, num_seeds = 48 for 100M-scale
-            for (int i = 0; i < num_seeds; i++) {
-                tableint obj = i * (max_elements_ / num_seeds);
-                dist_t dist = fstdistfunc_(query_data, getDataByInternalId(obj), dist_func_param_);
-                if (dist < curdist) {
-                    curdist = dist;
-                    currObj = obj;
-                }
+    template<typename StatsPolicy>
+    size_t searchKnnGroup(const char *queries, size_t query_size, size_t n, labeltype *labels,
+                          dist_t *distances, const SearchParams &params) const {
+        size_t k = params.k;
+        if (cur_element_count == 0 || k == 0) {
+            for (size_t i = 0; i < n * k; i++) {
+                labels[i] = (labeltype) -1;
+                distances[i] = std::numeric_limits<dist_t>::max();
             }
+            for (size_t i = 0; params.stats && i < n; i++) {
+                params.stats[i] = SearchStats();
+            }
+            return k ? n : 0;
         }
-        else {
-            for (int level = maxlevel_; level > 0; level--) {
-                bool changed = true;
-                while (changed) {
-                    changed = false;
-                    unsigned int *data;
-
-                    data = (unsigned int *) get_linklist(currObj, level);
-                    int size = getListCount(data);
-                    metric_hops++;
-                    metric_distance_computations+=size;
 
-                    tableint *datal = (tableint *) (data + 1);
-                    for (int i = 0; i < size; i++) {
-                        tableint cand = datal[i];
-                        if (static_cast<int>(cand) < 0 || cand > max_elements_)
-                            throw std::runtime_error("cand error");
-                        dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
-                        dist_ops_+=dim*2;
+        typedef BatchQuery<StatsPolicy> Query;
+        size_t max_neighbors = std::max(maxM0_, maxM_);
+        size_t ef = std::max(params.ef ? params.ef : ef_, k);
+        size_t group_size = BATCH_SEARCH_GROUP;
+        std::vector<Query> group(std::min(n, group_size));
+        for (Query &q : group) {
+            q.neighbors.reserve(max_neighbors);
+            q.vectors.resize(max_neighbors);
+            q.neighbor_dists.resize(max_neighbors);
+            q.top_candidates.reserve(ef + 1);
+        }
 
-                        if (d < curdist) {
-                            curdist = d;
-                            currObj = cand;
-                            changed = true;
-                        }
+        size_t incomplete = 0;
+        try {
+            size_t next_row = 0;
+            size_t active = group.size();
+            for (Query &q : group) {
+                startBatchQuery(q, queries + next_row * query_size, next_row, params);
+                next_row++;
+            }
+            while (active) {
+                for (Query &q : group) {
+                    if (q.stage == Query::DONE)
+                        continue;
+                    stepBatchQuery(q, params);
+                    if (q.stage != Query::DONE)
+                        continue;
+                    if (!finishBatchQuery(q, k, labels, distances))
+                        incomplete++;
+                    writeBatchStats(q, params);
+                    if (next_row < n) {
+                        startBatchQuery(q, queries + next_row * query_size, next_row, params);
+                        next_row++;
+                    } else {
+                        active--;
                     }
                 }
             }
+        } catch (...) {
+            for (Query &q : group) {
+                if (q.visited)
+                    visited_list_pool_->releaseVisitedList(q.visited);
+            }
+            throw;
         }
+        return incomplete;
+    }
 
-        // auto top_candidates;
-        // if (num_deleted_) {
-        //     top_candidates = searchBaseLayerST<true, true>(
-        //             currObj, query_data, std::max(ef_, k), isIdAllowed);
-        // } else {
-        //     // This is runned
-        //     top_candidates = searchBaseLayerST<false, true>(
-        //             currObj, query_data, std::max(ef_, k), isIdAllowed);
-        // }
-
-        auto top_candidates = (num_deleted_
-            ? this->searchBaseLayerST<true,  true>(currObj, query_data, std::max(ef_, k), isIdAllowed)
-            : this->searchBaseLayerST<false, true>(currObj, query_data, std::max(ef_, k), isIdAllowed)
-        );
 
+    void writeBatchStats(BatchQuery<NoSearchStats> &, const SearchParams &) const {}
 
-        while (top_candidates.size() > k) {
-            top_candidates.pop();
-        }
-        while (top_candidates.size() > 0) {
-            std::pair<dist_t, tableint> rez = top_candidates.top();
-            result.push(std::pair<dist_t, labeltype>(rez.first, getExternalLabel(rez.second)));
-            result_tmp.push(std::pair<dist_t, labeltype>(rez.first, getExternalLabel(rez.second)));
-            // std::cout<< "SearchKnn: " << rez.first << " " << getExternalLabel(rez.second) << "\n";
-            // std::cout<< this->result_cmp_cnt_ << "\n";
-            top_candidates.pop();
-        }
-        return result;
+    void writeBatchStats(BatchQuery<PerQuerySearchStats> &q, const SearchParams &params) const {
+        params.stats[q.row] = q.stats.stats;
     }
 
 
@@ -0,0 +1,551 @@
+#pragma once
+
+#include "hnswalg.h"
+#include "async_io.h"
+
+#include <functional>
+#include <limits>
+
+namespace hnswlib {
+
+/*
+ * Read-only HNSW index that keeps full vectors and level 0 on disk, in the style of DiskANN.
+ *
+ * The file uses the sectioned format (index_format.h). SECTION_NODE_BLOCKS holds one node per
+ * element, [vector][level 0 link list], packed into INDEX_FILE_ALIGNMENT-sized blocks so that no node
+ * straddles a block (large nodes get several blocks of their own). Everything else is loaded into
+ * memory: upper levels, labels and deleted marks in the HierarchicalNSW sections, and every vector
+ * scalar-quantized to one byte per dimension (SECTION_QUANTIZER: float min and scale per dimension,
+ * SECTION_VECTOR_CODES: the codes).
+ *
+ * Search descends the upper levels with the quantized vectors, then runs a beam search on level 0:
+ * each step reads the nodes of the beam_width closest unexpanded candidates in one batch
+ * (BlockReader, io_uring where available), scores their neighbors with the quantized vectors, and
+ * keeps the exact distances of the fetched full vectors, which give the final ranking.
+ * Only float vectors are supported.
+ */
+template<typename dist_t>
+class DiskHNSW : public AlgorithmInterface<dist_t> {
+ public:
+    size_t cur_element_count{0};
+    size_t dim_{0};
+    size_t data_size_{0};
+    size_t maxM_{0};
+    size_t maxM0_{0};
+    size_t size_links_per_element_{0};
+    size_t size_links_level0_{0};
+    int maxlevel_{0};
+    tableint enterpoint_node_{0};
+    size_t num_deleted_{0};
+
+    size_t node_size_{0};        // data_size_ + size_links_level0_
+    size_t nodes_per_block_{0};  // 0 if a node takes several blocks
+    size_t node_read_size_{0};   // bytes read to fetch one node
+    uint64_t nodes_offset_{0};
+
+    std::vector<float> quantizer_min_;
+    std::vector<float> quantizer_scale_;
+    std::vector<uint8_t> codes_;
+    std::vector<char> upper_levels_;        // SECTION_UPPER_LEVELS as stored
+    std::vector<size_t> link_list_offsets_;  // offset of each element's upper link lists in upper_levels_
+    std::vector<labeltype> labels_;
+    std::vector<uint64_t> deleted_;
+
+    size_t ef_{10};
+    size_t beam_width_{4};
+    bool use_io_uring_{true};
+
+    DISTFUNC<dist_t> fstdistfunc_;
+    void *dist_func_param_{nullptr};
+
+    FileIndexInput *nodes_input_{nullptr};
+    VisitedListPool *visited_list_pool_{nullptr};
+
+    struct Candidate {
+        dist_t dist;
+        tableint id;
+        bool expanded;
+        bool allowed;  // may be returned: not deleted and passes the filter
+    };
+
+    // Per-search buffers, reused through scratch_pool_
+    struct SearchScratch {
+        BlockReader reader;
+        char *blocks;
+        std::vector<float> decoded;
+        std::vector<Candidate> candidates;
+        std::vector<BlockRead> reads;
+        std::vector<Candidate> batch;
+
+        SearchScratch(FileIndexInput &input, size_t beam_width, size_t read_size, size_t dim, bool use_io_uring)
+            : reader(input, beam_width, use_io_uring), decoded(dim) {
+            blocks = (char *) allocateAlignedBlocks(beam_width * read_size);
+        }
+
+        ~SearchScratch() {
+            freeAlignedBlocks(blocks);
+        }
+    };
+
+    mutable std::mutex scratch_lock_;
+    mutable std::vector<SearchScratch *> scratch_pool_;
+
+
+    DiskHNSW(
+        SpaceInterface<dist_t> *s,
+        const std::string &location,
+        size_t beam_width = 4,
+        bool use_io_uring = true)
+        : beam_width_(std::max<size_t>(1, beam_width)), use_io_uring_(use_io_uring) {
+        loadIndex(location, s);
+    }
+
+
+    ~DiskHNSW() {
+        for (SearchScratch *scratch : scratch_pool_) {
+            delete scratch;
+        }
+        delete visited_list_pool_;
+        delete nodes_input_;
+    }
+
+
+    void setEf(size_t ef) {
+        ef_ = ef;
+    }
+
+
+    size_t getCurrentElementCount() const {
+        return cur_element_count;
+    }
+
+
+    size_t getDeletedCount() const {
+        return num_deleted_;
+    }
+
+
+    bool isMarkedDeleted(tableint internal_id) const {
+        return deleted_[internal_id / 64] >> (internal_id % 64) & 1;
+    }
+
+
+    labeltype getExternalLabel(tableint internal_id) const {
+        return labels_[internal_id];
+    }
+
+
+    const uint8_t *getCodesByInternalId(tableint internal_id) const {
+        return codes_.data() + internal_id * dim_;
+    }
+
+
+    linklistsizeint *get_linklist(tableint internal_id, int level) const {
+        return (linklistsizeint *) (upper_levels_.data() + link_list_offsets_[internal_id] +
+                                    (level - 1) * size_links_per_element_);
+    }
+
+
+    unsigned short int getListCount(const linklistsizeint *ptr) const {
+        return *((unsigned short int *) ptr);
+    }
+
+
+    static size_t nodesPerBlock(size_t node_size) {
+        return INDEX_FILE_ALIGNMENT / node_size;
+    }
+
+
+    static uint64_t nodeBlocksSize(size_t element_count, size_t node_size) {
+        size_t nodes_per_block = nodesPerBlock(node_size);
+        if (nodes_per_block)
+            return (element_count + nodes_per_block - 1) / nodes_per_block * (uint64_t) INDEX_FILE_ALIGNMENT;
+        return element_count * alignIndexOffset(node_size);
+    }
+
+
+    // Offset of the read that fetches a node, relative to SECTION_NODE_BLOCKS
+    uint64_t nodeReadOffset(tableint internal_id) const {
+        if (nodes_per_block_)
+            return internal_id / nodes_per_block_ * (uint64_t) INDEX_FILE_ALIGNMENT;
+        return internal_id * (uint64_t) node_read_size_;
+    }
+
+
+    // Position of a node within the block(s) read by nodeReadOffset
+    size_t nodeOffsetInRead(tableint internal_id) const {
+        return nodes_per_block_ ? internal_id % nodes_per_block_ * node_size_ : 0;
+    }
+
+
+    /*
+    * Writes index to location in the disk-resident format. Vectors are quantized with the per-dimension
+    * range of the indexed data.
+    */
+    static void build(const HierarchicalNSW<dist_t> &index, const std::string &location, bool checksums = true) {
+        size_t element_count = index.cur_element_count;
+        size_t dim = index.data_size_ / sizeof(float);
+        if (dim * sizeof(float) != index.data_size_)
+            throw std::runtime_error("DiskHNSW supports only float vectors");
+        size_t node_size = index.data_size_ + index.size_links_level0_;
+
+        std::vector<float> quantizer(2 * dim);
+        float *min = quantizer.data();
+        float *scale = quantizer.data() + dim;
+        std::vector<float> max(dim);
+        for (size_t d = 0; d < dim; d++) {
+            min[d] = std::numeric_limits<float>::max();
+            max[d] = std::numeric_limits<float>::lowest();
+        }
+        for (size_t i = 0; i < element_count; i++) {
+            const float *vector = (const float *) index.getDataByInternalId(i);
+            for (size_t d = 0; d < dim; d++) {
+                min[d] = std::min(min[d], vector[d]);
+                max[d] = std::max(max[d], vector[d]);
+            }
+        }
+        for (size_t d = 0; d < dim; d++) {
+            if (element_count == 0)
+                min[d] = max[d] = 0;
+            scale[d] = (max[d] - min[d]) / 255.0f;
+        }
+
+        IndexFileLayout layout;
+        layout.addSection(SECTION_METADATA, sizeof(IndexMetadata), checksums);
+        layout.addSection(SECTION_UPPER_LEVELS, index.getIndexFileLayout(false).section(SECTION_UPPER_LEVELS).size,
+                          checksums);
+        layout.addSection(SECTION_LABELS, element_count * sizeof(labeltype), checksums);
+        layout.addSection(SECTION_DELETED, (element_count + 63) / 64 * sizeof(uint64_t), checksums);
+        layout.addSection(SECTION_QUANTIZER, quantizer.size() * sizeof(float), checksums);
+        layout.addSection(SECTION_VECTOR_CODES, element_count * dim, checksums);
+        layout.addSection(SECTION_NODE_BLOCKS, nodeBlocksSize(element_count, node_size), checksums);
+        layout.finalize();
+
+        auto for_each_chunk = [&](uint32_t kind, std::function<void(const void *, size_t)> fn) {
+            const size_t chunk = 1024;
+            switch (kind) {
+            case SECTION_QUANTIZER:
+                fn(quantizer.data(), quantizer.size() * sizeof(float));
+                break;
+            case SECTION_VECTOR_CODES: {
+                std::vector<uint8_t> codes(chunk * dim);
+                for (size_t i = 0; i < element_count; i += chunk) {
+                    size_t n = std::min(chunk, element_count - i);
+                    for (size_t j = 0; j < n; j++) {
+                        encode(min, scale, dim, (const float *) index.getDataByInternalId(i + j), &codes[j * dim]);
+                    }
+                    fn(codes.data(), n * dim);
+                }
+                break;
+            }
+            case SECTION_NODE_BLOCKS: {
+                size_t nodes_per_block = nodesPerBlock(node_size);
+                size_t block_size = nodes_per_block ? INDEX_FILE_ALIGNMENT : alignIndexOffset(node_size);
+                size_t nodes_per_write = std::max<size_t>(1, nodes_per_block);
+                std::vector<char> block(block_size);
+                for (size_t i = 0; i < element_count; i += nodes_per_write) {
+                    size_t n = std::min(nodes_per_write, element_count - i);
+                    memset(block.data(), 0, block.size());
+                    for (size_t j = 0; j < n; j++) {
+                        char *node = block.data() + j * node_size;
+                        memcpy(node, index.getDataByInternalId(i + j), index.data_size_);
+                        memcpy(node + index.data_size_, index.get_linklist0(i + j), index.size_links_level0_);
+                    }
+                    fn(block.data(), block.size());
+                }
+                break;
+            }
+            default:
+                index.forEachSectionChunk(kind, fn);
+            }
+        };
+
+        if (checksums) {
+            for (size_t i = 0; i < layout.sections.size(); i++) {
+                uint32_t crc = 0;
+                for_each_chunk(layout.sections[i].kind, [&crc](const void *data, size_t size) {
+                    crc = crc32cExtend(crc, data, size);
+                });
+                layout.sections[i].crc = crc;
+            }
+        }
+
+        std::ofstream file(location, std::ios::binary);
+        if (!file.is_open())
+            throw std::runtime_error("Cannot open file");
+        StreamIndexOutput output(file);
+        layout.writeHeader(output);
+        for (size_t i = 0; i < layout.sections.size(); i++) {
+            const IndexSectionEntry &section = layout.sections[i];
+            for_each_chunk(section.kind, [&output](const void *data, size_t size) {
+                output.write(data, size);
+            });
+            uint64_t next = i + 1 < layout.sections.size() ? layout.sections[i + 1].offset : layout.fileSize();
+            output.writeZeros(next - section.offset - section.size);
+        }
+        file.close();
+        if (!file)
+            throw std::runtime_error("Failed to write the index");
+    }
+
+
+    static void encode(const float *min, const float *scale, size_t dim, const float *vector, uint8_t *codes) {
+        for (size_t d = 0; d < dim; d++) {
+            float code = scale[d] > 0 ? (vector[d] - min[d]) / scale[d] + 0.5f : 0.0f;
+            codes[d] = (uint8_t) std::min(255.0f, std::max(0.0f, code));
+        }
+    }
+
+
+    void decode(const uint8_t *codes, float *vector) const {
+        for (size_t d = 0; d < dim_; d++) {
+            vector[d] = quantizer_min_[d] + codes[d] * quantizer_scale_[d];
+        }
+    }
+
+
+    bool isAllowed(tableint internal_id, const FilterCheck &isIdAllowed) const {
+        return !isMarkedDeleted(internal_id) && isIdAllowed(getExternalLabel(internal_id));
+    }
+
+
+    dist_t approximateDistance(const void *query_data, tableint internal_id, SearchScratch &scratch) const {
+        decode(getCodesByInternalId(internal_id), scratch.decoded.data());
+        return fstdistfunc_(query_data, scratch.decoded.data(), dist_func_param_);
+    }
+
+
+    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s) {
+        typedef HierarchicalNSW<dist_t> Index;
+        FileIndexInput input(location);
+        IndexFileHeader header;
+        std::vector<IndexSectionEntry> sections;
+        if (!readIndexFileHeader(input, header, sections))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        IndexMetadata meta = Index::readIndexMetadata(input, sections, s);
+
+        data_size_ = s->get_data_size();
+        fstdistfunc_ = s->get_dist_func();
+        dist_func_param_ = s->get_dist_func_param();
+        dim_ = data_size_ / sizeof(float);
+        if (dim_ * sizeof(float) != data_size_)
+            throw std::runtime_error("DiskHNSW supports only float vectors");
+
+        cur_element_count = meta.cur_element_count;
+        maxM_ = meta.max_M;
+        maxM0_ = meta.max_M0;
+        maxlevel_ = meta.max_level;
+        enterpoint_node_ = meta.enterpoint_node;
+        num_deleted_ = meta.num_deleted;
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+        node_size_ = data_size_ + size_links_level0_;
+        nodes_per_block_ = nodesPerBlock(node_size_);
+        node_read_size_ = nodes_per_block_ ? INDEX_FILE_ALIGNMENT : alignIndexOffset(node_size_);
+
+        Index::readUpperLevelsSection(input, sections, cur_element_count, size_links_per_element_,
+                                      upper_levels_, link_list_offsets_);
+
+        const IndexSectionEntry &labels = Index::requireIndexSection(sections, SECTION_LABELS);
+        labels_.resize(cur_element_count);
+        if (labels.size != labels_.size() * sizeof(labeltype))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        Index::readIndexSection(input, labels, labels_.data());
+
+        deleted_.assign((cur_element_count + 63) / 64, 0);
+        const IndexSectionEntry *deleted = findIndexSection(sections, SECTION_DELETED);
+        if (deleted) {
+            if (deleted->size != deleted_.size() * sizeof(uint64_t))
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            Index::readIndexSection(input, *deleted, deleted_.data());
+        }
+
+        const IndexSectionEntry &quantizer = Index::requireIndexSection(sections, SECTION_QUANTIZER);
+        if (quantizer.size != 2 * dim_ * sizeof(float))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        std::vector<float> quantizer_data(2 * dim_);
+        Index::readIndexSection(input, quantizer, quantizer_data.data());
+        quantizer_min_.assign(quantizer_data.begin(), quantizer_data.begin() + dim_);
+        quantizer_scale_.assign(quantizer_data.begin() + dim_, quantizer_data.end());
+
+        const IndexSectionEntry &codes = Index::requireIndexSection(sections, SECTION_VECTOR_CODES);
+        if (codes.size != cur_element_count * dim_)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        codes_.resize(codes.size);
+        Index::readIndexSection(input, codes, codes_.data());
+
+        // node blocks are read on demand, so their checksum is not verified here
+        const IndexSectionEntry &nodes = Index::requireIndexSection(sections, SECTION_NODE_BLOCKS);
+        if (nodes.size != nodeBlocksSize(cur_element_count, node_size_) || nodes.offset % INDEX_FILE_ALIGNMENT)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        nodes_offset_ = nodes.offset;
+        nodes_input_ = new FileIndexInput(location, true);
+        visited_list_pool_ = new VisitedListPool(1, cur_element_count);
+    }
+
+
+    SearchScratch *getScratch() const {
+        {
+            std::unique_lock <std::mutex> lock(scratch_lock_);
+            if (!scratch_pool_.empty()) {
+                SearchScratch *scratch = scratch_pool_.back();
+                scratch_pool_.pop_back();
+                return scratch;
+            }
+        }
+        return new SearchScratch(*nodes_input_, beam_width_, node_read_size_, dim_, use_io_uring_);
+    }
+
+
+    void releaseScratch(SearchScratch *scratch) const {
+        std::unique_lock <std::mutex> lock(scratch_lock_);
+        scratch_pool_.push_back(scratch);
+    }
+
+
+    // Reads the nodes of scratch.batch; the node of scratch.batch[i] is then at fetchedNode(scratch, i).
+    void fetchNodes(SearchScratch &scratch) const {
+        scratch.reads.resize(scratch.batch.size());
+        for (size_t i = 0; i < scratch.batch.size(); i++) {
+            BlockRead &read = scratch.reads[i];
+            read.buffer = scratch.blocks + i * node_read_size_;
+            read.size = node_read_size_;
+            read.offset = nodes_offset_ + nodeReadOffset(scratch.batch[i].id);
+        }
+        scratch.reader.read(scratch.reads.data(), scratch.reads.size());
+    }
+
+
+    const char *fetchedNode(const SearchScratch &scratch, size_t i) const {
+        return scratch.blocks + i * node_read_size_ + nodeOffsetInRead(scratch.batch[i].id);
+    }
+
+
+    void addPoint(const void *datapoint, labeltype label, bool replace_deleted = false) {
+        throw std::runtime_error("DiskHNSW is read-only; build it from a HierarchicalNSW");
+    }
+
+
+    void saveIndex(const std::string &location) {
+        throw std::runtime_error("DiskHNSW is read-only; use DiskHNSW::build to write it");
+    }
+
+
+    using AlgorithmInterface<dist_t>::searchKnn;
+
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        std::priority_queue<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0 || k == 0) return result;
+
+        SearchScratch *scratch = getScratch();
+        try {
+            searchWithScratch(query_data, k, isIdAllowed, *scratch, result);
+        } catch (...) {
+            releaseScratch(scratch);
+            throw;
+        }
+        releaseScratch(scratch);
+        return result;
+    }
+
+
+    void searchWithScratch(const void *query_data, size_t k, BaseFilterFunctor *isIdAllowed,
+                           SearchScratch &scratch, std::priority_queue<std::pair<dist_t, labeltype >> &result) const {
+        FilterCheck filter(isIdAllowed);
+        tableint currObj = enterpoint_node_;
+        dist_t curdist = approximateDistance(query_data, currObj, scratch);
+        for (int level = maxlevel_; level > 0; level--) {
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                linklistsizeint *data = get_linklist(currObj, level);
+                int size = getListCount(data);
+                tableint *datal = (tableint *) (data + 1);
+                for (int i = 0; i < size; i++) {
+                    tableint cand = datal[i];
+                    if (cand >= cur_element_count)
+                        throw std::runtime_error("cand error");
+                    dist_t d = approximateDistance(query_data, cand, scratch);
+                    if (d < curdist) {
+                        curdist = d;
+                        currObj = cand;
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        try {
+            vl_type *visited_array = vl->mass;
+            vl_type visited_array_tag = vl->curV;
+
+            // Candidates sorted by approximate distance. Like top_candidates in HierarchicalNSW, only
+            // allowed ones count towards list_size, so deletions and filters do not shrink the search.
+            size_t list_size = std::max(ef_, k);
+            std::vector<Candidate> &candidates = scratch.candidates;
+            candidates.clear();
+            candidates.push_back(Candidate{curdist, currObj, false, isAllowed(currObj, filter)});
+            size_t num_allowed = candidates.back().allowed;
+            visited_array[currObj] = visited_array_tag;
+
+            while (true) {
+                scratch.batch.clear();
+                for (size_t i = 0; i < candidates.size() && scratch.batch.size() < beam_width_; i++) {
+                    if (!candidates[i].expanded) {
+                        candidates[i].expanded = true;
+                        scratch.batch.push_back(candidates[i]);
+                    }
+                }
+                if (scratch.batch.empty())
+                    break;
+                fetchNodes(scratch);
+
+                for (size_t b = 0; b < scratch.batch.size(); b++) {
+                    tableint id = scratch.batch[b].id;
+                    const char *node = fetchedNode(scratch, b);
+                    if (scratch.batch[b].allowed) {
+                        dist_t dist = fstdistfunc_(query_data, node, dist_func_param_);
+                        if (result.size() < k || dist < result.top().first) {
+                            result.emplace(dist, getExternalLabel(id));
+                            if (result.size() > k)
+                                result.pop();
+                        }
+                    }
+
+                    const linklistsizeint *links = (const linklistsizeint *) (node + data_size_);
+                    size_t size = getListCount(links);
+                    const tableint *datal = (const tableint *) (links + 1);
+                    for (size_t j = 0; j < size; j++) {
+                        tableint candidate_id = datal[j];
+                        if (candidate_id >= cur_element_count)
+                            throw std::runtime_error("cand error");
+                        if (visited_array[candidate_id] == visited_array_tag) continue;
+                        visited_array[candidate_id] = visited_array_tag;
+
+                        dist_t dist = approximateDistance(query_data, candidate_id, scratch);
+                        if (num_allowed >= list_size && !(dist < candidates.back().dist))
+                            continue;
+                        Candidate candidate{dist, candidate_id, false, isAllowed(candidate_id, filter)};
+                        candidates.insert(std::upper_bound(candidates.begin(), candidates.end(), candidate,
+                            [](const Candidate &a, const Candidate &b) { return a.dist < b.dist; }), candidate);
+                        num_allowed += candidate.allowed;
+                        while (num_allowed - candidates.back().allowed >= list_size) {
+                            num_allowed -= candidates.back().allowed;
+                            candidates.pop_back();
+                        }
+                    }
+                }
+            }
+        } catch (...) {
+            visited_list_pool_->releaseVisitedList(vl);
+            throw;
+        }
+
+        visited_list_pool_->releaseVisitedList(vl);
+    }
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,387 @@
+#pragma once
+
+#include "hnswalg.h"
+
+namespace hnswlib {
+
+/*
+ * Immutable HNSW index for serving replicas that never insert.
+ *
+ * Holds only what search needs: level 0 in the HierarchicalNSW layout (links, vector, label and the
+ * delete mark of every element in one row), the upper levels as one array in the SECTION_UPPER_LEVELS
+ * layout with the offset of every element's lists, and the graph parameters. There are no locks,
+ * label map, deleted set or per-element allocations, and search takes no locks and does no atomic
+ * operations: visited marks live in a per-thread array.
+ *
+ * Loads from the files written by HierarchicalNSW::saveIndex, or is copied from a HierarchicalNSW.
+ */
+template<typename dist_t>
+class FrozenHNSW : public AlgorithmInterface<dist_t> {
+ public:
+    static const unsigned char DELETE_MARK = 0x01;
+    typedef typename HierarchicalNSW<dist_t>::CompareByFirst CompareByFirst;
+
+    size_t cur_element_count{0};
+    size_t size_data_per_element_{0};
+    size_t size_links_per_element_{0};
+    size_t num_deleted_{0};
+    size_t M_{0};
+    size_t maxM_{0};
+    size_t maxM0_{0};
+    size_t ef_{10};
+
+    int maxlevel_{0};
+    tableint enterpoint_node_{0};
+
+    bool base_layer_only = false;
+    int num_seeds = 32;
+    std::vector<tableint> pivot_ids_;  // see HierarchicalNSW::buildPivots
+
+    size_t offsetData_{0};
+    size_t label_offset_{0};
+    size_t data_size_{0};
+
+    char *data_level0_memory_{nullptr};
+    std::vector<char> upper_levels_;        // SECTION_UPPER_LEVELS as stored
+    std::vector<size_t> link_list_offsets_;  // offset of each element's upper link lists in upper_levels_
+
+    DISTFUNC<dist_t> fstdistfunc_;
+    void *dist_func_param_{nullptr};
+
+    struct VisitedMarks {
+        std::vector<vl_type> marks;
+        vl_type tag{0};
+    };
+
+
+    FrozenHNSW(SpaceInterface<dist_t> *s, const std::string &location, size_t num_threads = 0) {
+        loadIndex(location, s, num_threads);
+    }
+
+
+    // Copies the searchable state of index, which must not be modified meanwhile.
+    explicit FrozenHNSW(const HierarchicalNSW<dist_t> &index) {
+        cur_element_count = index.cur_element_count;
+        size_data_per_element_ = index.size_data_per_element_;
+        size_links_per_element_ = index.size_links_per_element_;
+        num_deleted_ = index.num_deleted_;
+        M_ = index.M_;
+        maxM_ = index.maxM_;
+        maxM0_ = index.maxM0_;
+        ef_ = index.ef_;
+        maxlevel_ = index.maxlevel_;
+        enterpoint_node_ = index.enterpoint_node_;
+        base_layer_only = index.base_layer_only;
+        num_seeds = index.num_seeds;
+        pivot_ids_ = index.pivots()->ids;
+        offsetData_ = index.offsetData_;
+        label_offset_ = index.label_offset_;
+        data_size_ = index.data_size_;
+        fstdistfunc_ = index.fstdistfunc_;
+        dist_func_param_ = index.dist_func_param_;
+
+        data_level0_memory_ = allocateLevel0(cur_element_count);
+        memcpy(data_level0_memory_, index.data_level0_memory_ + index.offsetLevel0_,
+               cur_element_count * size_data_per_element_);
+        index.forEachSectionChunk(SECTION_UPPER_LEVELS, [this](const void *data, size_t size) {
+            upper_levels_.insert(upper_levels_.end(), (const char *) data, (const char *) data + size);
+        });
+        HierarchicalNSW<dist_t>::upperLevelListOffsets(upper_levels_, cur_element_count, size_links_per_element_,
+                                                       link_list_offsets_);
+    }
+
+
+    ~FrozenHNSW() {
+        free(data_level0_memory_);
+    }
+
+
+    char *allocateLevel0(size_t element_count) {
+        char *memory = (char *) malloc(std::max<size_t>(1, element_count * size_data_per_element_));
+        if (memory == nullptr)
+            throw std::runtime_error("Not enough memory");
+        return memory;
+    }
+
+
+    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t num_threads = 0) {
+        typedef HierarchicalNSW<dist_t> Index;
+        if (num_threads == 0)
+            num_threads = std::thread::hardware_concurrency();
+        FileIndexInput input(location);
+        IndexFileHeader header;
+        std::vector<IndexSectionEntry> sections;
+        if (!readIndexFileHeader(input, header, sections)) {
+            // legacy files have no sections to read from: go through a full index
+            Index index(s);
+            index.loadIndex(input, s, 0, num_threads);
+            FrozenHNSW<dist_t> frozen(index);
+            swap(frozen);
+            return;
+        }
+
+        IndexMetadata meta = Index::readIndexMetadata(input, sections, s);
+        cur_element_count = meta.cur_element_count;
+        size_data_per_element_ = meta.size_data_per_element;
+        num_deleted_ = meta.num_deleted;
+        M_ = meta.M;
+        maxM_ = meta.max_M;
+        maxM0_ = meta.max_M0;
+        maxlevel_ = meta.max_level;
+        enterpoint_node_ = meta.enterpoint_node;
+        offsetData_ = meta.offset_data;
+        label_offset_ = meta.label_offset;
+        data_size_ = s->get_data_size();
+        fstdistfunc_ = s->get_dist_func();
+        dist_func_param_ = s->get_dist_func_param();
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        if (meta.size_links_per_element != size_links_per_element_ || meta.offset_level0 != 0 ||
+            offsetData_ != maxM0_ * sizeof(tableint) + sizeof(linklistsizeint) ||
+            label_offset_ != offsetData_ + data_size_ || size_data_per_element_ != label_offset_ + sizeof(labeltype))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        const IndexSectionEntry &level0_section = Index::requireIndexSection(sections, SECTION_LEVEL0);
+        if (level0_section.size != cur_element_count * size_data_per_element_)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        data_level0_memory_ = allocateLevel0(cur_element_count);
+        Index::readIndexSection(input, level0_section, data_level0_memory_, num_threads);
+        Index::readUpperLevelsSection(input, sections, cur_element_count, size_links_per_element_,
+                                      upper_levels_, link_list_offsets_, num_threads);
+        Index::readPivotsSection(input, sections, cur_element_count, pivot_ids_);
+        base_layer_only = !pivot_ids_.empty();
+    }
+
+
+    void swap(FrozenHNSW<dist_t> &other) {
+        std::swap(cur_element_count, other.cur_element_count);
+        std::swap(size_data_per_element_, other.size_data_per_element_);
+        std::swap(size_links_per_element_, other.size_links_per_element_);
+        std::swap(num_deleted_, other.num_deleted_);
+        std::swap(M_, other.M_);
+        std::swap(maxM_, other.maxM_);
+        std::swap(maxM0_, other.maxM0_);
+        std::swap(ef_, other.ef_);
+        std::swap(maxlevel_, other.maxlevel_);
+        std::swap(enterpoint_node_, other.enterpoint_node_);
+        std::swap(base_layer_only, other.base_layer_only);
+        std::swap(num_seeds, other.num_seeds);
+        pivot_ids_.swap(other.pivot_ids_);
+        std::swap(offsetData_, other.offsetData_);
+        std::swap(label_offset_, other.label_offset_);
+        std::swap(data_size_, other.data_size_);
+        std::swap(data_level0_memory_, other.data_level0_memory_);
+        upper_levels_.swap(other.upper_levels_);
+        link_list_offsets_.swap(other.link_list_offsets_);
+        std::swap(fstdistfunc_, other.fstdistfunc_);
+        std::swap(dist_func_param_, other.dist_func_param_);
+    }
+
+
+    void setEf(size_t ef) {
+        ef_ = ef;
+    }
+
+
+    size_t getCurrentElementCount() const {
+        return cur_element_count;
+    }
+
+
+    size_t getDeletedCount() const {
+        return num_deleted_;
+    }
+
+
+    // Bytes held by the index, not counting the per-thread visited marks
+    size_t memoryUsage() const {
+        return sizeof(*this) + cur_element_count * size_data_per_element_ + upper_levels_.capacity() +
+               link_list_offsets_.capacity() * sizeof(size_t) + pivot_ids_.capacity() * sizeof(tableint);
+    }
+
+
+    inline char *getDataByInternalId(tableint internal_id) const {
+        return data_level0_memory_ + internal_id * size_data_per_element_ + offsetData_;
+    }
+
+
+    inline labeltype getExternalLabel(tableint internal_id) const {
+        labeltype return_label;
+        memcpy(&return_label, data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_,
+               sizeof(labeltype));
+        return return_label;
+    }
+
+
+    inline linklistsizeint *get_linklist0(tableint internal_id) const {
+        return (linklistsizeint *) (data_level0_memory_ + internal_id * size_data_per_element_);
+    }
+
+
+    inline linklistsizeint *get_linklist(tableint internal_id, int level) const {
+        return (linklistsizeint *) (upper_levels_.data() + link_list_offsets_[internal_id] +
+                                    (level - 1) * size_links_per_element_);
+    }
+
+
+    inline unsigned short int getListCount(const linklistsizeint *ptr) const {
+        return *((const unsigned short int *) ptr);
+    }
+
+
+    inline bool isMarkedDeleted(tableint internal_id) const {
+        unsigned char *ll_cur = ((unsigned char *) get_linklist0(internal_id)) + 2;
+        return *ll_cur & DELETE_MARK;
+    }
+
+
+    // Visited marks of the calling thread, with a fresh tag for a new search over count elements
+    static VisitedMarks &threadVisitedMarks(size_t count) {
+        static thread_local VisitedMarks visited;
+        if (visited.marks.size() < count)
+            visited.marks.resize(count, 0);
+        visited.tag++;
+        if (visited.tag == 0) {
+            std::fill(visited.marks.begin(), visited.marks.end(), 0);
+            visited.tag++;
+        }
+        return visited;
+    }
+
+
+    void addPoint(const void *datapoint, labeltype label, bool replace_deleted = false) {
+        throw std::runtime_error("FrozenHNSW is read-only");
+    }
+
+
+    void saveIndex(const std::string &location) {
+        throw std::runtime_error("FrozenHNSW is read-only; save the HierarchicalNSW it was loaded from");
+    }
+
+
+    template <bool has_deletions>
+    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+    searchBaseLayerST(tableint ep_id, const void *data_point, size_t ef, BaseFilterFunctor* isIdAllowed) const {
+        VisitedMarks &visited = threadVisitedMarks(cur_element_count);
+        vl_type *visited_array = visited.marks.data();
+        vl_type visited_array_tag = visited.tag;
+        FilterCheck isAllowed(isIdAllowed);
+
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
+
+        dist_t lowerBound;
+        if ((!has_deletions || !isMarkedDeleted(ep_id)) && isAllowed(getExternalLabel(ep_id))) {
+            dist_t dist = fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
+            lowerBound = dist;
+            top_candidates.emplace(dist, ep_id);
+            candidate_set.emplace(-dist, ep_id);
+        } else {
+            lowerBound = std::numeric_limits<dist_t>::max();
+            candidate_set.emplace(-lowerBound, ep_id);
+        }
+        visited_array[ep_id] = visited_array_tag;
+
+        while (!candidate_set.empty()) {
+            std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
+            if ((-current_node_pair.first) > lowerBound &&
+                (top_candidates.size() == ef || (!isIdAllowed && !has_deletions))) {
+                break;
+            }
+            candidate_set.pop();
+
+            tableint current_node_id = current_node_pair.second;
+            int *data = (int *) get_linklist0(current_node_id);
+            size_t size = getListCount((linklistsizeint*)data);
+#ifdef USE_SSE
+            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
+            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
+            _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
+#endif
+
+            for (size_t j = 1; j <= size; j++) {
+                int candidate_id = *(data + j);
+#ifdef USE_SSE
+                if (j < size) {
+                    _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
+                    _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
+                                 _MM_HINT_T0);
+                }
+#endif
+                if (visited_array[candidate_id] == visited_array_tag) continue;
+                visited_array[candidate_id] = visited_array_tag;
+
+                dist_t dist = fstdistfunc_(data_point, getDataByInternalId(candidate_id), dist_func_param_);
+                if (top_candidates.size() < ef || lowerBound > dist) {
+                    candidate_set.emplace(-dist, candidate_id);
+                    if ((!has_deletions || !isMarkedDeleted(candidate_id)) &&
+                        isAllowed(getExternalLabel(candidate_id)))
+                        top_candidates.emplace(dist, candidate_id);
+
+                    if (top_candidates.size() > ef)
+                        top_candidates.pop();
+
+                    if (!top_candidates.empty())
+                        lowerBound = top_candidates.top().first;
+                }
+            }
+        }
+        return top_candidates;
+    }
+
+
+    using AlgorithmInterface<dist_t>::searchKnn;
+
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        std::priority_queue<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) return result;
+
+        tableint currObj = enterpoint_node_;
+        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        if (base_layer_only) {
+            size_t num = pivot_ids_.empty() ? std::min<size_t>(num_seeds, cur_element_count) : pivot_ids_.size();
+            for (size_t i = 0; i < num; i++) {
+                tableint obj = pivot_ids_.empty() ? i * (cur_element_count / num) : pivot_ids_[i];
+                dist_t dist = fstdistfunc_(query_data, getDataByInternalId(obj), dist_func_param_);
+                if (dist < curdist) {
+                    curdist = dist;
+                    currObj = obj;
+                }
+            }
+        } else {
+            for (int level = maxlevel_; level > 0; level--) {
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    linklistsizeint *data = get_linklist(currObj, level);
+                    int size = getListCount(data);
+                    tableint *datal = (tableint *) (data + 1);
+                    for (int i = 0; i < size; i++) {
+                        tableint cand = datal[i];
+                        dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+                        if (d < curdist) {
+                            curdist = d;
+                            currObj = cand;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        auto top_candidates = num_deleted_
+            ? searchBaseLayerST<true>(currObj, query_data, std::max(ef_, k), isIdAllowed)
+            : searchBaseLayerST<false>(currObj, query_data, std::max(ef_, k), isIdAllowed);
+        while (top_candidates.size() > k) {
+            top_candidates.pop();
+        }
+        while (top_candidates.size() > 0) {
+            std::pair<dist_t, tableint> rez = top_candidates.top();
+            result.push(std::pair<dist_t, labeltype>(rez.first, getExternalLabel(rez.second)));
+            top_candidates.pop();
+        }
+        return result;
+    }
+};
+
+}  // namespace hnswlib
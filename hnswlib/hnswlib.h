@@ -116,10 +116,14 @@ static bool AVX512Capable() {
 }
 #endif
 
+#include <chrono>
 #include <queue>
 #include <vector>
 #include <iostream>
 #include <string.h>
+#include <stdexcept>
+#include "thread_pool.h"
+#include "bitmap.h"
 
 namespace hnswlib {
 typedef size_t labeltype;
@@ -128,9 +132,69 @@ typedef size_t labeltype;
 class BaseFilterFunctor {
  public:
     virtual bool operator()(hnswlib::labeltype id) { return true; }
+    // A bitmap over the internal ids of index equivalent to operator(), which the searches of index then
+    // test inline; nullptr if none for that index.
+    virtual const Bitmap *bitmap(const void *index) const { return nullptr; }
     virtual ~BaseFilterFunctor() {};
 };
 
+/*
+ * Filter allowing a set of labels. Bound to an index (HierarchicalNSW::bindFilter, which translates the
+ * labels once), it also holds a dense bitmap over the internal ids of that index, which its searches
+ * test without a virtual call or a label lookup; the bitmap is a snapshot of the elements present when
+ * it was bound. Other indexes ask operator(), a binary search over the labels.
+ */
+class BitmapFilter : public BaseFilterFunctor {
+ public:
+    std::vector<labeltype> labels;  // sorted, unique
+    Bitmap allowed;  // over the internal ids of index
+    const void *index{nullptr};
+
+    BitmapFilter() {}
+
+    explicit BitmapFilter(std::vector<labeltype> allowed_labels) : labels(std::move(allowed_labels)) {
+        std::sort(labels.begin(), labels.end());
+        labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+    }
+
+    bool operator()(labeltype label) override {
+        return std::binary_search(labels.begin(), labels.end(), label);
+    }
+
+    const Bitmap *bitmap(const void *for_index) const override {
+        return index && index == for_index ? &allowed : nullptr;
+    }
+};
+
+/*
+ * The filter of one search of index, resolved once: a bitmap over the internal ids of index is tested
+ * inline, any other functor through its virtual operator(). Allows everything without a filter.
+ */
+class FilterCheck {
+    BaseFilterFunctor *functor_;
+    const Bitmap *bitmap_;
+
+ public:
+    explicit FilterCheck(BaseFilterFunctor *functor, const void *index = nullptr)
+        : functor_(functor), bitmap_(functor ? functor->bitmap(index) : nullptr) {}
+
+    bool active() const {
+        return functor_ != nullptr;
+    }
+
+    bool operator()(labeltype label) const {
+        return !functor_ || (*functor_)(label);
+    }
+
+    // Whether the element with internal id internal_id is allowed; label_of() gives its label if needed.
+    template<typename LabelOf>
+    bool allows(size_t internal_id, LabelOf label_of) const {
+        if (bitmap_)
+            return bitmap_->test(internal_id);
+        return !functor_ || (*functor_)(label_of());
+    }
+};
+
 template<typename dist_t>
 class BaseSearchStopCondition {
  public:
@@ -149,6 +213,93 @@ class BaseSearchStopCondition {
     virtual ~BaseSearchStopCondition() {}
 };
 
+// Work done by one search
+struct SearchStats {
+    size_t hops{0};  // expanded nodes
+    size_t distance_computations{0};
+    size_t compares{0};  // distance comparisons in the candidate lists
+    uint64_t time_ns{0};
+    bool stopped_early{false};  // the distance budget or the deadline ended the search
+};
+
+// How a filtered search runs, see HierarchicalNSW::planFilteredSearch
+enum FilterStrategy {
+    FILTER_AUTO,  // chosen from the filter selectivity
+    FILTER_GRAPH,  // graph search, disallowed elements are still expanded
+    FILTER_TWO_HOP,  // graph search over allowed elements, reaching past disallowed neighbors
+    FILTER_BRUTE_FORCE  // exact scan of the allowed elements
+};
+
+/*
+ * Per-call search settings. Zero / unset members fall back to the index defaults (ef: the index ef,
+ * no distance budget, no deadline). max_distance_computations bounds the base layer search; a search
+ * stopped by the budget or the deadline returns the best results found so far. If stats is set it
+ * receives the SearchStats of the query (one entry per query for batched searches); otherwise no
+ * instrumentation runs at all. filter_selectivity is the fraction of elements filter allows, if known;
+ * bitmap filters are counted instead.
+ */
+struct SearchParams {
+    size_t k{1};
+    size_t ef{0};
+    BaseFilterFunctor *filter{nullptr};
+    float filter_selectivity{-1};
+    FilterStrategy filter_strategy{FILTER_AUTO};
+    size_t max_distance_computations{0};
+    std::chrono::steady_clock::time_point deadline{std::chrono::steady_clock::time_point::max()};
+    SearchStats *stats{nullptr};
+};
+
+/*
+ * Instrumentation policies for the search templates, passed by reference so that the counters live on
+ * the searching thread's stack and concurrent searches share nothing. NoSearchStats compiles to nothing.
+ */
+struct NoSearchStats {
+    void begin() {}
+    void addHop() {}
+    void addDistances(size_t) {}
+    void addCompare() {}
+    void addCompares(size_t) {}
+    void end(bool) {}
+};
+
+// Keeps the SearchStats of the last query in stats.
+struct PerQuerySearchStats {
+    SearchStats stats;
+    std::chrono::steady_clock::time_point start;
+
+    void begin() {
+        stats = SearchStats();
+        start = std::chrono::steady_clock::now();
+    }
+    void addHop() { stats.hops++; }
+    void addDistances(size_t count) { stats.distance_computations += count; }
+    void addCompare() { stats.compares++; }
+    void addCompares(size_t count) { stats.compares += count; }
+    void end(bool stopped_early) {
+        stats.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        stats.stopped_early = stopped_early;
+    }
+};
+
+// Adds every query to a total per thread, read and cleared with total(); stopped_early counts as "any".
+struct PerThreadSearchStats : public PerQuerySearchStats {
+    static SearchStats &total() {
+        static thread_local SearchStats total;
+        return total;
+    }
+
+    void end(bool stopped_early) {
+        PerQuerySearchStats::end(stopped_early);
+        SearchStats &sum = total();
+        sum.hops += stats.hops;
+        sum.distance_computations += stats.distance_computations;
+        sum.compares += stats.compares;
+        sum.time_ns += stats.time_ns;
+        sum.stopped_early = sum.stopped_early || stopped_early;
+    }
+};
+
 template <typename T>
 class pairGreater {
  public:
@@ -170,6 +321,11 @@ static void readBinaryPOD(std::istream &in, T &podRef) {
 template<typename MTYPE>
 using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+// Distances from one vector to count others: f(query, vectors, count, out, param) sets out[i] to the
+// distance between query and vectors[i], bit-identical to the space's DISTFUNC.
+template<typename MTYPE>
+using DISTFUNC_BATCH = void(*)(const void *, const void *const *, size_t, MTYPE *, const void *);
+
 template<typename MTYPE>
 class SpaceInterface {
  public:
@@ -178,6 +334,11 @@ class SpaceInterface {
 
     virtual DISTFUNC<MTYPE> get_dist_func() = 0;
 
+    // Optional batched kernel; nullptr if the space has none
+    virtual DISTFUNC_BATCH<MTYPE> get_dist_func_batch() {
+        return nullptr;
+    }
+
     virtual void *get_dist_func_param() = 0;
 
     virtual ~SpaceInterface() {}
@@ -191,23 +352,63 @@ class AlgorithmInterface {
     virtual std::priority_queue<std::pair<dist_t, labeltype>>
         searchKnn(const void*, size_t, BaseFilterFunctor* isIdAllowed = nullptr) const = 0;
 
+    // searchKnn with per-call settings; indexes that ignore ef, budget and deadline only use k and filter
+    virtual std::priority_queue<std::pair<dist_t, labeltype>>
+        searchKnn(const void* query_data, const SearchParams& params) const;
+
     // Return k nearest neighbor in the order of closer fist
     virtual std::vector<std::pair<dist_t, labeltype>>
         searchKnnCloserFirst(const void* query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const;
 
+    std::vector<std::pair<dist_t, labeltype>>
+        searchKnnCloserFirst(const void* query_data, const SearchParams& params) const;
+
+    // Searches n queries stored query_size bytes apart on the pool; row i of labels and distances
+    // (k entries each) gets the neighbors of query i, closer first. Throws if a query finds fewer than k.
+    void searchKnnParallel(const void* queries, size_t n, size_t query_size, size_t k,
+                           labeltype* labels, dist_t* distances, ThreadPool& pool,
+                           BaseFilterFunctor* isIdAllowed = nullptr) const {
+        SearchParams params;
+        params.k = k;
+        params.filter = isIdAllowed;
+        searchKnnParallel(queries, n, query_size, labels, distances, pool, params);
+    }
+
+    // As above with per-call settings; params.k entries per row
+    virtual void searchKnnParallel(const void* queries, size_t n, size_t query_size,
+                                   labeltype* labels, dist_t* distances, ThreadPool& pool,
+                                   const SearchParams& params) const;
+
     virtual void saveIndex(const std::string &location) = 0;
     virtual ~AlgorithmInterface(){
     }
 };
 
+template<typename dist_t>
+std::priority_queue<std::pair<dist_t, labeltype>>
+AlgorithmInterface<dist_t>::searchKnn(const void* query_data, const SearchParams& params) const {
+    if (params.stats)
+        *params.stats = SearchStats();
+    return searchKnn(query_data, params.k, params.filter);
+}
+
 template<typename dist_t>
 std::vector<std::pair<dist_t, labeltype>>
 AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t k,
                                                  BaseFilterFunctor* isIdAllowed) const {
+    SearchParams params;
+    params.k = k;
+    params.filter = isIdAllowed;
+    return searchKnnCloserFirst(query_data, params);
+}
+
+template<typename dist_t>
+std::vector<std::pair<dist_t, labeltype>>
+AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, const SearchParams& params) const {
     std::vector<std::pair<dist_t, labeltype>> result;
 
     // here searchKnn returns the result in the order of further first
-    auto ret = searchKnn(query_data, k, isIdAllowed);
+    auto ret = searchKnn(query_data, params);
     {
         size_t sz = ret.size();
         result.resize(sz);
@@ -219,6 +420,28 @@ AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t
 
     return result;
 }
+
+template<typename dist_t>
+void
+AlgorithmInterface<dist_t>::searchKnnParallel(const void* queries, size_t n, size_t query_size,
+                                              labeltype* labels, dist_t* distances, ThreadPool& pool,
+                                              const SearchParams& params) const {
+    size_t k = params.k;
+    pool.parallelFor(0, n, [&](size_t row, size_t) {
+        SearchParams row_params = params;
+        if (params.stats)
+            row_params.stats = params.stats + row;
+        auto result = searchKnn((const char*) queries + row * query_size, row_params);
+        if (result.size() != k)
+            throw std::runtime_error(
+                "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
+        for (size_t i = k; i > 0; i--) {
+            distances[row * k + i - 1] = result.top().first;
+            labels[row * k + i - 1] = result.top().second;
+            result.pop();
+        }
+    });
+}
 }  // namespace hnswlib
 
 #include "space_l2.h"
@@ -226,3 +449,5 @@ AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t
 #include "stop_condition.h"
 #include "bruteforce.h"
 #include "hnswalg.h"
+#include "hnswdisk.h"
+#include "hnswfrozen.h"
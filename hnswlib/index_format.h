@@ -0,0 +1,594 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <mutex>
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE4_2__) || (defined(_MSC_VER) && defined(__AVX__))
+#include <nmmintrin.h>
+#define HNSWLIB_HW_CRC32C
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HNSWLIB_ARM_CRC32C
+#endif
+
+namespace hnswlib {
+
+/*
+ * Index file format, version 2.
+ *
+ *   page 0:  IndexFileHeader, followed by num_sections IndexSectionEntry records
+ *   page k:  section payloads, each one starting on an INDEX_FILE_ALIGNMENT boundary
+ *
+ * Sections are located only through the section table, so readers skip the kinds they do not know
+ * and writers may append new kinds without bumping the version. A section that has SECTION_FLAG_CRC32C
+ * set carries the CRC32C of its payload.
+ *
+ * Legacy (version 1) files have no header and start with offsetLevel0_, a size_t that is always zero,
+ * so they can never be mistaken for a file starting with INDEX_FILE_MAGIC.
+ */
+static const char INDEX_FILE_MAGIC[8] = {'H', 'N', 'S', 'W', 'I', 'D', 'X', '\0'};
+static const uint32_t INDEX_FILE_VERSION = 2;
+static const uint32_t INDEX_FILE_ALIGNMENT = 4096;
+
+enum IndexSectionKind : uint32_t {
+    SECTION_METADATA = 1,      // IndexMetadata
+    SECTION_LEVEL0 = 2,        // data_level0_memory_ of the first cur_element_count elements
+    SECTION_UPPER_LEVELS = 3,  // int32 level per element, then the link lists of every element with level > 0
+    SECTION_LABELS = 4,        // labeltype per element
+    SECTION_DELETED = 5,       // uint64 words, bit i set if element i is marked deleted
+    SECTION_QUANTIZER = 6,     // parameters of a vector quantizer, owned by the index type that writes it
+    SECTION_VECTOR_CODES = 7,  // quantized vector per element, in the format of SECTION_QUANTIZER
+    SECTION_NODE_BLOCKS = 8,   // vector and level 0 links per element, packed in aligned blocks (hnswdisk.h)
+    SECTION_ATTRIBUTES = 9,    // attribute columns per element, in the format of AttributeStore (attributes.h)
+    SECTION_PIVOTS = 10,       // tableint internal id per pivot of a base_layer_only index (see buildPivots)
+};
+
+static const uint32_t SECTION_FLAG_CRC32C = 0x1;
+
+struct IndexFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t section_entry_size;
+    uint32_t num_sections;
+    uint32_t alignment;
+    uint32_t table_crc;  // CRC32C of the header (with table_crc = 0) and the section table
+    uint64_t file_size;
+};
+
+struct IndexSectionEntry {
+    uint32_t kind;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+/*
+ * Fixed-width copy of the HierarchicalNSW header. New fields are only ever appended:
+ * a reader zero-fills whatever an older writer did not store.
+ */
+struct IndexMetadata {
+    uint64_t offset_level0;
+    uint64_t max_elements;
+    uint64_t cur_element_count;
+    uint64_t size_data_per_element;
+    uint64_t label_offset;
+    uint64_t offset_data;
+    int32_t max_level;
+    uint32_t enterpoint_node;
+    uint64_t max_M;
+    uint64_t max_M0;
+    uint64_t M;
+    double mult;
+    uint64_t ef_construction;
+    uint64_t data_size;
+    uint64_t size_links_per_element;
+    uint64_t num_deleted;
+    uint32_t label_size;
+    uint32_t tableint_size;
+    uint64_t wal_lsn;  // LSN of the last write-ahead log record contained in the index (see wal.h)
+    uint32_t flags;  // INDEX_FLAG_*
+    float prune_alpha;  // NeighborSelection::alpha; 0 in files written before it was stored, meaning 1
+};
+
+static const uint32_t INDEX_FLAG_FLAT_GRAPH = 0x1;  // built with setFlatGraph: level 0 only
+static const uint32_t INDEX_FLAG_KEEP_PRUNED = 0x2;  // NeighborSelection::keep_pruned
+static const uint32_t INDEX_FLAG_EXTEND_CANDIDATES = 0x4;  // NeighborSelection::extend_candidates
+
+static_assert(sizeof(IndexFileHeader) == 40, "IndexFileHeader must not contain padding");
+static_assert(sizeof(IndexSectionEntry) == 32, "IndexSectionEntry must not contain padding");
+
+
+static inline uint64_t alignIndexOffset(uint64_t offset, uint64_t alignment = INDEX_FILE_ALIGNMENT) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+
+struct Crc32cTable {
+    uint32_t values[256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            values[i] = crc;
+        }
+    }
+};
+
+
+static inline const uint32_t *crc32cTable() {
+    static const Crc32cTable table;
+    return table.values;
+}
+
+
+/*
+ * Extends a CRC32C (Castagnoli) checksum with size more bytes:
+ * crc32cExtend(crc32cExtend(0, a, n), b, m) is the checksum of a followed by b.
+ * Uses the SSE4.2 / ARMv8 crc32c instructions when the compiler targets them.
+ */
+static inline uint32_t crc32cExtend(uint32_t crc, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *) data;
+    uint64_t c = ~crc;
+#if defined(HNSWLIB_HW_CRC32C) || defined(HNSWLIB_ARM_CRC32C)
+    while (size && ((uintptr_t) p & 7)) {
+#if defined(HNSWLIB_HW_CRC32C)
+        c = _mm_crc32_u8((uint32_t) c, *p);
+#else
+        c = __crc32cb((uint32_t) c, *p);
+#endif
+        p++;
+        size--;
+    }
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+#if defined(HNSWLIB_HW_CRC32C)
+#if defined(__x86_64__) || defined(_M_X64)
+        c = _mm_crc32_u64(c, word);
+#else
+        c = _mm_crc32_u32((uint32_t) c, (uint32_t) word);
+        c = _mm_crc32_u32((uint32_t) c, (uint32_t) (word >> 32));
+#endif
+#else
+        c = __crc32cd((uint32_t) c, word);
+#endif
+        p += 8;
+        size -= 8;
+    }
+#endif
+    const uint32_t *table = crc32cTable();
+    uint32_t c32 = (uint32_t) c;
+    while (size--) {
+        c32 = table[(c32 ^ *p++) & 0xff] ^ (c32 >> 8);
+    }
+    return ~c32;
+}
+
+
+static inline uint32_t crc32c(const void *data, size_t size) {
+    return crc32cExtend(0, data, size);
+}
+
+
+static inline uint32_t gf2MatrixTimes(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+
+static inline void gf2MatrixSquare(uint32_t *square, const uint32_t *mat) {
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2MatrixTimes(mat, mat[n]);
+}
+
+
+/*
+ * Checksum of a followed by b, given crc1 = crc32c(a), crc2 = crc32c(b) and the length of b.
+ * Lets chunks of a section be checksummed by different threads (same method as zlib's crc32_combine).
+ */
+static inline uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    if (len2 == 0)
+        return crc1;
+
+    uint32_t even[32];  // even-power-of-two zeros operator
+    uint32_t odd[32];   // odd-power-of-two zeros operator
+    odd[0] = 0x82F63B78;
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2MatrixSquare(even, odd);
+    gf2MatrixSquare(odd, even);
+
+    do {
+        gf2MatrixSquare(even, odd);
+        if (len2 & 1)
+            crc1 = gf2MatrixTimes(even, crc1);
+        len2 >>= 1;
+        if (len2 == 0)
+            break;
+        gf2MatrixSquare(odd, even);
+        if (len2 & 1)
+            crc1 = gf2MatrixTimes(odd, crc1);
+        len2 >>= 1;
+    } while (len2 != 0);
+    return crc1 ^ crc2;
+}
+
+
+/*
+ * Sink for index serialization. Lets the same writer target files, streams and memory buffers.
+ */
+class IndexOutput {
+ public:
+    virtual void write(const void *data, size_t size) = 0;
+
+    void writeZeros(size_t size) {
+        static const char zeros[256] = {0};
+        while (size) {
+            size_t chunk = std::min(size, sizeof(zeros));
+            write(zeros, chunk);
+            size -= chunk;
+        }
+    }
+
+    virtual ~IndexOutput() {}
+};
+
+
+class StreamIndexOutput : public IndexOutput {
+    std::ostream &out_;
+
+ public:
+    explicit StreamIndexOutput(std::ostream &out) : out_(out) {}
+
+    void write(const void *data, size_t size) override {
+        out_.write((const char *) data, size);
+        if (!out_)
+            throw std::runtime_error("Failed to write index");
+    }
+};
+
+
+/*
+ * Section table of a file being written: sections are laid out in the order they are added.
+ */
+class IndexFileLayout {
+ public:
+    std::vector<IndexSectionEntry> sections;
+
+    void addSection(uint32_t kind, uint64_t size, bool checksum) {
+        IndexSectionEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.kind = kind;
+        entry.flags = checksum ? SECTION_FLAG_CRC32C : 0;
+        entry.size = size;
+        sections.push_back(entry);
+    }
+
+    // Assigns offsets; call after all sections are added. Returns the file size.
+    uint64_t finalize() {
+        uint64_t offset = alignIndexOffset(sizeof(IndexFileHeader) + sections.size() * sizeof(IndexSectionEntry));
+        for (size_t i = 0; i < sections.size(); i++) {
+            sections[i].offset = offset;
+            offset = alignIndexOffset(offset + sections[i].size);
+        }
+        return offset;
+    }
+
+    uint64_t fileSize() const {
+        if (sections.empty())
+            return alignIndexOffset(sizeof(IndexFileHeader));
+        return alignIndexOffset(sections.back().offset + sections.back().size);
+    }
+
+    IndexSectionEntry &section(uint32_t kind) {
+        for (size_t i = 0; i < sections.size(); i++) {
+            if (sections[i].kind == kind)
+                return sections[i];
+        }
+        throw std::runtime_error("Unknown index section");
+    }
+
+    // Writes the header and the section table, padded up to the first section.
+    void writeHeader(IndexOutput &output) const {
+        IndexFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+        header.version = INDEX_FILE_VERSION;
+        header.header_size = sizeof(IndexFileHeader);
+        header.section_entry_size = sizeof(IndexSectionEntry);
+        header.num_sections = sections.size();
+        header.alignment = INDEX_FILE_ALIGNMENT;
+        header.file_size = fileSize();
+        uint32_t crc = crc32c(&header, sizeof(header));
+        header.table_crc = crc32cExtend(crc, sections.data(), sections.size() * sizeof(IndexSectionEntry));
+
+        output.write(&header, sizeof(header));
+        output.write(sections.data(), sections.size() * sizeof(IndexSectionEntry));
+        size_t table_end = sizeof(header) + sections.size() * sizeof(IndexSectionEntry);
+        size_t first_section = sections.empty() ? alignIndexOffset(table_end) : sections[0].offset;
+        output.writeZeros(first_section - table_end);
+    }
+};
+
+
+/*
+ * Source for index deserialization that supports positional reads.
+ * Inputs that report concurrentReads() may be read by several threads at once.
+ */
+class IndexInput {
+ public:
+    virtual void readAt(void *data, size_t size, uint64_t offset) = 0;
+
+    virtual uint64_t size() = 0;
+
+    virtual bool concurrentReads() const { return false; }
+
+    virtual ~IndexInput() {}
+};
+
+
+#ifndef _WIN32
+class FileIndexInput : public IndexInput {
+    int fd_;
+
+ public:
+    /*
+    * With direct, the file is opened with O_DIRECT if the file system supports it, bypassing the page
+    * cache; reads must then use INDEX_FILE_ALIGNMENT-aligned buffers, offsets and sizes.
+    */
+    explicit FileIndexInput(const std::string &location, bool direct = false) {
+        fd_ = -1;
+#ifdef O_DIRECT
+        if (direct)
+            fd_ = open(location.c_str(), O_RDONLY | O_DIRECT);
+#endif
+        if (fd_ < 0)
+            fd_ = open(location.c_str(), O_RDONLY);
+        if (fd_ < 0)
+            throw std::runtime_error("Cannot open file");
+    }
+
+    int fd() const { return fd_; }
+
+    void readAt(void *data, size_t size, uint64_t offset) override {
+        char *dst = (char *) data;
+        while (size) {
+            ssize_t n = pread(fd_, dst, size, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            dst += n;
+            size -= n;
+            offset += n;
+        }
+    }
+
+    uint64_t size() override {
+        struct stat st;
+        if (fstat(fd_, &st) != 0)
+            throw std::runtime_error("Cannot stat file");
+        return st.st_size;
+    }
+
+    bool concurrentReads() const override { return true; }
+
+    ~FileIndexInput() {
+        close(fd_);
+    }
+};
+
+
+/*
+ * Writes to a file descriptor in buffer-sized write() calls through a caller-provided buffer, so it
+ * never allocates. With O_DIRECT the buffer must be INDEX_FILE_ALIGNMENT-aligned; index files are a
+ * multiple of INDEX_FILE_ALIGNMENT long, so every write, including the last one, is then aligned.
+ */
+class FileIndexOutput : public IndexOutput {
+    int fd_;
+    char *buffer_;
+    size_t capacity_;
+    size_t used_{0};
+
+ public:
+    FileIndexOutput(int fd, char *buffer, size_t capacity) : fd_(fd), buffer_(buffer), capacity_(capacity) {}
+
+    void write(const void *data, size_t size) override {
+        const char *src = (const char *) data;
+        while (size) {
+            size_t n = std::min(size, capacity_ - used_);
+            memcpy(buffer_ + used_, src, n);
+            used_ += n;
+            src += n;
+            size -= n;
+            if (used_ == capacity_)
+                flush();
+        }
+    }
+
+    void flush() {
+        const char *src = buffer_;
+        while (used_) {
+            ssize_t n = ::write(fd_, src, used_);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw std::runtime_error("Failed to write index");
+            src += n;
+            used_ -= n;
+        }
+    }
+};
+#endif
+
+
+class StreamIndexInput : public IndexInput {
+    std::istream &in_;
+    std::streampos base_;
+    std::mutex lock_;
+
+ public:
+    explicit StreamIndexInput(std::istream &in) : in_(in) {
+        base_ = in_.tellg();
+    }
+
+    void readAt(void *data, size_t size, uint64_t offset) override {
+        std::unique_lock <std::mutex> lock(lock_);
+        in_.clear();
+        in_.seekg(base_ + (std::streamoff) offset, in_.beg);
+        in_.read((char *) data, size);
+        if (!in_)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+    }
+
+    uint64_t size() override {
+        std::unique_lock <std::mutex> lock(lock_);
+        in_.clear();
+        in_.seekg(0, in_.end);
+        std::streampos end = in_.tellg();
+        in_.seekg(base_, in_.beg);
+        return end - base_;
+    }
+};
+
+
+class MemoryIndexInput : public IndexInput {
+    const char *data_;
+    size_t size_;
+
+ public:
+    MemoryIndexInput(const void *data, size_t size) : data_((const char *) data), size_(size) {}
+
+    void readAt(void *data, size_t size, uint64_t offset) override {
+        if (offset > size_ || size > size_ - offset)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        memcpy(data, data_ + offset, size);
+    }
+
+    uint64_t size() override { return size_; }
+
+    bool concurrentReads() const override { return true; }
+};
+
+
+// Writes into a caller-provided span; throws if it is too small.
+class BufferIndexOutput : public IndexOutput {
+    char *data_;
+    size_t capacity_;
+    size_t size_{0};
+
+ public:
+    BufferIndexOutput(void *data, size_t capacity) : data_((char *) data), capacity_(capacity) {}
+
+    void write(const void *data, size_t size) override {
+        if (size > capacity_ - size_)
+            throw std::runtime_error("Buffer is too small for the index");
+        memcpy(data_ + size_, data, size);
+        size_ += size;
+    }
+
+    size_t size() const { return size_; }
+};
+
+
+#ifdef _WIN32
+class FileIndexInput : public IndexInput {
+    std::ifstream file_;
+    StreamIndexInput input_;
+
+ public:
+    explicit FileIndexInput(const std::string &location, bool direct = false) : file_(location, std::ios::binary), input_(file_) {
+        if (!file_.is_open())
+            throw std::runtime_error("Cannot open file");
+    }
+
+    void readAt(void *data, size_t size, uint64_t offset) override { input_.readAt(data, size, offset); }
+
+    uint64_t size() override { return input_.size(); }
+};
+#endif
+
+
+/*
+ * Reads and validates the header and section table. Returns false if the input does not start
+ * with INDEX_FILE_MAGIC, i.e. it holds a legacy index.
+ */
+static inline bool readIndexFileHeader(
+    IndexInput &input,
+    IndexFileHeader &header,
+    std::vector<IndexSectionEntry> &sections) {
+    uint64_t input_size = input.size();
+    memset(&header, 0, sizeof(header));
+    if (input_size < sizeof(header))
+        return false;
+    input.readAt(&header, sizeof(header), 0);
+    if (memcmp(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic)) != 0)
+        return false;
+
+    if (header.version > INDEX_FILE_VERSION)
+        throw std::runtime_error("Index file version is not supported");
+    if (header.header_size != sizeof(IndexFileHeader) || header.section_entry_size != sizeof(IndexSectionEntry) ||
+        header.file_size > input_size || sizeof(header) + header.num_sections * sizeof(IndexSectionEntry) > input_size)
+        throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+    sections.resize(header.num_sections);
+    input.readAt(sections.data(), sections.size() * sizeof(IndexSectionEntry), sizeof(header));
+
+    uint32_t stored_crc = header.table_crc;
+    header.table_crc = 0;
+    uint32_t crc = crc32c(&header, sizeof(header));
+    crc = crc32cExtend(crc, sections.data(), sections.size() * sizeof(IndexSectionEntry));
+    header.table_crc = stored_crc;
+    if (crc != stored_crc)
+        throw std::runtime_error("Index header checksum mismatch");
+
+    for (size_t i = 0; i < sections.size(); i++) {
+        // compared without a sum that could wrap
+        if (sections[i].offset > header.file_size || sections[i].size > header.file_size - sections[i].offset)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+    }
+    return true;
+}
+
+
+static inline const IndexSectionEntry *findIndexSection(const std::vector<IndexSectionEntry> &sections, uint32_t kind) {
+    for (size_t i = 0; i < sections.size(); i++) {
+        if (sections[i].kind == kind)
+            return &sections[i];
+    }
+    return nullptr;
+}
+
+
+static inline void checkIndexSectionCrc(const IndexSectionEntry &section, uint32_t crc) {
+    if ((section.flags & SECTION_FLAG_CRC32C) && section.crc != crc)
+        throw std::runtime_error("Index section checksum mismatch");
+}
+}  // namespace hnswlib
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+namespace hnswlib {
+
+/*
+ * Lets a snapshot wait for in-flight mutations to finish and hold new ones back for a short time.
+ * Mutations only touch an atomic counter while no pause is requested.
+ */
+class MutationGate {
+    std::atomic<size_t> in_flight_{0};
+    std::atomic<bool> paused_{false};
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::mutex pauser_lock_;  // one pause at a time
+
+ public:
+    void enter() {
+        while (true) {
+            in_flight_.fetch_add(1);
+            if (!paused_.load())
+                return;
+            leave();
+            std::unique_lock <std::mutex> lock(lock_);
+            cv_.wait(lock, [this] { return !paused_.load(); });
+        }
+    }
+
+    void leave() {
+        if (in_flight_.fetch_sub(1) == 1 && paused_.load()) {
+            std::unique_lock <std::mutex> lock(lock_);
+            cv_.notify_all();
+        }
+    }
+
+    // Blocks new mutations and waits for the in-flight ones to finish.
+    void pause() {
+        pauser_lock_.lock();
+        std::unique_lock <std::mutex> lock(lock_);
+        paused_.store(true);
+        cv_.wait(lock, [this] { return in_flight_.load() == 0; });
+    }
+
+    void resume() {
+        {
+            std::unique_lock <std::mutex> lock(lock_);
+            paused_.store(false);
+        }
+        cv_.notify_all();
+        pauser_lock_.unlock();
+    }
+};
+
+
+class MutationGuard {
+    MutationGate &gate_;
+
+ public:
+    explicit MutationGuard(MutationGate &gate) : gate_(gate) { gate_.enter(); }
+    ~MutationGuard() { gate_.leave(); }
+};
+
+
+class MutationPause {
+    MutationGate &gate_;
+
+ public:
+    explicit MutationPause(MutationGate &gate) : gate_(gate) { gate_.pause(); }
+    ~MutationPause() { gate_.resume(); }
+};
+
+}  // namespace hnswlib
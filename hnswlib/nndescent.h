@@ -0,0 +1,318 @@
+#pragma once
+
+#include "hnswlib.h"
+
+#include <atomic>
+#include <memory>
+
+namespace hnswlib {
+
+/*
+ * Bulk construction of a HierarchicalNSW over vectors known up front, instead of inserting them one at
+ * a time. An approximate kNN graph is built by NN-Descent (Dong et al., "Efficient k-nearest neighbor
+ * graph construction for generic similarity measures"): every element starts with K random neighbors,
+ * then repeatedly introduces its neighbors to each other (the local join) and keeps the K closest
+ * elements it has been introduced to, until an iteration improves fewer than delta * n * K entries.
+ * The local join computes the distances from one neighbor to all the others in one call of the
+ * space's batched kernel. Each kNN list is then pruned by the neighbor selection heuristic into the
+ * level 0 list of its element, the kept links are added back from the other side as addPoint does,
+ * and the upper levels are built over the elements their random level puts there (buildUpperLevels).
+ */
+struct NNDescentOptions {
+    size_t M = 16;
+    size_t ef_construction = 200;    // used to build the upper levels
+    size_t K = 0;                    // degree of the kNN graph; 0: 3 * M / 2
+    size_t max_candidates = 0;       // new and old neighbors joined per element and iteration; 0: K / 2
+    size_t max_iterations = 10;
+    float delta = 0.001f;            // stop once an iteration updates fewer than delta * n * K entries
+    bool build_upper_levels = true;  // otherwise the index searches level 0 only, from num_seeds pivots
+    NeighborSelection neighbor_selection;
+    size_t num_threads = 0;          // 0: hardware concurrency
+    size_t random_seed = 100;
+};
+
+
+/*
+ * The kNN lists of NN-Descent: per element up to K neighbors, closest first, each flagged while it has
+ * not taken part in a local join yet.
+ */
+template<typename dist_t>
+struct NNDescentGraph {
+    size_t K;
+    std::vector<dist_t> dists;  // n x K
+    std::vector<tableint> ids;
+    std::vector<char> fresh;
+    std::vector<size_t> sizes;
+    std::vector<std::atomic<dist_t>> bounds;  // distance of the K-th neighbor, to skip the lock
+    std::vector<std::mutex> locks;
+
+    NNDescentGraph(size_t n, size_t K)
+        : K(K), dists(n * K), ids(n * K), fresh(n * K), sizes(n, 0), bounds(n), locks(n) {
+        for (std::atomic<dist_t> &bound : bounds) {
+            bound.store(std::numeric_limits<dist_t>::max(), std::memory_order_relaxed);
+        }
+    }
+
+    // Adds id at dist to the list of element if it is among the K closest; returns whether it was added.
+    bool insert(tableint element, tableint id, dist_t dist) {
+        if (!(dist < bounds[element].load(std::memory_order_relaxed)))
+            return false;
+        std::unique_lock <std::mutex> lock(locks[element]);
+        dist_t *list_dists = &dists[element * K];
+        tableint *list_ids = &ids[element * K];
+        char *list_fresh = &fresh[element * K];
+        size_t size = sizes[element];
+        if (size == K && !(dist < list_dists[K - 1]))
+            return false;
+        for (size_t i = 0; i < size; i++) {
+            if (list_ids[i] == id)
+                return false;
+        }
+        size_t pos = size < K ? size : K - 1;
+        for (; pos > 0 && list_dists[pos - 1] > dist; pos--) {
+            list_dists[pos] = list_dists[pos - 1];
+            list_ids[pos] = list_ids[pos - 1];
+            list_fresh[pos] = list_fresh[pos - 1];
+        }
+        list_dists[pos] = dist;
+        list_ids[pos] = id;
+        list_fresh[pos] = 1;
+        if (size < K)
+            sizes[element] = ++size;
+        if (size == K)
+            bounds[element].store(list_dists[K - 1], std::memory_order_relaxed);
+        return true;
+    }
+};
+
+
+// Keeps at most count of ids, picked at random.
+static void sampleCandidates(std::vector<tableint> &ids, size_t count, std::mt19937 &rng) {
+    if (ids.size() <= count)
+        return;
+    for (size_t i = 0; i < count; i++) {
+        std::swap(ids[i], ids[i + rng() % (ids.size() - i)]);
+    }
+    ids.resize(count);
+}
+
+
+// Sorts ids and drops the duplicates and the ids also in exclude.
+static void uniqueCandidates(std::vector<tableint> &ids, const std::vector<tableint> &exclude) {
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    ids.erase(std::remove_if(ids.begin(), ids.end(), [&](tableint id) {
+        return std::find(exclude.begin(), exclude.end(), id) != exclude.end();
+    }), ids.end());
+}
+
+
+/*
+ * Runs NN-Descent over the elements of index (level 0 data in place, links not yet) and returns the
+ * kNN graph of degree K.
+ */
+template<typename dist_t>
+static std::unique_ptr<NNDescentGraph<dist_t>> buildKnnGraph(const HierarchicalNSW<dist_t> &index, size_t K,
+                                                             const NNDescentOptions &options, size_t num_threads) {
+    size_t n = index.cur_element_count;
+    K = std::min(K, n - 1);
+    std::unique_ptr<NNDescentGraph<dist_t>> graph(new NNDescentGraph<dist_t>(n, K));
+    size_t max_candidates = options.max_candidates ? options.max_candidates : std::max<size_t>(1, K / 2);
+    size_t num_ranges = HierarchicalNSW<dist_t>::parallelRangeCount(n, num_threads);
+
+    // random neighbors to start from
+    HierarchicalNSW<dist_t>::parallelRanges(n, num_threads, [&](size_t range_id, size_t begin, size_t end) {
+        std::mt19937 rng(options.random_seed + range_id);
+        std::vector<tableint> ids;
+        std::vector<const char *> vectors(K);
+        std::vector<dist_t> dists(K);
+        for (size_t i = begin; i < end; i++) {
+            ids.clear();
+            while (ids.size() < K) {
+                tableint id = rng() % n;
+                if (id != i && std::find(ids.begin(), ids.end(), id) == ids.end())
+                    ids.push_back(id);
+            }
+            index.computeDistances(index.getDataByInternalId(i), ids.data(), K, vectors.data(), dists.data());
+            for (size_t j = 0; j < K; j++) {
+                graph->insert(i, ids[j], dists[j]);
+            }
+        }
+    });
+
+    std::vector<std::vector<tableint>> new_candidates(n);
+    std::vector<std::vector<tableint>> old_candidates(n);
+    std::vector<std::vector<tableint>> new_reverse(n);
+    std::vector<std::vector<tableint>> old_reverse(n);
+    for (size_t iteration = 0; iteration < options.max_iterations; iteration++) {
+        // the neighbors of every element: a sample of the fresh ones, which are then no longer fresh,
+        // and the old ones, each also added to the reverse candidates of the neighbor
+        HierarchicalNSW<dist_t>::parallelRanges(n, num_threads, [&](size_t range_id, size_t begin, size_t end) {
+            std::mt19937 rng(options.random_seed + iteration * num_ranges + range_id);
+            std::vector<size_t> fresh_slots;
+            for (size_t i = begin; i < end; i++) {
+                std::vector<tableint> &new_ids = new_candidates[i];
+                std::vector<tableint> &old_ids = old_candidates[i];
+                new_ids.clear();
+                old_ids.clear();
+                fresh_slots.clear();
+                {
+                    std::unique_lock <std::mutex> lock(graph->locks[i]);
+                    for (size_t j = 0; j < graph->sizes[i]; j++) {
+                        if (graph->fresh[i * K + j])
+                            fresh_slots.push_back(j);
+                        else
+                            old_ids.push_back(graph->ids[i * K + j]);
+                    }
+                    for (size_t j = 0; j < fresh_slots.size() && j < max_candidates; j++) {
+                        std::swap(fresh_slots[j], fresh_slots[j + rng() % (fresh_slots.size() - j)]);
+                        graph->fresh[i * K + fresh_slots[j]] = 0;
+                        new_ids.push_back(graph->ids[i * K + fresh_slots[j]]);
+                    }
+                }
+                for (tableint id : new_ids) {
+                    std::unique_lock <std::mutex> lock(graph->locks[id]);
+                    new_reverse[id].push_back(i);
+                }
+                for (tableint id : old_ids) {
+                    std::unique_lock <std::mutex> lock(graph->locks[id]);
+                    old_reverse[id].push_back(i);
+                }
+            }
+        });
+
+        // local joins: new with new and new with old
+        std::vector<size_t> range_updates(num_ranges, 0);
+        HierarchicalNSW<dist_t>::parallelRanges(n, num_threads, [&](size_t range_id, size_t begin, size_t end) {
+            std::mt19937 rng(options.random_seed + (iteration + options.max_iterations) * num_ranges + range_id);
+            std::vector<tableint> others;
+            std::vector<const char *> vectors;
+            std::vector<dist_t> dists;
+            size_t updates = 0;
+            for (size_t i = begin; i < end; i++) {
+                std::vector<tableint> &new_ids = new_candidates[i];
+                std::vector<tableint> &old_ids = old_candidates[i];
+                sampleCandidates(new_reverse[i], max_candidates, rng);
+                sampleCandidates(old_reverse[i], max_candidates, rng);
+                new_ids.insert(new_ids.end(), new_reverse[i].begin(), new_reverse[i].end());
+                old_ids.insert(old_ids.end(), old_reverse[i].begin(), old_reverse[i].end());
+                std::vector<tableint>().swap(new_reverse[i]);
+                std::vector<tableint>().swap(old_reverse[i]);
+                uniqueCandidates(new_ids, std::vector<tableint>());
+                sampleCandidates(new_ids, max_candidates, rng);
+                uniqueCandidates(old_ids, new_ids);
+                sampleCandidates(old_ids, max_candidates, rng);
+
+                for (size_t a = 0; a < new_ids.size(); a++) {
+                    others.assign(new_ids.begin() + a + 1, new_ids.end());
+                    others.insert(others.end(), old_ids.begin(), old_ids.end());
+                    if (others.empty())
+                        continue;
+                    vectors.resize(others.size());
+                    dists.resize(others.size());
+                    index.computeDistances(index.getDataByInternalId(new_ids[a]), others.data(), others.size(),
+                                           vectors.data(), dists.data());
+                    for (size_t b = 0; b < others.size(); b++) {
+                        updates += graph->insert(new_ids[a], others[b], dists[b]);
+                        updates += graph->insert(others[b], new_ids[a], dists[b]);
+                    }
+                }
+            }
+            range_updates[range_id] = updates;
+        });
+
+        size_t updates = 0;
+        for (size_t range_updates_count : range_updates) {
+            updates += range_updates_count;
+        }
+        if (updates < options.delta * n * K)
+            break;
+    }
+    return graph;
+}
+
+
+/*
+ * Builds an index over the n vectors at data (each s->get_data_size() bytes, one after the other)
+ * with NN-Descent, see NNDescentOptions. labels may be nullptr, in which case vector i gets label i.
+ */
+template<typename dist_t>
+static HierarchicalNSW<dist_t> *buildNNDescent(
+    SpaceInterface<dist_t> *s,
+    const void *data,
+    const labeltype *labels,
+    size_t n,
+    const NNDescentOptions &options = NNDescentOptions()) {
+    size_t num_threads = options.num_threads ? options.num_threads : std::thread::hardware_concurrency();
+    std::unique_ptr<HierarchicalNSW<dist_t>> index(
+        new HierarchicalNSW<dist_t>(s, std::max<size_t>(1, n), options.M, options.ef_construction,
+                                    options.random_seed));
+    index->setNeighborSelection(options.neighbor_selection);
+    size_t data_size = s->get_data_size();
+
+    // level 0: vectors and labels
+    HierarchicalNSW<dist_t>::parallelRanges(n, num_threads, [&](size_t, size_t begin, size_t end) {
+        memset(index->data_level0_memory_ + begin * index->size_data_per_element_, 0,
+               (end - begin) * index->size_data_per_element_);
+        for (size_t i = begin; i < end; i++) {
+            labeltype label = labels ? labels[i] : i;
+            memcpy(index->getExternalLabeLp(i), &label, sizeof(labeltype));
+            memcpy(index->getDataByInternalId(i), (const char *) data + i * data_size, data_size);
+        }
+    });
+    index->cur_element_count = n;
+    index->label_lookup_.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        if (!index->label_lookup_.emplace(index->getExternalLabel(i), i).second)
+            throw std::runtime_error("Duplicate label in buildNNDescent");
+    }
+    if (n == 0)
+        return index.release();
+    index->enterpoint_node_ = 0;
+    index->maxlevel_ = 0;
+
+    if (n > 1) {
+        size_t K = options.K ? options.K : 3 * options.M / 2;
+        std::unique_ptr<NNDescentGraph<dist_t>> graph = buildKnnGraph(*index, K, options, num_threads);
+        K = graph->K;
+
+        // the heuristic picks the links of every element from its kNN list; the list keeps them for the
+        // pass that adds them back, since the level 0 lists change from then on
+        HierarchicalNSW<dist_t>::parallelRanges(n, num_threads, [&](size_t, size_t begin, size_t end) {
+            std::vector<std::pair<dist_t, tableint>> candidates;
+            for (size_t i = begin; i < end; i++) {
+                candidates.clear();
+                for (size_t j = 0; j < graph->sizes[i]; j++) {
+                    candidates.emplace_back(graph->dists[i * K + j], graph->ids[i * K + j]);
+                }
+                index->selectNeighbors(candidates, index->maxM0_);
+                linklistsizeint *ll = index->get_linklist0(i);
+                tableint *links = (tableint *) (ll + 1);
+                for (size_t j = 0; j < candidates.size(); j++) {
+                    links[j] = candidates[j].second;
+                    graph->dists[i * K + j] = candidates[j].first;
+                    graph->ids[i * K + j] = candidates[j].second;
+                }
+                index->setListCount(ll, candidates.size());
+                graph->sizes[i] = candidates.size();
+            }
+        });
+        HierarchicalNSW<dist_t>::parallelRanges(n, num_threads, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                for (size_t j = 0; j < graph->sizes[i]; j++) {
+                    index->connectBack(graph->ids[i * K + j], i, graph->dists[i * K + j], 0, true);
+                }
+            }
+        });
+    }
+
+    if (options.build_upper_levels) {
+        index->buildUpperLevels(num_threads);
+    } else {
+        index->base_layer_only = true;
+        index->buildPivots(0, options.random_seed);
+    }
+    return index.release();
+}
+
+}  // namespace hnswlib
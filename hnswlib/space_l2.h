@@ -52,6 +52,37 @@ L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_p
 
     return (res);
 }
+
+// Four vectors at a time sharing the query loads, each summed exactly like L2SqrSIMD16ExtAVX512.
+static void
+L2SqrSIMD16ExtAVX512Batch(const void *pVect1v, const void *const *pVect2v, size_t count, float *res,
+                          const void *qty_ptr) {
+    size_t qty16 = *((size_t *) qty_ptr) >> 4;
+    float PORTABLE_ALIGN64 TmpRes[4][16];
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float *pVect1 = (const float *) pVect1v;
+        const float *pVect2[4] = {(const float *) pVect2v[i], (const float *) pVect2v[i + 1],
+                                  (const float *) pVect2v[i + 2], (const float *) pVect2v[i + 3]};
+        __m512 sum[4] = {_mm512_set1_ps(0), _mm512_set1_ps(0), _mm512_set1_ps(0), _mm512_set1_ps(0)};
+        for (size_t j = 0; j < qty16; j++) {
+            __m512 v1 = _mm512_loadu_ps(pVect1 + 16 * j);
+            for (int v = 0; v < 4; v++) {
+                __m512 diff = _mm512_sub_ps(v1, _mm512_loadu_ps(pVect2[v] + 16 * j));
+                sum[v] = _mm512_add_ps(sum[v], _mm512_mul_ps(diff, diff));
+            }
+        }
+        for (int v = 0; v < 4; v++) {
+            _mm512_store_ps(TmpRes[v], sum[v]);
+            res[i + v] = TmpRes[v][0] + TmpRes[v][1] + TmpRes[v][2] + TmpRes[v][3] + TmpRes[v][4] + TmpRes[v][5] +
+                    TmpRes[v][6] + TmpRes[v][7] + TmpRes[v][8] + TmpRes[v][9] + TmpRes[v][10] + TmpRes[v][11] +
+                    TmpRes[v][12] + TmpRes[v][13] + TmpRes[v][14] + TmpRes[v][15];
+        }
+    }
+    for (; i < count; i++) {
+        res[i] = L2SqrSIMD16ExtAVX512(pVect1v, pVect2v[i], qty_ptr);
+    }
+}
 #endif
 
 #if defined(USE_AVX)
@@ -90,6 +121,39 @@ L2SqrSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
     return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
 }
 
+// Four vectors at a time sharing the query loads, each summed exactly like L2SqrSIMD16ExtAVX.
+static void
+L2SqrSIMD16ExtAVXBatch(const void *pVect1v, const void *const *pVect2v, size_t count, float *res,
+                       const void *qty_ptr) {
+    size_t qty16 = *((size_t *) qty_ptr) >> 4;
+    float PORTABLE_ALIGN32 TmpRes[4][8];
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float *pVect1 = (const float *) pVect1v;
+        const float *pVect2[4] = {(const float *) pVect2v[i], (const float *) pVect2v[i + 1],
+                                  (const float *) pVect2v[i + 2], (const float *) pVect2v[i + 3]};
+        __m256 sum[4] = {_mm256_set1_ps(0), _mm256_set1_ps(0), _mm256_set1_ps(0), _mm256_set1_ps(0)};
+        for (size_t j = 0; j < qty16; j++) {
+            __m256 v1_low = _mm256_loadu_ps(pVect1 + 16 * j);
+            __m256 v1_high = _mm256_loadu_ps(pVect1 + 16 * j + 8);
+            for (int v = 0; v < 4; v++) {
+                __m256 diff = _mm256_sub_ps(v1_low, _mm256_loadu_ps(pVect2[v] + 16 * j));
+                sum[v] = _mm256_add_ps(sum[v], _mm256_mul_ps(diff, diff));
+                diff = _mm256_sub_ps(v1_high, _mm256_loadu_ps(pVect2[v] + 16 * j + 8));
+                sum[v] = _mm256_add_ps(sum[v], _mm256_mul_ps(diff, diff));
+            }
+        }
+        for (int v = 0; v < 4; v++) {
+            _mm256_store_ps(TmpRes[v], sum[v]);
+            res[i + v] = TmpRes[v][0] + TmpRes[v][1] + TmpRes[v][2] + TmpRes[v][3] + TmpRes[v][4] + TmpRes[v][5] +
+                    TmpRes[v][6] + TmpRes[v][7];
+        }
+    }
+    for (; i < count; i++) {
+        res[i] = L2SqrSIMD16ExtAVX(pVect1v, pVect2v[i], qty_ptr);
+    }
+}
+
 #endif
 
 #if defined(USE_SSE)
@@ -141,10 +205,40 @@ L2SqrSIMD16ExtSSE(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
     _mm_store_ps(TmpRes, sum);
     return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
 }
+
+// Four vectors at a time sharing the query loads, each summed exactly like L2SqrSIMD16ExtSSE.
+static void
+L2SqrSIMD16ExtSSEBatch(const void *pVect1v, const void *const *pVect2v, size_t count, float *res,
+                       const void *qty_ptr) {
+    size_t qty16 = *((size_t *) qty_ptr) >> 4;
+    float PORTABLE_ALIGN32 TmpRes[4][4];
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float *pVect1 = (const float *) pVect1v;
+        const float *pVect2[4] = {(const float *) pVect2v[i], (const float *) pVect2v[i + 1],
+                                  (const float *) pVect2v[i + 2], (const float *) pVect2v[i + 3]};
+        __m128 sum[4] = {_mm_set1_ps(0), _mm_set1_ps(0), _mm_set1_ps(0), _mm_set1_ps(0)};
+        for (size_t j = 0; j < 4 * qty16; j++) {
+            __m128 v1 = _mm_loadu_ps(pVect1 + 4 * j);
+            for (int v = 0; v < 4; v++) {
+                __m128 diff = _mm_sub_ps(v1, _mm_loadu_ps(pVect2[v] + 4 * j));
+                sum[v] = _mm_add_ps(sum[v], _mm_mul_ps(diff, diff));
+            }
+        }
+        for (int v = 0; v < 4; v++) {
+            _mm_store_ps(TmpRes[v], sum[v]);
+            res[i + v] = TmpRes[v][0] + TmpRes[v][1] + TmpRes[v][2] + TmpRes[v][3];
+        }
+    }
+    for (; i < count; i++) {
+        res[i] = L2SqrSIMD16ExtSSE(pVect1v, pVect2v[i], qty_ptr);
+    }
+}
 #endif
 
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
 static DISTFUNC<float> L2SqrSIMD16Ext = L2SqrSIMD16ExtSSE;
+static DISTFUNC_BATCH<float> L2SqrSIMD16ExtBatch = L2SqrSIMD16ExtSSEBatch;
 
 static float
 L2SqrSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
@@ -158,6 +252,21 @@ L2SqrSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qt
     float res_tail = L2Sqr(pVect1, pVect2, &qty_left);
     return (res + res_tail);
 }
+
+static void
+L2SqrSIMD16ExtResidualsBatch(const void *pVect1v, const void *const *pVect2v, size_t count, float *res,
+                             const void *qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    L2SqrSIMD16ExtBatch(pVect1v, pVect2v, count, res, &qty16);
+    float *pVect1 = (float *) pVect1v + qty16;
+
+    size_t qty_left = qty - qty16;
+    for (size_t i = 0; i < count; i++) {
+        float res_tail = L2Sqr(pVect1, (float *) pVect2v[i] + qty16, &qty_left);
+        res[i] = res[i] + res_tail;
+    }
+}
 #endif
 
 
@@ -207,31 +316,41 @@ L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty
 
 class L2Space : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    DISTFUNC_BATCH<float> fstdistfunc_batch_;
     size_t data_size_;
     size_t dim_;
 
  public:
     L2Space(size_t dim) {
         fstdistfunc_ = L2Sqr;
+        fstdistfunc_batch_ = nullptr;
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
     #if defined(USE_AVX512)
-        if (AVX512Capable())
+        if (AVX512Capable()) {
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX512;
-        else if (AVXCapable())
+            L2SqrSIMD16ExtBatch = L2SqrSIMD16ExtAVX512Batch;
+        } else if (AVXCapable()) {
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
+            L2SqrSIMD16ExtBatch = L2SqrSIMD16ExtAVXBatch;
+        }
     #elif defined(USE_AVX)
-        if (AVXCapable())
+        if (AVXCapable()) {
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
+            L2SqrSIMD16ExtBatch = L2SqrSIMD16ExtAVXBatch;
+        }
     #endif
 
-        if (dim % 16 == 0)
+        if (dim % 16 == 0) {
             fstdistfunc_ = L2SqrSIMD16Ext;
-        else if (dim % 4 == 0)
+            fstdistfunc_batch_ = L2SqrSIMD16ExtBatch;
+        } else if (dim % 4 == 0) {
             fstdistfunc_ = L2SqrSIMD4Ext;
-        else if (dim > 16)
+        } else if (dim > 16) {
             fstdistfunc_ = L2SqrSIMD16ExtResiduals;
-        else if (dim > 4)
+            fstdistfunc_batch_ = L2SqrSIMD16ExtResidualsBatch;
+        } else if (dim > 4) {
             fstdistfunc_ = L2SqrSIMD4ExtResiduals;
+        }
 #endif
         dim_ = dim;
         data_size_ = dim * sizeof(float);
@@ -245,6 +364,10 @@ class L2Space : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    DISTFUNC_BATCH<float> get_dist_func_batch() {
+        return fstdistfunc_batch_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace hnswlib {
+
+/*
+ * Persistent pool of worker threads for parallel loops, shared by index build, batch search and the
+ * Python bindings so that short loops do not pay for thread creation.
+ *
+ * parallelFor splits the range evenly over the threads. Each thread takes shrinking chunks from the
+ * front of its own part; a thread that runs out steals the back half of the largest remaining
+ * part of another thread, so uneven per-item costs, like HNSW insertions, still balance.
+ * The calling thread works as thread 0. The first exception thrown by fn stops the loop and is
+ * rethrown to the caller once all threads are done.
+ *
+ * Loops from different threads run one after another. A loop started from inside a loop of the same
+ * pool runs serially on the calling worker.
+ */
+class ThreadPool {
+    struct Part {
+        std::mutex lock;
+        size_t begin{0};
+        size_t end{0};
+    };
+
+    size_t num_threads_;
+    std::vector<std::thread> workers_;
+    std::unique_ptr<Part[]> parts_;
+
+    std::mutex run_lock_;  // one loop at a time
+    std::mutex lock_;
+    std::condition_variable work_ready_;
+    std::condition_variable work_done_;
+    uint64_t generation_{0};
+    size_t busy_workers_{0};
+    bool stop_{false};
+
+    std::function<void(size_t, size_t, size_t)> job_;  // job_(begin, end, thread_id)
+    std::atomic<bool> failed_{false};
+    std::exception_ptr last_exception_{nullptr};
+    std::mutex last_exception_lock_;
+
+    static ThreadPool *&currentPool() {
+        static thread_local ThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    static size_t &currentThreadId() {
+        static thread_local size_t thread_id = 0;
+        return thread_id;
+    }
+
+    bool takeChunk(size_t thread_id, size_t &begin, size_t &end) {
+        Part &part = parts_[thread_id];
+        std::unique_lock <std::mutex> lock(part.lock);
+        if (part.begin >= part.end)
+            return false;
+        size_t chunk_size = std::max<size_t>(1, (part.end - part.begin) / 4);
+        begin = part.begin;
+        end = begin + chunk_size;
+        part.begin = end;
+        return true;
+    }
+
+    bool stealPart(size_t thread_id) {
+        size_t victim = num_threads_;
+        size_t victim_size = 0;
+        for (size_t i = 1; i < num_threads_; i++) {
+            size_t candidate = (thread_id + i) % num_threads_;
+            std::unique_lock <std::mutex> lock(parts_[candidate].lock);
+            size_t size = parts_[candidate].end - std::min(parts_[candidate].end, parts_[candidate].begin);
+            if (size > victim_size) {
+                victim = candidate;
+                victim_size = size;
+            }
+        }
+        if (victim == num_threads_)
+            return false;
+
+        size_t begin, end;
+        {
+            std::unique_lock <std::mutex> lock(parts_[victim].lock);
+            Part &part = parts_[victim];
+            if (part.begin >= part.end)
+                return true;  // taken meanwhile, look again
+            size_t middle = part.begin + (part.end - part.begin) / 2;
+            begin = middle;
+            end = part.end;
+            part.end = middle;
+        }
+        std::unique_lock <std::mutex> lock(parts_[thread_id].lock);
+        parts_[thread_id].begin = begin;
+        parts_[thread_id].end = end;
+        return true;
+    }
+
+    void work(size_t thread_id) {
+        while (!failed_) {
+            size_t begin, end;
+            if (!takeChunk(thread_id, begin, end)) {
+                if (!stealPart(thread_id))
+                    return;
+                continue;
+            }
+            try {
+                job_(begin, end, thread_id);
+            } catch (...) {
+                std::unique_lock <std::mutex> lock(last_exception_lock_);
+                last_exception_ = std::current_exception();
+                failed_ = true;
+            }
+        }
+    }
+
+    void workerLoop(size_t thread_id) {
+        currentPool() = this;
+        currentThreadId() = thread_id;
+        uint64_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock <std::mutex> lock(lock_);
+                work_ready_.wait(lock, [&] { return stop_ || generation_ != seen_generation; });
+                if (stop_)
+                    return;
+                seen_generation = generation_;
+            }
+            work(thread_id);
+            {
+                std::unique_lock <std::mutex> lock(lock_);
+                if (--busy_workers_ == 0)
+                    work_done_.notify_all();
+            }
+        }
+    }
+
+    static void pinThread(std::thread &thread, size_t cpu) {
+#if defined(__linux__)
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu % CPU_SETSIZE, &cpu_set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set), &cpu_set);
+#endif
+    }
+
+ public:
+    /*
+    * num_threads = 0 uses one thread per hardware thread. With pin_threads, worker i is bound to CPU
+    * i (Linux only; ignored elsewhere); the calling thread is left alone.
+    */
+    explicit ThreadPool(size_t num_threads = 0, bool pin_threads = false) {
+        if (num_threads == 0)
+            num_threads = std::thread::hardware_concurrency();
+        num_threads_ = std::max<size_t>(1, num_threads);
+        parts_.reset(new Part[num_threads_]);
+        size_t num_cpus = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t thread_id = 1; thread_id < num_threads_; thread_id++) {
+            workers_.push_back(std::thread(&ThreadPool::workerLoop, this, thread_id));
+            if (pin_threads)
+                pinThread(workers_.back(), thread_id % num_cpus);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::unique_lock <std::mutex> lock(lock_);
+            stop_ = true;
+        }
+        work_ready_.notify_all();
+        for (auto &thread : workers_) {
+            thread.join();
+        }
+    }
+
+    size_t size() const {
+        return num_threads_;
+    }
+
+    /*
+    * Calls fn(i, thread_id) for every i in [begin, end), with thread_id in [0, size()).
+    * Items with the same thread_id never run concurrently, so thread_id can index per-thread buffers.
+    */
+    template<typename Function>
+    void parallelFor(size_t begin, size_t end, Function fn) {
+        if (begin >= end)
+            return;
+        if (num_threads_ == 1 || end - begin == 1 || currentPool() == this) {
+            size_t thread_id = currentPool() == this ? currentThreadId() : 0;
+            for (size_t i = begin; i < end; i++) {
+                fn(i, thread_id);
+            }
+            return;
+        }
+
+        std::unique_lock <std::mutex> run_lock(run_lock_);
+        size_t count = end - begin;
+        for (size_t thread_id = 0; thread_id < num_threads_; thread_id++) {
+            std::unique_lock <std::mutex> lock(parts_[thread_id].lock);
+            parts_[thread_id].begin = begin + count * thread_id / num_threads_;
+            parts_[thread_id].end = begin + count * (thread_id + 1) / num_threads_;
+        }
+        job_ = [&fn](size_t chunk_begin, size_t chunk_end, size_t thread_id) {
+            for (size_t i = chunk_begin; i < chunk_end; i++) {
+                fn(i, thread_id);
+            }
+        };
+        failed_ = false;
+        last_exception_ = nullptr;
+        {
+            std::unique_lock <std::mutex> lock(lock_);
+            busy_workers_ = workers_.size();
+            generation_++;
+        }
+        work_ready_.notify_all();
+
+        // a worker of another pool gets its own pool and thread id back afterwards
+        ThreadPool *outer_pool = currentPool();
+        size_t outer_thread_id = currentThreadId();
+        currentPool() = this;
+        currentThreadId() = 0;
+        work(0);
+        currentPool() = outer_pool;
+        currentThreadId() = outer_thread_id;
+        {
+            std::unique_lock <std::mutex> lock(lock_);
+            work_done_.wait(lock, [this] { return busy_workers_ == 0; });
+        }
+        job_ = nullptr;
+        if (last_exception_)
+            std::rethrow_exception(last_exception_);
+    }
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,278 @@
+#pragma once
+
+#include "index_format.h"
+
+#include <stdio.h>
+#include <string>
+#include <condition_variable>
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+namespace hnswlib {
+
+/*
+ * Write-ahead log of index mutations, used to persist an index incrementally between snapshots.
+ *
+ *   WalFileHeader, then records: WalRecordHeader followed by data_size bytes of vector data
+ *   (only for WAL_ADD_POINT records).
+ *
+ * Every record carries a log sequence number (LSN). A snapshot stores the LSN of the last mutation it
+ * contains, so recovery loads the snapshot and replays only the records after it. A torn or corrupted
+ * record ends the log: it and everything after it are dropped when the log is opened.
+ */
+static const char WAL_FILE_MAGIC[8] = {'H', 'N', 'S', 'W', 'W', 'A', 'L', '\0'};
+static const uint32_t WAL_FILE_VERSION = 1;
+
+enum WalRecordType {
+    WAL_ADD_POINT = 1,  // addPoint, either an insertion or an update
+    WAL_MARK_DELETE = 2,
+    WAL_UNMARK_DELETE = 3
+};
+
+static const uint8_t WAL_FLAG_REPLACE_DELETED = 0x1;
+
+struct WalFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t data_size;  // size of the vectors in WAL_ADD_POINT records
+    uint64_t reserved;
+};
+
+struct WalRecordHeader {
+    uint32_t crc;  // CRC32C of the rest of the header and the data
+    uint32_t data_size;
+    uint64_t lsn;
+    uint64_t label;
+    uint8_t type;
+    uint8_t flags;
+    uint8_t reserved[6];
+};
+
+static_assert(sizeof(WalFileHeader) == 24, "WalFileHeader must not contain padding");
+static_assert(sizeof(WalRecordHeader) == 32, "WalRecordHeader must not contain padding");
+
+
+static inline uint32_t walRecordCrc(const WalRecordHeader &header, const void *data) {
+    uint32_t crc = crc32c((const char *) &header + sizeof(header.crc), sizeof(header) - sizeof(header.crc));
+    return crc32cExtend(crc, data, header.data_size);
+}
+
+
+static inline bool syncFile(FILE *file) {
+    if (fflush(file) != 0)
+        return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+
+static inline bool truncateFile(FILE *file, uint64_t size) {
+#ifdef _WIN32
+    return _chsize_s(_fileno(file), size) == 0;
+#else
+    return ftruncate(fileno(file), size) == 0;
+#endif
+}
+
+
+/*
+ * Calls fn(header, data) for every valid record of the log at location, in LSN order.
+ * Returns the size of the valid prefix of the file, or 0 if the file does not exist.
+ */
+template<typename Function>
+static uint64_t readWal(const std::string &location, size_t data_size, uint64_t *last_lsn, Function fn) {
+    FILE *file = fopen(location.c_str(), "rb");
+    if (file == nullptr)
+        return 0;
+
+    WalFileHeader file_header;
+    if (fread(&file_header, sizeof(file_header), 1, file) != 1 ||
+        memcmp(file_header.magic, WAL_FILE_MAGIC, sizeof(file_header.magic)) != 0 ||
+        file_header.version != WAL_FILE_VERSION) {
+        fclose(file);
+        throw std::runtime_error("Write-ahead log seems to be corrupted or unsupported");
+    }
+    if (file_header.data_size != data_size) {
+        fclose(file);
+        throw std::runtime_error("Write-ahead log data size does not match the index");
+    }
+
+    uint64_t valid_end = sizeof(file_header);
+    std::vector<char> data(data_size);
+    WalRecordHeader header;
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        if (header.data_size != 0 && header.data_size != data_size)
+            break;
+        if (header.data_size && fread(data.data(), header.data_size, 1, file) != 1)
+            break;
+        if (walRecordCrc(header, data.data()) != header.crc || header.lsn <= *last_lsn)
+            break;
+        *last_lsn = header.lsn;
+        fn(header, data.data());
+        valid_end += sizeof(header) + header.data_size;
+    }
+    fclose(file);
+    return valid_end;
+}
+
+
+/*
+ * Appending side of the log, with group commit: append() only queues the encoded record, and
+ * waitDurable() lets one waiting thread write and sync everything queued so far in a single
+ * write while the others wait for it.
+ */
+class WriteAheadLog {
+    std::string location_;
+    size_t data_size_;
+    bool sync_;
+    FILE *file_{nullptr};
+
+    std::mutex lock_;
+    std::condition_variable flushed_;
+    std::vector<char> pending_;       // records queued since the last write
+    std::vector<char> write_buffer_;  // records being written by the current leader
+    uint64_t last_lsn_{0};
+    uint64_t durable_lsn_{0};
+    bool flushing_{false};
+    bool failed_{false};
+
+    void createFile() {
+        file_ = fopen(location_.c_str(), "w+b");
+        if (file_ == nullptr)
+            throw std::runtime_error("Cannot open write-ahead log");
+        WalFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, WAL_FILE_MAGIC, sizeof(header.magic));
+        header.version = WAL_FILE_VERSION;
+        header.data_size = data_size_;
+        if (fwrite(&header, sizeof(header), 1, file_) != 1 || !syncFile(file_))
+            throw std::runtime_error("Failed to write the write-ahead log");
+    }
+
+    bool writeRecords(const std::vector<char> &records) {
+        if (records.empty())
+            return true;
+        if (fwrite(records.data(), records.size(), 1, file_) != 1)
+            return false;
+        return sync_ ? syncFile(file_) : fflush(file_) == 0;
+    }
+
+ public:
+    /*
+    * Opens the log at location for appending, creating it if needed. Records after the last valid
+    * one are truncated. New records get LSNs above both the last logged one and min_lsn.
+    * With sync, waitDurable() returns only once the records are on disk; otherwise once they
+    * reached the operating system.
+    */
+    WriteAheadLog(const std::string &location, size_t data_size, bool sync, uint64_t min_lsn)
+        : location_(location), data_size_(data_size), sync_(sync) {
+        uint64_t last_lsn = 0;
+        uint64_t valid_end = readWal(location, data_size, &last_lsn, [](const WalRecordHeader &, const char *) {});
+        if (valid_end == 0) {
+            createFile();
+        } else {
+            file_ = fopen(location.c_str(), "r+b");
+            if (file_ == nullptr || !truncateFile(file_, valid_end) || fseek(file_, 0, SEEK_END) != 0) {
+                if (file_)
+                    fclose(file_);
+                throw std::runtime_error("Cannot open write-ahead log");
+            }
+        }
+        last_lsn_ = std::max(last_lsn, min_lsn);
+        durable_lsn_ = last_lsn_;
+    }
+
+    ~WriteAheadLog() {
+        std::unique_lock <std::mutex> lock(lock_);
+        flushed_.wait(lock, [this] { return !flushing_; });
+        if (file_ == nullptr)
+            return;
+        if (!failed_)
+            writeRecords(pending_);
+        fclose(file_);
+    }
+
+    // Queues a record and returns its LSN. Records are written in the order they are appended.
+    uint64_t append(uint8_t type, uint8_t flags, uint64_t label, const void *data) {
+        WalRecordHeader header;
+        memset(&header, 0, sizeof(header));
+        header.data_size = data ? data_size_ : 0;
+        header.label = label;
+        header.type = type;
+        header.flags = flags;
+
+        std::unique_lock <std::mutex> lock(lock_);
+        header.lsn = ++last_lsn_;
+        header.crc = walRecordCrc(header, data);
+        size_t offset = pending_.size();
+        pending_.resize(offset + sizeof(header) + header.data_size);
+        memcpy(pending_.data() + offset, &header, sizeof(header));
+        if (header.data_size)
+            memcpy(pending_.data() + offset + sizeof(header), data, header.data_size);
+        return header.lsn;
+    }
+
+    // Returns once the record with the given LSN (and all before it) is written.
+    void waitDurable(uint64_t lsn) {
+        std::unique_lock <std::mutex> lock(lock_);
+        while (durable_lsn_ < lsn) {
+            if (failed_)
+                throw std::runtime_error("Failed to write the write-ahead log");
+            if (flushing_) {
+                flushed_.wait(lock);
+                continue;
+            }
+            // become the leader and write everything queued so far
+            flushing_ = true;
+            write_buffer_.clear();
+            write_buffer_.swap(pending_);
+            uint64_t batch_lsn = last_lsn_;
+            lock.unlock();
+            bool ok = writeRecords(write_buffer_);
+            lock.lock();
+            flushing_ = false;
+            if (ok)
+                durable_lsn_ = batch_lsn;
+            else
+                failed_ = true;
+            flushed_.notify_all();
+        }
+    }
+
+    uint64_t lastLsn() {
+        std::unique_lock <std::mutex> lock(lock_);
+        return last_lsn_;
+    }
+
+    /*
+    * Moves the records logged so far to old_location and continues in an empty log.
+    * Used by checkpoints; appends are blocked meanwhile.
+    */
+    void rotate(const std::string &old_location) {
+        std::unique_lock <std::mutex> lock(lock_);
+        flushed_.wait(lock, [this] { return !flushing_; });
+        if (failed_ || !writeRecords(pending_) || !syncFile(file_))
+            throw std::runtime_error("Failed to write the write-ahead log");
+        pending_.clear();
+        fclose(file_);
+        file_ = nullptr;
+        if (rename(location_.c_str(), old_location.c_str()) != 0) {
+            failed_ = true;
+            throw std::runtime_error("Failed to rotate the write-ahead log");
+        }
+        try {
+            createFile();
+        } catch (...) {
+            failed_ = true;
+            throw;
+        }
+        durable_lsn_ = last_lsn_;
+        flushed_.notify_all();
+    }
+};
+
+}  // namespace hnswlib
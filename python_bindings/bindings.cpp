@@ -6,6 +6,8 @@
 #include "hnswlib.h"
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <mutex>
 #include <stdlib.h>
 #include <assert.h>
 
@@ -13,65 +15,37 @@ namespace py = pybind11;
 using namespace pybind11::literals;  // needed to bring in _a literal
 
 /*
- * replacement for the openmp '#pragma omp parallel for' directive
- * only handles a subset of functionality (no reductions etc)
- * Process ids from start (inclusive) to end (EXCLUSIVE)
- *
- * The method is borrowed from nmslib
+ * Keeps the worker threads of an index alive between add_items/knn_query calls. A call takes an idle
+ * pool with the number of threads it asks for, or a new one if all of them are busy, and hands it back
+ * when it is done; so calls from different Python threads still run in parallel instead of queueing on
+ * one pool. Idle pools of another size are dropped.
  */
-template<class Function>
-inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-    }
+class ThreadPoolCache {
+    std::mutex lock;
+    std::vector<std::unique_ptr<hnswlib::ThreadPool>> idle;
 
-    if (numThreads == 1) {
-        for (size_t id = start; id < end; id++) {
-            fn(id, 0);
-        }
-    } else {
-        std::vector<std::thread> threads;
-        std::atomic<size_t> current(start);
-
-        // keep track of exceptions in threads
-        // https://stackoverflow.com/a/32428427/1713196
-        std::exception_ptr lastException = nullptr;
-        std::mutex lastExceptMutex;
-
-        for (size_t threadId = 0; threadId < numThreads; ++threadId) {
-            threads.push_back(std::thread([&, threadId] {
-                while (true) {
-                    size_t id = current.fetch_add(1);
-
-                    if (id >= end) {
-                        break;
-                    }
-
-                    try {
-                        fn(id, threadId);
-                    } catch (...) {
-                        std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
-                        lastException = std::current_exception();
-                        /*
-                         * This will work even when current is the largest value that
-                         * size_t can fit, because fetch_add returns the previous value
-                         * before the increment (what will result in overflow
-                         * and produce 0 instead of current + 1).
-                         */
-                        current = end;
-                        break;
-                    }
-                }
-            }));
-        }
-        for (auto &thread : threads) {
-            thread.join();
-        }
-        if (lastException) {
-            std::rethrow_exception(lastException);
+ public:
+    std::shared_ptr<hnswlib::ThreadPool> get(int num_threads) {
+        if (num_threads <= 0)
+            num_threads = std::thread::hardware_concurrency();
+        size_t size = std::max(1, num_threads);
+        std::unique_ptr<hnswlib::ThreadPool> pool;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (!idle.empty() && !pool) {
+                if (idle.back()->size() == size)
+                    pool = std::move(idle.back());
+                idle.pop_back();
+            }
         }
+        if (!pool)
+            pool.reset(new hnswlib::ThreadPool(size));
+        return std::shared_ptr<hnswlib::ThreadPool>(pool.release(), [this](hnswlib::ThreadPool *returned) {
+            std::unique_lock<std::mutex> guard(lock);
+            idle.emplace_back(returned);
+        });
     }
-}
+};
 
 
 inline void assert_true(bool expr, const std::string & msg) {
@@ -94,6 +68,61 @@ class CustomFilterFunctor: public hnswlib::BaseFilterFunctor {
 };
 
 
+/*
+ * The filter argument of knn_query: None, a callable taking a label, a bool/uint8 mask indexed by label,
+ * or an array of allowed labels. Arrays become a BitmapFilter, which searches check without calling back
+ * into Python; bind() it to an HNSW index so its searches test internal ids. Build it while holding the GIL.
+ */
+class QueryFilter {
+    hnswlib::BitmapFilter bitmap_filter;
+    std::unique_ptr<CustomFilterFunctor> callback_filter;
+
+ public:
+    hnswlib::BaseFilterFunctor *filter{nullptr};
+
+    explicit QueryFilter(const py::object &filter_arg) {
+        if (filter_arg.is_none())
+            return;
+        if (py::isinstance<py::array>(filter_arg)) {
+            py::array array = filter_arg.cast<py::array>();
+            char kind = array.dtype().kind();
+            std::vector<hnswlib::labeltype> labels;
+            if (kind == 'b' || (kind == 'u' && array.itemsize() == 1)) {
+                py::array_t<uint8_t, py::array::c_style | py::array::forcecast> mask(array);
+                const uint8_t *values = mask.data();
+                for (py::ssize_t i = 0; i < mask.size(); i++) {
+                    if (values[i])
+                        labels.push_back(i);
+                }
+            } else if (kind == 'i' || kind == 'u') {
+                py::array_t<int64_t, py::array::c_style | py::array::forcecast> ids(array);
+                const int64_t *values = ids.data();
+                labels.reserve(ids.size());
+                for (py::ssize_t i = 0; i < ids.size(); i++) {
+                    if (values[i] < 0)
+                        throw std::runtime_error("Filter ids must be non-negative labels");
+                    labels.push_back(values[i]);
+                }
+            } else {
+                throw std::runtime_error("Filter array must be a bool/uint8 mask or an array of integer labels");
+            }
+            bitmap_filter = hnswlib::BitmapFilter(std::move(labels));
+            filter = &bitmap_filter;
+            return;
+        }
+        callback_filter.reset(new CustomFilterFunctor(filter_arg.cast<std::function<bool(hnswlib::labeltype)>>()));
+        filter = callback_filter.get();
+    }
+
+    // Translates the labels of an array filter to the internal ids of index, once for the whole query
+    template<typename dist_t>
+    void bind(const hnswlib::HierarchicalNSW<dist_t> &index) {
+        if (filter == &bitmap_filter)
+            index.bindFilter(bitmap_filter);
+    }
+};
+
+
 inline void get_input_array_shapes(const py::buffer_info& buffer, size_t* rows, size_t* features) {
     if (buffer.ndim != 2 && buffer.ndim != 1) {
         char msg[256];
@@ -145,7 +174,7 @@ inline std::vector<size_t> get_input_ids_and_check_shapes(const py::object& ids_
 template<typename dist_t, typename data_t = float>
 class Index {
  public:
-    static const int ser_version = 1;  // serialization version
+    static const int ser_version = 2;  // serialization version
 
     std::string space_name;
     int dim;
@@ -159,6 +188,7 @@ class Index {
     hnswlib::labeltype cur_l;
     hnswlib::HierarchicalNSW<dist_t>* appr_alg;
     hnswlib::SpaceInterface<float>* l2space;
+    ThreadPoolCache thread_pools;
 
 
     Index(const std::string &space_name, const int dim) : space_name(space_name), dim(dim) {
@@ -260,45 +290,28 @@ class Index {
         if (features != dim)
             throw std::runtime_error("Wrong dimensionality of the vectors");
 
-        // avoid using threads when the number of additions is small:
-        if (rows <= num_threads * 4) {
-            num_threads = 1;
-        }
-
         std::vector<size_t> ids = get_input_ids_and_check_shapes(ids_, rows);
-
-        {
-            int start = 0;
-            if (!ep_added) {
-                size_t id = ids.size() ? ids.at(0) : (cur_l);
-                float* vector_data = (float*)items.data(0);
-                std::vector<float> norm_array(dim);
-                if (normalize) {
-                    normalize_vector(vector_data, norm_array.data());
-                    vector_data = norm_array.data();
-                }
-                appr_alg->addPoint((void*)vector_data, (size_t)id, replace_deleted);
-                start = 1;
-                ep_added = true;
+        if (ids.empty()) {
+            ids.resize(rows);
+            for (size_t row = 0; row < rows; row++) {
+                ids[row] = cur_l + row;
             }
+        }
 
+        {
             py::gil_scoped_release l;
-            if (normalize == false) {
-                ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
-                    size_t id = ids.size() ? ids.at(row) : (cur_l + row);
-                    appr_alg->addPoint((void*)items.data(row), (size_t)id, replace_deleted);
-                    });
-            } else {
-                std::vector<float> norm_array(num_threads * dim);
-                ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
-                    // normalize vector:
-                    size_t start_idx = threadId * dim;
-                    normalize_vector((float*)items.data(row), (norm_array.data() + start_idx));
-
-                    size_t id = ids.size() ? ids.at(row) : (cur_l + row);
-                    appr_alg->addPoint((void*)(norm_array.data() + start_idx), (size_t)id, replace_deleted);
+            const void *vector_data = rows ? items.data(0) : nullptr;
+            std::shared_ptr<hnswlib::ThreadPool> pool = thread_pools.get(num_threads);
+            std::vector<float> norm_array;
+            if (normalize) {
+                norm_array.resize(rows * dim);
+                pool->parallelFor(0, rows, [&](size_t row, size_t threadId) {
+                    normalize_vector((float*)items.data(row), norm_array.data() + row * dim);
                     });
+                vector_data = norm_array.data();
             }
+            appr_alg->addPoints(vector_data, ids.data(), rows, *pool, replace_deleted);
+            ep_added = true;
             cur_l += rows;
         }
     }
@@ -348,122 +361,8 @@ class Index {
     }
 
 
-    py::dict getAnnData() const { /* WARNING: Index::getAnnData is not thread-safe with Index::addItems */
-        std::unique_lock <std::mutex> templock(appr_alg->global);
-
-        size_t level0_npy_size = appr_alg->cur_element_count * appr_alg->size_data_per_element_;
-        size_t link_npy_size = 0;
-        std::vector<size_t> link_npy_offsets(appr_alg->cur_element_count);
-
-        for (size_t i = 0; i < appr_alg->cur_element_count; i++) {
-            size_t linkListSize = appr_alg->element_levels_[i] > 0 ? appr_alg->size_links_per_element_ * appr_alg->element_levels_[i] : 0;
-            link_npy_offsets[i] = link_npy_size;
-            if (linkListSize)
-                link_npy_size += linkListSize;
-        }
-
-        char* data_level0_npy = (char*)malloc(level0_npy_size);
-        char* link_list_npy = (char*)malloc(link_npy_size);
-        int* element_levels_npy = (int*)malloc(appr_alg->element_levels_.size() * sizeof(int));
-
-        hnswlib::labeltype* label_lookup_key_npy = (hnswlib::labeltype*)malloc(appr_alg->label_lookup_.size() * sizeof(hnswlib::labeltype));
-        hnswlib::tableint* label_lookup_val_npy = (hnswlib::tableint*)malloc(appr_alg->label_lookup_.size() * sizeof(hnswlib::tableint));
-
-        memset(label_lookup_key_npy, -1, appr_alg->label_lookup_.size() * sizeof(hnswlib::labeltype));
-        memset(label_lookup_val_npy, -1, appr_alg->label_lookup_.size() * sizeof(hnswlib::tableint));
-
-        size_t idx = 0;
-        for (auto it = appr_alg->label_lookup_.begin(); it != appr_alg->label_lookup_.end(); ++it) {
-            label_lookup_key_npy[idx] = it->first;
-            label_lookup_val_npy[idx] = it->second;
-            idx++;
-        }
-
-        memset(link_list_npy, 0, link_npy_size);
-
-        memcpy(data_level0_npy, appr_alg->data_level0_memory_, level0_npy_size);
-        memcpy(element_levels_npy, appr_alg->element_levels_.data(), appr_alg->element_levels_.size() * sizeof(int));
-
-        for (size_t i = 0; i < appr_alg->cur_element_count; i++) {
-            size_t linkListSize = appr_alg->element_levels_[i] > 0 ? appr_alg->size_links_per_element_ * appr_alg->element_levels_[i] : 0;
-            if (linkListSize) {
-                memcpy(link_list_npy + link_npy_offsets[i], appr_alg->linkLists_[i], linkListSize);
-            }
-        }
-
-        py::capsule free_when_done_l0(data_level0_npy, [](void* f) {
-            delete[] f;
-            });
-        py::capsule free_when_done_lvl(element_levels_npy, [](void* f) {
-            delete[] f;
-            });
-        py::capsule free_when_done_lb(label_lookup_key_npy, [](void* f) {
-            delete[] f;
-            });
-        py::capsule free_when_done_id(label_lookup_val_npy, [](void* f) {
-            delete[] f;
-            });
-        py::capsule free_when_done_ll(link_list_npy, [](void* f) {
-            delete[] f;
-            });
-
-        /*  TODO: serialize state of random generators appr_alg->level_generator_ and appr_alg->update_probability_generator_  */
-        /*        for full reproducibility / to avoid re-initializing generators inside Index::createFromParams         */
-
+    py::dict getStateParams() const {
         return py::dict(
-            "offset_level0"_a = appr_alg->offsetLevel0_,
-            "max_elements"_a = appr_alg->max_elements_,
-            "cur_element_count"_a = (size_t)appr_alg->cur_element_count,
-            "size_data_per_element"_a = appr_alg->size_data_per_element_,
-            "label_offset"_a = appr_alg->label_offset_,
-            "offset_data"_a = appr_alg->offsetData_,
-            "max_level"_a = appr_alg->maxlevel_,
-            "enterpoint_node"_a = appr_alg->enterpoint_node_,
-            "max_M"_a = appr_alg->maxM_,
-            "max_M0"_a = appr_alg->maxM0_,
-            "M"_a = appr_alg->M_,
-            "mult"_a = appr_alg->mult_,
-            "ef_construction"_a = appr_alg->ef_construction_,
-            "ef"_a = appr_alg->ef_,
-            "has_deletions"_a = (bool)appr_alg->num_deleted_,
-            "size_links_per_element"_a = appr_alg->size_links_per_element_,
-            "allow_replace_deleted"_a = appr_alg->allow_replace_deleted_,
-
-            "label_lookup_external"_a = py::array_t<hnswlib::labeltype>(
-                { appr_alg->label_lookup_.size() },  // shape
-                { sizeof(hnswlib::labeltype) },  // C-style contiguous strides for each index
-                label_lookup_key_npy,  // the data pointer
-                free_when_done_lb),
-
-            "label_lookup_internal"_a = py::array_t<hnswlib::tableint>(
-                { appr_alg->label_lookup_.size() },  // shape
-                { sizeof(hnswlib::tableint) },  // C-style contiguous strides for each index
-                label_lookup_val_npy,  // the data pointer
-                free_when_done_id),
-
-            "element_levels"_a = py::array_t<int>(
-                { appr_alg->element_levels_.size() },  // shape
-                { sizeof(int) },  // C-style contiguous strides for each index
-                element_levels_npy,  // the data pointer
-                free_when_done_lvl),
-
-            // linkLists_,element_levels_,data_level0_memory_
-            "data_level0"_a = py::array_t<char>(
-                { level0_npy_size },  // shape
-                { sizeof(char) },  // C-style contiguous strides for each index
-                data_level0_npy,  // the data pointer
-                free_when_done_l0),
-
-            "link_lists"_a = py::array_t<char>(
-                { link_npy_size },  // shape
-                { sizeof(char) },  // C-style contiguous strides for each index
-                link_list_npy,  // the data pointer
-                free_when_done_ll));
-    }
-
-
-    py::dict getIndexParams() const { /* WARNING: Index::getAnnData is not thread-safe with Index::addItems */
-        auto params = py::dict(
             "ser_version"_a = py::int_(Index<float>::ser_version),  // serialization version
             "space"_a = space_name,
             "dim"_a = dim,
@@ -471,17 +370,59 @@ class Index {
             "ep_added"_a = ep_added,
             "normalize"_a = normalize,
             "num_threads"_a = num_threads_default,
-            "seed"_a = seed);
+            "seed"_a = seed,
+            "ef"_a = default_ef,
+            "allow_replace_deleted"_a = index_inited ? appr_alg->allow_replace_deleted_ : false);
+    }
+
+
+    /*
+    * Index in the sectioned file format, written by saveIndexToBuffer straight into a bytes object
+    * (None if the index is not initialized). WARNING: not thread-safe with Index::addItems
+    */
+    py::object getIndexBytes() const {
+        if (!index_inited)
+            return py::none();
+        size_t size = appr_alg->indexFileSize();
+        py::object bytes = py::reinterpret_steal<py::object>(PyBytes_FromStringAndSize(nullptr, size));
+        if (!bytes)
+            throw py::error_already_set();
+        appr_alg->saveIndexToBuffer(PyBytes_AS_STRING(bytes.ptr()), size);
+        return bytes;
+    }
 
-        if (index_inited == false)
-            return py::dict(**params, "ef"_a = default_ef);
 
-        auto ann_params = getAnnData();
+    /*
+    * Inverse of getStateParams/getIndexBytes. index_data can be any object supporting the buffer
+    * protocol (bytes, bytearray, memoryview, numpy array, ...).
+    */
+    static Index<float>* createFromState(const py::dict d, py::object index_data) {
+        assert_true(((int)py::int_(Index<float>::ser_version)) >= d["ser_version"].cast<int>(), "Invalid serialization version!");
 
-        return py::dict(**params, **ann_params);
+        Index<float>* new_index = new Index<float>(d["space"].cast<std::string>(), d["dim"].cast<int>());
+        new_index->seed = d["seed"].cast<size_t>();
+        new_index->index_inited = d["index_inited"].cast<bool>();
+        new_index->ep_added = d["ep_added"].cast<bool>();
+        new_index->num_threads_default = d["num_threads"].cast<int>();
+        new_index->default_ef = d["ef"].cast<size_t>();
+
+        if (new_index->index_inited) {
+            py::buffer_info info = py::buffer(index_data).request();
+            new_index->appr_alg = new hnswlib::HierarchicalNSW<dist_t>(new_index->l2space);
+            new_index->appr_alg->level_generator_.seed(new_index->seed);
+            new_index->appr_alg->update_probability_generator_.seed(new_index->seed + 1);
+            new_index->appr_alg->allow_replace_deleted_ = d["allow_replace_deleted"].cast<bool>();
+            new_index->appr_alg->loadIndexFromBuffer(info.ptr, info.size * info.itemsize, new_index->l2space);
+            new_index->appr_alg->ef_ = new_index->default_ef;
+            new_index->cur_l = new_index->appr_alg->cur_element_count;
+        }
+        return new_index;
     }
 
 
+    /*
+    * Reads the dictionary state pickled by versions before the buffer-based one.
+    */
     static Index<float>* createFromParams(const py::dict d) {
         // check serialization version
         assert_true(((int)py::int_(Index<float>::ser_version)) >= d["ser_version"].cast<int>(), "Invalid serialization version!");
@@ -519,7 +460,7 @@ class Index {
 
 
     static Index<float> * createFromIndex(const Index<float> & index) {
-        return createFromParams(index.getIndexParams());
+        return createFromState(index.getStateParams(), index.getIndexBytes());
     }
 
 
@@ -613,9 +554,12 @@ class Index {
         py::object input,
         size_t k = 1,
         int num_threads = -1,
-        const std::function<bool(hnswlib::labeltype)>& filter = nullptr) {
+        const py::object& filter = py::none(),
+        size_t ef = 0) {
         py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
         auto buffer = items.request();
+        QueryFilter query_filter(filter);
+        query_filter.bind(*appr_alg);
         hnswlib::labeltype* data_numpy_l;
         dist_t* data_numpy_d;
         size_t rows, features;
@@ -627,53 +571,27 @@ class Index {
             py::gil_scoped_release l;
             get_input_array_shapes(buffer, &rows, &features);
 
-            // avoid using threads when the number of searches is small:
-            if (rows <= num_threads * 4) {
-                num_threads = 1;
-            }
-
             data_numpy_l = new hnswlib::labeltype[rows * k];
             data_numpy_d = new dist_t[rows * k];
 
-            // Warning: search with a filter works slow in python in multithreaded mode. For best performance set num_threads=1
-            CustomFilterFunctor idFilter(filter);
-            CustomFilterFunctor* p_idFilter = filter ? &idFilter : nullptr;
-
-            if (normalize == false) {
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                    std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                        (void*)items.data(row), k, p_idFilter);
-                    if (result.size() != k)
-                        throw std::runtime_error(
-                            "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
-                    for (int i = k - 1; i >= 0; i--) {
-                        auto& result_tuple = result.top();
-                        data_numpy_d[row * k + i] = result_tuple.first;
-                        data_numpy_l[row * k + i] = result_tuple.second;
-                        result.pop();
-                    }
-                });
-            } else {
-                std::vector<float> norm_array(num_threads * features);
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                    float* data = (float*)items.data(row);
-
-                    size_t start_idx = threadId * dim;
-                    normalize_vector((float*)items.data(row), (norm_array.data() + start_idx));
-
-                    std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                        (void*)(norm_array.data() + start_idx), k, p_idFilter);
-                    if (result.size() != k)
-                        throw std::runtime_error(
-                            "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
-                    for (int i = k - 1; i >= 0; i--) {
-                        auto& result_tuple = result.top();
-                        data_numpy_d[row * k + i] = result_tuple.first;
-                        data_numpy_l[row * k + i] = result_tuple.second;
-                        result.pop();
-                    }
+            // Warning: search with a callable filter works slow in python in multithreaded mode. For best performance
+            // pass a mask or an array of allowed ids, or set num_threads=1
+            std::shared_ptr<hnswlib::ThreadPool> pool = thread_pools.get(num_threads);
+            const void* query_data = rows ? items.data(0) : nullptr;
+            std::vector<float> norm_array;
+            if (normalize) {
+                norm_array.resize(rows * features);
+                pool->parallelFor(0, rows, [&](size_t row, size_t threadId) {
+                    normalize_vector((float*)items.data(row), norm_array.data() + row * features);
                 });
+                query_data = norm_array.data();
             }
+            hnswlib::SearchParams params;
+            params.k = k;
+            params.ef = ef;  // 0 keeps the index ef
+            params.filter = query_filter.filter;
+            appr_alg->searchKnnParallel(query_data, rows, features * sizeof(dist_t),
+                                        data_numpy_l, data_numpy_d, *pool, params);
         }
         py::capsule free_when_done_l(data_numpy_l, [](void* f) {
             delete[] f;
@@ -736,6 +654,7 @@ class BFIndex {
     hnswlib::labeltype cur_l;
     hnswlib::BruteforceSearch<dist_t>* alg;
     hnswlib::SpaceInterface<float>* space;
+    ThreadPoolCache thread_pools;
 
 
     BFIndex(const std::string &space_name, const int dim) : space_name(space_name), dim(dim) {
@@ -851,9 +770,10 @@ class BFIndex {
         py::object input,
         size_t k = 1,
         int num_threads = -1,
-        const std::function<bool(hnswlib::labeltype)>& filter = nullptr) {
+        const py::object& filter = py::none()) {
         py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
         auto buffer = items.request();
+        QueryFilter query_filter(filter);
         hnswlib::labeltype *data_numpy_l;
         dist_t *data_numpy_d;
         size_t rows, features;
@@ -868,19 +788,9 @@ class BFIndex {
             data_numpy_l = new hnswlib::labeltype[rows * k];
             data_numpy_d = new dist_t[rows * k];
 
-            CustomFilterFunctor idFilter(filter);
-            CustomFilterFunctor* p_idFilter = filter ? &idFilter : nullptr;
-
-            ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = alg->searchKnn(
-                    (void*)items.data(row), k, p_idFilter);
-                for (int i = k - 1; i >= 0; i--) {
-                    auto& result_tuple = result.top();
-                    data_numpy_d[row * k + i] = result_tuple.first;
-                    data_numpy_l[row * k + i] = result_tuple.second;
-                    result.pop();
-                }
-            });
+            std::shared_ptr<hnswlib::ThreadPool> pool = thread_pools.get(num_threads);
+            alg->searchKnnParallel(rows ? items.data(0) : nullptr, rows, features * sizeof(dist_t), k,
+                                   data_numpy_l, data_numpy_d, *pool, query_filter.filter);
         }
 
         py::capsule free_when_done_l(data_numpy_l, [](void *f) {
@@ -927,7 +837,8 @@ PYBIND11_PLUGIN(hnswlib) {
             py::arg("data"),
             py::arg("k") = 1,
             py::arg("num_threads") = -1,
-            py::arg("filter") = py::none())
+            py::arg("filter") = py::none(),
+            py::arg("ef") = 0)
         .def("add_items",
             &Index<float>::addItems,
             py::arg("data"),
@@ -977,9 +888,12 @@ PYBIND11_PLUGIN(hnswlib) {
 
         .def(py::pickle(
             [](const Index<float> &ind) {  // __getstate__
-                return py::make_tuple(ind.getIndexParams()); /* Return dict (wrapped in a tuple) that fully encodes state of the Index object */
+                /* Small dict of parameters and the whole index as one bytes object */
+                return py::make_tuple(ind.getStateParams(), ind.getIndexBytes());
             },
             [](py::tuple t) {  // __setstate__
+                if (t.size() == 2)
+                    return Index<float>::createFromState(t[0].cast<py::dict>(), t[1]);
                 if (t.size() != 1)
                     throw std::runtime_error("Invalid state!");
                 return Index<float>::createFromParams(t[0].cast<py::dict>());
@@ -0,0 +1,100 @@
+// This is a test file for multi-threaded bulk insertion with addPoints
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test() {
+    int d = 16;
+    idx_t n = 10000;
+    size_t num_queries = 100;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<idx_t> labels(n);
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = distrib(rng);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        labels[i] = 3 * i + 1;
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_brute.addPoint(data.data() + d * i, labels[i]);
+    }
+
+    // first half with a thread count, second half with a pool, with progress reports
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    std::vector<size_t> reports;
+    alg_hnsw.addPoints(data.data(), labels.data(), n / 2, 4, false, [&](size_t done, size_t total) {
+        assert(total == n / 2);
+        assert(reports.empty() || done >= reports.back());
+        reports.push_back(done);
+    });
+    assert(!reports.empty() && reports.back() == n / 2);
+    hnswlib::ThreadPool pool(3);
+    alg_hnsw.addPoints(data.data() + d * (n / 2), labels.data() + n / 2, n - n / 2, pool);
+    assert(alg_hnsw.getCurrentElementCount() == n);
+
+    for (size_t i = 0; i < n; ++i) {
+        std::vector<float> point = alg_hnsw.getDataByLabel<float>(labels[i]);
+        assert(memcmp(point.data(), data.data() + d * i, d * sizeof(float)) == 0);
+    }
+
+    float correct = 0;
+    alg_hnsw.setEf(50);
+    for (size_t q = 0; q < num_queries; q++) {
+        std::vector<float> query(d);
+        for (int j = 0; j < d; j++) {
+            query[j] = distrib(rng);
+        }
+        auto expected = alg_brute.searchKnn(query.data(), k);
+        auto result = alg_hnsw.searchKnn(query.data(), k);
+        std::vector<idx_t> expected_labels;
+        while (!expected.empty()) {
+            expected_labels.push_back(expected.top().second);
+            expected.pop();
+        }
+        while (!result.empty()) {
+            if (std::find(expected_labels.begin(), expected_labels.end(), result.top().second) != expected_labels.end())
+                correct++;
+            result.pop();
+        }
+    }
+    float recall = correct / (num_queries * k);
+    std::cout << "recall: " << recall << std::endl;
+    assert(recall > 0.9);
+
+    // exceptions from insertions reach the caller
+    hnswlib::HierarchicalNSW<float> small_hnsw(&space, n / 2);
+    bool thrown = false;
+    try {
+        small_hnsw.addPoints(data.data(), labels.data(), n, 4);
+    } catch (const std::runtime_error &e) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(small_hnsw.getCurrentElementCount() == n / 2);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
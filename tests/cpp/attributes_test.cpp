@@ -0,0 +1,160 @@
+// This is a test file for the attribute columns and the filters compiled from them
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <functional>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+// the elements the predicates of the test allow, by brute force
+struct Expected {
+    std::vector<int64_t> category;
+    std::vector<int64_t> timestamp;
+    std::vector<std::vector<uint32_t>> tags;
+
+    bool hasTag(idx_t label, const std::vector<uint32_t> &any) const {
+        for (uint32_t tag : tags[label]) {
+            if (std::find(any.begin(), any.end(), tag) != any.end())
+                return true;
+        }
+        return false;
+    }
+};
+
+void checkFilter(const hnswlib::BitmapFilter &filter, idx_t n, std::function<bool(idx_t)> expected) {
+    size_t count = 0;
+    for (idx_t label = 0; label < n; label++) {
+        assert(filter.allowed.test(label) == expected(label));
+        count += expected(label);
+    }
+    assert(filter.allowed.count() == count);
+}
+
+void checkPredicates(hnswlib::HierarchicalNSW<float> &alg_hnsw, const Expected &expected, idx_t n) {
+    using hnswlib::AttributePredicate;
+    checkFilter(alg_hnsw.compileFilter({AttributePredicate::equal("category", 3)}), n,
+                [&](idx_t label) { return expected.category[label] == 3; });
+    checkFilter(alg_hnsw.compileFilter({AttributePredicate::range("timestamp", 1000, 250000)}), n,
+                [&](idx_t label) { return expected.timestamp[label] >= 1000 && expected.timestamp[label] <= 250000; });
+    checkFilter(alg_hnsw.compileFilter({AttributePredicate::tagIn("tags", {2, 7})}), n,
+                [&](idx_t label) { return expected.hasTag(label, {2, 7}); });
+    checkFilter(alg_hnsw.compileFilter({AttributePredicate::range("category", 2, 5),
+                                        AttributePredicate::tagIn("tags", {1}),
+                                        AttributePredicate::range("timestamp", 0, 500000)}), n,
+                [&](idx_t label) {
+                    return expected.category[label] >= 2 && expected.category[label] <= 5 &&
+                           expected.hasTag(label, {1}) && expected.timestamp[label] <= 500000;
+                });
+    checkFilter(alg_hnsw.compileFilter({}), n, [](idx_t) { return true; });
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 5000;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (auto &value : data) value = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    alg_hnsw.addAttribute("category", hnswlib::ATTRIBUTE_INT);  // few values: bitmap index
+    alg_hnsw.addAttribute("timestamp", hnswlib::ATTRIBUTE_INT);  // many values: scanned
+    alg_hnsw.addAttribute("tags", hnswlib::ATTRIBUTE_TAGS);
+
+    Expected expected;
+    expected.category.resize(n);
+    expected.timestamp.resize(n);
+    expected.tags.resize(n);
+    for (idx_t i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+        alg_brute.addPoint(data.data() + d * i, i);
+        // every third element keeps the default category, 0
+        if (i % 3) {
+            expected.category[i] = rng() % 8;
+            alg_hnsw.setAttribute(i, "category", expected.category[i]);
+        }
+        expected.timestamp[i] = rng() % 1000000;
+        alg_hnsw.setAttribute(i, "timestamp", expected.timestamp[i]);
+        for (uint32_t tag = 0; tag < 10; tag++) {
+            if (rng() % 4 == 0)
+                expected.tags[i].push_back(tag);
+        }
+        alg_hnsw.setAttributeTags(i, "tags", expected.tags[i]);
+    }
+    assert(alg_hnsw.getAttribute(7, "timestamp") == expected.timestamp[7]);
+    assert(alg_hnsw.getAttributeTags(7, "tags") == expected.tags[7]);
+    checkPredicates(alg_hnsw, expected, n);
+
+    // writes after the bitmap indexes are built keep them up to date
+    for (idx_t i = 0; i < n; i += 7) {
+        expected.category[i] = (expected.category[i] + 1) % 8;
+        alg_hnsw.setAttribute(i, "category", expected.category[i]);
+        expected.tags[i] = {1, 2};
+        alg_hnsw.setAttributeTags(i, "tags", expected.tags[i]);
+    }
+    checkPredicates(alg_hnsw, expected, n);
+
+    // wrong names, types and labels
+    bool thrown = false;
+    try { alg_hnsw.setAttribute(0, "tags", 1); } catch (std::runtime_error &) { thrown = true; }
+    assert(thrown);
+    thrown = false;
+    try { alg_hnsw.compileFilter({hnswlib::AttributePredicate::equal("missing", 1)}); } catch (std::runtime_error &) { thrown = true; }
+    assert(thrown);
+    thrown = false;
+    try { alg_hnsw.setAttribute(n, "category", 1); } catch (std::runtime_error &) { thrown = true; }
+    assert(thrown);
+
+    // the compiled filter gives the searches the same results as the functor
+    hnswlib::BitmapFilter filter = alg_hnsw.compileFilter({hnswlib::AttributePredicate::range("category", 1, 2)});
+    for (idx_t q = 0; q < 50; q++) {
+        const float *query = data.data() + d * q * 17;
+        auto result = alg_brute.searchKnnCloserFirst(query, k, &filter);
+        for (auto &item : result) {
+            assert(expected.category[item.second] >= 1 && expected.category[item.second] <= 2);
+        }
+        hnswlib::SearchParams params;
+        params.k = k;
+        params.filter = &filter;
+        params.filter_strategy = hnswlib::FILTER_BRUTE_FORCE;
+        assert(alg_hnsw.searchKnnCloserFirst(query, params) == result);
+    }
+
+    // saved and loaded with the index
+    std::vector<char> buffer(alg_hnsw.indexFileSize());
+    alg_hnsw.saveIndexToBuffer(buffer.data(), buffer.size());
+    hnswlib::HierarchicalNSW<float> loaded(&space);
+    loaded.loadIndexFromBuffer(buffer.data(), buffer.size(), &space);
+    assert(loaded.getAttribute(11, "category") == expected.category[11]);
+    checkPredicates(loaded, expected, n);
+
+    // a reused element slot starts with the default attributes
+    hnswlib::HierarchicalNSW<float> replacing(&space, n, 16, 200, 100, true);
+    replacing.addAttribute("category", hnswlib::ATTRIBUTE_INT);
+    replacing.addPoint(data.data(), 0);
+    replacing.setAttribute(0, "category", 5);
+    replacing.markDelete(0);
+    replacing.addPoint(data.data() + d, 1, true);
+    assert(replacing.getAttribute(1, "category") == 0);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
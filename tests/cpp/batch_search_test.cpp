@@ -0,0 +1,189 @@
+// This is a test file for searchKnnBatch and the batched distance kernels
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <chrono>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+    unsigned int divisor;
+
+ public:
+    explicit PickDivisibleIds(unsigned int divisor) : divisor(divisor) {}
+
+    bool operator()(idx_t label_id) {
+        return label_id % divisor == 0;
+    }
+};
+
+void testKernels() {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    size_t dims[] = {3, 12, 16, 20, 64, 100};
+    for (size_t d : dims) {
+        hnswlib::L2Space space(d);
+        hnswlib::DISTFUNC<float> dist_func = space.get_dist_func();
+        hnswlib::DISTFUNC_BATCH<float> dist_func_batch = space.get_dist_func_batch();
+#ifdef USE_SSE
+        assert((dist_func_batch != nullptr) == (d % 16 == 0 || (d % 4 != 0 && d > 16)));
+#endif
+        if (!dist_func_batch)
+            continue;
+
+        size_t count = 11;
+        std::vector<float> query(d);
+        std::vector<float> data(count * d);
+        for (auto &value : query) value = distrib(rng);
+        for (auto &value : data) value = distrib(rng);
+        std::vector<const void *> vectors(count);
+        for (size_t i = 0; i < count; i++) {
+            vectors[i] = data.data() + i * d;
+        }
+        std::vector<float> dists(count);
+        dist_func_batch(query.data(), vectors.data(), count, dists.data(), space.get_dist_func_param());
+        for (size_t i = 0; i < count; i++) {
+            assert(dists[i] == dist_func(query.data(), vectors[i], space.get_dist_func_param()));
+        }
+    }
+}
+
+void compareWithSearchKnn(hnswlib::HierarchicalNSW<float> &alg_hnsw, const std::vector<float> &queries,
+                          size_t num_queries, size_t k, hnswlib::BaseFilterFunctor *filter) {
+    size_t d = alg_hnsw.data_size_ / sizeof(float);
+    std::vector<idx_t> labels(num_queries * k);
+    std::vector<float> distances(num_queries * k);
+    size_t incomplete = alg_hnsw.searchKnnBatch(queries.data(), num_queries, k, labels.data(), distances.data(),
+                                                filter);
+    size_t expected_incomplete = 0;
+    for (size_t q = 0; q < num_queries; q++) {
+        auto expected = alg_hnsw.searchKnnCloserFirst(queries.data() + q * d, k, filter);
+        if (expected.size() < k)
+            expected_incomplete++;
+        for (size_t i = 0; i < k; i++) {
+            if (i < expected.size()) {
+                assert(labels[q * k + i] == expected[i].second);
+                assert(distances[q * k + i] == expected[i].first);
+            } else {
+                assert(labels[q * k + i] == (idx_t) -1);
+                assert(distances[q * k + i] == std::numeric_limits<float>::max());
+            }
+        }
+    }
+    assert(incomplete == expected_incomplete);
+}
+
+void testSearch(size_t d) {
+    idx_t n = 3000;
+    size_t num_queries = 37;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (idx_t i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.setEf(40);
+
+    PickDivisibleIds pick_every_7(7);
+    compareWithSearchKnn(alg_hnsw, queries, num_queries, k, nullptr);
+    compareWithSearchKnn(alg_hnsw, queries, num_queries, k, &pick_every_7);
+    compareWithSearchKnn(alg_hnsw, queries, 1, k, nullptr);
+
+    // fewer than k results
+    PickDivisibleIds pick_every_1000(1000);
+    compareWithSearchKnn(alg_hnsw, queries, num_queries, k, &pick_every_1000);
+
+    for (idx_t i = 0; i < n; i += 3) {
+        alg_hnsw.markDelete(i);
+    }
+    compareWithSearchKnn(alg_hnsw, queries, num_queries, k, nullptr);
+
+    alg_hnsw.base_layer_only = true;
+    compareWithSearchKnn(alg_hnsw, queries, num_queries, k, nullptr);
+    alg_hnsw.buildPivots();
+    compareWithSearchKnn(alg_hnsw, queries, num_queries, k, nullptr);
+    alg_hnsw.setPivots({});
+    alg_hnsw.base_layer_only = false;
+
+    // the parallel path goes through searchKnnBatch
+    hnswlib::ThreadPool pool(3);
+    std::vector<idx_t> labels(num_queries * k);
+    std::vector<float> distances(num_queries * k);
+    alg_hnsw.searchKnnParallel(queries.data(), num_queries, d * sizeof(float), k, labels.data(),
+                               distances.data(), pool);
+    for (size_t q = 0; q < num_queries; q++) {
+        auto expected = alg_hnsw.searchKnnCloserFirst(queries.data() + q * d, k);
+        for (size_t i = 0; i < k; i++) {
+            assert(labels[q * k + i] == expected[i].second);
+        }
+    }
+}
+
+void benchmark() {
+    size_t d = 128;
+    idx_t n = 20000;
+    size_t num_queries = 2000;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    std::vector<idx_t> labels(n);
+    for (idx_t i = 0; i < n; i++) {
+        labels[i] = i;
+    }
+    alg_hnsw.addPoints(data.data(), labels.data(), n);
+    alg_hnsw.setEf(100);
+
+    std::vector<idx_t> result_labels(num_queries * k);
+    std::vector<float> result_distances(num_queries * k);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t q = 0; q < num_queries; q++) {
+        alg_hnsw.searchKnn(queries.data() + q * d, k);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    alg_hnsw.searchKnnBatch(queries.data(), num_queries, k, result_labels.data(), result_distances.data());
+    auto end = std::chrono::steady_clock::now();
+    double loop_seconds = std::chrono::duration<double>(middle - start).count();
+    double batch_seconds = std::chrono::duration<double>(end - middle).count();
+    std::cout << "searchKnn loop: " << num_queries / loop_seconds << " QPS, searchKnnBatch: "
+              << num_queries / batch_seconds << " QPS" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testKernels();
+    size_t dims[] = {3, 12, 16, 20};
+    for (size_t d : dims) {
+        testSearch(d);
+    }
+    benchmark();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
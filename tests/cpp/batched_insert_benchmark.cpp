@@ -0,0 +1,140 @@
+// This is a test file for mini-batch insertion with addPointsBatched, with a benchmark against addPoints
+
+#include "../../hnswlib/hnswlib.h"
+
+#include "benchmark_data.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test() {
+    size_t d = 64;
+    idx_t n = 20000;
+    size_t num_queries = 200;
+    size_t k = 10;
+    size_t ef = 64;
+
+    std::vector<float> data;
+    std::vector<float> queries;
+    benchmark::generateEmbeddings(n, num_queries, d, 47, data, queries);
+    std::vector<idx_t> labels(n);
+    for (idx_t i = 0; i < n; i++) {
+        labels[i] = 3 * i + 1;
+    }
+
+    hnswlib::L2Space space(d);
+    auto ground_truth = benchmark::groundTruth(&space, data, labels, queries, d, k);
+
+    size_t num_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    hnswlib::HierarchicalNSW<float> single(&space, n, 16, 100);
+    double single_seconds = benchmark::seconds([&]() { single.addPoints(data.data(), labels.data(), n, num_threads); });
+    single.setEf(ef);
+    float single_recall = benchmark::recall(single, queries, d, ground_truth, k);
+
+    hnswlib::HierarchicalNSW<float> batched(&space, n, 16, 100);
+    std::vector<size_t> reports;
+    double batched_seconds = benchmark::seconds([&]() {
+        batched.addPointsBatched(data.data(), labels.data(), n, num_threads, [&](size_t done, size_t total) {
+            assert(total == n);
+            assert(reports.empty() || done > reports.back());
+            reports.push_back(done);
+        });
+    });
+    assert(!reports.empty() && reports.back() == n);
+    batched.setEf(ef);
+    float batched_recall = benchmark::recall(batched, queries, d, ground_truth, k);
+
+    std::cout << "insertion (" << num_threads << " threads)\tpoints/s\trecall" << std::endl;
+    std::cout << "addPoints\t\t" << n / single_seconds << "\t" << single_recall << std::endl;
+    std::cout << "addPointsBatched\t" << n / batched_seconds << "\t" << batched_recall << std::endl;
+    assert(batched_recall > single_recall - 0.03f);
+
+    assert(batched.getCurrentElementCount() == n);
+    for (idx_t i = 0; i < n; i++) {
+        assert(batched.getDataByLabel<float>(labels[i]) == std::vector<float>(data.begin() + i * d, data.begin() + (i + 1) * d));
+        size_t count = batched.getListCount(batched.get_linklist0(batched.label_lookup_[labels[i]]));
+        assert(count > 0 && count <= batched.maxM0_);
+    }
+
+    // labels of the batch in flight can be deleted meanwhile, and no delete mark is lost
+    hnswlib::HierarchicalNSW<float> deleting(&space, n, 16, 100);
+    std::atomic<bool> inserting{true};
+    std::vector<idx_t> deleted;
+    std::thread deleter([&]() {
+        while (inserting) {
+            for (idx_t i = n / 2; i < n; i += 97) {
+                try {
+                    deleting.markDelete(labels[i]);
+                    deleted.push_back(labels[i]);
+                } catch (std::runtime_error &) {}  // not inserted yet, or already deleted
+            }
+        }
+    });
+    deleting.addPointsBatched(data.data(), labels.data(), n, 2);
+    inserting = false;
+    deleter.join();
+    assert(deleting.getDeletedCount() == deleted.size());
+    for (idx_t label : deleted) {
+        assert(deleting.isMarkedDeleted(deleting.label_lookup_[label]));
+    }
+
+    // labels already indexed or repeated in the input are updated, the last write winning
+    hnswlib::HierarchicalNSW<float> updated(&space, n, 16, 100);
+    updated.addPointsBatched(data.data(), labels.data(), n / 2, 2);
+    std::vector<float> expected(data);
+    std::vector<float> mixed_data;
+    std::vector<idx_t> mixed_labels;
+    for (idx_t i = n / 2; i < n; i++) {
+        if (i % 7 == 0) {
+            mixed_data.insert(mixed_data.end(), d, 0.0f);
+            mixed_labels.push_back(labels[i]);
+        }
+        mixed_data.insert(mixed_data.end(), data.begin() + i * d, data.begin() + (i + 1) * d);
+        mixed_labels.push_back(labels[i]);
+        if (i % 5 == 0) {
+            idx_t old = i - n / 2;
+            for (size_t j = 0; j < d; j++) expected[old * d + j] += 1.0f;
+            mixed_data.insert(mixed_data.end(), expected.begin() + old * d, expected.begin() + (old + 1) * d);
+            mixed_labels.push_back(labels[old]);
+        }
+    }
+    updated.addPointsBatched(mixed_data.data(), mixed_labels.data(), mixed_labels.size(), 2);
+    assert(updated.getCurrentElementCount() == n);
+    for (idx_t i = 0; i < n; i++) {
+        assert(updated.getDataByLabel<float>(labels[i]) == std::vector<float>(expected.begin() + i * d, expected.begin() + (i + 1) * d));
+    }
+
+    // running out of space throws before the batch that does not fit, and the batches before it stay
+    // searchable
+    hnswlib::HierarchicalNSW<float> small(&space, n / 2);
+    bool thrown = false;
+    try { small.addPointsBatched(data.data(), labels.data(), n, 2); } catch (std::runtime_error &) { thrown = true; }
+    assert(thrown);
+    size_t small_count = small.getCurrentElementCount();
+    assert(small_count > 0 && small_count <= n / 2 && small.label_lookup_.size() == small_count);
+    small.setEf(50);
+    size_t found = 0;
+    for (hnswlib::tableint id = 0; id < small_count; id++) {
+        found += small.searchKnn(small.getDataByInternalId(id), 1).top().second == small.getExternalLabel(id);
+    }
+    assert(found > 0.99 * small_count);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+// Data and timing helpers shared by the benchmarks in this directory
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <chrono>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+namespace benchmark {
+
+/*
+ * Fills data (n x d) and queries (num_queries x d) with embeddings-like vectors:
+ * 16 latent dimensions spread over d by a fixed random projection, plus a little noise.
+ * Deterministic for a given seed.
+ */
+inline void generateEmbeddings(size_t n, size_t num_queries, size_t d, unsigned seed,
+                               std::vector<float> &data, std::vector<float> &queries) {
+    std::mt19937 rng;
+    rng.seed(seed);
+    std::uniform_real_distribution<> distrib;
+    size_t latent = 16;
+    std::vector<float> projection(latent * d);
+    for (auto &value : projection) value = distrib(rng) - 0.5;
+    std::vector<float> z(latent);
+    auto generate = [&](float *vector) {
+        for (auto &value : z) value = distrib(rng);
+        for (size_t j = 0; j < d; j++) {
+            vector[j] = 0.05f * distrib(rng);
+            for (size_t l = 0; l < latent; l++) vector[j] += z[l] * projection[l * d + j];
+        }
+    };
+    data.resize(n * d);
+    queries.resize(num_queries * d);
+    for (size_t i = 0; i < n; i++) generate(data.data() + i * d);
+    for (size_t q = 0; q < num_queries; q++) generate(queries.data() + q * d);
+}
+
+// Exact k nearest labels of every query, by brute force
+inline std::vector<std::unordered_set<hnswlib::labeltype>> groundTruth(
+        hnswlib::SpaceInterface<float> *space, const std::vector<float> &data, const std::vector<hnswlib::labeltype> &labels,
+        const std::vector<float> &queries, size_t d, size_t k) {
+    size_t n = labels.size();
+    size_t num_queries = queries.size() / d;
+    hnswlib::BruteforceSearch<float> alg_brute(space, n);
+    for (size_t i = 0; i < n; i++) {
+        alg_brute.addPoint(data.data() + d * i, labels[i]);
+    }
+    std::vector<std::unordered_set<hnswlib::labeltype>> ground_truth(num_queries);
+    for (size_t q = 0; q < num_queries; q++) {
+        for (auto &item : alg_brute.searchKnnCloserFirst(queries.data() + q * d, k)) {
+            ground_truth[q].insert(item.second);
+        }
+    }
+    return ground_truth;
+}
+
+inline float recall(const hnswlib::HierarchicalNSW<float> &index, const std::vector<float> &queries, size_t d,
+                    const std::vector<std::unordered_set<hnswlib::labeltype>> &ground_truth, size_t k) {
+    size_t correct = 0;
+    for (size_t q = 0; q < ground_truth.size(); q++) {
+        auto result = index.searchKnn(queries.data() + q * d, k);
+        while (!result.empty()) {
+            correct += ground_truth[q].count(result.top().second);
+            result.pop();
+        }
+    }
+    return (float) correct / (ground_truth.size() * k);
+}
+
+template<typename Function>
+double seconds(Function fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace benchmark
@@ -0,0 +1,167 @@
+// This is a test file for bitmap filters
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <chrono>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+    unsigned int divisor;
+
+ public:
+    explicit PickDivisibleIds(unsigned int divisor) : divisor(divisor) {}
+
+    bool operator()(idx_t label_id) {
+        return label_id % divisor == 0;
+    }
+};
+
+void testBitmap() {
+    hnswlib::Bitmap bitmap(130);
+    assert(bitmap.count() == 0);
+    bitmap.set(0);
+    bitmap.set(64);
+    bitmap.set(129);
+    assert(bitmap.test(0) && bitmap.test(64) && bitmap.test(129));
+    assert(!bitmap.test(1) && !bitmap.test(128));
+    assert(!bitmap.test(130) && !bitmap.test(100000));  // beyond the size
+    assert(bitmap.count() == 3);
+    bitmap.reset(64);
+    assert(!bitmap.test(64) && bitmap.count() == 2);
+    bitmap.set(0);  // already set ids and already clear ids leave the count alone
+    bitmap.reset(64);
+    assert(bitmap.count() == 2);
+
+    hnswlib::Bitmap other(100);
+    other.set(0);
+    other.set(64);
+    bitmap.orWith(other);
+    assert(bitmap.count() == 3);
+    bitmap.andWith(other);
+    assert(bitmap.count() == 2 && !bitmap.test(129));
+
+    bitmap.setAll();
+    assert(bitmap.count() == 130);
+    bitmap.resize(70);
+    assert(bitmap.count() == 70 && !bitmap.test(70));
+    bitmap.resize(200);  // new ids are clear
+    assert(bitmap.count() == 70 && !bitmap.test(150));
+    bitmap.clear();
+    assert(bitmap.count() == 0);
+
+    // labels far beyond the index size cost no bitmap space until bound
+    hnswlib::BitmapFilter filter({uint64_t(1) << 40, 1000, 1000});
+    assert(filter.labels.size() == 2 && filter.allowed.size() == 0);
+    assert(filter(1000) && filter(uint64_t(1) << 40) && !filter(999) && !filter(5000));
+    assert(filter.bitmap(nullptr) == nullptr);
+}
+
+void testSearch() {
+    int d = 16;
+    idx_t n = 10000;
+    size_t num_queries = 200;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    // added in reverse so that internal ids differ from labels
+    for (idx_t i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + d * (n - 1 - i), n - 1 - i);
+        alg_brute.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.setEf(50);
+
+    // the same labels through the virtual call and through the bitmap give the same results; the bitmap
+    // search is kept on the graph, which the functor without a selectivity hint gets too
+    PickDivisibleIds pick_divisible(3);
+    std::vector<idx_t> divisible;
+    for (idx_t i = 0; i < n; i += 3) {
+        divisible.push_back(i);
+    }
+    hnswlib::BitmapFilter bitmap_filter(divisible);
+    alg_hnsw.bindFilter(bitmap_filter);
+    assert(bitmap_filter.bitmap(&alg_hnsw) == &bitmap_filter.allowed);
+    assert(bitmap_filter.bitmap(&alg_brute) == nullptr);
+    assert(bitmap_filter.allowed.count() == divisible.size());
+    hnswlib::SearchParams params;
+    params.k = k;
+    params.filter = &bitmap_filter;
+    params.filter_strategy = hnswlib::FILTER_GRAPH;
+    hnswlib::SearchContext<float> ctx;
+    std::vector<idx_t> labels(num_queries * k);
+    std::vector<float> distances(num_queries * k);
+    alg_hnsw.searchKnnBatch(queries.data(), num_queries, k, labels.data(), distances.data(), &bitmap_filter);
+    for (size_t q = 0; q < num_queries; q++) {
+        const float *query = queries.data() + q * d;
+        auto expected = alg_hnsw.searchKnnCloserFirst(query, k, &pick_divisible);
+        assert(alg_hnsw.searchKnnCloserFirst(query, params) == expected);
+        std::vector<idx_t> ctx_labels(k);
+        std::vector<float> ctx_distances(k);
+        assert(alg_hnsw.searchKnn(ctx, query, params, ctx_labels.data(), ctx_distances.data()) == k);
+        for (size_t i = 0; i < k; i++) {
+            assert(expected[i].second % 3 == 0);
+            assert(ctx_labels[i] == expected[i].second);
+            assert(labels[q * k + i] == expected[i].second);
+        }
+        assert(alg_brute.searchKnnCloserFirst(query, k, &bitmap_filter) ==
+               alg_brute.searchKnnCloserFirst(query, k, &pick_divisible));
+    }
+
+    // deleted elements stay excluded
+    for (idx_t i = 0; i < n; i += 6) {
+        alg_hnsw.markDelete(i);
+    }
+    for (size_t q = 0; q < num_queries; q++) {
+        const float *query = queries.data() + q * d;
+        auto result = alg_hnsw.searchKnnCloserFirst(query, params);
+        assert(result == alg_hnsw.searchKnnCloserFirst(query, k, &pick_divisible));
+        for (auto &item : result) {
+            assert(item.second % 3 == 0 && item.second % 6 != 0);
+        }
+    }
+
+    double functor_seconds = 1e9;
+    double bitmap_seconds = 1e9;
+    for (int rep = 0; rep < 5; rep++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t q = 0; q < num_queries; q++) {
+            alg_hnsw.searchKnn(ctx, queries.data() + q * d, k, labels.data(), distances.data(), &pick_divisible);
+        }
+        auto middle = std::chrono::steady_clock::now();
+        for (size_t q = 0; q < num_queries; q++) {
+            alg_hnsw.searchKnn(ctx, queries.data() + q * d, params, labels.data(), distances.data());
+        }
+        auto end = std::chrono::steady_clock::now();
+        functor_seconds = std::min(functor_seconds, std::chrono::duration<double>(middle - start).count());
+        bitmap_seconds = std::min(bitmap_seconds, std::chrono::duration<double>(end - middle).count());
+    }
+    std::cout << "functor filter: " << num_queries / functor_seconds << " QPS, bitmap filter: "
+              << num_queries / bitmap_seconds << " QPS" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testBitmap();
+    testSearch();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+// This is a test file for the disk-resident index (DiskHNSW)
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+#include <unistd.h>
+
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickEvenFilter : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label_id) {
+        return label_id % 2 == 0;
+    }
+};
+
+float recall(hnswlib::BruteforceSearch<float> &exact, hnswlib::AlgorithmInterface<float> &index,
+             const std::vector<float> &queries, size_t num_queries, int d, size_t k,
+             hnswlib::BaseFilterFunctor *filter = nullptr) {
+    size_t correct = 0;
+    for (size_t q = 0; q < num_queries; q++) {
+        auto expected = exact.searchKnn(queries.data() + d * q, k, filter);
+        auto result = index.searchKnn(queries.data() + d * q, k, filter);
+        assert(result.size() == expected.size());
+        std::vector<idx_t> expected_labels;
+        while (!expected.empty()) {
+            expected_labels.push_back(expected.top().second);
+            expected.pop();
+        }
+        while (!result.empty()) {
+            if (std::find(expected_labels.begin(), expected_labels.end(), result.top().second) != expected_labels.end())
+                correct++;
+            if (filter)
+                assert((*filter)(result.top().second));
+            result.pop();
+        }
+    }
+    return (float) correct / (num_queries * k);
+}
+
+void test(int d, size_t M) {
+    idx_t n = 3000;
+    size_t num_queries = 100;
+    size_t k = 10;
+    std::string path = "disk_index_test.bin";
+
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = distrib(rng);
+    }
+    for (size_t i = 0; i < queries.size(); ++i) {
+        queries[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, M);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+        if (i % 10 == 0)
+            alg_hnsw.markDelete(i);
+        else
+            alg_brute.addPoint(data.data() + d * i, i);
+    }
+    hnswlib::DiskHNSW<float>::build(alg_hnsw, path);
+
+    hnswlib::DiskHNSW<float> disk_uring(&space, path, 4, true);
+    hnswlib::DiskHNSW<float> disk_pread(&space, path, 4, false);
+    std::cout << "node size " << disk_uring.node_size_ << ", nodes per block " << disk_uring.nodes_per_block_
+              << ", io_uring " << hnswlib::BlockReader(*disk_uring.nodes_input_, 1).usesIoUring() << std::endl;
+    assert(disk_uring.getCurrentElementCount() == n);
+    assert(disk_uring.getDeletedCount() == alg_hnsw.getDeletedCount());
+    disk_uring.setEf(100);
+    disk_pread.setEf(100);
+
+    // both read paths return the same results, ranked by exact distances
+    for (size_t q = 0; q < num_queries; q++) {
+        const float *query = queries.data() + d * q;
+        auto uring_result = disk_uring.searchKnnCloserFirst(query, k);
+        auto pread_result = disk_pread.searchKnnCloserFirst(query, k);
+        assert(uring_result == pread_result);
+        for (auto &item : uring_result) {
+            assert(item.second % 10 != 0);
+            float expected = space.get_dist_func()(query, data.data() + d * item.second, space.get_dist_func_param());
+            assert(item.first == expected);
+        }
+    }
+
+    // quantized traversal keeps the recall of the in-memory index
+    alg_hnsw.setEf(100);
+    float memory_recall = recall(alg_brute, alg_hnsw, queries, num_queries, d, k);
+    float disk_recall = recall(alg_brute, disk_uring, queries, num_queries, d, k);
+    std::cout << "recall: " << disk_recall << ", in memory: " << memory_recall << std::endl;
+    assert(disk_recall > memory_recall - 0.05);
+
+    PickEvenFilter pickEven;
+    float memory_filter_recall = recall(alg_brute, alg_hnsw, queries, num_queries, d, k, &pickEven);
+    float filter_recall = recall(alg_brute, disk_pread, queries, num_queries, d, k, &pickEven);
+    std::cout << "filtered recall: " << filter_recall << ", in memory: " << memory_filter_recall << std::endl;
+    assert(filter_recall > memory_filter_recall - 0.05);
+
+    // a disk index is not an in-memory index and vice versa
+    bool thrown = false;
+    try {
+        hnswlib::HierarchicalNSW<float> wrong(&space, path);
+    } catch (const std::runtime_error &e) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // a failed read fails the search and gives back its visited list
+    assert(truncate(path.c_str(), 0) == 0);
+    hnswlib::VisitedList *visited = disk_pread.visited_list_pool_->getFreeVisitedList();
+    disk_pread.visited_list_pool_->releaseVisitedList(visited);
+    for (int i = 0; i < 3; i++) {
+        thrown = false;
+        try {
+            disk_pread.searchKnn(queries.data(), k);
+        } catch (const std::runtime_error &e) {
+            thrown = true;
+        }
+        assert(thrown);
+        hnswlib::VisitedList *next = disk_pread.visited_list_pool_->getFreeVisitedList();
+        disk_pread.visited_list_pool_->releaseVisitedList(next);
+        assert(next == visited);
+    }
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test(16, 16);
+    // nodes larger than a block
+    test(1100, 8);
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
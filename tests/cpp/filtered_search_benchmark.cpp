@@ -0,0 +1,177 @@
+// This is a test file for the filtered search strategies, with a benchmark across filter selectivities
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <chrono>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+// the same labels as a BitmapFilter, through the virtual call
+class SetFilter : public hnswlib::BaseFilterFunctor {
+    const hnswlib::Bitmap &allowed;
+
+ public:
+    explicit SetFilter(const hnswlib::Bitmap &allowed) : allowed(allowed) {}
+
+    bool operator()(idx_t label_id) {
+        return allowed.test(label_id);
+    }
+};
+
+const char *strategyName(hnswlib::FilterStrategy strategy) {
+    switch (strategy) {
+        case hnswlib::FILTER_GRAPH: return "graph";
+        case hnswlib::FILTER_TWO_HOP: return "two-hop";
+        case hnswlib::FILTER_BRUTE_FORCE: return "brute force";
+        default: return "auto";
+    }
+}
+
+void test() {
+    size_t d = 32;
+    idx_t n = 50000;
+    size_t num_queries = 100;
+    size_t k = 10;
+    size_t ef = 64;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    std::vector<idx_t> labels(n);
+    for (idx_t i = 0; i < n; i++) {
+        labels[i] = i;
+        alg_brute.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.addPoints(data.data(), labels.data(), n);
+
+    float selectivities[] = {0.001f, 0.005f, 0.01f, 0.05f, 0.1f, 0.2f, 0.5f, 1.0f};
+    hnswlib::FilterStrategy strategies[] = {hnswlib::FILTER_GRAPH, hnswlib::FILTER_TWO_HOP,
+                                            hnswlib::FILTER_BRUTE_FORCE, hnswlib::FILTER_AUTO};
+    hnswlib::SearchContext<float> ctx;
+    std::vector<idx_t> result_labels(k);
+    std::vector<float> result_distances(k);
+    std::cout << "selectivity\tstrategy\trecall\tQPS" << std::endl;
+    for (float selectivity : selectivities) {
+        hnswlib::Bitmap allowed(n);
+        std::vector<idx_t> allowed_labels;
+        std::uniform_real_distribution<float> pick;
+        for (idx_t i = 0; i < n; i++) {
+            if (pick(rng) < selectivity) {
+                allowed.set(i);
+                allowed_labels.push_back(i);
+            }
+        }
+        hnswlib::BitmapFilter filter(allowed_labels);
+        alg_hnsw.bindFilter(filter);
+        SetFilter set_filter(allowed);
+
+        std::vector<std::unordered_set<idx_t>> ground_truth(num_queries);
+        for (size_t q = 0; q < num_queries; q++) {
+            auto result = alg_brute.searchKnn(queries.data() + q * d, k, &set_filter);
+            while (!result.empty()) {
+                ground_truth[q].insert(result.top().second);
+                result.pop();
+            }
+        }
+
+        hnswlib::SearchParams params;
+        params.k = k;
+        params.ef = ef;
+        params.filter = &filter;
+        hnswlib::FilterStrategy planned = alg_hnsw.planFilteredSearch(params, ef);
+        float graph_recall = 0;
+        for (hnswlib::FilterStrategy strategy : strategies) {
+            params.filter_strategy = strategy;
+            size_t correct = 0;
+            size_t total = 0;
+            double seconds = 1e9;
+            for (int rep = 0; rep < 2; rep++) {
+                correct = 0;
+                total = 0;
+                auto start = std::chrono::steady_clock::now();
+                for (size_t q = 0; q < num_queries; q++) {
+                    size_t found = alg_hnsw.searchKnn(ctx, queries.data() + q * d, params, result_labels.data(),
+                                                      result_distances.data());
+                    for (size_t i = 0; i < found; i++) {
+                        assert(allowed.test(result_labels[i]));
+                        correct += ground_truth[q].count(result_labels[i]);
+                    }
+                    total += ground_truth[q].size();
+                }
+                auto end = std::chrono::steady_clock::now();
+                seconds = std::min(seconds, std::chrono::duration<double>(end - start).count());
+            }
+            float recall = total ? (float) correct / total : 1.0f;
+            std::cout << selectivity << "\t" << strategyName(strategy == hnswlib::FILTER_AUTO ? planned : strategy)
+                      << (strategy == hnswlib::FILTER_AUTO ? " (auto)" : "") << "\t" << recall << "\t"
+                      << num_queries / seconds << std::endl;
+            if (strategy == hnswlib::FILTER_GRAPH)
+                graph_recall = recall;
+            if (strategy == hnswlib::FILTER_BRUTE_FORCE)
+                assert(recall > 0.999f);
+            // the planner does not trade recall for speed
+            if (strategy == hnswlib::FILTER_AUTO)
+                assert(recall > graph_recall - 0.05f);
+        }
+        if (selectivity <= 0.001f)
+            assert(planned == hnswlib::FILTER_BRUTE_FORCE);
+        if (selectivity >= 1.0f)
+            assert(planned == hnswlib::FILTER_GRAPH);
+    }
+
+    // a selectivity hint plans functor filters; without one they keep the graph search
+    hnswlib::Bitmap few(n);
+    std::vector<idx_t> few_labels;
+    for (idx_t i = 0; i < n; i += 1000) {
+        few.set(i);
+        few_labels.push_back(i);
+    }
+    SetFilter few_filter(few);
+    hnswlib::SearchParams params;
+    params.k = k;
+    params.filter = &few_filter;
+    assert(alg_hnsw.planFilteredSearch(params, ef) == hnswlib::FILTER_GRAPH);
+    params.filter_selectivity = 0.001f;
+    assert(alg_hnsw.planFilteredSearch(params, ef) == hnswlib::FILTER_BRUTE_FORCE);
+    auto result = alg_hnsw.searchKnnCloserFirst(queries.data(), params);
+    assert(result == alg_brute.searchKnnCloserFirst(queries.data(), k, &few_filter));
+
+    // deleted elements are skipped by every strategy
+    for (idx_t i = 0; i < n; i += 2000) {
+        alg_hnsw.markDelete(i);
+    }
+    hnswlib::BitmapFilter few_bitmap(few_labels);
+    alg_hnsw.bindFilter(few_bitmap);
+    params.filter = &few_bitmap;
+    for (hnswlib::FilterStrategy strategy : strategies) {
+        params.filter_strategy = strategy;
+        for (auto &item : alg_hnsw.searchKnnCloserFirst(queries.data(), params)) {
+            assert(item.second % 1000 == 0 && item.second % 2000 != 0);
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
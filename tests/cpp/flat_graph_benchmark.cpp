@@ -0,0 +1,120 @@
+// This is a test file for flat (hierarchy-free) graphs, with a benchmark against the full hierarchy
+
+#include "../../hnswlib/hnswlib.h"
+
+#include "benchmark_data.h"
+
+#include <assert.h>
+
+#include <chrono>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+struct Measure {
+    float recall;
+    double qps;
+};
+
+Measure measure(const hnswlib::HierarchicalNSW<float> &index, const std::vector<float> &queries, size_t d,
+                const std::vector<std::unordered_set<idx_t>> &ground_truth, size_t k) {
+    size_t num_queries = ground_truth.size();
+    size_t correct = 0;
+    double seconds = 1e9;
+    for (int rep = 0; rep < 3; rep++) {
+        correct = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t q = 0; q < num_queries; q++) {
+            auto result = index.searchKnn(queries.data() + q * d, k);
+            while (!result.empty()) {
+                correct += ground_truth[q].count(result.top().second);
+                result.pop();
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        seconds = std::min(seconds, std::chrono::duration<double>(end - start).count());
+    }
+    return {(float) correct / (num_queries * k), num_queries / seconds};
+}
+
+void test() {
+    size_t d = 128;
+    idx_t n = 20000;
+    size_t num_queries = 200;
+    size_t k = 10;
+    size_t ef = 64;
+
+    std::vector<float> data;
+    std::vector<float> queries;
+    benchmark::generateEmbeddings(n, num_queries, d, 47, data, queries);
+    std::vector<idx_t> labels(n);
+    for (idx_t i = 0; i < n; i++) {
+        labels[i] = i;
+    }
+
+    hnswlib::L2Space space(d);
+    auto ground_truth = benchmark::groundTruth(&space, data, labels, queries, d, k);
+
+    hnswlib::HierarchicalNSW<float> hierarchy(&space, n, 16, 100);
+    hierarchy.addPoints(data.data(), labels.data(), n);
+    hierarchy.setEf(ef);
+    Measure hierarchy_measure = measure(hierarchy, queries, d, ground_truth, k);
+    std::cout << "graph\t\tmemory MB\trecall\tQPS" << std::endl;
+    std::cout << "hierarchy\t" << hierarchy.memoryUsage() / 1e6 << "\t" << hierarchy_measure.recall << "\t"
+              << hierarchy_measure.qps << std::endl;
+
+    float alphas[] = {1.0f, 1.2f};
+    for (float alpha : alphas) {
+        hnswlib::HierarchicalNSW<float> flat(&space, n, 16, 100);
+        flat.setFlatGraph(alpha);
+        flat.addPoints(data.data(), labels.data(), n);
+        flat.setEf(ef);
+        assert(flat.maxlevel_ == 0 && flat.linkLists_ == nullptr && !flat.pivots()->ids.empty());
+        Measure flat_measure = measure(flat, queries, d, ground_truth, k);
+        std::cout << "flat alpha " << alpha << "\t" << flat.memoryUsage() / 1e6 << "\t" << flat_measure.recall
+                  << "\t" << flat_measure.qps << std::endl;
+        assert(flat.memoryUsage() < hierarchy.memoryUsage());
+        assert(flat_measure.recall > hierarchy_measure.recall - 0.05f);
+    }
+
+    // saved and loaded as a flat graph, and still flat when it grows
+    hnswlib::HierarchicalNSW<float> flat(&space, n / 2, 16, 100);
+    flat.setFlatGraph(1.2f);
+    flat.addPoints(data.data(), labels.data(), n / 2);
+    flat.setEf(ef);
+    std::vector<char> buffer(flat.indexFileSize());
+    flat.saveIndexToBuffer(buffer.data(), buffer.size());
+    hnswlib::HierarchicalNSW<float> loaded(&space);
+    loaded.loadIndexFromBuffer(buffer.data(), buffer.size(), &space);
+    loaded.setEf(ef);
+    assert(loaded.flat_graph_ && loaded.neighbor_selection_.alpha == 1.2f && loaded.base_layer_only);
+    assert(loaded.linkLists_ == nullptr && loaded.pivots()->ids == flat.pivots()->ids);
+    for (size_t q = 0; q < num_queries; q++) {
+        assert(loaded.searchKnnCloserFirst(queries.data() + q * d, k) ==
+               flat.searchKnnCloserFirst(queries.data() + q * d, k));
+    }
+    loaded.resizeIndex(n);
+    for (idx_t i = n / 2; i < n; i++) {
+        loaded.addPoint(data.data() + d * i, i, 3);  // the level is ignored
+    }
+    assert(loaded.maxlevel_ == 0);
+    assert(measure(loaded, queries, d, ground_truth, k).recall > 0.8f);
+
+    bool thrown = false;
+    try { flat.setFlatGraph(); } catch (std::runtime_error &) { thrown = true; }
+    assert(thrown);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
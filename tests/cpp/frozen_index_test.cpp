@@ -0,0 +1,118 @@
+// This is a test file for the read-only FrozenHNSW index
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+    unsigned int divisor = 1;
+
+ public:
+    explicit PickDivisibleIds(unsigned int divisor) : divisor(divisor) {}
+
+    bool operator()(idx_t label_id) {
+        return label_id % divisor == 0;
+    }
+};
+
+void check_same_results(hnswlib::HierarchicalNSW<float> &expected, hnswlib::FrozenHNSW<float> &frozen,
+                        const std::vector<float> &queries, size_t num_queries, int d, size_t k) {
+    PickDivisibleIds pickThree(3);
+    for (size_t q = 0; q < num_queries; q++) {
+        const float *query = queries.data() + d * q;
+        assert(expected.searchKnnCloserFirst(query, k) == frozen.searchKnnCloserFirst(query, k));
+        assert(expected.searchKnnCloserFirst(query, k, &pickThree) ==
+               frozen.searchKnnCloserFirst(query, k, &pickThree));
+    }
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 4000;
+    size_t num_queries = 200;
+    size_t k = 10;
+    std::string path = "frozen_index_test.bin";
+    std::string legacy_path = "frozen_index_test_legacy.bin";
+
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = distrib(rng);
+    }
+    for (size_t i = 0; i < queries.size(); ++i) {
+        queries[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 2 * n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+        if (i % 9 == 0)
+            alg_hnsw.markDelete(i);
+    }
+    alg_hnsw.setEf(40);
+    alg_hnsw.saveIndex(path);
+    alg_hnsw.saveIndexLegacy(legacy_path);
+
+    // copied, loaded from the sectioned format and from a legacy file
+    hnswlib::FrozenHNSW<float> copied(alg_hnsw);
+    hnswlib::FrozenHNSW<float> loaded(&space, path, 3);
+    hnswlib::FrozenHNSW<float> legacy(&space, legacy_path);
+    loaded.setEf(40);
+    legacy.setEf(40);
+    for (hnswlib::FrozenHNSW<float> *frozen : {&copied, &loaded, &legacy}) {
+        assert(frozen->getCurrentElementCount() == n);
+        assert(frozen->getDeletedCount() == alg_hnsw.getDeletedCount());
+        check_same_results(alg_hnsw, *frozen, queries, num_queries, d, k);
+    }
+    std::cout << "frozen index: " << loaded.memoryUsage() << " bytes" << std::endl;
+
+    // concurrent searches, each thread with its own visited marks
+    std::vector<std::vector<std::pair<float, idx_t>>> results(num_queries);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; t++) {
+        threads.push_back(std::thread([&, t]() {
+            for (size_t q = t; q < num_queries; q += 4) {
+                results[q] = loaded.searchKnnCloserFirst(queries.data() + d * q, k);
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (size_t q = 0; q < num_queries; q++) {
+        assert(results[q] == alg_hnsw.searchKnnCloserFirst(queries.data() + d * q, k));
+    }
+
+    bool thrown = false;
+    try {
+        loaded.addPoint(data.data(), n);
+    } catch (const std::runtime_error &e) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    remove(path.c_str());
+    remove(legacy_path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
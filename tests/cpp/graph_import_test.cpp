@@ -0,0 +1,251 @@
+// This is a test file for importing graphs built by other libraries (graph_import.h)
+
+#include "../../hnswlib/graph_import.h"
+
+#include <assert.h>
+
+#include <fstream>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+typedef std::vector<std::vector<hnswlib::tableint>> Graph;
+
+template<typename T>
+void write_pod(std::ofstream &output, const T &value) {
+    output.write((const char *) &value, sizeof(T));
+}
+
+void write_vecs(const std::string &path, const std::vector<float> &data, int d, bool bytes) {
+    std::ofstream output(path, std::ios::binary);
+    for (size_t i = 0; i < data.size() / d; i++) {
+        write_pod(output, (int32_t) d);
+        for (int j = 0; j < d; j++) {
+            if (bytes)
+                write_pod(output, (uint8_t) data[i * d + j]);
+            else
+                write_pod(output, data[i * d + j]);
+        }
+    }
+}
+
+void write_graph(const std::string &path, hnswlib::GraphFormat format, const Graph &graph, uint32_t entry_point) {
+    std::ofstream output(path, std::ios::binary);
+    uint32_t max_degree = 0;
+    for (auto &list : graph) {
+        max_degree = std::max<uint32_t>(max_degree, list.size());
+    }
+    if (format == hnswlib::GRAPH_CAGRA) {
+        write_pod(output, (uint32_t) graph.size());
+        write_pod(output, max_degree);
+        for (auto &list : graph) {
+            for (uint32_t j = 0; j < max_degree; j++) {
+                write_pod(output, j < list.size() ? list[j] : hnswlib::GRAPH_INVALID_ID);
+            }
+        }
+        return;
+    }
+    if (format == hnswlib::GRAPH_NSG) {
+        write_pod(output, max_degree);
+        write_pod(output, entry_point);
+    } else {
+        uint64_t file_size = 24;
+        for (auto &list : graph) {
+            file_size += 4 * (1 + list.size());
+        }
+        write_pod(output, file_size);
+        write_pod(output, max_degree);
+        write_pod(output, entry_point);
+        write_pod(output, (uint64_t) 0);
+    }
+    for (auto &list : graph) {
+        write_pod(output, (uint32_t) list.size());
+        output.write((const char *) list.data(), list.size() * sizeof(hnswlib::tableint));
+    }
+}
+
+void check_level0(hnswlib::HierarchicalNSW<float> &index, const Graph &graph, const std::vector<float> &data, int d) {
+    assert(index.getCurrentElementCount() == graph.size());
+    for (size_t i = 0; i < graph.size(); i++) {
+        assert(index.getExternalLabel(i) == i);
+        assert(index.label_lookup_.at(i) == i);
+        assert(memcmp(index.getDataByInternalId(i), data.data() + i * d, d * sizeof(float)) == 0);
+        hnswlib::linklistsizeint *ll = index.get_linklist0(i);
+        assert(index.getListCount(ll) == graph[i].size());
+        hnswlib::tableint *neighbors = (hnswlib::tableint *) (ll + 1);
+        assert(std::equal(graph[i].begin(), graph[i].end(), neighbors));
+    }
+}
+
+bool import_throws(hnswlib::SpaceInterface<float> *space, const std::string &graph_path, hnswlib::GraphFormat format,
+                   const std::string &vectors_path, const hnswlib::GraphImportOptions &options) {
+    try {
+        delete hnswlib::importGraph(space, graph_path, format, vectors_path, options);
+    } catch (const std::runtime_error &e) {
+        return true;
+    }
+    return false;
+}
+
+// Level 0 of an index built here, imported back in every format
+void test_import_hnsw() {
+    int d = 16;
+    idx_t n = 3000;
+    size_t k = 10;
+    std::string graph_path = "graph_import_test.graph";
+    std::string fvecs_path = "graph_import_test.fvecs";
+    std::string bvecs_path = "graph_import_test.bvecs";
+
+    std::vector<float> data(n * d);
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_int_distribution<> distrib(0, 255);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = distrib(rng);
+    }
+    write_vecs(fvecs_path, data, d, false);
+    write_vecs(bvecs_path, data, d, true);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 8);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    Graph graph(n);
+    for (size_t i = 0; i < n; i++) {
+        hnswlib::linklistsizeint *ll = alg_hnsw.get_linklist0(i);
+        hnswlib::tableint *neighbors = (hnswlib::tableint *) (ll + 1);
+        graph[i].assign(neighbors, neighbors + alg_hnsw.getListCount(ll));
+    }
+
+    hnswlib::GraphFormat formats[] = {hnswlib::GRAPH_CAGRA, hnswlib::GRAPH_NSG, hnswlib::GRAPH_VAMANA};
+    for (hnswlib::GraphFormat format : formats) {
+        write_graph(graph_path, format, graph, alg_hnsw.enterpoint_node_);
+        for (bool upper_levels : {true, false}) {
+            hnswlib::GraphImportOptions options;
+            options.build_upper_levels = upper_levels;
+            options.num_threads = 3;
+            hnswlib::HierarchicalNSW<float> *index = hnswlib::importGraph(
+                &space, graph_path, format, upper_levels ? fvecs_path : bvecs_path, options);
+            check_level0(*index, graph, data, d);
+            assert(index->maxM0_ == alg_hnsw.maxM0_);
+            assert(index->base_layer_only == !upper_levels);
+            if (!upper_levels)
+                assert(index->maxlevel_ == 0);
+
+            // every point finds itself
+            index->setEf(50);
+            size_t found = 0;
+            for (size_t i = 0; i < n; i += 10) {
+                auto result = index->searchKnnCloserFirst(data.data() + d * i, k);
+                for (auto &item : result) {
+                    if (item.first == 0)
+                        found++;
+                }
+            }
+            std::cout << "format " << format << ", upper levels " << upper_levels << ", max level "
+                      << index->maxlevel_ << ", found " << found << "/" << n / 10 << std::endl;
+            assert(found >= n / 10 * 0.98);
+
+            // upper levels are built once
+            if (upper_levels) {
+                bool thrown = false;
+                try { index->buildUpperLevels(); } catch (std::runtime_error &) { thrown = true; }
+                assert(thrown);
+            }
+            delete index;
+        }
+    }
+
+    // degrees are checked against maxM0_
+    hnswlib::GraphImportOptions small_options;
+    small_options.M = 2;
+    assert(import_throws(&space, graph_path, hnswlib::GRAPH_VAMANA, fvecs_path, small_options));
+    small_options.truncate = true;
+    hnswlib::HierarchicalNSW<float> *truncated = hnswlib::importGraph(
+        &space, graph_path, hnswlib::GRAPH_VAMANA, fvecs_path, small_options);
+    for (size_t i = 0; i < n; i++) {
+        assert(truncated->getListCount(truncated->get_linklist0(i)) == std::min<size_t>(4, graph[i].size()));
+    }
+    delete truncated;
+
+    // ids out of range, mismatched vector files and truncated graphs are rejected
+    hnswlib::GraphImportOptions options;
+    graph[n / 2].push_back(n);
+    write_graph(graph_path, hnswlib::GRAPH_NSG, graph, 0);
+    assert(import_throws(&space, graph_path, hnswlib::GRAPH_NSG, fvecs_path, options));
+    graph[n / 2].pop_back();
+    graph.pop_back();
+    write_graph(graph_path, hnswlib::GRAPH_NSG, graph, 0);
+    assert(import_throws(&space, graph_path, hnswlib::GRAPH_NSG, fvecs_path, options));
+    graph.push_back(std::vector<hnswlib::tableint>(3, 1));
+    write_graph(graph_path, hnswlib::GRAPH_NSG, graph, 0);
+    {
+        std::ofstream output(graph_path, std::ios::binary | std::ios::app);
+        write_pod(output, (uint32_t) 5);
+    }
+    assert(import_throws(&space, graph_path, hnswlib::GRAPH_NSG, fvecs_path, options));
+    hnswlib::L2Space wrong_space(d + 1);
+    write_graph(graph_path, hnswlib::GRAPH_NSG, graph, 0);
+    assert(import_throws(&wrong_space, graph_path, hnswlib::GRAPH_NSG, fvecs_path, options));
+
+    remove(graph_path.c_str());
+    remove(fvecs_path.c_str());
+    remove(bvecs_path.c_str());
+}
+
+// A random graph spanning several chunks, imported level 0 only
+void test_import_chunks() {
+    int d = 2;
+    size_t n = 3 * hnswlib::GRAPH_CHUNK_SIZE + 123;
+    std::string graph_path = "graph_import_test.graph";
+    std::string fvecs_path = "graph_import_test.fvecs";
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = rng() % 1000;
+    }
+    write_vecs(fvecs_path, data, d, false);
+    Graph graph(n);
+    for (size_t i = 0; i < n; i++) {
+        size_t degree = rng() % 13;
+        for (size_t j = 0; j < degree; j++) {
+            hnswlib::tableint neighbor = rng() % n;
+            if (neighbor != i)
+                graph[i].push_back(neighbor);
+        }
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::GraphFormat formats[] = {hnswlib::GRAPH_CAGRA, hnswlib::GRAPH_NSG, hnswlib::GRAPH_VAMANA};
+    for (hnswlib::GraphFormat format : formats) {
+        write_graph(graph_path, format, graph, 7);
+        hnswlib::GraphImportOptions options;
+        options.build_upper_levels = false;
+        options.num_threads = 2;
+        hnswlib::HierarchicalNSW<float> *index = hnswlib::importGraph(&space, graph_path, format, fvecs_path, options);
+        check_level0(*index, graph, data, d);
+        assert(index->M_ == 6);
+        if (format != hnswlib::GRAPH_CAGRA)
+            assert(index->enterpoint_node_ == 7);
+        delete index;
+    }
+
+    remove(graph_path.c_str());
+    remove(fvecs_path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test_import_hnsw();
+    test_import_chunks();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
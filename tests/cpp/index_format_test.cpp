@@ -0,0 +1,235 @@
+// This is a test file for the sectioned index file format and the legacy format loader
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void check_same_index(hnswlib::HierarchicalNSW<float> &expected, hnswlib::HierarchicalNSW<float> &actual,
+                      const std::vector<float> &query, int d, size_t nq, size_t k) {
+    assert(expected.cur_element_count == actual.cur_element_count);
+    assert(expected.maxlevel_ == actual.maxlevel_);
+    assert(expected.enterpoint_node_ == actual.enterpoint_node_);
+    assert(expected.getDeletedCount() == actual.getDeletedCount());
+    assert(expected.label_lookup_ == actual.label_lookup_);
+    for (size_t i = 0; i < expected.cur_element_count; i++) {
+        assert(expected.element_levels_[i] == actual.element_levels_[i]);
+        if (expected.element_levels_[i] > 0)
+            assert(memcmp(expected.linkLists_[i], actual.linkLists_[i], expected.getLinkListSize(i)) == 0);
+    }
+    assert(memcmp(expected.data_level0_memory_, actual.data_level0_memory_,
+                  expected.cur_element_count * expected.size_data_per_element_) == 0);
+
+    for (size_t j = 0; j < nq; ++j) {
+        const void* p = query.data() + j * d;
+        auto expected_result = expected.searchKnnCloserFirst(p, k);
+        auto actual_result = actual.searchKnnCloserFirst(p, k);
+        assert(expected_result == actual_result);
+    }
+}
+
+size_t file_size(const std::string &path) {
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    return input.tellg();
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 1000;
+    idx_t nq = 20;
+    size_t k = 10;
+    std::string path = "index_format_test.bin";
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 2 * n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, 7 * i);
+    }
+    for (size_t i = 0; i < n; i += 10) {
+        alg_hnsw.markDelete(7 * i);
+    }
+
+    // sectioned format, with checksums
+    alg_hnsw.saveIndex(path);
+    assert(file_size(path) == alg_hnsw.indexFileSize());
+    assert(file_size(path) % hnswlib::INDEX_FILE_ALIGNMENT == 0);
+    {
+        std::ifstream input(path, std::ios::binary);
+        char magic[8];
+        input.read(magic, sizeof(magic));
+        assert(memcmp(magic, hnswlib::INDEX_FILE_MAGIC, sizeof(magic)) == 0);
+    }
+    {
+        hnswlib::HierarchicalNSW<float> loaded(&space, path);
+        check_same_index(alg_hnsw, loaded, query, d, nq, k);
+    }
+
+    // sectioned format, without checksums
+    alg_hnsw.saveIndex(path, false);
+    {
+        hnswlib::HierarchicalNSW<float> loaded(&space, path, false, 3 * n, true);
+        check_same_index(alg_hnsw, loaded, query, d, nq, k);
+        assert(loaded.getMaxElements() == 3 * n);
+        assert(loaded.deleted_elements.size() == n / 10);
+    }
+
+    // parallel positional reads and sequential stream reads give the same index
+    alg_hnsw.saveIndex(path);
+    for (size_t num_threads : {1, 3, 8}) {
+        hnswlib::HierarchicalNSW<float> loaded(&space);
+        loaded.loadIndex(path, &space, 0, num_threads);
+        check_same_index(alg_hnsw, loaded, query, d, nq, k);
+    }
+    {
+        std::ifstream input(path, std::ios::binary);
+        hnswlib::HierarchicalNSW<float> loaded(&space);
+        loaded.loadIndex(input, &space);
+        check_same_index(alg_hnsw, loaded, query, d, nq, k);
+    }
+
+    // in-memory buffers
+    {
+        std::vector<char> buffer(alg_hnsw.indexFileSize());
+        size_t written = alg_hnsw.saveIndexToBuffer(buffer.data(), buffer.size());
+        assert(written == buffer.size());
+        hnswlib::HierarchicalNSW<float> loaded(&space);
+        loaded.loadIndexFromBuffer(buffer.data(), buffer.size(), &space);
+        check_same_index(alg_hnsw, loaded, query, d, nq, k);
+
+        bool too_small_thrown = false;
+        try {
+            alg_hnsw.saveIndexToBuffer(buffer.data(), buffer.size() - 1);
+        } catch (const std::runtime_error &e) {
+            too_small_thrown = true;
+        }
+        assert(too_small_thrown);
+
+        // zero-copy: vectors and links stay in the buffer until the index grows
+        for (bool verify : {true, false}) {
+            hnswlib::HierarchicalNSW<float> adopted(&space);
+            adopted.adoptIndexBuffer(buffer.data(), buffer.size(), &space, verify);
+            check_same_index(alg_hnsw, adopted, query, d, nq, k);
+            assert(adopted.getMaxElements() == n);
+            assert(adopted.data_level0_memory_ >= buffer.data() &&
+                   adopted.data_level0_memory_ < buffer.data() + buffer.size());
+
+            adopted.resizeIndex(n + 10);
+            assert(!adopted.isInAdoptedBuffer(adopted.data_level0_memory_));
+            check_same_index(alg_hnsw, adopted, query, d, nq, k);
+            adopted.addPoint(query.data(), 1000000);
+            assert(adopted.searchKnn(query.data(), 1).top().second == 1000000);
+        }
+    }
+    {
+        std::stringbuf buffer;
+        alg_hnsw.saveIndexToBuffer(buffer);
+        hnswlib::HierarchicalNSW<float> loaded(&space);
+        loaded.loadIndexFromBuffer(buffer, &space);
+        check_same_index(alg_hnsw, loaded, query, d, nq, k);
+    }
+
+    // legacy format
+    alg_hnsw.saveIndexLegacy(path);
+    {
+        hnswlib::HierarchicalNSW<float> loaded(&space, path);
+        check_same_index(alg_hnsw, loaded, query, d, nq, k);
+    }
+    {
+        hnswlib::HierarchicalNSW<float> loaded(&space);
+        loaded.loadIndex(path, &space, 0, 5);
+        check_same_index(alg_hnsw, loaded, query, d, nq, k);
+    }
+
+    // truncated legacy file must be rejected
+    {
+        std::ifstream input(path, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        std::ofstream output(path, std::ios::binary);
+        output.write(bytes.data(), bytes.size() - 3);
+    }
+    bool truncated_thrown = false;
+    try {
+        hnswlib::HierarchicalNSW<float> loaded(&space, path);
+    } catch (const std::runtime_error &e) {
+        truncated_thrown = true;
+    }
+    assert(truncated_thrown);
+
+    // corrupted level 0 block must be detected by the checksum
+    alg_hnsw.saveIndex(path);
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(hnswlib::INDEX_FILE_ALIGNMENT * 2 + 100);
+        char byte = 0x5a;
+        file.write(&byte, 1);
+    }
+    bool thrown = false;
+    try {
+        hnswlib::HierarchicalNSW<float> loaded(&space, path);
+    } catch (const std::runtime_error &e) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // a section past the end of the file is rejected even when offset + size wraps around
+    alg_hnsw.saveIndex(path);
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        hnswlib::IndexFileHeader header;
+        file.read((char *) &header, sizeof(header));
+        std::vector<hnswlib::IndexSectionEntry> sections(header.num_sections);
+        file.read((char *) sections.data(), sections.size() * sizeof(hnswlib::IndexSectionEntry));
+        sections[1].size = ~uint64_t(0) - sections[1].offset + 2;
+        header.table_crc = 0;
+        uint32_t crc = hnswlib::crc32c(&header, sizeof(header));
+        header.table_crc = hnswlib::crc32cExtend(crc, sections.data(), sections.size() * sizeof(hnswlib::IndexSectionEntry));
+        file.seekp(0);
+        file.write((const char *) &header, sizeof(header));
+        file.write((const char *) sections.data(), sections.size() * sizeof(hnswlib::IndexSectionEntry));
+    }
+    bool wrapped_thrown = false;
+    try {
+        hnswlib::HierarchicalNSW<float> loaded(&space, path);
+    } catch (const std::runtime_error &e) {
+        wrapped_thrown = true;
+    }
+    assert(wrapped_thrown);
+
+    // crc32c check value
+    assert(hnswlib::crc32c("123456789", 9) == 0xE3069283);
+    assert(hnswlib::crc32cCombine(hnswlib::crc32c("1234", 4), hnswlib::crc32c("56789", 5), 5) == 0xE3069283);
+
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
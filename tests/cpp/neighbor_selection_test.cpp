@@ -0,0 +1,137 @@
+// This is a test file for the neighbor selection strategies of the index construction
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::atomic<size_t> distance_count(0);
+
+// L2 that counts the distances computed
+class CountingL2Space : public hnswlib::SpaceInterface<float> {
+    hnswlib::L2Space l2;
+
+    static float countingDistance(const void *a, const void *b, const void *param) {
+        distance_count++;
+        return hnswlib::L2Sqr(a, b, param);
+    }
+
+ public:
+    explicit CountingL2Space(size_t dim) : l2(dim) {}
+
+    size_t get_data_size() override {
+        return l2.get_data_size();
+    }
+
+    hnswlib::DISTFUNC<float> get_dist_func() override {
+        return countingDistance;
+    }
+
+    void *get_dist_func_param() override {
+        return l2.get_dist_func_param();
+    }
+};
+
+float averageDegree(const hnswlib::HierarchicalNSW<float> &index) {
+    size_t links = 0;
+    for (size_t i = 0; i < index.cur_element_count; i++) {
+        links += index.getListCount(index.get_linklist0(i));
+    }
+    return (float) links / index.cur_element_count;
+}
+
+void test() {
+    size_t d = 16;
+    idx_t n = 5000;
+    size_t num_queries = 200;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    CountingL2Space space(d);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (idx_t i = 0; i < n; i++) {
+        alg_brute.addPoint(data.data() + d * i, i);
+    }
+    std::vector<std::unordered_set<idx_t>> ground_truth(num_queries);
+    for (size_t q = 0; q < num_queries; q++) {
+        for (auto &item : alg_brute.searchKnnCloserFirst(queries.data() + q * d, k)) {
+            ground_truth[q].insert(item.second);
+        }
+    }
+
+    hnswlib::NeighborSelection selections[5];
+    const char *names[5] = {"hnsw", "alpha 1.2", "keep pruned", "extend candidates", "all"};
+    selections[1].alpha = 1.2f;
+    selections[2].keep_pruned = true;
+    selections[3].extend_candidates = true;
+    selections[4].alpha = 1.2f;
+    selections[4].keep_pruned = true;
+    selections[4].extend_candidates = true;
+    float degrees[5];
+    std::cout << "selection\t\tdegree\tdistances per insert\trecall" << std::endl;
+    for (int s = 0; s < 5; s++) {
+        hnswlib::HierarchicalNSW<float> index(&space, n, 8, 100);
+        index.setNeighborSelection(selections[s]);
+        distance_count = 0;
+        for (idx_t i = 0; i < n; i++) {
+            index.addPoint(data.data() + d * i, i);
+        }
+        size_t build_distances = distance_count;
+        index.setEf(20);
+        size_t correct = 0;
+        for (size_t q = 0; q < num_queries; q++) {
+            for (auto &item : index.searchKnnCloserFirst(queries.data() + q * d, k)) {
+                correct += ground_truth[q].count(item.second);
+            }
+        }
+        float recall = (float) correct / (num_queries * k);
+        degrees[s] = averageDegree(index);
+        std::cout << names[s] << "\t\t" << degrees[s] << "\t" << (float) build_distances / n << "\t" << recall
+                  << std::endl;
+        assert(recall > 0.85f);
+
+        // the selection is saved with the index
+        std::vector<char> buffer(index.indexFileSize());
+        index.saveIndexToBuffer(buffer.data(), buffer.size());
+        hnswlib::HierarchicalNSW<float> loaded(&space);
+        loaded.loadIndexFromBuffer(buffer.data(), buffer.size(), &space);
+        assert(loaded.neighbor_selection_.alpha == selections[s].alpha);
+        assert(loaded.neighbor_selection_.keep_pruned == selections[s].keep_pruned);
+        assert(loaded.neighbor_selection_.extend_candidates == selections[s].extend_candidates);
+    }
+    // relaxed pruning and the fill-up keep more links
+    assert(degrees[1] > degrees[0]);
+    assert(degrees[2] > degrees[1]);
+
+    bool thrown = false;
+    hnswlib::NeighborSelection bad;
+    bad.alpha = 0.5f;
+    hnswlib::HierarchicalNSW<float> index(&space, n);
+    try { index.setNeighborSelection(bad); } catch (std::runtime_error &) { thrown = true; }
+    assert(thrown);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
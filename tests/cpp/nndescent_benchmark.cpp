@@ -0,0 +1,109 @@
+// This is a test file for the NN-Descent bulk builder, with a benchmark against the incremental build
+
+#include "../../hnswlib/nndescent.h"
+
+#include "benchmark_data.h"
+
+#include <assert.h>
+
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test() {
+    size_t d = 128;
+    idx_t n = 20000;
+    size_t num_queries = 200;
+    size_t k = 10;
+    size_t M = 16;
+    size_t ef_construction = 100;
+
+    std::vector<float> data;
+    std::vector<float> queries;
+    benchmark::generateEmbeddings(n, num_queries, d, 47, data, queries);
+    std::vector<idx_t> labels(n);
+    for (idx_t i = 0; i < n; i++) {
+        labels[i] = i;
+    }
+
+    hnswlib::L2Space space(d);
+    auto ground_truth = benchmark::groundTruth(&space, data, labels, queries, d, k);
+
+    hnswlib::HierarchicalNSW<float> incremental(&space, n, M, ef_construction);
+    double incremental_seconds = benchmark::seconds([&]() { incremental.addPoints(data.data(), labels.data(), n); });
+
+    hnswlib::NNDescentOptions options;
+    options.M = M;
+    options.ef_construction = ef_construction;
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> bulk;
+    double bulk_seconds = benchmark::seconds([&]() { bulk.reset(hnswlib::buildNNDescent(&space, data.data(), nullptr, n, options)); });
+
+    std::cout << "build\t\tseconds\trecall at ef 16, 32, 64, 128" << std::endl;
+    size_t efs[] = {16, 32, 64, 128};
+    float incremental_recall[4];
+    float bulk_recall[4];
+    std::cout << "incremental\t" << incremental_seconds;
+    for (size_t i = 0; i < 4; i++) {
+        incremental.setEf(efs[i]);
+        incremental_recall[i] = benchmark::recall(incremental, queries, d, ground_truth, k);
+        std::cout << "\t" << incremental_recall[i];
+    }
+    std::cout << std::endl << "nn-descent\t" << bulk_seconds;
+    for (size_t i = 0; i < 4; i++) {
+        bulk->setEf(efs[i]);
+        bulk_recall[i] = benchmark::recall(*bulk, queries, d, ground_truth, k);
+        std::cout << "\t" << bulk_recall[i];
+    }
+    std::cout << std::endl;
+    assert(bulk_recall[2] > incremental_recall[2] - 0.03f);
+    assert(bulk_recall[3] > 0.9f);
+
+    // the same structures as an incremental build: labels, vectors, bounded lists, upper levels
+    assert(bulk->getCurrentElementCount() == n && bulk->maxlevel_ > 0);
+    assert(bulk->getDataByLabel<float>(123) == std::vector<float>(data.begin() + 123 * d, data.begin() + 124 * d));
+    for (idx_t i = 0; i < n; i++) {
+        size_t count = bulk->getListCount(bulk->get_linklist0(i));
+        assert(count > 0 && count <= bulk->maxM0_);
+    }
+    std::vector<char> buffer(bulk->indexFileSize());
+    bulk->saveIndexToBuffer(buffer.data(), buffer.size());
+    hnswlib::HierarchicalNSW<float> loaded(&space);
+    loaded.loadIndexFromBuffer(buffer.data(), buffer.size(), &space);
+    loaded.setEf(64);
+    bulk->setEf(64);
+    for (size_t q = 0; q < num_queries; q++) {
+        assert(loaded.searchKnnCloserFirst(queries.data() + q * d, k) ==
+               bulk->searchKnnCloserFirst(queries.data() + q * d, k));
+    }
+    loaded.resizeIndex(n + 1);
+    loaded.addPoint(queries.data(), n);
+    assert(loaded.searchKnnCloserFirst(queries.data(), 1)[0].second == n);
+
+    // level 0 only, searched from pivots
+    options.build_upper_levels = false;
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> flat(
+        hnswlib::buildNNDescent(&space, data.data(), labels.data(), n / 4, options));
+    assert(flat->maxlevel_ == 0 && flat->base_layer_only && !flat->pivots()->ids.empty());
+
+    // tiny and invalid inputs
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> tiny(hnswlib::buildNNDescent(&space, data.data(), nullptr, 3));
+    assert(tiny->searchKnnCloserFirst(data.data() + 2 * d, 1)[0].second == 2);
+    labels[1] = 0;
+    bool thrown = false;
+    try { delete hnswlib::buildNNDescent(&space, data.data(), labels.data(), 10); } catch (std::runtime_error &) { thrown = true; }
+    assert(thrown);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
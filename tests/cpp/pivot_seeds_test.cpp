@@ -0,0 +1,138 @@
+// This is a test file for the pivots base_layer_only searches start from
+
+#include "../../hnswlib/hnswlib.h"
+#include "../../hnswlib/hnswfrozen.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+template<typename Index>
+float recall(const Index &index, hnswlib::BruteforceSearch<float> &alg_brute, const std::vector<float> &queries,
+             size_t num_queries, size_t d, size_t k) {
+    size_t correct = 0;
+    for (size_t q = 0; q < num_queries; q++) {
+        const float *query = queries.data() + q * d;
+        std::unordered_set<idx_t> expected;
+        for (auto &item : alg_brute.searchKnnCloserFirst(query, k)) expected.insert(item.second);
+        for (auto &item : index.searchKnnCloserFirst(query, k)) correct += expected.count(item.second);
+    }
+    return (float) correct / (num_queries * k);
+}
+
+void test() {
+    size_t d = 16;
+    idx_t n = 10000;
+    size_t num_queries = 200;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    // room for four times the elements: seeds spread over max_elements would land in empty slots
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 4 * n);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (idx_t i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+        alg_brute.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.setEf(20);
+    alg_hnsw.base_layer_only = true;
+    float seeds_recall = recall(alg_hnsw, alg_brute, queries, num_queries, d, k);
+
+    alg_hnsw.buildPivots(64);
+    std::vector<hnswlib::tableint> pivot_ids = alg_hnsw.pivots()->ids;
+    assert(pivot_ids.size() == 64);
+    for (hnswlib::tableint id : pivot_ids) assert(id < n);
+    float pivots_recall = recall(alg_hnsw, alg_brute, queries, num_queries, d, k);
+    std::cout << "spread seeds recall: " << seeds_recall << ", pivots recall: " << pivots_recall << std::endl;
+    assert(pivots_recall > 0.8f);
+
+    // the nearest pivots, closest first, as a scan over the pivot elements finds them
+    for (size_t q = 0; q < 20; q++) {
+        const float *query = queries.data() + q * d;
+        auto pivots = alg_hnsw.nearestPivots(query, 5);
+        assert(pivots.size() == 5);
+        std::vector<std::pair<float, hnswlib::tableint>> expected;
+        for (hnswlib::tableint id : pivot_ids) {
+            expected.emplace_back(space.get_dist_func()(query, alg_hnsw.getDataByInternalId(id),
+                                                        space.get_dist_func_param()), id);
+        }
+        std::sort(expected.begin(), expected.end());
+        for (size_t i = 0; i < pivots.size(); i++) {
+            assert(pivots[i].second == expected[i].second);
+            assert(std::abs(pivots[i].first - expected[i].first) < 1e-4f);
+        }
+    }
+
+    // an updated pivot element is scanned with its new vector; a table taken before keeps the old one
+    hnswlib::tableint updated = pivot_ids[0];
+    auto before = alg_hnsw.pivots();
+    std::vector<char> before_vectors = before->vectors;
+    alg_hnsw.addPoint(queries.data(), alg_hnsw.getExternalLabel(updated));
+    assert(alg_hnsw.nearestPivots(queries.data(), 1)[0].second == updated);
+    assert(before->vectors == before_vectors);
+    alg_hnsw.addPoint(data.data() + d * alg_hnsw.getExternalLabel(updated), alg_hnsw.getExternalLabel(updated));
+
+    // saved with the index, and used by the frozen copy
+    std::vector<char> buffer(alg_hnsw.indexFileSize());
+    alg_hnsw.saveIndexToBuffer(buffer.data(), buffer.size());
+    hnswlib::HierarchicalNSW<float> loaded(&space);
+    loaded.loadIndexFromBuffer(buffer.data(), buffer.size(), &space);
+    assert(loaded.base_layer_only && loaded.pivots()->ids == alg_hnsw.pivots()->ids);
+    loaded.setEf(20);
+    hnswlib::FrozenHNSW<float> frozen(alg_hnsw);
+    for (size_t q = 0; q < num_queries; q++) {
+        const float *query = queries.data() + q * d;
+        auto expected = alg_hnsw.searchKnnCloserFirst(query, k);
+        assert(loaded.searchKnnCloserFirst(query, k) == expected);
+        assert(frozen.searchKnnCloserFirst(query, k) == expected);
+    }
+
+    // searches keep working while the pivots are rebuilt
+    std::atomic<bool> rebuilding{true};
+    std::thread rebuilder([&]() {
+        for (size_t seed = 0; seed < 200; seed++) {
+            alg_hnsw.buildPivots(64, seed);
+        }
+        rebuilding = false;
+    });
+    while (rebuilding) {
+        for (size_t q = 0; q < num_queries; q++) {
+            alg_hnsw.searchKnn(queries.data() + q * d, k);
+        }
+    }
+    rebuilder.join();
+
+    // indexes with upper levels do not save pivots
+    alg_hnsw.base_layer_only = false;
+    buffer.resize(alg_hnsw.indexFileSize());
+    alg_hnsw.saveIndexToBuffer(buffer.data(), buffer.size());
+    hnswlib::HierarchicalNSW<float> layered(&space);
+    layered.loadIndexFromBuffer(buffer.data(), buffer.size(), &space);
+    assert(!layered.base_layer_only && layered.pivots()->ids.empty());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
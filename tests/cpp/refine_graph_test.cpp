@@ -0,0 +1,153 @@
+// This is a test file for the refinement of a built graph
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+float recall(const hnswlib::HierarchicalNSW<float> &index, const std::vector<float> &queries, size_t d,
+             const std::vector<std::unordered_set<idx_t>> &ground_truth, size_t k) {
+    size_t correct = 0;
+    for (size_t q = 0; q < ground_truth.size(); q++) {
+        for (auto &item : index.searchKnnCloserFirst(queries.data() + q * d, k)) {
+            correct += ground_truth[q].count(item.second);
+        }
+    }
+    return (float) correct / (ground_truth.size() * k);
+}
+
+// level 0 lists: no self links, no duplicates, no more than maxM0_ links
+void checkLinks(const hnswlib::HierarchicalNSW<float> &index) {
+    for (hnswlib::tableint i = 0; i < index.cur_element_count; i++) {
+        hnswlib::linklistsizeint *list = index.get_linklist0(i);
+        size_t size = index.getListCount(list);
+        assert(size <= index.maxM0_);
+        hnswlib::tableint *links = (hnswlib::tableint *) (list + 1);
+        std::unordered_set<hnswlib::tableint> unique(links, links + size);
+        assert(unique.size() == size);
+        assert(!unique.count(i));
+        for (hnswlib::tableint link : unique) assert(link < index.cur_element_count);
+    }
+}
+
+void test() {
+    size_t d = 16;
+    idx_t n = 20000;
+    idx_t n_extra = 2000;
+    size_t num_queries = 300;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data((n + n_extra) * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+    std::vector<idx_t> labels(n + n_extra);
+    for (idx_t i = 0; i < n + n_extra; i++) {
+        labels[i] = i;
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (idx_t i = 0; i < n; i++) {
+        alg_brute.addPoint(data.data() + d * i, i);
+    }
+    std::vector<std::unordered_set<idx_t>> ground_truth(num_queries);
+    for (size_t q = 0; q < num_queries; q++) {
+        for (auto &item : alg_brute.searchKnnCloserFirst(queries.data() + q * d, k)) {
+            ground_truth[q].insert(item.second);
+        }
+    }
+
+    // a cheap build leaves a poor graph
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n + n_extra, 8, 20);
+    alg_hnsw.addPoints(data.data(), labels.data(), n);
+    for (idx_t i = 0; i < n; i += 50) {
+        alg_hnsw.markDelete(i);
+    }
+    size_t efs[] = {10, 20, 40};
+    std::vector<float> before;
+    for (size_t ef : efs) {
+        alg_hnsw.setEf(ef);
+        before.push_back(recall(alg_hnsw, queries, d, ground_truth, k));
+    }
+
+    // refined while another thread keeps searching
+    std::atomic<bool> refining(true);
+    std::thread searcher([&]() {
+        while (refining) {
+            for (size_t q = 0; q < num_queries; q++) {
+                alg_hnsw.searchKnn(queries.data() + q * d, k);
+            }
+        }
+    });
+    size_t last_done = 0;
+    alg_hnsw.refineGraph(100, 1, 2, [&](size_t done, size_t total) {
+        assert(done > last_done && total == n);
+        last_done = done;
+    });
+    refining = false;
+    searcher.join();
+    assert(last_done == n);
+    checkLinks(alg_hnsw);
+
+    std::cout << "ef\trecall before\trecall after" << std::endl;
+    for (size_t i = 0; i < sizeof(efs) / sizeof(efs[0]); i++) {
+        alg_hnsw.setEf(efs[i]);
+        float after = recall(alg_hnsw, queries, d, ground_truth, k);
+        std::cout << efs[i] << "\t" << before[i] << "\t" << after << std::endl;
+        assert(after > before[i]);
+    }
+
+    // a second pass while points are inserted keeps the graph valid and the links the inserts add, so
+    // the new points stay reachable; deleted elements stay out of the results. Refinement and inserts
+    // share one pool while snapshots are taken, which must not deadlock
+    hnswlib::ThreadPool pool(2);
+    std::atomic<bool> refining_again(true);
+    std::thread inserter([&]() {
+        alg_hnsw.addPoints(data.data() + d * n, labels.data() + n, n_extra, pool);
+    });
+    std::thread snapshotter([&]() {
+        while (refining_again) {
+            alg_hnsw.saveIndexAsync("refine_graph_test.bin").get();
+        }
+    });
+    alg_hnsw.refineGraph(50, 1, pool);
+    refining_again = false;
+    inserter.join();
+    snapshotter.join();
+    remove("refine_graph_test.bin");
+    checkLinks(alg_hnsw);
+    for (size_t q = 0; q < num_queries; q++) {
+        for (auto &item : alg_hnsw.searchKnnCloserFirst(queries.data() + q * d, k)) {
+            assert(item.second >= n || item.second % 50 != 0);
+        }
+    }
+    alg_hnsw.setEf(50);
+    size_t found = 0;
+    for (idx_t i = n; i < n + n_extra; i++) {
+        found += alg_hnsw.searchKnn(data.data() + d * i, 1).top().second == i;
+    }
+    assert(found > 0.95 * n_extra);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
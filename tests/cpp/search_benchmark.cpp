@@ -0,0 +1,176 @@
+// This is a test file for the bounded candidate lists of the search, with a benchmark across ef values
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <chrono>
+#include <set>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+typedef std::pair<float, hnswlib::tableint> Candidate;
+
+// random pushes and pops against a multiset
+template<typename CandidateList>
+void testCandidateList(size_t capacity) {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_int_distribution<int> distrib(0, 50);  // small range, so there are ties
+    CandidateList list;
+    list.reserve(capacity);
+    std::multiset<float> expected;
+    for (int rep = 0; rep < 3; rep++) {
+        list.clear();
+        expected.clear();
+        for (int step = 0; step < 20000; step++) {
+            int op = rng() % 5;
+            if (op < 2 && expected.size() < capacity) {
+                float dist = (float) distrib(rng);
+                list.push(dist, step);
+                expected.insert(dist);
+            } else if (op == 2 && !expected.empty()) {
+                assert(list.minDist() == *expected.begin());
+                list.popMin();
+                expected.erase(expected.begin());
+            } else if (op == 3 && !expected.empty()) {
+                assert(list.maxDist() == *expected.rbegin());
+                list.popMax();
+                expected.erase(std::prev(expected.end()));
+            } else if (op == 4) {
+                // bounded by the current size, replacing the farthest, or by one more, growing
+                size_t max_size = std::min(expected.size() + rng() % 2, capacity);
+                if (max_size == 0)
+                    continue;
+                float dist = (float) distrib(rng);
+                list.pushBounded(dist, step, max_size);
+                if (expected.size() < max_size) {
+                    expected.insert(dist);
+                } else if (dist < *expected.rbegin()) {
+                    expected.erase(std::prev(expected.end()));
+                    expected.insert(dist);
+                }
+            }
+            assert(list.size() == expected.size());
+        }
+    }
+}
+
+void testSortedOrder() {
+    hnswlib::SortedCandidateBuffer<float, hnswlib::tableint> buffer;
+    buffer.reserve(40);
+    for (hnswlib::tableint i = 0; i < 40; i++) {
+        buffer.push((float) ((i * 7) % 13), i);
+    }
+    for (size_t i = 1; i < buffer.size(); i++) {
+        assert(buffer.dist(i - 1) <= buffer.dist(i));
+        // equal distances keep insertion order
+        if (buffer.dist(i - 1) == buffer.dist(i))
+            assert(buffer.id(i - 1) < buffer.id(i));
+    }
+}
+
+// the reference: base layer search on binary heaps of pairs
+std::vector<Candidate> searchWithHeaps(const hnswlib::HierarchicalNSW<float> &alg_hnsw, hnswlib::VisitedList *vl,
+                                       const float *query, size_t ef) {
+    hnswlib::NoSearchStats stats;
+    hnswlib::SearchParams params;
+    std::vector<Candidate> top_candidates;
+    std::vector<Candidate> candidate_set;
+    hnswlib::tableint ep = alg_hnsw.searchUpperLevels(query, stats);
+    alg_hnsw.searchBaseLayerST<false>(vl, top_candidates, candidate_set, ep, query, ef, params, stats);
+    std::sort(top_candidates.begin(), top_candidates.end());
+    return top_candidates;
+}
+
+std::vector<Candidate> searchWithBuffers(const hnswlib::HierarchicalNSW<float> &alg_hnsw,
+                                         hnswlib::SearchContext<float> &ctx, const float *query, size_t ef) {
+    hnswlib::NoSearchStats stats;
+    hnswlib::SearchParams params;
+    ctx.reserveCandidates(ef);
+    alg_hnsw.searchLayers(ctx.visited, ctx, query, ef, params, stats);
+    std::vector<Candidate> top_candidates = ctx.top_candidates;
+    std::sort(top_candidates.begin(), top_candidates.end());
+    return top_candidates;
+}
+
+void testAndBenchmark() {
+    size_t d = 32;
+    idx_t n = 20000;
+    size_t num_queries = 300;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    std::vector<idx_t> labels(n);
+    for (idx_t i = 0; i < n; i++) {
+        labels[i] = i;
+    }
+    alg_hnsw.addPoints(data.data(), labels.data(), n);
+
+    hnswlib::SearchContext<float> ctx(n, 10);
+    hnswlib::VisitedList vl(n);
+    size_t efs[] = {10, 50, 100, 256, 512, 513, 1000};
+    std::cout << "ef\theaps QPS\tbuffers QPS" << std::endl;
+    for (size_t ef : efs) {
+        // same candidates, bit for bit
+        for (size_t q = 0; q < num_queries; q++) {
+            const float *query = queries.data() + q * d;
+            assert(searchWithBuffers(alg_hnsw, ctx, query, ef) == searchWithHeaps(alg_hnsw, &vl, query, ef));
+        }
+
+        // best of a few alternating runs, timings are noisy
+        double heap_seconds = 1e9;
+        double buffer_seconds = 1e9;
+        for (int rep = 0; rep < 5; rep++) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t q = 0; q < num_queries; q++) {
+                searchWithHeaps(alg_hnsw, &vl, queries.data() + q * d, ef);
+            }
+            auto middle = std::chrono::steady_clock::now();
+            for (size_t q = 0; q < num_queries; q++) {
+                searchWithBuffers(alg_hnsw, ctx, queries.data() + q * d, ef);
+            }
+            auto end = std::chrono::steady_clock::now();
+            heap_seconds = std::min(heap_seconds, std::chrono::duration<double>(middle - start).count());
+            buffer_seconds = std::min(buffer_seconds, std::chrono::duration<double>(end - middle).count());
+        }
+        std::cout << ef << "\t" << num_queries / heap_seconds << "\t" << num_queries / buffer_seconds << std::endl;
+    }
+
+    // the public search gives what the filtered (heap) path gives with a filter that allows everything
+    hnswlib::BaseFilterFunctor allow_all;
+    for (size_t ef : efs) {
+        alg_hnsw.setEf(ef);
+        for (size_t q = 0; q < 20; q++) {
+            const float *query = queries.data() + q * d;
+            assert(alg_hnsw.searchKnnCloserFirst(query, k) == alg_hnsw.searchKnnCloserFirst(query, k, &allow_all));
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testCandidateList<hnswlib::SortedCandidateBuffer<float, hnswlib::tableint>>(300);
+    testCandidateList<hnswlib::SortedCandidateBuffer<int, hnswlib::tableint>>(300);
+    testCandidateList<hnswlib::MinMaxCandidateHeap<float, hnswlib::tableint>>(300);
+    testCandidateList<hnswlib::MinMaxCandidateHeap<float, hnswlib::tableint>>(3);
+    testSortedOrder();
+    testAndBenchmark();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+// This is a test file for allocation-free search with a SearchContext
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <new>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+std::atomic<size_t> num_allocations(0);
+
+}  // namespace
+
+void *operator new(size_t size) {
+    num_allocations++;
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    free(ptr);
+}
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+    unsigned int divisor;
+
+ public:
+    explicit PickDivisibleIds(unsigned int divisor) : divisor(divisor) {}
+
+    bool operator()(idx_t label_id) {
+        return label_id % divisor == 0;
+    }
+};
+
+void test() {
+    int d = 16;
+    idx_t n = 5000;
+    size_t num_queries = 200;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (idx_t i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    for (idx_t i = 0; i < n; i += 5) {
+        alg_hnsw.markDelete(i);
+    }
+    alg_hnsw.setEf(50);
+
+    PickDivisibleIds pick_even(2);
+    PickDivisibleIds pick_every_3000(3000);
+    hnswlib::BaseFilterFunctor *filters[] = {nullptr, &pick_even, &pick_every_3000};
+
+    hnswlib::SearchContext<float> ctx;
+    std::vector<idx_t> labels(k);
+    std::vector<float> distances(k);
+    for (auto filter : filters) {
+        // same results as searchKnnCloserFirst
+        for (size_t q = 0; q < num_queries; q++) {
+            const float *query = queries.data() + q * d;
+            size_t found = alg_hnsw.searchKnn(ctx, query, k, labels.data(), distances.data(), filter);
+            auto expected = alg_hnsw.searchKnnCloserFirst(query, k, filter);
+            assert(found == expected.size());
+            for (size_t i = 0; i < found; i++) {
+                assert(labels[i] == expected[i].second);
+                assert(distances[i] == expected[i].first);
+            }
+        }
+
+        // no allocations once the context is warm
+        size_t allocations_before = num_allocations;
+        for (size_t q = 0; q < num_queries; q++) {
+            alg_hnsw.searchKnn(ctx, queries.data() + q * d, k, labels.data(), distances.data(), filter);
+        }
+        assert(num_allocations == allocations_before);
+    }
+
+    // a context sized for a smaller index grows for a larger one
+    hnswlib::HierarchicalNSW<float> small_hnsw(&space, 100);
+    for (idx_t i = 0; i < 100; i++) {
+        small_hnsw.addPoint(data.data() + d * i, i);
+    }
+    hnswlib::SearchContext<float> small_ctx(100, 10);
+    assert(small_hnsw.searchKnn(small_ctx, queries.data(), k, labels.data(), distances.data()) == k);
+    assert(alg_hnsw.searchKnn(small_ctx, queries.data(), k, labels.data(), distances.data()) == k);
+    assert(small_ctx.visited->numelements >= n);
+
+    // empty index and k = 0
+    hnswlib::HierarchicalNSW<float> empty_hnsw(&space, 10);
+    assert(empty_hnsw.searchKnn(ctx, queries.data(), k, labels.data(), distances.data()) == 0);
+    assert(alg_hnsw.searchKnn(ctx, queries.data(), 0, labels.data(), distances.data()) == 0);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,183 @@
+// This is a test file for per-query search parameters
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+    unsigned int divisor;
+
+ public:
+    explicit PickDivisibleIds(unsigned int divisor) : divisor(divisor) {}
+
+    bool operator()(idx_t label_id) {
+        return label_id % divisor == 0;
+    }
+};
+
+void test() {
+    int d = 16;
+    idx_t n = 5000;
+    size_t num_queries = 100;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    for (idx_t i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.setEf(10);
+
+    // per-call ef gives the same results as setEf, without changing the index
+    PickDivisibleIds pick_even(2);
+    size_t efs[] = {10, 40, 200};
+    std::vector<std::vector<std::pair<float, idx_t>>> expected[3];
+    for (size_t e = 0; e < 3; e++) {
+        alg_hnsw.setEf(efs[e]);
+        for (size_t q = 0; q < num_queries; q++) {
+            expected[e].push_back(alg_hnsw.searchKnnCloserFirst(queries.data() + q * d, k, &pick_even));
+        }
+    }
+    alg_hnsw.setEf(10);
+    for (size_t e = 0; e < 3; e++) {
+        hnswlib::SearchParams params;
+        params.k = k;
+        params.ef = efs[e];
+        params.filter = &pick_even;
+        hnswlib::SearchContext<float> ctx;
+        std::vector<idx_t> labels(num_queries * k);
+        std::vector<float> distances(num_queries * k);
+        alg_hnsw.searchKnnBatch(queries.data(), num_queries, labels.data(), distances.data(), params);
+        for (size_t q = 0; q < num_queries; q++) {
+            const float *query = queries.data() + q * d;
+            assert(alg_hnsw.searchKnnCloserFirst(query, params) == expected[e][q]);
+            std::vector<idx_t> ctx_labels(k);
+            std::vector<float> ctx_distances(k);
+            assert(alg_hnsw.searchKnn(ctx, query, params, ctx_labels.data(), ctx_distances.data()) == k);
+            for (size_t i = 0; i < k; i++) {
+                assert(ctx_labels[i] == expected[e][q][i].second);
+                assert(labels[q * k + i] == expected[e][q][i].second);
+                assert(distances[q * k + i] == expected[e][q][i].first);
+            }
+        }
+    }
+    assert(alg_hnsw.ef_ == 10);
+
+    // concurrent searches with different ef
+    std::vector<std::thread> threads;
+    for (size_t e = 0; e < 3; e++) {
+        threads.push_back(std::thread([&, e] {
+            hnswlib::SearchParams params;
+            params.k = k;
+            params.ef = efs[e];
+            params.filter = &pick_even;
+            for (int rep = 0; rep < 5; rep++) {
+                for (size_t q = 0; q < num_queries; q++) {
+                    assert(alg_hnsw.searchKnnCloserFirst(queries.data() + q * d, params) == expected[e][q]);
+                }
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // stats, including the parallel path with one entry per query
+    hnswlib::SearchStats stats;
+    hnswlib::SearchParams params;
+    params.k = k;
+    params.ef = 100;
+    params.stats = &stats;
+    alg_hnsw.searchKnn(queries.data(), params);
+    assert(stats.hops > 0);
+    assert(stats.distance_computations >= stats.hops);
+    assert(stats.compares > 0);
+    assert(stats.time_ns > 0);
+    assert(!stats.stopped_early);
+    size_t full_computations = stats.distance_computations;
+
+    std::vector<hnswlib::SearchStats> batch_stats(num_queries);
+    params.stats = batch_stats.data();
+    hnswlib::ThreadPool pool(3);
+    std::vector<idx_t> labels(num_queries * k);
+    std::vector<float> distances(num_queries * k);
+    alg_hnsw.searchKnnParallel(queries.data(), num_queries, d * sizeof(float), labels.data(), distances.data(),
+                               pool, params);
+    assert(batch_stats[0].hops == stats.hops);
+    assert(batch_stats[0].distance_computations == stats.distance_computations);
+    for (auto &query_stats : batch_stats) {
+        assert(query_stats.hops > 0 && !query_stats.stopped_early);
+    }
+
+    // per-thread totals add up the per-query stats
+    hnswlib::PerThreadSearchStats::total() = hnswlib::SearchStats();
+    hnswlib::PerThreadSearchStats thread_stats;
+    hnswlib::SearchContext<float> ctx;
+    size_t hops = 0;
+    size_t distance_computations = 0;
+    for (size_t q = 0; q < num_queries; q++) {
+        alg_hnsw.searchKnn(ctx, queries.data() + q * d, params, labels.data(), distances.data(), thread_stats);
+        assert(thread_stats.stats.hops == batch_stats[q].hops);
+        hops += thread_stats.stats.hops;
+        distance_computations += thread_stats.stats.distance_computations;
+    }
+    assert(hnswlib::PerThreadSearchStats::total().hops == hops);
+    assert(hnswlib::PerThreadSearchStats::total().distance_computations == distance_computations);
+
+    // a distance budget stops the search early with the best results so far
+    params.stats = &stats;
+    params.max_distance_computations = full_computations / 4;
+    auto result = alg_hnsw.searchKnnCloserFirst(queries.data(), params);
+    assert(stats.stopped_early);
+    assert(stats.distance_computations < full_computations);
+    assert(!result.empty());
+    params.stats = batch_stats.data();
+    alg_hnsw.searchKnnBatch(queries.data(), 1, labels.data(), distances.data(), params);
+    assert(batch_stats[0].stopped_early);
+    assert(batch_stats[0].distance_computations == stats.distance_computations);
+    params.max_distance_computations = 0;
+
+    // a deadline in the past stops before the first expansion
+    params.stats = &stats;
+    params.deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+    alg_hnsw.searchKnn(queries.data(), params);
+    assert(stats.stopped_early);
+    assert(stats.distance_computations < full_computations);
+
+    // indexes without per-call settings use k and filter
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (idx_t i = 0; i < n; i++) {
+        alg_brute.addPoint(data.data() + d * i, i);
+    }
+    params.filter = &pick_even;
+    hnswlib::AlgorithmInterface<float> *algorithm = &alg_brute;
+    assert(algorithm->searchKnnCloserFirst(queries.data(), params) ==
+           alg_brute.searchKnnCloserFirst(queries.data(), k, &pick_even));
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
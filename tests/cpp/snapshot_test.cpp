@@ -0,0 +1,108 @@
+// This is a test file for saving snapshots with saveIndexAsync while points are being added
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test() {
+    int d = 16;
+    idx_t n = 4000;
+    idx_t n_initial = 1000;
+    std::string path = "snapshot_test.bin";
+
+    std::vector<float> data(n * d);
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    alg_hnsw.addAttribute("category", hnswlib::ATTRIBUTE_INT);
+    for (size_t i = 0; i < n_initial; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+        alg_hnsw.setAttribute(i, "category", i % 5 + 1);
+    }
+
+    // inserts, deletes, attribute writes and filter compilations keep going while the snapshot is taken
+    std::atomic<bool> writing{true};
+    std::thread writer([&]() {
+        for (size_t i = n_initial; i < n; ++i) {
+            alg_hnsw.addPoint(data.data() + d * i, i);
+            alg_hnsw.setAttribute(i, "category", i % 5 + 1);
+            if (i % 7 == 0)
+                alg_hnsw.markDelete(i);
+        }
+        writing = false;
+    });
+    std::thread filterer([&]() {
+        while (writing)
+            alg_hnsw.compileFilter({hnswlib::AttributePredicate::equal("category", 2)});
+    });
+    std::future<void> saved = alg_hnsw.saveIndexAsync(path);
+    saved.get();
+    writer.join();
+    filterer.join();
+    assert(alg_hnsw.getCurrentElementCount() == n);
+
+    hnswlib::HierarchicalNSW<float> loaded(&space, path);
+    size_t count = loaded.getCurrentElementCount();
+    assert(count >= n_initial && count <= n);
+    assert(loaded.label_lookup_.size() == count);
+
+    // every saved element matches the live index
+    size_t deleted = 0;
+    for (size_t i = 0; i < count; i++) {
+        assert(loaded.getExternalLabel(i) == alg_hnsw.getExternalLabel(i));
+        assert(memcmp(loaded.getDataByInternalId(i), alg_hnsw.getDataByInternalId(i), d * sizeof(float)) == 0);
+        assert(loaded.element_levels_[i] == alg_hnsw.element_levels_[i]);
+        int64_t category = loaded.getAttribute(loaded.getExternalLabel(i), "category");
+        assert(category == 0 ? i >= n_initial : category == (int64_t) loaded.getExternalLabel(i) % 5 + 1);
+        for (int l = 0; l <= loaded.element_levels_[i]; l++) {
+            hnswlib::linklistsizeint *ll = loaded.get_linklist_at_level(i, l);
+            hnswlib::tableint *neighbors = (hnswlib::tableint *) (ll + 1);
+            for (size_t j = 0; j < loaded.getListCount(ll); j++)
+                assert(neighbors[j] < count);
+        }
+        if (loaded.isMarkedDeleted(i))
+            deleted++;
+    }
+    assert(deleted == loaded.getDeletedCount());
+
+    for (size_t i = 0; i < n_initial; i += 10) {
+        auto result = loaded.searchKnn(data.data() + d * i, 1);
+        assert(result.top().second == i);
+    }
+
+    // a failed snapshot is reported through the future
+    bool thrown = false;
+    try {
+        alg_hnsw.saveIndexAsync("no_such_directory/snapshot_test.bin").get();
+    } catch (const std::runtime_error &e) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
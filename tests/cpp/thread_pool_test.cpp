@@ -0,0 +1,178 @@
+// This is a test file for the persistent ThreadPool and parallel batch search
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testParallelFor(hnswlib::ThreadPool &pool) {
+    size_t sizes[] = {0, 1, 2, 3, pool.size() - 1, pool.size() + 1, 1000, 100000};
+    for (size_t size : sizes) {
+        // every item exactly once, items of one thread id never concurrently
+        std::vector<std::atomic<int>> visits(size + 10);
+        std::vector<std::atomic<int>> running(pool.size());
+        for (auto &count : visits) count = 0;
+        for (auto &count : running) count = 0;
+        pool.parallelFor(10, size + 10, [&](size_t i, size_t thread_id) {
+            assert(thread_id < pool.size());
+            int already_running = running[thread_id].fetch_add(1);
+            assert(already_running == 0);
+            visits[i]++;
+            running[thread_id]--;
+        });
+        for (size_t i = 0; i < visits.size(); i++) {
+            assert(visits[i] == (i < 10 ? 0 : 1));
+        }
+    }
+
+    // skewed item costs
+    std::atomic<size_t> sum(0);
+    pool.parallelFor(0, 2000, [&](size_t i, size_t) {
+        if (i < 20)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        sum += i;
+    });
+    assert(sum == 2000 * 1999 / 2);
+}
+
+void testExceptions(hnswlib::ThreadPool &pool) {
+    std::atomic<size_t> calls(0);
+    bool thrown = false;
+    try {
+        pool.parallelFor(0, 100000, [&](size_t i, size_t) {
+            calls++;
+            if (i == 500)
+                throw std::runtime_error("item 500");
+        });
+    } catch (const std::runtime_error &e) {
+        thrown = std::string(e.what()) == "item 500";
+    }
+    assert(thrown);
+    assert(calls < 100000);
+
+    // the pool keeps working afterwards
+    std::atomic<size_t> count(0);
+    pool.parallelFor(0, 1000, [&](size_t, size_t) { count++; });
+    assert(count == 1000);
+}
+
+void testNestedAndConcurrent(hnswlib::ThreadPool &pool) {
+    // nested loops run serially on the calling thread, with its thread id
+    std::atomic<size_t> count(0);
+    pool.parallelFor(0, 64, [&](size_t, size_t thread_id) {
+        pool.parallelFor(0, 10, [&](size_t, size_t inner_thread_id) {
+            assert(inner_thread_id == thread_id);
+            count++;
+        });
+    });
+    assert(count == 640);
+
+    // a loop of another pool in between leaves the thread id of the outer loop as it was
+    hnswlib::ThreadPool other_pool(2);
+    count = 0;
+    pool.parallelFor(0, 64, [&](size_t, size_t thread_id) {
+        other_pool.parallelFor(0, 4, [&](size_t, size_t) {});
+        pool.parallelFor(0, 10, [&](size_t, size_t inner_thread_id) {
+            assert(inner_thread_id == thread_id);
+            count++;
+        });
+    });
+    assert(count == 640);
+
+    // loops from different threads
+    count = 0;
+    std::vector<std::thread> callers;
+    for (int t = 0; t < 4; t++) {
+        callers.push_back(std::thread([&] {
+            for (int rep = 0; rep < 20; rep++) {
+                pool.parallelFor(0, 100, [&](size_t, size_t) { count++; });
+            }
+        }));
+    }
+    for (auto &caller : callers) {
+        caller.join();
+    }
+    assert(count == 4 * 20 * 100);
+}
+
+void testSearchKnnParallel() {
+    int d = 16;
+    idx_t n = 2000;
+    size_t num_queries = 50;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    std::vector<float> queries(num_queries * d);
+    for (auto &value : data) value = distrib(rng);
+    for (auto &value : queries) value = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    hnswlib::ThreadPool pool(4);
+    std::vector<idx_t> labels(n);
+    for (idx_t i = 0; i < n; i++) {
+        labels[i] = i;
+        alg_brute.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.addPoints(data.data(), labels.data(), n, pool);
+
+    hnswlib::AlgorithmInterface<float> *algorithms[] = {&alg_hnsw, &alg_brute};
+    for (auto algorithm : algorithms) {
+        std::vector<idx_t> result_labels(num_queries * k);
+        std::vector<float> result_distances(num_queries * k);
+        algorithm->searchKnnParallel(queries.data(), num_queries, d * sizeof(float), k,
+                                     result_labels.data(), result_distances.data(), pool);
+        for (size_t q = 0; q < num_queries; q++) {
+            auto expected = algorithm->searchKnnCloserFirst(queries.data() + d * q, k);
+            assert(expected.size() == k);
+            for (size_t i = 0; i < k; i++) {
+                assert(result_labels[q * k + i] == expected[i].second);
+                assert(result_distances[q * k + i] == expected[i].first);
+            }
+        }
+    }
+
+    // fewer than k results
+    bool thrown = false;
+    try {
+        std::vector<idx_t> too_many_labels(n + 1);
+        std::vector<float> too_many_distances(n + 1);
+        alg_hnsw.searchKnnParallel(queries.data(), 1, d * sizeof(float), n + 1,
+                                   too_many_labels.data(), too_many_distances.data(), pool);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    hnswlib::ThreadPool pool(4);
+    hnswlib::ThreadPool pinned_pool(3, true);
+    hnswlib::ThreadPool single_pool(1);
+    hnswlib::ThreadPool *pools[] = {&pool, &pinned_pool, &single_pool};
+    for (auto p : pools) {
+        testParallelFor(*p);
+        testExceptions(*p);
+        testNestedAndConcurrent(*p);
+    }
+    testSearchKnnParallel();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
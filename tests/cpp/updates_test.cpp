@@ -21,68 +21,6 @@ class StopW {
 };
 
 
-/*
- * replacement for the openmp '#pragma omp parallel for' directive
- * only handles a subset of functionality (no reductions etc)
- * Process ids from start (inclusive) to end (EXCLUSIVE)
- *
- * The method is borrowed from nmslib 
- */
-template<class Function>
-inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-    }
-
-    if (numThreads == 1) {
-        for (size_t id = start; id < end; id++) {
-            fn(id, 0);
-        }
-    } else {
-        std::vector<std::thread> threads;
-        std::atomic<size_t> current(start);
-
-        // keep track of exceptions in threads
-        // https://stackoverflow.com/a/32428427/1713196
-        std::exception_ptr lastException = nullptr;
-        std::mutex lastExceptMutex;
-
-        for (size_t threadId = 0; threadId < numThreads; ++threadId) {
-            threads.push_back(std::thread([&, threadId] {
-                while (true) {
-                    size_t id = current.fetch_add(1);
-
-                    if ((id >= end)) {
-                        break;
-                    }
-
-                    try {
-                        fn(id, threadId);
-                    } catch (...) {
-                        std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
-                        lastException = std::current_exception();
-                        /*
-                         * This will work even when current is the largest value that
-                         * size_t can fit, because fetch_add returns the previous value
-                         * before the increment (what will result in overflow
-                         * and produce 0 instead of current + 1).
-                         */
-                        current = end;
-                        break;
-                    }
-                }
-            }));
-        }
-        for (auto &thread : threads) {
-            thread.join();
-        }
-        if (lastException) {
-            std::rethrow_exception(lastException);
-        }
-    }
-}
-
-
 template <typename datatype>
 std::vector<datatype> load_batch(std::string path, int size) {
     std::cout << "Loading " << path << "...";
@@ -109,9 +47,13 @@ test_approx(std::vector<float> &queries, size_t qsize, hnswlib::HierarchicalNSW<
             std::vector<std::unordered_set<hnswlib::labeltype>> &answers, size_t K) {
     size_t correct = 0;
     size_t total = 0;
+    hnswlib::SearchParams params;
+    params.k = K;
+    hnswlib::PerThreadSearchStats stats;
 
     for (int i = 0; i < qsize; i++) {
-        std::priority_queue<std::pair<d_type, hnswlib::labeltype>> result = appr_alg.searchKnn((char *)(queries.data() + vecdim * i), K);
+        std::priority_queue<std::pair<d_type, hnswlib::labeltype>> result =
+            appr_alg.searchKnn((char *)(queries.data() + vecdim * i), params, stats);
         total += K;
         while (result.size()) {
             if (answers[i].find(result.top().second) != answers[i].end()) {
@@ -150,14 +92,14 @@ test_vs_recall(
     for (size_t ef : efs) {
         appr_alg.setEf(ef);
 
-        appr_alg.metric_hops = 0;
-        appr_alg.metric_distance_computations = 0;
+        hnswlib::PerThreadSearchStats::total() = hnswlib::SearchStats();
         StopW stopw = StopW();
 
         float recall = test_approx<float>(queries, qsize, appr_alg, vecdim, answers, k);
         float time_us_per_query = stopw.getElapsedTimeMicro() / qsize;
-        float distance_comp_per_query =  appr_alg.metric_distance_computations / (1.0f * qsize);
-        float hops_per_query =  appr_alg.metric_hops / (1.0f * qsize);
+        hnswlib::SearchStats &search_stats = hnswlib::PerThreadSearchStats::total();
+        float distance_comp_per_query =  search_stats.distance_computations / (1.0f * qsize);
+        float hops_per_query =  search_stats.hops / (1.0f * qsize);
 
         std::cout << ef << "\t" << recall << "\t" << time_us_per_query << "us \t" << hops_per_query << "\t" << distance_comp_per_query << "\n";
         if (recall > 0.99) {
@@ -177,6 +119,7 @@ int main(int argc, char **argv) {
     int M = 16;
     int efConstruction = 200;
     int num_threads = std::thread::hardware_concurrency();
+    hnswlib::ThreadPool pool(num_threads);
 
     bool update = false;
 
@@ -226,12 +169,12 @@ int main(int argc, char **argv) {
     if (update) {
         std::cout << "Update iteration 0\n";
 
-        ParallelFor(1, N, num_threads, [&](size_t i, size_t threadId) {
+        pool.parallelFor(1, N, [&](size_t i, size_t threadId) {
             appr_alg.addPoint((void *)(dummy_batch.data() + i * d), i);
         });
         appr_alg.checkIntegrity();
 
-        ParallelFor(1, N, num_threads, [&](size_t i, size_t threadId) {
+        pool.parallelFor(1, N, [&](size_t i, size_t threadId) {
             appr_alg.addPoint((void *)(dummy_batch.data() + i * d), i);
         });
         appr_alg.checkIntegrity();
@@ -242,7 +185,7 @@ int main(int argc, char **argv) {
             snprintf(cpath, sizeof(cpath), "batch_dummy_%02d.bin", b);
             std::vector<float> dummy_batchb = load_batch<float>(path + cpath, N * d);
 
-            ParallelFor(0, N, num_threads, [&](size_t i, size_t threadId) {
+            pool.parallelFor(0, N, [&](size_t i, size_t threadId) {
                 appr_alg.addPoint((void *)(dummy_batch.data() + i * d), i);
             });
             appr_alg.checkIntegrity();
@@ -253,7 +196,7 @@ int main(int argc, char **argv) {
     std::vector<float> final_batch = load_batch<float>(path + "batch_final.bin", N * d);
 
     stopw.reset();
-    ParallelFor(0, N, num_threads, [&](size_t i, size_t threadId) {
+    pool.parallelFor(0, N, [&](size_t i, size_t threadId) {
                     appr_alg.addPoint((void *)(final_batch.data() + i * d), i);
                 });
     std::cout << "Finished. Time taken:" << stopw.getElapsedTimeMicro()*1e-6 << " s\n";
@@ -0,0 +1,143 @@
+// This is a test file for crash recovery with the write-ahead log and checkpoints
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void check_same_points(hnswlib::HierarchicalNSW<float> &expected, hnswlib::HierarchicalNSW<float> &actual, int d) {
+    assert(expected.getCurrentElementCount() == actual.getCurrentElementCount());
+    assert(expected.getDeletedCount() == actual.getDeletedCount());
+    for (auto &item : expected.label_lookup_) {
+        hnswlib::tableint expected_id = item.second;
+        hnswlib::tableint actual_id = actual.getInternalIdByLabel(item.first);
+        assert(expected.isMarkedDeleted(expected_id) == actual.isMarkedDeleted(actual_id));
+        assert(memcmp(expected.getDataByInternalId(expected_id), actual.getDataByInternalId(actual_id),
+                      d * sizeof(float)) == 0);
+    }
+}
+
+size_t file_size(const std::string &path) {
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    return input.tellg();
+}
+
+void test() {
+    int d = 8;
+    idx_t n = 2000;
+    size_t num_threads = 4;
+    std::string index_path = "wal_test.bin";
+    std::string wal_path = "wal_test.wal";
+    remove(index_path.c_str());
+    remove(wal_path.c_str());
+
+    std::vector<float> data(2 * n * d);
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (idx_t i = 0; i < 2 * n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 2 * n);
+    alg_hnsw.openWal(wal_path);
+    for (size_t i = 0; i < n / 2; ++i) {
+        alg_hnsw.addPoint(data.data() + d * i, i);
+    }
+    alg_hnsw.checkpoint(index_path);
+    assert(file_size(wal_path) == sizeof(hnswlib::WalFileHeader));
+
+    // inserts, updates, deletes and undeletes from several threads after the checkpoint
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            for (size_t i = n / 2 + t; i < n; i += num_threads) {
+                alg_hnsw.addPoint(data.data() + d * i, i);
+                if (i % 5 == 0)
+                    alg_hnsw.markDelete(i - n / 2);
+                if (i % 15 == 0)
+                    alg_hnsw.unmarkDelete(i - n / 2);
+                if (i % 7 == 0)
+                    alg_hnsw.addPoint(data.data() + d * (n + i), i);
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // "crash": recover from the snapshot and the log, with a torn record at its end
+    alg_hnsw.closeWal();
+    {
+        std::ofstream output(wal_path, std::ios::binary | std::ios::app);
+        output.write("torn", 4);
+    }
+    {
+        hnswlib::HierarchicalNSW<float> recovered(&space, index_path);
+        recovered.openWal(wal_path, true, num_threads);
+        check_same_points(alg_hnsw, recovered, d);
+
+        // the log keeps going after recovery
+        recovered.addPoint(data.data(), 2 * n);
+        recovered.closeWal();
+        hnswlib::HierarchicalNSW<float> recovered_again(&space, index_path);
+        recovered_again.openWal(wal_path);
+        check_same_points(recovered, recovered_again, d);
+        std::vector<float> point = recovered_again.getDataByLabel<float>(2 * n);
+        assert(memcmp(point.data(), data.data(), d * sizeof(float)) == 0);
+    }
+
+    // a checkpoint compacts the log
+    alg_hnsw.openWal(wal_path);
+    alg_hnsw.checkpoint(index_path);
+    assert(file_size(wal_path) == sizeof(hnswlib::WalFileHeader));
+    assert(!std::ifstream(wal_path + ".old").good());
+    {
+        hnswlib::HierarchicalNSW<float> recovered(&space, index_path);
+        recovered.openWal(wal_path);
+        check_same_points(alg_hnsw, recovered, d);
+    }
+    alg_hnsw.closeWal();
+    remove(index_path.c_str());
+    remove(wal_path.c_str());
+
+    // adds that replace deleted elements replay in log order with the deletes around them:
+    // delete A, add B into the slot of A, add A again
+    hnswlib::HierarchicalNSW<float> replacing(&space, 2 * n, 16, 200, 100, true);
+    replacing.openWal(wal_path);
+    for (idx_t i = 0; i < n / 2; i++) {
+        replacing.addPoint(data.data() + d * i, i);
+    }
+    for (idx_t i = 0; i < n / 2; i += 3) {
+        replacing.markDelete(i);
+        replacing.addPoint(data.data() + d * (n + i), n + i, true);
+        replacing.addPoint(data.data() + d * (n / 2 + i), i);
+    }
+    replacing.closeWal();
+    {
+        hnswlib::HierarchicalNSW<float> recovered(&space, 2 * n, 16, 200, 100, true);
+        recovered.openWal(wal_path, true, num_threads);
+        check_same_points(replacing, recovered, d);
+        recovered.closeWal();
+    }
+    remove(wal_path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -55,3 +55,13 @@ class RandomSelfTestCase(unittest.TestCase):
 
         labels, distances = bf_index.knn_query(data, k=1, filter=filter_function)
         self.assertEqual(np.mean(labels.reshape(-1) == np.arange(len(data))), .5)
+
+        print("Querying only even elements with a mask and with an array of ids")
+        mask = np.arange(num_elements) % 2 == 0
+        even_ids = np.arange(0, num_elements, 2)
+        expected_labels, expected_distances = hnsw_index.knn_query(data, k=1, num_threads=1, filter=filter_function)
+        for allowed in [mask, mask.astype(np.uint8), even_ids]:
+            labels, distances = hnsw_index.knn_query(data, k=1, filter=allowed)
+            np.testing.assert_array_equal(labels, expected_labels)
+            labels, distances = bf_index.knn_query(data, k=1, filter=allowed)
+            self.assertTrue(np.max(np.mod(labels, 2)) == 0)
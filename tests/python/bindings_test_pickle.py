@@ -76,6 +76,11 @@ def test_space_main(self, space, dim):
 
     p2=pickle.loads(pickle.dumps(p)) # pickle Index before adding items
 
+    # the index itself is pickled as a single bytes object in the index file format
+    params, index_bytes = p.__getstate__()
+    self.assertEqual(len(index_bytes), p.index_file_size())
+    self.assertTrue(np.allclose(p.get_items(), pickle.loads(pickle.dumps(p, protocol=5)).get_items()))
+
     self.assertTrue(np.allclose(p.get_items(), p0.get_items()), "items for p and p0 must be same")
     self.assertTrue(np.allclose(p0.get_items(), p1.get_items()), "items for p0 and p1 must be same")
     self.assertTrue(np.allclose(p1.get_items(), p2.get_items()), "items for p1 and p2 must be same")